@@ -9,11 +9,15 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <stdarg.h>
+#include <stdio.h>
 #include <fcntl.h>
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
 #include "config.h"
 #ifndef NO_SYSLOG
 #include <syslog.h>
@@ -32,6 +36,9 @@ static int filelog_control(xlog_s *, xlog_cmd_e, va_list) ;
 static int filelog_write(xlog_s *, const char buf[], int, int, va_list) ;
 static int filelog_parms(xlog_e, va_list) ;
 static int limit_checks(const xlog_s *) ;
+static int size_checks(xlog_s *, int, int) ;
+static int async_write(xlog_s *, const char *, int, int) ;
+static int rotate(struct filelog_s *) ;
 
 struct xlog_ops __xlog_filelog_ops = 
 	{
@@ -49,6 +56,7 @@ static int filelog_init( xlog_s *xp, va_list ap )
 	struct filelog_s		*flp ;
 	char				*filename;
 	int				flags;
+	int				mode = 0 ;
 
 	filename = va_arg(ap, char *);
 	flags = va_arg(ap, int);
@@ -56,14 +64,23 @@ static int filelog_init( xlog_s *xp, va_list ap )
 	flp = NEW( struct filelog_s ) ;
 	if ( flp == NULL )
 		return( XLOG_ENOMEM ) ;
+	if ( ( flp->fl_path = __xlog_new_string( filename ) ) == NULL )
+	{
+		free( flp ) ;
+		return( XLOG_ENOMEM ) ;
+	}
 
 	if ( flags & O_CREAT )
-		fd = open( filename, flags, va_arg( ap, int ) ) ;
+	{
+		mode = va_arg( ap, int ) ;
+		fd = open( filename, flags, mode ) ;
+	}
 	else
 		fd = open( filename, flags ) ;
 
 	if ( fd == -1 )
 	{
+		free( flp->fl_path ) ;
 		free( flp ) ;
 		return( XLOG_EOPEN ) ;
 	}
@@ -71,6 +88,13 @@ static int filelog_init( xlog_s *xp, va_list ap )
 	FILELOG_DISABLE_SIZE_CONTROL( flp ) ;
 	(void) Sbuftype( fd, SIO_LINEBUF ) ;
 	flp->fl_fd = fd ;
+	flp->fl_pipe = -1 ;
+	flp->fl_overflow = XLOG_OVERFLOW_COUNT ;
+	flp->fl_dropped = 0 ;
+	flp->fl_flags = flags & ~O_TRUNC ;
+	flp->fl_mode = mode ;
+	flp->fl_keep = 0 ;
+	flp->fl_suffix = NULL ;
 	flp->fl_state = FL_OPEN ;
 	xp->xl_data = flp ;
 	return( XLOG_ENOERROR ) ;
@@ -86,6 +110,10 @@ static void filelog_fini( xlog_s *xp )
 		(void) Sclose( flp->fl_fd ) ;
 		flp->fl_state = FL_CLOSED ;
 	}
+	if ( flp->fl_pipe != -1 )
+		(void) close( flp->fl_pipe ) ;
+	free( flp->fl_suffix ) ;
+	free( flp->fl_path ) ;
 	free( flp ) ;
 	xp->xl_data = NULL ;
 }
@@ -128,11 +156,56 @@ static int filelog_control( xlog_s *xp, xlog_cmd_e cmd, va_list ap )
 			}
 			else
 			{
-				flp->fl_size = st.st_size ;
-				if ( flp->fl_size > flp->fl_soft_limit )
+				/*
+				 * The writer of an asynchronous log may not have
+				 * written all it was sent yet, so the file can only
+				 * tell that the log is larger than counted.
+				 */
+				if ( flp->fl_pipe == -1 || st.st_size > flp->fl_size )
+					flp->fl_size = st.st_size ;
+				/* a log that is rotated is rotated by its next write */
+				if ( flp->fl_size > flp->fl_soft_limit && flp->fl_keep == 0 )
 					status = limit_checks( xp ) ;
 			}
 			break ;
+
+		/*
+		 * Past the soft limit, a write returns XLOG_EROTATE for the
+		 * caller to rotate the file with XLOG_ROTATE, instead of the
+		 * limits being applied.
+		 */
+		case XLOG_ROTATION:
+		{
+			const char *suffix ;
+
+			flp->fl_keep = va_arg( ap, unsigned ) ;
+			suffix = va_arg( ap, const char * ) ;
+			free( flp->fl_suffix ) ;
+			flp->fl_suffix = NULL ;
+			if ( suffix != NULL &&
+					( flp->fl_suffix = __xlog_new_string( suffix ) ) == NULL )
+				status = XLOG_ENOMEM ;
+			if ( flp->fl_keep != 0 && flp->fl_state == FL_SIZE )
+				flp->fl_state = FL_OPEN ;
+			break ;
+		}
+
+		case XLOG_ROTATE:
+			status = rotate( flp ) ;
+			break ;
+
+		/*
+		 * From now on, records are written to the pipe instead of the
+		 * file; the process at the other end writes them to the file.
+		 */
+		case XLOG_ASYNC:
+			if ( flp->fl_pipe != -1 )
+				(void) close( flp->fl_pipe ) ;
+			flp->fl_pipe = va_arg( ap, int ) ;
+			flp->fl_overflow = va_arg( ap, int ) ;
+			flp->fl_dropped = 0 ;
+			break ;
+
 		case XLOG_LINK:
 		case XLOG_CALLBACK:
 		case XLOG_GETFLAG:
@@ -183,36 +256,50 @@ static int filelog_write( xlog_s *xp, const char buf[], int len, int flags,
 	int	msglen		= 0 ;
 	int	percent_m_pos   = 0 ;
 	int	cc ;
-	int	status ;
 	time_t 		current_time ;
 	struct tm	*tmp ;
 
 	if ( flp->fl_state != FL_OPEN )
 		return( flp->fl_error ) ;
 
-	(void) time( &current_time ) ;
-	tmp = localtime( &current_time ) ;
-	cc = Sprint( flp->fl_fd, "%02d/%d/%d@%02d:%02d:%02d",
-		tmp->tm_year%100, tmp->tm_mon+1, tmp->tm_mday,
-		tmp->tm_hour, tmp->tm_min, tmp->tm_sec ) ;
-	if ( cc == SIO_ERR ) 
-		return XLOG_EWRITE;
-	
-	msglen += cc ;
+	if ( flp->fl_pipe != -1 &&
+			( msglen = async_write( xp, buf, len, action_flags ) ) != -1 )
+		return( size_checks( xp, flags, msglen ) ) ;
+	msglen = 0 ;
 
-	if ( action_flags & XLOG_PRINT_ID )
+	if ( ! ( action_flags & XLOG_NO_HEADER ) )
 	{
-		cc = Sprint( flp->fl_fd, " %s", xp->xl_id ) ;
-		if ( cc == SIO_ERR ) {
-			flp->fl_size += msglen ;
+		(void) time( &current_time ) ;
+		tmp = localtime( &current_time ) ;
+		cc = Sprint( flp->fl_fd, "%02d/%d/%d@%02d:%02d:%02d",
+			tmp->tm_year%100, tmp->tm_mon+1, tmp->tm_mday,
+			tmp->tm_hour, tmp->tm_min, tmp->tm_sec ) ;
+		if ( cc == SIO_ERR ) 
 			return XLOG_EWRITE;
-		}
+
 		msglen += cc ;
-	}
 
-	if ( action_flags & XLOG_PRINT_PID )
-	{
-		cc = Sprint( flp->fl_fd, "[%d]", getpid() ) ;
+		if ( action_flags & XLOG_PRINT_ID )
+		{
+			cc = Sprint( flp->fl_fd, " %s", xp->xl_id ) ;
+			if ( cc == SIO_ERR ) {
+				flp->fl_size += msglen ;
+				return XLOG_EWRITE;
+			}
+			msglen += cc ;
+		}
+
+		if ( action_flags & XLOG_PRINT_PID )
+		{
+			cc = Sprint( flp->fl_fd, "[%d]", getpid() ) ;
+			if ( cc == SIO_ERR ) { 
+				flp->fl_size += msglen ;
+				return XLOG_EWRITE;
+			}
+			msglen += cc ;
+		}
+
+		cc = Sprint( flp->fl_fd, ": " ) ;
 		if ( cc == SIO_ERR ) { 
 			flp->fl_size += msglen ;
 			return XLOG_EWRITE;
@@ -220,13 +307,6 @@ static int filelog_write( xlog_s *xp, const char buf[], int len, int flags,
 		msglen += cc ;
 	}
 
-	cc = Sprint( flp->fl_fd, ": " ) ;
-	if ( cc == SIO_ERR ) { 
-		flp->fl_size += msglen ;
-		return XLOG_EWRITE;
-	}
-	msglen += cc ;
-
 	if ( ( action_flags & XLOG_NO_ERRNO ) ||
 		( percent_m_pos = __xlog_add_errno( buf, len ) ) == -1 )
 	{
@@ -275,6 +355,18 @@ static int filelog_write( xlog_s *xp, const char buf[], int len, int flags,
 	if ( Sputchar( flp->fl_fd, '\n' ) != SIO_ERR )
 		msglen++ ;
 
+	return( size_checks( xp, flags, msglen ) ) ;
+}
+
+
+/*
+ * Account for a record of msglen bytes written to the file
+ */
+static int size_checks( xlog_s *xp, int flags, int msglen )
+{
+	struct filelog_s *flp	= FILELOG( xp ) ;
+	int	status ;
+
 	/*
 	 * NOTE: we don't check if XLOG_NO_SIZECHECK is set in xp->xl_flags
 	 *	because size control is off by default and in order to
@@ -284,8 +376,11 @@ static int filelog_write( xlog_s *xp, const char buf[], int len, int flags,
 		return( XLOG_ENOERROR ) ;
 
 	flp->fl_size += msglen ;
-	if ( flp->fl_size <= flp->fl_soft_limit || 
-		( status = limit_checks( xp ) ) == XLOG_ENOERROR )
+	if ( flp->fl_size <= flp->fl_soft_limit )
+		return( XLOG_ENOERROR ) ;
+	if ( flp->fl_keep != 0 )
+		return( XLOG_EROTATE ) ;
+	if ( ( status = limit_checks( xp ) ) == XLOG_ENOERROR )
 		return( XLOG_ENOERROR ) ;
 	
 	flp->fl_state = FL_SIZE ;
@@ -293,6 +388,239 @@ static int filelog_write( xlog_s *xp, const char buf[], int len, int flags,
 }
 
 
+/*
+ * A record written to the pipe of an asynchronous filelog must fit in
+ * PIPE_BUF bytes, so that it is written in one piece even when several
+ * processes share the pipe. Longer records are cut short.
+ */
+#ifdef PIPE_BUF
+#define RECORD_SIZE				PIPE_BUF
+#else
+#define RECORD_SIZE				512
+#endif
+
+
+/*
+ * Append the n bytes at s to the cc bytes of record rec, keeping room
+ * for the newline. Returns the new length of the record.
+ */
+static int record_add( char rec[], int cc, const char *s, int n )
+{
+	if ( n > RECORD_SIZE - 1 - cc )
+		n = RECORD_SIZE - 1 - cc ;
+	(void) memcpy( rec + cc, s, n ) ;
+	return( cc + n ) ;
+}
+
+
+/*
+ * Build in rec the record that filelog_write would print for buf.
+ * Returns the length of the record.
+ */
+static int async_record( const xlog_s *xp, char rec[], const char buf[],
+	int len, int action_flags, int percent_m_pos, const char *ep, int eplen )
+{
+	int		cc = 0 ;
+	time_t 		current_time ;
+	struct tm	*tmp ;
+
+	if ( ! ( action_flags & XLOG_NO_HEADER ) )
+	{
+		(void) time( &current_time ) ;
+		tmp = localtime( &current_time ) ;
+		cc = strx_nprint( rec, RECORD_SIZE - 1, "%02d/%d/%d@%02d:%02d:%02d",
+			tmp->tm_year%100, tmp->tm_mon+1, tmp->tm_mday,
+			tmp->tm_hour, tmp->tm_min, tmp->tm_sec ) ;
+		if ( action_flags & XLOG_PRINT_ID )
+			cc += strx_nprint( rec + cc, RECORD_SIZE - 1 - cc, " %s", xp->xl_id ) ;
+		if ( action_flags & XLOG_PRINT_PID )
+			cc += strx_nprint( rec + cc, RECORD_SIZE - 1 - cc, "[%d]", getpid() ) ;
+		cc = record_add( rec, cc, ": ", 2 ) ;
+	}
+
+	if ( percent_m_pos == -1 )
+		cc = record_add( rec, cc, buf, len ) ;
+	else
+	{
+		cc = record_add( rec, cc, buf, percent_m_pos ) ;
+		cc = record_add( rec, cc, ep, eplen ) ;
+		cc = record_add( rec, cc, buf+percent_m_pos+2, len-percent_m_pos-2 ) ;
+	}
+	rec[ cc++ ] = '\n' ;
+	return( cc ) ;
+}
+
+
+/*
+ * Write a record to the pipe, applying the overflow policy when the
+ * pipe is full. Returns 1 if the record was written, 0 if it was
+ * dropped, and -1 if the pipe is broken.
+ */
+static int async_send( struct filelog_s *flp, const char rec[], int len )
+{
+	for ( ;; )
+	{
+		ssize_t cc = write( flp->fl_pipe, rec, len ) ;
+
+		if ( cc == len )
+			return( 1 ) ;
+		if ( cc == -1 && errno == EINTR )
+			continue ;
+		if ( cc == -1 && errno == EAGAIN )
+		{
+			struct pollfd pfd ;
+
+			if ( flp->fl_overflow != XLOG_OVERFLOW_BLOCK )
+				return( 0 ) ;
+			pfd.fd = flp->fl_pipe ;
+			pfd.events = POLLOUT ;
+			(void) poll( &pfd, 1, -1 ) ;
+			continue ;
+		}
+		return( -1 ) ;
+	}
+}
+
+
+/*
+ * Write a record of an asynchronous filelog. Returns the number of
+ * bytes written, or -1 if the pipe is broken, in which case the record
+ * is to be written to the file directly, as are all later records.
+ */
+static int async_write( xlog_s *xp, const char buf[], int len,
+	int action_flags )
+{
+	struct filelog_s *flp	= FILELOG( xp ) ;
+	char		rec[ RECORD_SIZE ] ;
+	char		errno_buf[ 100 ] ;
+	unsigned	size = sizeof( errno_buf ) ;
+	const char	*ep = NULL ;
+	int		percent_m_pos = -1 ;
+	int		msglen = 0 ;
+	int		cc ;
+	int		status = 1 ;
+
+	if ( ! ( action_flags & XLOG_NO_ERRNO ) &&
+		( percent_m_pos = __xlog_add_errno( buf, len ) ) != -1 )
+		ep = __xlog_explain_errno( errno_buf, &size ) ;
+
+	if ( flp->fl_dropped != 0 && flp->fl_overflow == XLOG_OVERFLOW_COUNT )
+	{
+		char note[ 64 ] ;
+		int notelen = strx_nprint( note, sizeof( note ),
+				"%u log records dropped", flp->fl_dropped ) ;
+
+		cc = async_record( xp, rec, note, notelen,
+				action_flags | XLOG_NO_ERRNO, -1, NULL, 0 ) ;
+		status = async_send( flp, rec, cc ) ;
+		if ( status == 1 )
+		{
+			flp->fl_dropped = 0 ;
+			msglen += cc ;
+		}
+		else if ( status == 0 )
+		{
+			/* the record we are asked to write would be dropped too */
+			flp->fl_dropped++ ;
+			return( 0 ) ;
+		}
+	}
+
+	if ( status != -1 )
+	{
+		cc = async_record( xp, rec, buf, len, action_flags,
+									percent_m_pos, ep, (int) size ) ;
+		status = async_send( flp, rec, cc ) ;
+	}
+	if ( status == -1 )
+	{
+		(void) close( flp->fl_pipe ) ;
+		flp->fl_pipe = -1 ;
+		return( -1 ) ;
+	}
+	if ( status == 0 )
+		flp->fl_dropped++ ;
+	return( msglen + status * cc ) ;
+}
+
+
+/*
+ * Rotate the file: the file becomes <file>.1, <file>.1 becomes <file>.2
+ * and so on up to <file>.<fl_keep>, which is replaced. Files with the
+ * names followed by fl_suffix (compressed files) are renamed the same
+ * way. A new file is then opened on the same descriptor, so that the
+ * descriptor known to the users of the log stays good.
+ * Whether it succeeds or not, the size of the log starts over, so that
+ * a file that cannot be rotated is tried again only a soft limit later.
+ */
+static int rotate( struct filelog_s *flp )
+{
+	size_t	len ;
+	char		*from ;
+	char		*to ;
+	unsigned	k ;
+	int		fd ;
+	int		fdflags ;
+	int		status = XLOG_ENOERROR ;
+
+	flp->fl_size = 0 ;
+	flp->fl_issued_warning = FALSE ;
+	if ( flp->fl_keep == 0 )
+		return( XLOG_ENOERROR ) ;
+
+	len = strlen( flp->fl_path ) + 16 +
+				( flp->fl_suffix ? strlen( flp->fl_suffix ) : 0 ) ;
+	from = malloc( len ) ;
+	to = malloc( len ) ;
+	if ( from == NULL || to == NULL )
+	{
+		free( from ) ;
+		free( to ) ;
+		return( XLOG_ENOMEM ) ;
+	}
+
+	for ( k = flp->fl_keep - 1 ; k > 0 ; k-- )
+	{
+		(void) strx_nprint( from, (int) len, "%s.%u", flp->fl_path, k ) ;
+		(void) strx_nprint( to, (int) len, "%s.%u", flp->fl_path, k + 1 ) ;
+		(void) rename( from, to ) ;
+		if ( flp->fl_suffix == NULL )
+			continue ;
+		(void) strx_nprint( from, (int) len, "%s.%u%s",
+											flp->fl_path, k, flp->fl_suffix ) ;
+		(void) strx_nprint( to, (int) len, "%s.%u%s",
+											flp->fl_path, k + 1, flp->fl_suffix ) ;
+		(void) rename( from, to ) ;
+	}
+
+	(void) strx_nprint( to, (int) len, "%s.1", flp->fl_path ) ;
+	(void) Sflush( flp->fl_fd ) ;
+	if ( rename( flp->fl_path, to ) == -1 )
+		status = XLOG_EOPEN ;
+	else if ( ( fd = open( flp->fl_path, flp->fl_flags, flp->fl_mode ) ) == -1 )
+	{
+		(void) rename( to, flp->fl_path ) ;
+		status = XLOG_EOPEN ;
+	}
+	else
+	{
+		/* dup2 clears the close-on-exec flag */
+		fdflags = fcntl( flp->fl_fd, F_GETFD ) ;
+		if ( dup2( fd, flp->fl_fd ) == -1 )
+			status = XLOG_EOPEN ;
+		else if ( fdflags != -1 )
+			(void) fcntl( flp->fl_fd, F_SETFD, fdflags ) ;
+		(void) close( fd ) ;
+	}
+
+	if ( status == XLOG_ENOERROR && flp->fl_state == FL_SIZE )
+		flp->fl_state = FL_OPEN ;
+	free( from ) ;
+	free( to ) ;
+	return( status ) ;
+}
+
+
 static int filelog_parms( xlog_e type, va_list ap)
 {
 	return( XLOG_ENOERROR ) ;
@@ -34,6 +34,14 @@ struct filelog_s
 	unsigned 			fl_size ;            /* current size                   	*/
 	unsigned				fl_soft_limit ;
 	unsigned				fl_hard_limit ;
+	int					fl_pipe ;				/* to the log writer, or -1			*/
+	int					fl_overflow ;			/* when the pipe is full				*/
+	unsigned				fl_dropped ;			/* records not written to the pipe	*/
+	char					*fl_path ;				/* to reopen the file					*/
+	int					fl_flags ;
+	int					fl_mode ;
+	unsigned				fl_keep ;				/* rotated files kept, 0: no rotation	*/
+	char					*fl_suffix ;			/* of compressed rotated files, or NULL	*/
 } ;
 
 #define FILELOG_ENABLE_SIZE_CONTROL( flp )	(flp)->fl_size_control = TRUE
@@ -6,9 +6,20 @@
 
 
 #include "config.h"
+/* for sendmmsg(2) */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #ifndef NO_SYSLOG
 #include <syslog.h>
 #endif
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "xlog.h"
 #include "impl.h"
@@ -17,6 +28,11 @@
 #include <stdarg.h>
 
 #define MSGBUFSIZE         2048
+#define BATCH_SIZE         32       /* records queued at most */
+
+#ifndef _PATH_LOG
+#define _PATH_LOG          "/dev/log"
+#endif
 
 
 static int syslog_init(xlog_s *, va_list) ;
@@ -48,6 +64,37 @@ struct xlog_ops __xlog_syslog_ops =
       syslog_parms
    } ;
 
+/*
+ * A note on the transport:
+ * Records are not handed to syslog(3) but sent by us to the datagram
+ * socket of the syslog daemon, without waiting for it: the records it
+ * has no room for are dropped and counted, and their number is sent
+ * ahead of the next record. Each xlog keeps the header of its last
+ * record, which changes once a second at most.
+ *
+ * The records of the xlogs with the XLOG_BATCH flag are queued, and
+ * sent together (with a single sendmmsg(2) where there is one) when the
+ * queue is full or xlog_flush() is called. Only the process that calls
+ * xlog_flush() queues records: a child process discards the records it
+ * inherits, which are its parent's to send, and sends its own at once.
+ *
+ * If the socket cannot be used, the records go through syslog(3).
+ */
+static struct
+{
+   int            st_fd ;           /* -1 if not connected */
+   time_t         st_failed ;       /* when connecting last failed */
+   char           st_host[ 256 ] ;
+   unsigned       st_dropped ;
+   unsigned       st_noted ;        /* dropped, as told by the note queued */
+   int            st_note ;         /* slot of that note */
+   pid_t          st_pid ;          /* of the process that flushes */
+   bool_int       st_atexit ;
+   unsigned       st_count ;        /* of records queued */
+   struct iovec   st_iov[ BATCH_SIZE ] ;
+   char           st_rec[ BATCH_SIZE ][ MSGBUFSIZE ] ;
+} transport = { -1, 0, "", 0, 0, -1 } ;
+
 #ifdef NO_SYSLOG
 
 /*
@@ -68,9 +115,304 @@ static void closelog()
 {
 }
 
+#define LOG_PID            0
+#define LOG_WARNING        4
+
 #endif   /* NO_SYSLOG */
 
 
+static void transport_close( void )
+{
+   if ( transport.st_fd != -1 )
+   {
+      (void) close( transport.st_fd ) ;
+      transport.st_fd = -1 ;
+   }
+}
+
+
+/*
+ * Connect to the syslog daemon. Returns 0 on success, -1 otherwise.
+ * After a failure, we try again a second later at the earliest.
+ */
+static int transport_open( void )
+{
+   struct sockaddr_un   sa ;
+   time_t               now = time( NULL ) ;
+   int                  fd ;
+
+   if ( transport.st_failed == now )
+      return( -1 ) ;
+
+   (void) memset( &sa, 0, sizeof( sa ) ) ;
+   sa.sun_family = AF_UNIX ;
+   (void) strncpy( sa.sun_path, _PATH_LOG, sizeof( sa.sun_path ) - 1 ) ;
+   if ( ( fd = socket( AF_UNIX, SOCK_DGRAM, 0 ) ) == -1 )
+   {
+      transport.st_failed = now ;
+      return( -1 ) ;
+   }
+   if ( fcntl( fd, F_SETFD, FD_CLOEXEC ) == -1 ||
+         connect( fd, (struct sockaddr *) &sa, sizeof( sa ) ) == -1 )
+   {
+      (void) close( fd ) ;
+      transport.st_failed = now ;
+      return( -1 ) ;
+   }
+   if ( gethostname( transport.st_host, sizeof( transport.st_host ) ) == -1 ||
+         transport.st_host[ 0 ] == '\0' )
+      (void) strcpy( transport.st_host, "-" ) ;
+   transport.st_host[ sizeof( transport.st_host ) - 1 ] = '\0' ;
+   transport.st_fd = fd ;
+   return( 0 ) ;
+}
+
+
+/*
+ * Send n records without waiting. If the daemon has gone away (it was
+ * restarted), we connect again, once. Returns the number of records sent.
+ */
+static unsigned transport_send( struct iovec iov[], unsigned n )
+{
+#ifdef HAVE_SENDMMSG
+   struct mmsghdr    msgs[ BATCH_SIZE ] ;
+   unsigned          u ;
+#endif
+   unsigned          sent = 0 ;
+   bool_int          retried = FALSE ;
+
+#ifdef HAVE_SENDMMSG
+   (void) memset( msgs, 0, n * sizeof( struct mmsghdr ) ) ;
+   for ( u = 0 ; u < n ; u++ )
+   {
+      msgs[ u ].msg_hdr.msg_iov = &iov[ u ] ;
+      msgs[ u ].msg_hdr.msg_iovlen = 1 ;
+   }
+#endif
+   while ( sent < n && transport.st_fd != -1 )
+   {
+      int cc ;
+
+#ifdef HAVE_SENDMMSG
+      cc = sendmmsg( transport.st_fd, &msgs[ sent ], n - sent, MSG_DONTWAIT ) ;
+#else
+      cc = ( send( transport.st_fd, iov[ sent ].iov_base,
+                     iov[ sent ].iov_len, MSG_DONTWAIT ) == -1 ) ? -1 : 1 ;
+#endif
+      if ( cc > 0 )
+      {
+         sent += cc ;
+         continue ;
+      }
+      if ( cc == -1 && errno == EINTR )
+         continue ;
+      /* the daemon is behind: the rest is dropped */
+      if ( cc == 0 || errno == EAGAIN || errno == EWOULDBLOCK ||
+                                                         errno == ENOBUFS )
+         break ;
+      transport_close() ;
+      if ( retried || transport_open() == -1 )
+         break ;
+      retried = TRUE ;
+   }
+   return( sent ) ;
+}
+
+
+/*
+ * Count the records that were not sent, out of n. If note is not -1,
+ * record note tells of the records dropped before: if it was sent, they
+ * are not counted anymore, and if it was not, it is not counted itself.
+ */
+static void transport_count( unsigned n, unsigned sent, int note )
+{
+   if ( note != -1 )
+   {
+      if ( (unsigned) note < sent )
+         transport.st_dropped -= transport.st_noted ;
+      else
+         n-- ;
+      transport.st_noted = 0 ;
+   }
+   transport.st_dropped += n - sent ;
+}
+
+
+/*
+ * Forget the queued records
+ */
+static void transport_discard( void )
+{
+   transport.st_count = 0 ;
+   if ( transport.st_note != -1 )
+   {
+      transport.st_noted = 0 ;
+      transport.st_note = -1 ;
+   }
+}
+
+
+static void transport_flush( void )
+{
+   unsigned n = transport.st_count ;
+
+   if ( n == 0 || transport.st_pid != getpid() )
+   {
+      transport_discard() ;
+      return ;
+   }
+   transport.st_count = 0 ;
+   transport_count( n, transport_send( transport.st_iov, n ),
+                                                   transport.st_note ) ;
+   transport.st_note = -1 ;
+}
+
+
+/*
+ * Send the queued records. From now on, the records of the xlogs with
+ * the XLOG_BATCH flag are queued in this process.
+ */
+void __xlog_syslog_flush( void )
+{
+   if ( ! transport.st_atexit )
+   {
+      transport.st_atexit = TRUE ;
+      (void) atexit( __xlog_syslog_flush ) ;
+   }
+   if ( transport.st_pid != getpid() )
+   {
+      transport.st_pid = getpid() ;
+      transport_discard() ;
+   }
+   transport_flush() ;
+}
+
+
+/*
+ * Build the header of a record of priority pri, unless the header built
+ * last is still good. Returns its length.
+ */
+static int record_header( xlog_s *xp, int pri, int action_flags )
+{
+   struct syslog_s   *sp = SYSLOG( xp ) ;
+   time_t            now = time( NULL ) ;
+   pid_t             pid = getpid() ;
+   int               format = action_flags & XLOG_RFC5424 ;
+   struct tm         *tmp ;
+   char              stamp[ 64 ] ;
+
+   if ( sp->sl_hdr_len != 0 && sp->sl_hdr_pri == pri &&
+         sp->sl_hdr_time == now && sp->sl_hdr_pid == pid &&
+         sp->sl_hdr_format == format )
+      return( sp->sl_hdr_len ) ;
+
+   tmp = localtime( &now ) ;
+   if ( format )
+   {
+      char zone[ 8 ] ;
+
+      /* RFC 5424 wants the offset as +hh:mm */
+      (void) strftime( stamp, sizeof( stamp ), "%Y-%m-%dT%H:%M:%S", tmp ) ;
+      if ( strftime( zone, sizeof( zone ), "%z", tmp ) == 5 )
+      {
+         zone[ 6 ] = '\0' ;
+         zone[ 5 ] = zone[ 4 ] ;
+         zone[ 4 ] = zone[ 3 ] ;
+         zone[ 3 ] = ':' ;
+      }
+      else
+         (void) strcpy( zone, "Z" ) ;
+      sp->sl_hdr_len = strx_nprint( sp->sl_hdr, sizeof( sp->sl_hdr ),
+               "<%d>1 %s%s %s %s %d - - ", pri, stamp, zone,
+               transport.st_host, parms.slp_ident, (int) pid ) ;
+   }
+   else
+   {
+      (void) strftime( stamp, sizeof( stamp ), "%b %e %H:%M:%S", tmp ) ;
+      if ( parms.slp_logopts & LOG_PID )
+         sp->sl_hdr_len = strx_nprint( sp->sl_hdr, sizeof( sp->sl_hdr ),
+               "<%d>%s %s[%d]: ", pri, stamp, parms.slp_ident, (int) pid ) ;
+      else
+         sp->sl_hdr_len = strx_nprint( sp->sl_hdr, sizeof( sp->sl_hdr ),
+               "<%d>%s %s: ", pri, stamp, parms.slp_ident ) ;
+   }
+   sp->sl_hdr_pri = pri ;
+   sp->sl_hdr_time = now ;
+   sp->sl_hdr_pid = pid ;
+   sp->sl_hdr_format = format ;
+   return( sp->sl_hdr_len ) ;
+}
+
+
+static int record_add( char rec[], int cc, const char *s, int len )
+{
+   if ( len > MSGBUFSIZE - cc )
+      len = MSGBUFSIZE - cc ;
+   if ( len > 0 )
+   {
+      (void) memcpy( &rec[ cc ], s, len ) ;
+      cc += len ;
+   }
+   return( cc ) ;
+}
+
+
+/*
+ * Build a record of priority pri in rec. Returns its length.
+ */
+static int record_build( xlog_s *xp, char rec[], int pri,
+   const char buf[], int len, int action_flags )
+{
+   int   cc ;
+   int   percent_m_pos ;
+
+   cc = record_header( xp, pri, action_flags ) ;
+   (void) memcpy( rec, SYSLOG( xp )->sl_hdr, cc ) ;
+   if ( action_flags & XLOG_PRINT_ID )
+   {
+      cc = record_add( rec, cc, xp->xl_id, strlen( xp->xl_id ) ) ;
+      cc = record_add( rec, cc, ": ", 2 ) ;
+   }
+
+   if ( ( action_flags & XLOG_NO_ERRNO ) ||
+                  ( percent_m_pos = __xlog_add_errno( buf, len ) ) == -1 )
+      cc = record_add( rec, cc, buf, len ) ;
+   else
+   {
+      char *ep ;
+      char errno_buf[ 100 ] ;
+      unsigned size = sizeof( errno_buf ) ;
+
+      ep = __xlog_explain_errno( errno_buf, &size ) ;
+      cc = record_add( rec, cc, buf, percent_m_pos ) ;
+      cc = record_add( rec, cc, ep, (int) size ) ;
+      cc = record_add( rec, cc, buf + percent_m_pos + 2,
+                                          len - percent_m_pos - 2 ) ;
+   }
+   return( cc ) ;
+}
+
+
+/*
+ * Find room for a record: the next slot of the queue if the record is
+ * queued, buf otherwise
+ */
+static struct iovec *record_slot( bool_int queued, struct iovec *iovp,
+   char buf[] )
+{
+   if ( ! queued )
+   {
+      iovp->iov_base = buf ;
+      return( iovp ) ;
+   }
+   if ( transport.st_count == BATCH_SIZE )
+      transport_flush() ;
+   iovp = &transport.st_iov[ transport.st_count ] ;
+   iovp->iov_base = transport.st_rec[ transport.st_count++ ] ;
+   return( iovp ) ;
+}
+
+
 /*
  * Expected arguments:
  *      facility, level
@@ -85,6 +427,7 @@ static int syslog_init( xlog_s *xp, va_list ap )
       return( XLOG_ENOMEM ) ;
    sp->sl_facility = va_arg( ap, int ) ;
    sp->sl_default_level = va_arg( ap, int ) ;
+   sp->sl_hdr_len = 0 ;
    if ( slp->slp_n_xlogs++ == 0 )
       openlog( slp->slp_ident, slp->slp_logopts, slp->slp_facility ) ;
    xp->xl_data = sp ;
@@ -95,7 +438,11 @@ static int syslog_init( xlog_s *xp, va_list ap )
 static void syslog_fini( xlog_s *xp )
 {
    if ( --parms.slp_n_xlogs == 0 )
+   {
       closelog() ;
+      transport_flush() ;
+      transport_close() ;
+   }
    free( SYSLOG( xp ) ) ;
    xp->xl_data = NULL ;
 }
@@ -130,28 +477,26 @@ static int syslog_control( xlog_s *xp, xlog_cmd_e cmd, va_list ap )
       case XLOG_SIZECHECK:
       case XLOG_GETFD:
       case XLOG_LIMITS:
+      case XLOG_ASYNC:
+      case XLOG_ROTATION:
+      case XLOG_ROTATE:
          break ;
    }
    return( XLOG_ENOERROR ) ;
 }
 
 
-static int syslog_write( xlog_s *xp, const char buf[], int len, int flags, va_list ap )
+/*
+ * Hand a record to syslog(3), when we cannot send it ourselves
+ */
+static void syslog_fallback( xlog_s *xp, int syslog_arg, const char buf[],
+   int len, int action_flags )
 {
-   int   level ;
-   int   syslog_arg ;
    char   prefix[ MSGBUFSIZE ] ;
    int   prefix_size = sizeof( prefix ) ;
    int   prefix_len = 0 ;
    int   cc ;
    int   percent_m_pos ;
-   int   action_flags = ( flags | xp->xl_flags ) ;
-
-   if ( flags & XLOG_SET_LEVEL )
-      level = va_arg( ap, int ) ;
-   else
-      level = SYSLOG( xp )->sl_default_level ;
-   syslog_arg = SYSLOG( xp )->sl_facility + level ;
 
    if ( action_flags & XLOG_PRINT_ID )
    {
@@ -177,6 +522,62 @@ static int syslog_write( xlog_s *xp, const char buf[], int len, int flags, va_li
                   (int)size, ep,
                      len - percent_m_pos - 2, buf + percent_m_pos + 2 ) ;
    }
+}
+
+
+static int syslog_write( xlog_s *xp, const char buf[], int len, int flags, va_list ap )
+{
+   int            level ;
+   int            syslog_arg ;
+   int            action_flags = ( flags | xp->xl_flags ) ;
+   bool_int       queued ;
+   struct iovec   iov[ 2 ] ;
+   struct iovec   *iovp ;
+   unsigned       n = 0 ;
+   int            note = -1 ;
+   char           notebuf[ MSGBUFSIZE ] ;
+   char           rec[ MSGBUFSIZE ] ;
+
+   if ( flags & XLOG_SET_LEVEL )
+      level = va_arg( ap, int ) ;
+   else
+      level = SYSLOG( xp )->sl_default_level ;
+   syslog_arg = SYSLOG( xp )->sl_facility + level ;
+
+   if ( transport.st_fd == -1 && transport_open() == -1 )
+   {
+      syslog_fallback( xp, syslog_arg, buf, len, action_flags ) ;
+      return( XLOG_ENOERROR ) ;
+   }
+
+   /* the records queued by our parent are not ours to send */
+   if ( transport.st_pid != getpid() )
+      transport_discard() ;
+   queued = ( action_flags & XLOG_BATCH ) && transport.st_pid == getpid() ;
+
+   /* one note at a time */
+   if ( transport.st_dropped != 0 && transport.st_noted == 0 )
+   {
+      char text[ 64 ] ;
+      int textlen = strx_nprint( text, sizeof( text ),
+                     "%u syslog records dropped", transport.st_dropped ) ;
+
+      iovp = record_slot( queued, &iov[ n++ ], notebuf ) ;
+      iovp->iov_len = record_build( xp, iovp->iov_base,
+               SYSLOG( xp )->sl_facility + LOG_WARNING, text, textlen,
+               ( action_flags & ~XLOG_PRINT_ID ) | XLOG_NO_ERRNO ) ;
+      transport.st_noted = transport.st_dropped ;
+      if ( queued )
+         transport.st_note = iovp - transport.st_iov ;
+      else
+         note = 0 ;
+   }
+   iovp = record_slot( queued, &iov[ n++ ], rec ) ;
+   iovp->iov_len = record_build( xp, iovp->iov_base, syslog_arg,
+                                                buf, len, action_flags ) ;
+
+   if ( ! queued )
+      transport_count( n, transport_send( iov, n ), note ) ;
    return( XLOG_ENOERROR ) ;
 }
 
@@ -193,4 +594,3 @@ static int syslog_parms( xlog_e type, va_list ap )
    parms.slp_facility = va_arg( ap, int ) ;
    return( XLOG_ENOERROR ) ;
 }
-
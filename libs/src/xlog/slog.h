@@ -15,6 +15,12 @@ struct syslog_s
 {
 	int sl_facility ;
 	int sl_default_level ;
+	int sl_hdr_len ;			/* header of the last record, if not 0 */
+	int sl_hdr_pri ;
+	int sl_hdr_format ;
+	time_t sl_hdr_time ;
+	pid_t sl_hdr_pid ;
+	char sl_hdr[ 384 ] ;
 } ;
 
 
@@ -29,5 +35,7 @@ struct syslog_parms
 
 #define SYSLOG( xp )         ((struct syslog_s *)xp->xl_data)
 
+void __xlog_syslog_flush( void ) ;
+
 #endif
 
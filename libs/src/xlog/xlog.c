@@ -14,6 +14,7 @@
 extern struct xlog_ops __xlog_filelog_ops ;
 #ifndef NO_SYSLOG
 extern struct xlog_ops __xlog_syslog_ops ;
+extern void __xlog_syslog_flush( void ) ;
 #endif
 
 struct lookup_table
@@ -258,3 +259,14 @@ int xlog_parms( xlog_e type, ... )
 	return( status ) ;
 }
 
+
+/*
+ * Send the records queued by the xlogs with the XLOG_BATCH flag
+ */
+void xlog_flush( void )
+{
+#ifndef NO_SYSLOG
+	__xlog_syslog_flush() ;
+#endif
+}
+
@@ -21,6 +21,9 @@
 /* #define XLOG_PRINT_TIMESTAMP		0x8 */
 #define XLOG_PRINT_ID				0x10
 #define XLOG_PRINT_PID				0x20
+#define XLOG_NO_HEADER				0x40
+#define XLOG_BATCH					0x80
+#define XLOG_RFC5424					0x100
 
 /*
  * Errors
@@ -31,6 +34,7 @@
 #define XLOG_EFSTAT					3
 #define XLOG_ENOMEM					4
 #define XLOG_EWRITE					5
+#define XLOG_EROTATE					6		/* not an error: see XLOG_ROTATION	*/
 
 /*
  * Interface
@@ -50,9 +54,19 @@ typedef enum
 		XLOG_POSTEXEC,			/* syslog:	exec(2) failed								*/
 		XLOG_SIZECHECK,		/* filelog: check file size 							*/
 		XLOG_GETFD,				/* filelog: get file descriptor of log file		*/
-		XLOG_LIMITS 			/* filelog: set (new) soft/hard limits				*/
+		XLOG_LIMITS,			/* filelog: set (new) soft/hard limits				*/
+		XLOG_ASYNC,				/* filelog: write records to a pipe				*/
+		XLOG_ROTATION,			/* filelog: rotate at the soft limit				*/
+		XLOG_ROTATE				/* filelog: rotate the file now						*/
 	} xlog_cmd_e ;
 
+/*
+ * What an asynchronous filelog does with a record when its pipe is full
+ */
+#define XLOG_OVERFLOW_COUNT		0		/* drop it and report how many were	*/
+#define XLOG_OVERFLOW_DROP			1		/* drop it									*/
+#define XLOG_OVERFLOW_BLOCK		2		/* wait until it can be written		*/
+
 typedef void *xlog_h ;
 
 xlog_h xlog_create	( xlog_e type, const char *id, int flags, ... ) ;
@@ -60,5 +74,6 @@ void xlog_destroy		( xlog_h ) ;
 void xlog_write		( xlog_h, const char *buf, int len, int flags, ... ) ;
 int xlog_control		( xlog_h, xlog_cmd_e, ... ) ;
 int xlog_parms			( xlog_e type, ... ) ;
+void xlog_flush		( void ) ;
 
 #endif	/* __XLOG_H */
@@ -353,7 +353,9 @@ access_e parent_access_control( struct service *sp, const connection_s *cp )
    }
 
    if ( ps.ros.process_limit ) {
-      unsigned processes_to_create = SC_IS_INTERCEPTED( scp ) ? 2 : 1 ;
+      /* An interceptor is a process of its own, unless it is inline */
+      unsigned processes_to_create = ( SC_IS_INTERCEPTED( scp ) &&
+                           SC_INTERCEPT_INLINE( scp ) != YES ) ? 2 : 1 ;
 
       if ( pset_count( SERVERS( ps ) ) + processes_to_create > 
          ps.ros.process_limit ) {
@@ -62,12 +62,28 @@
 #define A_MDNS             44
 #define A_LIBWRAP          45
 #define A_KAFEL_RULE       46
+#define A_REDIRECT_MODE    47
+#define A_REDIRECT_POLICY  48
+#define A_REDIRECT_CHECK   49
+#define A_REDIRECT_CONNECT_TIMEOUT 50
+#define A_REDIRECT_IDLE_TIMEOUT    51
+#define A_DEFER_ACCEPT     52
+#define A_TCP_FASTOPEN     53
+#define A_INTERCEPT_MODE   54
+#define A_BUILTIN_MODE     55
+#define A_LOG_MODE         56
+#define A_LOG_OVERFLOW     57
+#define A_LOG_ROTATE       58
+#define A_LOG_FORMAT       59
+#define A_LOG_FAILURE_LIMIT 60
+#define A_SPAWN_RATE       61
+#define A_SPAWN_BURST      62
 
 /*
  * SERVICE_ATTRIBUTES is the number of service attributes and also
  * the number from which defaults-only attributes start.
  */
-#define SERVICE_ATTRIBUTES      ( A_KAFEL_RULE + 1 )
+#define SERVICE_ATTRIBUTES      ( A_LOG_FAILURE_LIMIT + 1 )
 
 /*
  * Mask of attributes that must be specified.
@@ -0,0 +1,339 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+
+/*
+ * A note on automatic reloading:
+ * With -auto_reload <delay>, xinetd watches with inotify(7) the
+ * directories that hold its configuration files, and its included
+ * directories. A change to a file that is part of the configuration
+ * (see conffile_relevant) causes a hard reconfiguration <delay> seconds
+ * later, as if SIGHUP had been received. Every further change during
+ * that time starts the wait again, so that a burst of changes causes a
+ * single reconfiguration, which happens no later than
+ * AUTO_RELOAD_MAX_DELAY seconds (or <delay> seconds if longer) after
+ * the first change of the burst. The watches follow the files of the
+ * configuration after each reconfiguration.
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#ifdef HAVE_INOTIFY_INIT1
+#include <sys/inotify.h>
+#endif
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sio.h"
+#include "str.h"
+
+#include "autoreload.h"
+#include "conffile.h"
+#include "main.h"
+#include "msg.h"
+#include "options.h"
+#include "reconfig.h"
+#include "state.h"
+#include "util.h"
+#include "xconfig.h"
+#include "xtimer.h"
+
+#define WATCH_EVENTS       ( IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |       \
+                             IN_MOVED_FROM | IN_MOVED_TO |                  \
+                             IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR )
+
+struct watch
+{
+   int             w_wd ;
+   char           *w_dir ;
+} ;
+
+static int notify_fd = -1 ;
+static struct watch *watches = NULL ;
+static unsigned watch_count = 0 ;
+static unsigned watch_size = 0 ;
+static int reload_timer = 0 ;
+static time_t reload_when ;
+static time_t burst_start ;            /* first change not reloaded yet */
+
+#ifdef HAVE_INOTIFY_INIT1
+
+static void watch_clear( void )
+{
+   unsigned u ;
+
+   for ( u = 0 ; u < watch_count ; u++ )
+   {
+      if ( watches[ u ].w_wd != -1 )
+         (void) inotify_rm_watch( notify_fd, watches[ u ].w_wd ) ;
+      free( watches[ u ].w_dir ) ;
+   }
+   watch_count = 0 ;
+}
+
+
+static void watch_add( const char *dir )
+{
+   struct watch *wp ;
+   unsigned u ;
+   const char *func = "watch_add" ;
+
+   for ( u = 0 ; u < watch_count ; u++ )
+      if ( strcmp( watches[ u ].w_dir, dir ) == 0 )
+         return ;
+
+   if ( watch_count == watch_size )
+   {
+      unsigned size = watch_size ? watch_size * 2 : 8 ;
+
+      if ( ( wp = realloc( watches, size * sizeof( *wp ) ) ) == NULL )
+      {
+         out_of_memory( func ) ;
+         return ;
+      }
+      watches = wp ;
+      watch_size = size ;
+   }
+
+   wp = &watches[ watch_count ] ;
+   if ( ( wp->w_dir = new_string( dir ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      return ;
+   }
+   if ( ( wp->w_wd = inotify_add_watch( notify_fd, dir, WATCH_EVENTS ) ) == -1 )
+   {
+      msg( LOG_ERR, func, "inotify_add_watch( %s ) failed: %m", dir ) ;
+      free( wp->w_dir ) ;
+      return ;
+   }
+   watch_count++ ;
+}
+
+
+static const char *watch_dir( int wd )
+{
+   unsigned u ;
+
+   for ( u = 0 ; u < watch_count ; u++ )
+      if ( watches[ u ].w_wd == wd )
+         return( watches[ u ].w_dir ) ;
+   return( NULL ) ;
+}
+
+
+static void reload( void )
+{
+   reload_timer = 0 ;
+   msg( LOG_NOTICE, "reload", "Configuration changed" ) ;
+   hard_reconfig() ;
+}
+
+
+/*
+ * Reload when no other change came for auto_reload_option_arg seconds,
+ * or when the burst of changes has gone on long enough
+ */
+static void reload_schedule( void )
+{
+   time_t      now = time( NULL ) ;
+   time_t      when ;
+   time_t      latest ;
+   const char *func = "reload_schedule" ;
+
+   if ( reload_timer == 0 )
+      burst_start = now ;
+   when = now + auto_reload_option_arg ;
+   latest = burst_start + ( ( auto_reload_option_arg > AUTO_RELOAD_MAX_DELAY ) ?
+                           auto_reload_option_arg : AUTO_RELOAD_MAX_DELAY ) ;
+   if ( when > latest )
+      when = latest ;
+
+   if ( reload_timer != 0 )
+   {
+      if ( reload_when == when )
+         return ;
+      xtimer_remove( reload_timer ) ;
+      reload_timer = 0 ;
+   }
+   if ( ( reload_timer = xtimer_add( reload, when > now ? when - now : 0 ) )
+                                                                     == -1 )
+   {
+      msg( LOG_ERR, func, "xtimer_add: %m" ) ;
+      reload_timer = 0 ;
+      return ;
+   }
+   reload_when = when ;
+}
+
+
+/*
+ * Read the pending events. Returns TRUE if one of them is about the
+ * configuration.
+ */
+static bool_int read_events( void )
+{
+   union
+   {
+      struct inotify_event    ev ;
+      char                    buf[ 4096 ] ;
+   } u ;
+   bool_int    changed = FALSE ;
+   ssize_t     n ;
+   const char *func = "read_events" ;
+
+   while ( ( n = read( notify_fd, u.buf, sizeof( u.buf ) ) ) != 0 )
+   {
+      char *p ;
+
+      if ( n == -1 )
+      {
+         if ( errno == EINTR )
+            continue ;
+         if ( errno != EAGAIN )
+            msg( LOG_ERR, func, "read: %m" ) ;
+         break ;
+      }
+
+      for ( p = u.buf ; p < u.buf + n ;
+            p += sizeof( struct inotify_event ) + ((struct inotify_event *)p)->len )
+      {
+         struct inotify_event *evp = (struct inotify_event *) p ;
+         const char *dir ;
+
+         if ( evp->mask & IN_Q_OVERFLOW )
+            changed = TRUE ;
+         else if ( ( dir = watch_dir( evp->wd ) ) == NULL ||
+                   ( evp->mask & IN_IGNORED ) )
+            continue ;
+         else if ( evp->mask & ( IN_DELETE_SELF | IN_MOVE_SELF ) )
+            changed = TRUE ;
+         else if ( evp->len != 0 && conffile_relevant( dir, evp->name ) )
+            changed = TRUE ;
+      }
+   }
+   return( changed ) ;
+}
+
+#endif   /* HAVE_INOTIFY_INIT1 */
+
+
+/*
+ * Start watching the configuration, if -auto_reload was given
+ */
+void autoreload_start( void )
+{
+   const char *func = "autoreload_start" ;
+
+   if ( ! auto_reload_option )
+      return ;
+#ifdef HAVE_INOTIFY_INIT1
+   if ( ( notify_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC ) ) == -1 )
+   {
+      msg( LOG_ERR, func, "inotify_init1: %m" ) ;
+      return ;
+   }
+   FD_SET( notify_fd, &ps.rws.socket_mask ) ;
+   if ( notify_fd > ps.rws.mask_max )
+      ps.rws.mask_max = notify_fd ;
+   autoreload_update() ;
+#else
+   msg( LOG_ERR, func, "auto_reload is not supported on this system" ) ;
+#endif
+}
+
+
+/*
+ * Invoked after each reconfiguration: watch the directories of the
+ * files it read, and forget the changes it took in
+ */
+void autoreload_update( void )
+{
+#ifdef HAVE_INOTIFY_INIT1
+   unsigned u ;
+
+   if ( notify_fd < 0 )
+      return ;
+
+   if ( reload_timer != 0 )
+   {
+      xtimer_remove( reload_timer ) ;
+      reload_timer = 0 ;
+   }
+
+   watch_clear() ;
+   for ( u = 0 ; u < conffile_count() ; u++ )
+   {
+      bool_int is_dir ;
+      const char *path = conffile_path( u, &is_dir ) ;
+      const char *slash ;
+
+      if ( is_dir )
+         watch_add( path ) ;
+      else if ( ( slash = strrchr( path, '/' ) ) == NULL )
+         watch_add( "." ) ;
+      else if ( slash == path )
+         watch_add( "/" ) ;
+      else
+      {
+         char *dir = new_string( path ) ;
+
+         if ( dir == NULL )
+         {
+            out_of_memory( "autoreload_update" ) ;
+            continue ;
+         }
+         dir[ slash - path ] = NUL ;
+         watch_add( dir ) ;
+         free( dir ) ;
+      }
+   }
+#endif
+}
+
+
+int autoreload_poll( fd_set *maskp )
+{
+   if ( notify_fd < 0 || ! FD_ISSET( notify_fd, maskp ) )
+      return( 0 ) ;
+#ifdef HAVE_INOTIFY_INIT1
+   if ( read_events() )
+      reload_schedule() ;
+#endif
+   return( 1 ) ;
+}
+
+
+bool_int autoreload_fd( int fd )
+{
+   return( notify_fd >= 0 && fd == notify_fd ) ;
+}
+
+
+/*
+ * Close the inotify descriptor in a child that does not exec
+ */
+void autoreload_close( void )
+{
+   if ( notify_fd >= 0 )
+      (void) close( notify_fd ) ;
+}
+
+
+void autoreload_dump( int fd )
+{
+   if ( notify_fd < 0 )
+      return ;
+   Sprint( fd, "auto reload: directories watched = %u", watch_count ) ;
+   if ( reload_timer != 0 )
+      Sprint( fd, ", reload in %lds",
+                     (long) ( reload_when - time( NULL ) ) ) ;
+   Sputchar( fd, '\n' ) ;
+   Sputchar( fd, '\n' ) ;
+}
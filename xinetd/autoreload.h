@@ -0,0 +1,22 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+#ifndef AUTORELOAD_H
+#define AUTORELOAD_H
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/select.h>
+
+#include "defs.h"
+
+void autoreload_start(void);
+void autoreload_update(void);
+int autoreload_poll(fd_set *maskp);
+bool_int autoreload_fd(int fd);
+void autoreload_close(void);
+void autoreload_dump(int fd);
+
+#endif
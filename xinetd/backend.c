@@ -0,0 +1,502 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sio.h"
+#include "backend.h"
+#include "connection.h"
+#include "log.h"
+#include "main.h"
+#include "msg.h"
+#include "sconf.h"
+#include "state.h"
+#include "util.h"
+#include "xconfig.h"
+#include "xtimer.h"
+
+/*
+ * Backend selection and health tracking for redirected services.
+ *
+ * The backends of a service are the address pairs of its redirect
+ * attribute. A connection is given to a backend by the parent, before
+ * the redirector is forked or the connection is passed to a proxy, and
+ * the backend is charged with it until the server ends. A udp
+ * redirector serves many clients and picks the backend of each one
+ * itself, on its copy of the table.
+ *
+ * Health is tracked passively: a backend is ejected after
+ * REDIR_EJECT_FAILURES consecutive failed connects. If the service has
+ * redirect_check set, each backend is also probed with a TCP connect
+ * every redirect_check seconds, and an ejected backend comes back only
+ * when a probe succeeds. Otherwise it is tried again every
+ * REDIR_EJECT_TIME seconds.
+ *
+ * When a connect fails, or does not complete within
+ * redirect_connect_timeout seconds, the redirector fails over to the
+ * other usable backends in ring order (see backend_next). The failure
+ * is charged to the backend the policy picked.
+ *
+ * Byte counters are only kept for inline sessions; a forked redirector
+ * cannot tell the parent how much it forwarded.
+ *
+ * A reconfiguration may replace the backends of a service while servers
+ * are still charged to them. Each backend gets a new generation number
+ * when it is set up, and a server is only released from the backend it
+ * was charged to if that backend is still the same one.
+ */
+
+static bool_int check_timer_running ;
+static unsigned backend_generation ;
+
+static void backend_check(void) ;
+
+
+static void backend_reset( struct backend *bep, const union xsockaddr *addrp )
+{
+   CLEAR( *bep ) ;
+   bep->be_addr = *addrp ;
+   bep->be_probe = -1 ;
+   bep->be_gen = ++backend_generation ;
+}
+
+
+static void probe_close( struct backend *bep )
+{
+   if ( bep->be_probe >= 0 )
+   {
+      (void) close( bep->be_probe ) ;
+      bep->be_probe = -1 ;
+   }
+}
+
+
+/*
+ * Arm the probe timer; it keeps itself running while some service
+ * wants its backends checked
+ */
+static void start_check_timer(void)
+{
+   const char *func = "start_check_timer" ;
+
+   if ( check_timer_running )
+      return ;
+   if ( xtimer_add( backend_check, 1 ) == -1 )
+      msg( LOG_ERR, func, "xtimer_add: %m" ) ;
+   else
+      check_timer_running = TRUE ;
+}
+
+
+/*
+ * Set up the backend table of a redirected service. On reconfiguration
+ * the state of the backends whose address did not change is kept.
+ */
+status_e backend_activate( struct service *sp )
+{
+   struct service_config *scp = SVC_CONF( sp ) ;
+   unsigned count = SC_REDIR_COUNT( scp ) ;
+   struct backend *table ;
+   unsigned u ;
+   const char *func = "backend_activate" ;
+
+   if ( SC_REDIR_ADDR( scp ) == NULL )
+   {
+      backend_free( sp ) ;
+      return( OK ) ;
+   }
+
+   if ( count != SVC_BACKEND_COUNT( sp ) )
+   {
+      table = (struct backend *) calloc( count, sizeof( *table ) ) ;
+      if ( table == NULL )
+      {
+         out_of_memory( func ) ;
+         return( FAILED ) ;
+      }
+      for ( u = 0 ; u < count ; u++ )
+         backend_reset( &table[ u ], SC_REDIR_BACKEND( scp, u ) ) ;
+      backend_free( sp ) ;
+      SVC_BACKENDS( sp ) = table ;
+      SVC_BACKEND_COUNT( sp ) = count ;
+   }
+   else
+   {
+      for ( u = 0 ; u < count ; u++ )
+      {
+         struct backend *bep = &SVC_BACKENDS( sp )[ u ] ;
+
+         if ( memcmp( &bep->be_addr, SC_REDIR_BACKEND( scp, u ),
+                                          sizeof( bep->be_addr ) ) != 0 )
+         {
+            probe_close( bep ) ;
+            backend_reset( bep, SC_REDIR_BACKEND( scp, u ) ) ;
+         }
+      }
+   }
+
+   if ( SC_REDIR_CHECK( scp ) > 0 )
+      start_check_timer() ;
+   return( OK ) ;
+}
+
+
+/*
+ * Stop probing the backends of a service that is going away
+ */
+void backend_deactivate( const struct service *sp )
+{
+   unsigned u ;
+
+   for ( u = 0 ; u < SVC_BACKEND_COUNT( sp ) ; u++ )
+      probe_close( &SVC_BACKENDS( sp )[ u ] ) ;
+}
+
+
+void backend_free( struct service *sp )
+{
+   if ( SVC_BACKENDS( sp ) == NULL )
+      return ;
+   backend_deactivate( sp ) ;
+   free( SVC_BACKENDS( sp ) ) ;
+   SVC_BACKENDS( sp ) = NULL ;
+   SVC_BACKEND_COUNT( sp ) = 0 ;
+   SVC_BACKEND_NEXT( sp ) = 0 ;
+}
+
+
+static void backend_up( struct service *sp, struct backend *bep )
+{
+   const char *func = "backend_up" ;
+
+   bep->be_failures = 0 ;
+   if ( bep->be_down )
+   {
+      bep->be_down = FALSE ;
+      msg( LOG_NOTICE, func, "%s: backend %s:%d is back", SVC_ID( sp ),
+            xaddrname( &bep->be_addr ), xaddrport( &bep->be_addr ) ) ;
+   }
+}
+
+
+static void backend_failed( struct service *sp, struct backend *bep )
+{
+   const char *func = "backend_failed" ;
+
+   bep->be_errors++ ;
+   if ( ++bep->be_failures < REDIR_EJECT_FAILURES )
+      return ;
+   bep->be_retry = time( NULL ) + REDIR_EJECT_TIME ;
+   if ( ! bep->be_down )
+   {
+      bep->be_down = TRUE ;
+      msg( LOG_WARNING, func,
+            "%s: backend %s:%d ejected after %u failed connects",
+            SVC_ID( sp ), xaddrname( &bep->be_addr ),
+            xaddrport( &bep->be_addr ), bep->be_failures ) ;
+   }
+}
+
+
+/*
+ * Returns TRUE if a backend may be given a connection. An ejected
+ * backend of a service without probes gets a trial connection every
+ * REDIR_EJECT_TIME seconds.
+ */
+static bool_int backend_usable( const struct service *sp,
+                                struct backend *bep, time_t now )
+{
+   if ( ! bep->be_down )
+      return( TRUE ) ;
+   if ( SC_REDIR_CHECK( SVC_CONF( sp ) ) > 0 || now < bep->be_retry )
+      return( FALSE ) ;
+   return( TRUE ) ;
+}
+
+
+/*
+ * Pick the backend for a client at addrp according to the policy of
+ * service sp. If all backends are ejected, the policy picks among all
+ * of them, since refusing the connection would not help.
+ * Returns -1 if the service has no backends.
+ */
+int backend_choose( struct service *sp, const union xsockaddr *addrp )
+{
+   struct service_config *scp = SVC_CONF( sp ) ;
+   unsigned count = SVC_BACKEND_COUNT( sp ) ;
+   struct backend *table = SVC_BACKENDS( sp ) ;
+   time_t now = time( NULL ) ;
+   unsigned start, u ;
+   int pass, best = -1 ;
+
+   if ( count == 0 )
+      return( -1 ) ;
+
+   if ( SC_REDIR_POLICY( scp ) == REDIR_SOURCE )
+      start = ( addrp ? xaddrhash( addrp, FALSE ) : 0 ) % count ;
+   else
+      start = SVC_BACKEND_NEXT( sp ) % count ;
+
+   for ( pass = 0 ; pass < 2 && best < 0 ; pass++ )
+      for ( u = 0 ; u < count ; u++ )
+      {
+         unsigned idx = ( start + u ) % count ;
+
+         if ( pass == 0 && ! backend_usable( sp, &table[ idx ], now ) )
+            continue ;
+         if ( SC_REDIR_POLICY( scp ) != REDIR_LEASTCONN )
+         {
+            best = idx ;
+            break ;
+         }
+         if ( best < 0 || table[ idx ].be_active < table[ best ].be_active )
+            best = idx ;
+      }
+
+   if ( table[ best ].be_down )
+      table[ best ].be_retry = now + REDIR_EJECT_TIME ;
+   if ( SC_REDIR_POLICY( scp ) != REDIR_SOURCE )
+      SVC_BACKEND_NEXT( sp ) = best + 1 ;
+   return( best ) ;
+}
+
+
+/*
+ * Pick the backend for the connection of serp. A datagram redirector
+ * serves many clients and picks a backend for each of them itself.
+ */
+void backend_select( struct server *serp )
+{
+   struct service *sp = SERVER_SERVICE( serp ) ;
+   int idx = -1 ;
+
+   if ( SVC_SOCKET_TYPE( sp ) != SOCK_DGRAM )
+      idx = backend_choose( sp, CONN_XADDRESS( SERVER_CONNECTION( serp ) ) ) ;
+   SERVER_BACKEND( serp ) = SERVER_BACKEND_FIRST( serp ) = idx ;
+}
+
+
+/*
+ * The backend to fail over to when the one of serp could not be
+ * reached: the next usable one in ring order, stopping short of the
+ * one the policy picked. Returns -1 when there is none left.
+ * A forked redirector calls this on its copy of the table.
+ */
+int backend_next( const struct server *serp )
+{
+   struct service *sp = SERVER_SERVICE( serp ) ;
+   unsigned count = SVC_BACKEND_COUNT( sp ) ;
+   int idx = SERVER_BACKEND( serp ) ;
+   int first = SERVER_BACKEND_FIRST( serp ) ;
+   time_t now = time( NULL ) ;
+   unsigned u ;
+
+   /* the table may have been replaced since the policy picked */
+   if ( idx < 0 || first < 0 || count <= 1 ||
+        (unsigned) idx >= count || (unsigned) first >= count )
+      return( -1 ) ;
+
+   for ( u = ( idx + 1 ) % count ; u != (unsigned) first ; u = ( u + 1 ) % count )
+      if ( backend_usable( sp, &SVC_BACKENDS( sp )[ u ], now ) )
+         return( u ) ;
+   return( -1 ) ;
+}
+
+
+/*
+ * The address the redirector of serp should connect to
+ */
+const union xsockaddr *backend_addr( const struct server *serp )
+{
+   struct service_config *scp = SVC_CONF( SERVER_SERVICE( serp ) ) ;
+   int idx = SERVER_BACKEND( serp ) ;
+
+   if ( idx < 0 || (unsigned) idx >= SC_REDIR_COUNT( scp ) )
+      idx = 0 ;
+   return( SC_REDIR_BACKEND( scp, idx ) ) ;
+}
+
+
+/*
+ * Charge the backend of serp with its connection
+ */
+void backend_use( struct server *serp )
+{
+   struct service *sp = SERVER_SERVICE( serp ) ;
+   int idx = SERVER_BACKEND( serp ) ;
+
+   if ( idx < 0 || (unsigned) idx >= SVC_BACKEND_COUNT( sp ) )
+   {
+      SERVER_BACKEND( serp ) = -1 ;
+      return ;
+   }
+   SVC_BACKENDS( sp )[ idx ].be_active++ ;
+   SVC_BACKENDS( sp )[ idx ].be_conns++ ;
+   SERVER_BACKEND_GEN( serp ) = SVC_BACKENDS( sp )[ idx ].be_gen ;
+}
+
+
+/*
+ * The connection of serp is over. failed is TRUE if the backend could
+ * not be reached. Nothing is charged back to a backend that has been
+ * replaced since serp was charged to it.
+ */
+void backend_release( struct server *serp, bool_int failed,
+                      unsigned long bytes_in, unsigned long bytes_out )
+{
+   struct service *sp = SERVER_SERVICE( serp ) ;
+   int idx = SERVER_BACKEND( serp ) ;
+   struct backend *bep ;
+
+   SERVER_BACKEND( serp ) = -1 ;
+   if ( idx < 0 || (unsigned) idx >= SVC_BACKEND_COUNT( sp ) )
+      return ;
+
+   bep = &SVC_BACKENDS( sp )[ idx ] ;
+   if ( bep->be_gen != SERVER_BACKEND_GEN( serp ) )
+      return ;
+   if ( bep->be_active > 0 )
+      bep->be_active-- ;
+   bep->be_bytes_in += bytes_in ;
+   bep->be_bytes_out += bytes_out ;
+   if ( failed )
+      backend_failed( sp, bep ) ;
+   else
+      backend_up( sp, bep ) ;
+}
+
+
+/*
+ * Finish the probe of a backend, if it is done, and start the next one
+ * when it is due. A probe that has not connected by the time the next
+ * one is due has failed.
+ */
+static void backend_probe( struct service *sp, struct backend *bep,
+                           time_t now )
+{
+   int interval = SC_REDIR_CHECK( SVC_CONF( sp ) ) ;
+   socklen_t len ;
+
+   if ( bep->be_probe >= 0 )
+   {
+      struct pollfd pfd ;
+      int error = 0 ;
+
+      pfd.fd = bep->be_probe ;
+      pfd.events = POLLOUT ;
+      pfd.revents = 0 ;
+      if ( poll( &pfd, 1, 0 ) == 1 )
+      {
+         len = sizeof( error ) ;
+         if ( getsockopt( bep->be_probe, SOL_SOCKET, SO_ERROR,
+                                    (char *) &error, &len ) == -1 )
+            error = errno ;
+         probe_close( bep ) ;
+         if ( error == 0 )
+            backend_up( sp, bep ) ;
+         else
+            backend_failed( sp, bep ) ;
+      }
+      else if ( now >= bep->be_probe_time )
+      {
+         probe_close( bep ) ;
+         backend_failed( sp, bep ) ;
+      }
+   }
+
+   if ( bep->be_probe >= 0 || now < bep->be_probe_time )
+      return ;
+
+   bep->be_probe_time = now + interval ;
+   bep->be_probe = socket( bep->be_addr.sa.sa_family, SOCK_STREAM, 0 ) ;
+   if ( bep->be_probe < 0 )
+      return ;
+   if ( fcntl( bep->be_probe, F_SETFD, FD_CLOEXEC ) == -1 ||
+        fcntl( bep->be_probe, F_SETFL, O_NONBLOCK ) == -1 )
+   {
+      probe_close( bep ) ;
+      return ;
+   }
+
+   {
+      union xsockaddr addr = bep->be_addr ;
+
+      if ( addr.sa.sa_family == AF_INET6 )
+      {
+         addr.sa_in6.sin6_port = htons( addr.sa_in6.sin6_port ) ;
+         len = sizeof( struct sockaddr_in6 ) ;
+      }
+      else
+      {
+         addr.sa_in.sin_port = htons( addr.sa_in.sin_port ) ;
+         len = sizeof( struct sockaddr_in ) ;
+      }
+      if ( connect( bep->be_probe, &addr.sa, len ) == 0 )
+      {
+         probe_close( bep ) ;
+         backend_up( sp, bep ) ;
+      }
+      else if ( errno != EINPROGRESS )
+      {
+         probe_close( bep ) ;
+         backend_failed( sp, bep ) ;
+      }
+   }
+}
+
+
+/*
+ * Timer callback: advance the probes of all services with redirect_check
+ */
+static void backend_check(void)
+{
+   time_t now = time( NULL ) ;
+   unsigned u, i ;
+   bool_int checking = FALSE ;
+
+   check_timer_running = FALSE ;
+   for ( u = 0 ; u < pset_count( SERVICES( ps ) ) ; u++ )
+   {
+      struct service *sp = SP( pset_pointer( SERVICES( ps ), u ) ) ;
+
+      if ( ! SVC_IS_AVAILABLE( sp ) || SC_REDIR_CHECK( SVC_CONF( sp ) ) <= 0 )
+         continue ;
+      for ( i = 0 ; i < SVC_BACKEND_COUNT( sp ) ; i++ )
+         backend_probe( sp, &SVC_BACKENDS( sp )[ i ], now ) ;
+      checking = TRUE ;
+   }
+   if ( checking )
+      start_check_timer() ;
+}
+
+
+void backend_dump( const struct service *sp, int fd )
+{
+   unsigned u ;
+
+   for ( u = 0 ; u < SVC_BACKEND_COUNT( sp ) ; u++ )
+   {
+      const struct backend *bep = &SVC_BACKENDS( sp )[ u ] ;
+
+      tabprint( fd, 1, "backend %s:%d: %s, active = %u, connections = %lu, "
+                  "failures = %lu, bytes in = %lu, bytes out = %lu\n",
+                  xaddrname( &bep->be_addr ), xaddrport( &bep->be_addr ),
+                  bep->be_down ? "down" : "up",
+                  bep->be_active, bep->be_conns, bep->be_errors,
+                  bep->be_bytes_in, bep->be_bytes_out ) ;
+   }
+}
@@ -0,0 +1,48 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include "config.h"
+#include <sys/types.h>
+#include <time.h>
+
+#include "defs.h"
+#include "server.h"
+#include "service.h"
+
+/*
+ * The state of one backend of a redirected service
+ */
+struct backend
+{
+   union xsockaddr   be_addr ;
+   unsigned          be_active ;       /* connections in progress      */
+   unsigned          be_failures ;     /* consecutive failed connects  */
+   bool_int          be_down ;         /* ejected                      */
+   time_t            be_retry ;        /* next trial of an ejected one */
+   int               be_probe ;        /* descriptor of a probe or -1  */
+   time_t            be_probe_time ;   /* when the next probe is due   */
+   unsigned long     be_conns ;
+   unsigned long     be_errors ;
+   unsigned long     be_bytes_in ;
+   unsigned long     be_bytes_out ;
+   unsigned          be_gen ;          /* changes when it is replaced  */
+} ;
+
+status_e backend_activate(struct service *sp);
+void backend_deactivate(const struct service *sp);
+void backend_free(struct service *sp);
+int backend_choose(struct service *sp, const union xsockaddr *addrp);
+void backend_select(struct server *serp);
+int backend_next(const struct server *serp);
+const union xsockaddr *backend_addr(const struct server *serp);
+void backend_use(struct server *serp);
+void backend_release(struct server *serp, bool_int failed,
+                     unsigned long bytes_in, unsigned long bytes_out);
+void backend_dump(const struct service *sp, int fd);
+
+#endif
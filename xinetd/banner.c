@@ -0,0 +1,240 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+
+/*
+ * The banner files are read when the services are (re)configured and
+ * kept in memory, one copy per file however many services use it.
+ * A banner is then sent with a single write(2) instead of being read
+ * from its file on each connection. A file is looked at again (with
+ * stat(2)) at most every BANNER_CHECK_INTERVAL seconds, and read again
+ * if it has changed.
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "str.h"
+
+#include "banner.h"
+#include "defs.h"
+#include "main.h"
+#include "msg.h"
+#include "sconf.h"
+#include "service.h"
+#include "state.h"
+#include "util.h"
+#include "xconfig.h"
+
+struct banner
+{
+   char             *bn_path ;
+   char             *bn_data ;
+   size_t            bn_len ;
+   bool_int          bn_ok ;         /* the file could be read */
+   time_t            bn_checked ;    /* when the file was last looked at */
+   time_t            bn_mtime ;
+   time_t            bn_ctime ;
+   off_t             bn_size ;
+   ino_t             bn_ino ;
+   dev_t             bn_dev ;
+   struct banner    *bn_next ;
+} ;
+
+static struct banner *banners = NULL ;
+
+
+/*
+ * (Re)read the file of banner bp. Returns OK if it could be read.
+ */
+static status_e banner_load( struct banner *bp, const char *id )
+{
+   const char  *func = "banner_load" ;
+   struct stat  st ;
+   char        *data ;
+   size_t       len = 0 ;
+   int          fd ;
+
+   FREE( bp->bn_data ) ;
+   bp->bn_data = NULL ;
+   bp->bn_len = 0 ;
+   bp->bn_ok = FALSE ;
+   bp->bn_checked = time( NULL ) ;
+
+   if ( ( fd = open( bp->bn_path, O_RDONLY ) ) == -1 )
+   {
+      msg( LOG_ERR, func, "service = %s, open of banner %s failed",
+                                                         id, bp->bn_path ) ;
+      return( FAILED ) ;
+   }
+   if ( fstat( fd, &st ) == -1 )
+   {
+      msg( LOG_ERR, func, "service %s, Error %m reading banner %s",
+                                                         id, bp->bn_path ) ;
+      (void) close( fd ) ;
+      return( FAILED ) ;
+   }
+   bp->bn_mtime = st.st_mtime ;
+   bp->bn_ctime = st.st_ctime ;
+   bp->bn_size = st.st_size ;
+   bp->bn_ino = st.st_ino ;
+   bp->bn_dev = st.st_dev ;
+
+   if ( ( data = malloc( (size_t) st.st_size + 1 ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      (void) close( fd ) ;
+      return( FAILED ) ;
+   }
+   while ( len < (size_t) st.st_size )
+   {
+      ssize_t cc = read( fd, data + len, (size_t) st.st_size - len ) ;
+
+      if ( cc == -1 && errno == EINTR )
+         continue ;
+      if ( cc == -1 )
+      {
+         msg( LOG_ERR, func, "service %s, Error %m reading banner %s",
+                                                         id, bp->bn_path ) ;
+         free( data ) ;
+         (void) close( fd ) ;
+         return( FAILED ) ;
+      }
+      if ( cc == 0 )
+         break ;
+      len += cc ;
+   }
+   (void) close( fd ) ;
+
+   bp->bn_data = data ;
+   bp->bn_len = len ;
+   bp->bn_ok = TRUE ;
+   return( OK ) ;
+}
+
+
+/*
+ * Read the banner again if its file has changed since it was read
+ */
+static void banner_check( struct banner *bp, const char *id )
+{
+   struct stat st ;
+   time_t      now = time( NULL ) ;
+
+   if ( bp->bn_ok && now >= bp->bn_checked &&
+                     now - bp->bn_checked < BANNER_CHECK_INTERVAL )
+      return ;
+   if ( ! bp->bn_ok && now == bp->bn_checked )
+      return ;
+   bp->bn_checked = now ;
+
+   if ( bp->bn_ok && stat( bp->bn_path, &st ) == 0 &&
+        st.st_mtime == bp->bn_mtime && st.st_ctime == bp->bn_ctime &&
+        st.st_size == bp->bn_size && st.st_ino == bp->bn_ino &&
+        st.st_dev == bp->bn_dev )
+      return ;
+   (void) banner_load( bp, id ) ;
+}
+
+
+/*
+ * Find the banner of file path, reading it if it is not known yet
+ */
+static struct banner *banner_find( const char *path, const char *id )
+{
+   const char     *func = "banner_find" ;
+   struct banner  *bp ;
+
+   for ( bp = banners ; bp != NULL ; bp = bp->bn_next )
+      if ( strcmp( bp->bn_path, path ) == 0 )
+         return( bp ) ;
+
+   if ( ( bp = NEW( struct banner ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      return( NULL ) ;
+   }
+   CLEAR( *bp ) ;
+   if ( ( bp->bn_path = new_string( path ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      FREE( bp ) ;
+      return( NULL ) ;
+   }
+   (void) banner_load( bp, id ) ;
+   bp->bn_next = banners ;
+   banners = bp ;
+   return( bp ) ;
+}
+
+
+/*
+ * Forget the banners read so far and read the banners of the services
+ * now configured
+ */
+void banner_reload( void )
+{
+   unsigned u ;
+
+   while ( banners != NULL )
+   {
+      struct banner *bp = banners ;
+
+      banners = bp->bn_next ;
+      FREE( bp->bn_data ) ;
+      free( bp->bn_path ) ;
+      FREE( bp ) ;
+   }
+
+   for ( u = 0 ; u < pset_count( SERVICES( ps ) ) ; u++ )
+   {
+      struct service_config *scp =
+                        SVC_CONF( SP( pset_pointer( SERVICES( ps ), u ) ) ) ;
+
+      if ( SC_BANNER( scp ) != NULL )
+         (void) banner_find( SC_BANNER( scp ), SC_ID( scp ) ) ;
+      if ( SC_BANNER_SUCCESS( scp ) != NULL )
+         (void) banner_find( SC_BANNER_SUCCESS( scp ), SC_ID( scp ) ) ;
+      if ( SC_BANNER_FAIL( scp ) != NULL )
+         (void) banner_find( SC_BANNER_FAIL( scp ), SC_ID( scp ) ) ;
+   }
+}
+
+
+/*
+ * Write the banner of file path to fd, for service id.
+ * Returns -1 if the banner could not be read.
+ */
+int banner_send( const char *path, int fd, const char *id )
+{
+   struct banner  *bp ;
+   size_t          done = 0 ;
+
+   if ( ( bp = banner_find( path, id ) ) == NULL )
+      return( -1 ) ;
+   banner_check( bp, id ) ;
+   if ( ! bp->bn_ok )
+      return( -1 ) ;
+
+   while ( done < bp->bn_len )
+   {
+      ssize_t cc = write( fd, bp->bn_data + done, bp->bn_len - done ) ;
+
+      if ( cc == -1 && errno == EINTR )
+         continue ;
+      if ( cc <= 0 )
+         break ;
+      done += cc ;
+   }
+   return( 0 ) ;
+}
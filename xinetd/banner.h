@@ -0,0 +1,17 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+#ifndef BANNER_H
+#define BANNER_H
+
+/*
+ * The contents of the banner files, kept in memory so that a banner
+ * costs a single write(2) per connection
+ */
+
+void banner_reload(void);
+int banner_send(const char *path, int fd, const char *id);
+
+#endif
@@ -9,10 +9,12 @@
 #include "config.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <errno.h>
 #include <time.h>
+#include <ctype.h>
 #include <syslog.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -38,9 +40,13 @@
 #include "nvlists.h"
 #include "child.h"
 #include "access.h"
+#include "dgram.h"
+#include "log.h"
 
 #define BUFFER_SIZE               1024
 
+#define min( a, b )               ((a)<(b) ? (a) : (b))
+
 static void stream_echo(const struct server *) ;
 static void dgram_echo(const struct server *) ;
 static void stream_discard(const struct server *) ;
@@ -68,20 +74,20 @@ static void tcpmux_handler(const struct server *) ;
 
 static const struct builtin_service builtin_services[] =
    {
-      { "echo",      SOCK_STREAM,   { stream_echo,     FORK    } },
-      { "echo",      SOCK_DGRAM,    { dgram_echo,      NO_FORK } },
-      { "discard",   SOCK_STREAM,   { stream_discard,  FORK    } },
-      { "discard",   SOCK_DGRAM,    { dgram_discard,   NO_FORK } },
-      { "time",      SOCK_STREAM,   { stream_time,     NO_FORK } },
-      { "time",      SOCK_DGRAM,    { dgram_time,      NO_FORK } },
-      { "daytime",   SOCK_STREAM,   { stream_daytime,  NO_FORK } },
-      { "daytime",   SOCK_DGRAM,    { dgram_daytime,   NO_FORK } },
-      { "chargen",   SOCK_STREAM,   { stream_chargen,  FORK    } },
-      { "chargen",   SOCK_DGRAM,    { dgram_chargen,   NO_FORK } },
-      { "sensor",    SOCK_STREAM,   { stream_discard,  NO_FORK } },
-      { "sensor",    SOCK_DGRAM,    { dgram_discard,   NO_FORK } },
-      { "tcpmux",    SOCK_STREAM,   { tcpmux_handler,  FORK    } },
-      { NULL,        0,             { NULL,            0       } }
+      { "echo",      SOCK_STREAM,   { stream_echo,     FORK,    ENGINE_ECHO    } },
+      { "echo",      SOCK_DGRAM,    { dgram_echo,      NO_FORK, NO_ENGINE      } },
+      { "discard",   SOCK_STREAM,   { stream_discard,  FORK,    ENGINE_DISCARD } },
+      { "discard",   SOCK_DGRAM,    { dgram_discard,   NO_FORK, NO_ENGINE      } },
+      { "time",      SOCK_STREAM,   { stream_time,     NO_FORK, NO_ENGINE      } },
+      { "time",      SOCK_DGRAM,    { dgram_time,      NO_FORK, NO_ENGINE      } },
+      { "daytime",   SOCK_STREAM,   { stream_daytime,  NO_FORK, NO_ENGINE      } },
+      { "daytime",   SOCK_DGRAM,    { dgram_daytime,   NO_FORK, NO_ENGINE      } },
+      { "chargen",   SOCK_STREAM,   { stream_chargen,  FORK,    ENGINE_CHARGEN } },
+      { "chargen",   SOCK_DGRAM,    { dgram_chargen,   NO_FORK, NO_ENGINE      } },
+      { "sensor",    SOCK_STREAM,   { stream_discard,  NO_FORK, NO_ENGINE      } },
+      { "sensor",    SOCK_DGRAM,    { dgram_discard,   NO_FORK, NO_ENGINE      } },
+      { "tcpmux",    SOCK_STREAM,   { tcpmux_handler,  FORK,    ENGINE_TCPMUX  } },
+      { NULL,        0,             { NULL,            0,       NO_ENGINE      } }
    } ;
 
 
@@ -163,23 +169,83 @@ static void stream_echo( const struct server *serp )
       Sclose(descriptor);
 }
 
-static void dgram_echo( const struct server *serp )
+/*
+ * The datagram services answer up to BUILTIN_UDP_BATCH datagrams each
+ * time their socket is readable, with one recvmmsg(2) and sendmmsg(2)
+ * where the system has them. The access checks were done for the first
+ * datagram only, so they are repeated for each of the others. reply
+ * turns a datagram of len bytes in a buffer of size bytes into the
+ * answer, and returns its length; without it, nothing is answered.
+ */
+typedef unsigned (*dgram_reply_f)( char *buf, unsigned len, unsigned size ) ;
+
+static struct dgram_batch *dgram_batch = NULL ;
+
+static void dgram_serve( const struct server *serp, dgram_reply_f reply )
 {
-   char            buf[ DATAGRAM_SIZE ] ;
-   union xsockaddr lsin;
-   ssize_t             cc ;
-   socklen_t       sin_len = 0;
-   int             descriptor = SERVER_FD( serp ) ;
-
-   if( SC_IPV4( SVC_CONF( SERVER_SERVICE( serp ) ) ) )
-      sin_len = sizeof( struct sockaddr_in );
-   else if( SC_IPV6( SVC_CONF( SERVER_SERVICE( serp ) ) ) )
-      sin_len = sizeof( struct sockaddr_in6 );
-
-   cc = recvfrom( descriptor, buf, sizeof( buf ), 0, (struct sockaddr *)( &lsin ), &sin_len ) ;
-   if ( cc != (ssize_t)-1 ) {
-      (void) sendto( descriptor, buf, (size_t)cc, 0, SA( &lsin ), sizeof( lsin ) ) ;
+   struct service     *sp = SERVER_SERVICE( serp ) ;
+   connection_s       *cp = SERVER_CONNECTION( serp ) ;
+   int                 fd = SERVER_FD( serp ) ;
+   struct dgram_batch *bp ;
+   int                 i, n ;
+   int                 first = 0 ;
+   const char         *func = "dgram_serve" ;
+
+   if ( dgram_batch == NULL )
+   {
+      if ( ( dgram_batch = dgram_create( BUILTIN_UDP_BATCH, 
+                                             DATAGRAM_SIZE ) ) == NULL )
+      {
+         out_of_memory( func ) ;
+         drain( fd ) ;
+         return ;
+      }
+      (void) dgram_pktinfo( dgram_batch ) ;
+   }
+   bp = dgram_batch ;
+
+   if ( ( n = dgram_recv( fd, bp, 0, BUILTIN_UDP_BATCH, TRUE ) ) <= 0 )
+      return ;
+
+   for ( i = 0 ; i < n ; i++ )
+   {
+      if ( i > 0 )
+      {
+         CONN_SETADDR( cp, DGRAM_ADDR( bp, i ) ) ;
+         if ( svc_parent_access_control( sp, cp ) == FAILED ||
+              svc_child_access_control( sp, cp ) == FAILED )
+         {
+            if ( reply != NULL && i > first )
+               dgram_send( fd, bp, first, i - first, TRUE ) ;
+            first = i + 1 ;
+            /* stopped for too many requests */
+            if ( ! SVC_IS_AVAILABLE( sp ) )
+               return ;
+            continue ;
+         }
+         svc_log_success( sp, cp, SERVER_PID( serp ) ) ;
+      }
+      if ( reply != NULL )
+      {
+         DGRAM_LEN( bp, i ) = (*reply)( DGRAM_BUF( bp, i ), 
+                                        DGRAM_LEN( bp, i ), bp->db_bufsize ) ;
+         dgram_reply( bp, i ) ;
+      }
    }
+   if ( reply != NULL && n > first )
+      dgram_send( fd, bp, first, n - first, TRUE ) ;
+}
+
+
+static unsigned echo_reply( char *buf, unsigned len, unsigned size )
+{
+   return( len ) ;
+}
+
+
+static void dgram_echo( const struct server *serp )
+{
+   dgram_serve( serp, echo_reply ) ;
 }
 
 static void stream_discard( const struct server *serp )
@@ -213,9 +279,7 @@ static void stream_discard( const struct server *serp )
 
 static void dgram_discard( const struct server *serp )
 {
-   char buf[ 1 ] ;
-
-   (void) recv( SERVER_FD( serp ), buf, sizeof( buf ), 0 ) ;
+   dgram_serve( serp, NULL ) ;
 }
 
 
@@ -284,28 +348,18 @@ static void stream_daytime( const struct server *serp )
 }
 
 
-static void dgram_daytime( const struct server *serp )
+static unsigned daytime_reply( char *buf, unsigned len, unsigned size )
 {
-   char            time_buf[ BUFFER_SIZE ] ;
-   union xsockaddr lsin ;
-   socklen_t       sin_len     = 0 ;
-   unsigned int    buflen      = sizeof( time_buf ) ;
-   int             descriptor  = SERVER_FD( serp ) ;
-   ssize_t         val;
-
-   if ( SC_IPV4( SVC_CONF( SERVER_SERVICE( serp ) ) ) ) 
-      sin_len = sizeof( struct sockaddr_in );
-   else if ( SC_IPV6( SVC_CONF( SERVER_SERVICE( serp ) ) ) ) 
-      sin_len = sizeof( struct sockaddr_in6 );
-
-   val = recvfrom( descriptor, time_buf, sizeof( time_buf ), 0,
-            (struct sockaddr *)( &lsin ), &sin_len );
-   if ( val == (ssize_t)-1 )
-      return ;
+   unsigned int buflen = min( BUFFER_SIZE, size ) ;
 
-   daytime_protocol( time_buf, &buflen ) ;
-   
-   (void) sendto( descriptor, time_buf, buflen, 0, SA(&lsin), sizeof( lsin ) ) ;
+   daytime_protocol( buf, &buflen ) ;
+   return( buflen ) ;
+}
+
+
+static void dgram_daytime( const struct server *serp )
+{
+   dgram_serve( serp, daytime_reply ) ;
 }
 
 
@@ -351,31 +405,21 @@ static void stream_time( const struct server *serp )
 }
 
 
-static void dgram_time( const struct server *serp )
+static unsigned time_reply( char *buf, unsigned len, unsigned size )
 {
-   char     buf[ 1 ] ;
-   unsigned char time_buf[4];
-   union xsockaddr lsin ;
-   socklen_t       sin_len = 0 ;
-   int             fd      = SERVER_FD( serp ) ;
-   ssize_t         val;
-
-   if ( SC_IPV4( SVC_CONF( SERVER_SERVICE( serp ) ) ) ) 
-      sin_len = sizeof( struct sockaddr_in );
-   else if ( SC_IPV6( SVC_CONF( SERVER_SERVICE( serp ) ) ) ) 
-      sin_len = sizeof( struct sockaddr_in6 );
-
-   val = recvfrom( fd, buf, sizeof( buf ), 0, (struct sockaddr *)( &lsin ), &sin_len );
-   if ( val == (ssize_t)-1 )
-      return ;
+   time_protocol( (unsigned char *) buf ) ;
+   return( 4 ) ;
+}
 
-   time_protocol( time_buf ) ;
-   (void) sendto( fd, (char *) time_buf, 4, 0, SA( &lsin ), sin_len ) ;
+
+static void dgram_time( const struct server *serp )
+{
+   dgram_serve( serp, time_reply ) ;
 }
 
 
 #define ASCII_PRINTABLE_CHARS     94
-#define LINE_LENGTH               72
+#define LINE_LENGTH               ( CHARGEN_LINE_SIZE - 2 )
 
 #define RING_BUF_SIZE             ASCII_PRINTABLE_CHARS + LINE_LENGTH
 
@@ -386,26 +430,24 @@ static char *ring ;
 #define ASCII_START          ( ' ' + 1 )
 #define ASCII_END            126
 
-#define min( a, b )          ((a)<(b) ? (a) : (b))
+/*
+ * Lines start at each of the first RING_LINES characters of the ring
+ */
+#define RING_LINES           ( RING_BUF_SIZE - LINE_LENGTH + 1 )
 
-static char *generate_line( char *buf, unsigned int len )
+static status_e ring_init(void)
 {
-   unsigned int line_len = min( LINE_LENGTH, len-2 ) ;
-
-   if ( len < 2 )       /* If len < 2, min will be wrong */
-      return( NULL ) ;
+   char ch ;
+   char *p ;
 
    /* This never gets freed.  That's ok, because the reference to it is
     * always kept for future reference.
     */
    if ( (ring_buf == NULL) && ((ring_buf = malloc(RING_BUF_SIZE)) == NULL) ) 
-      return(NULL);
+      return( FAILED );
 
    if ( ring == NULL )
    {
-      char ch ;
-      char *p ;
-
       for ( p = ring_buf, ch = ASCII_START ;
             p <= &ring_buf[ RING_BUF_SIZE - 1 ] ; p++ )
       {
@@ -415,6 +457,20 @@ static char *generate_line( char *buf, unsigned int len )
       }
       ring = ring_buf ;
    }
+   return( OK ) ;
+}
+
+
+static char *generate_line( char *buf, unsigned int len )
+{
+   unsigned int line_len = min( LINE_LENGTH, len-2 ) ;
+
+   if ( len < 2 )       /* If len < 2, min will be wrong */
+      return( NULL ) ;
+
+   if ( ring_init() == FAILED )
+      return(NULL);
+
    (void) memcpy( buf, ring, line_len ) ;
    buf[ line_len   ] = '\r' ;
    buf[ line_len+1 ] = '\n' ;
@@ -426,10 +482,64 @@ static char *generate_line( char *buf, unsigned int len )
 }
 
 
+/*
+ * Put line number 'line' of the chargen output in buf, which has room
+ * for LINE_LENGTH+2 characters. Unlike generate_line, this keeps no
+ * state, so that the output of a stream can be computed in advance.
+ */
+static void chargen_line( char *buf, unsigned line )
+{
+   (void) memcpy( buf, &ring_buf[ line % RING_LINES ], LINE_LENGTH ) ;
+   buf[ LINE_LENGTH   ] = '\r' ;
+   buf[ LINE_LENGTH+1 ] = '\n' ;
+}
+
+
+#if RING_LINES != CHARGEN_LINES
+   bad_variable = 1 ;      /* this will cause a compilation error */
+#endif
+
+/*
+ * The output of a chargen stream repeats every CHARGEN_PATTERN_SIZE
+ * bytes. The pattern is built once and followed by a copy of itself,
+ * so that CHARGEN_PATTERN_SIZE bytes starting at any offset below
+ * CHARGEN_PATTERN_SIZE are contiguous and can be sent as they are.
+ */
+static char *pattern_buf = NULL ;
+
+const char *chargen_pattern(void)
+{
+   unsigned line ;
+
+   /* Like ring_buf, this is never freed */
+   if ( pattern_buf != NULL )
+      return( pattern_buf ) ;
+   if ( ring_init() == FAILED )
+      return( NULL ) ;
+   if ( ( pattern_buf = malloc( 2 * CHARGEN_PATTERN_SIZE ) ) == NULL )
+      return( NULL ) ;
+
+   for ( line = 0 ; line < CHARGEN_LINES ; line++ )
+      chargen_line( &pattern_buf[ line * CHARGEN_LINE_SIZE ], line ) ;
+   (void) memcpy( &pattern_buf[ CHARGEN_PATTERN_SIZE ], pattern_buf,
+                                             CHARGEN_PATTERN_SIZE ) ;
+   return( pattern_buf ) ;
+}
+
+
+/*
+ * Number of copies of the pattern handed to each writev(2) call
+ */
+#define CHARGEN_IOVECS       16
+
 static void stream_chargen( const struct server *serp )
 {
-   char   line_buf[ LINE_LENGTH+2 ] ;
-   int    descriptor = SERVER_FD( serp ) ;
+   struct iovec   iov[ CHARGEN_IOVECS ] ;
+   const char     *pattern = chargen_pattern() ;
+   size_t         pos = 0 ;
+   ssize_t        cc ;
+   int            i ;
+   int            descriptor = SERVER_FD( serp ) ;
    struct service *svc = SERVER_SERVICE( serp );
 
    if( SVC_WAITS( svc ) ) {
@@ -444,37 +554,35 @@ static void stream_chargen( const struct server *serp )
    (void) shutdown( descriptor, 0 ) ;
    close_all_svc_descriptors();
 
-   for ( ;; )
+   /*
+    * The iovecs all start at the current offset in the pattern, which
+    * makes them one long run of chargen output
+    */
+   while ( pattern != NULL )
    {
-      if ( generate_line( line_buf, sizeof( line_buf ) ) == NULL )
-         break ;
-      if ( write_buf( descriptor, line_buf, sizeof( line_buf ) ) == FAILED )
+      for ( i = 0 ; i < CHARGEN_IOVECS ; i++ )
+      {
+         iov[ i ].iov_base = (char *) &pattern[ pos ] ;
+         iov[ i ].iov_len = CHARGEN_PATTERN_SIZE ;
+      }
+      cc = writev( descriptor, iov, CHARGEN_IOVECS ) ;
+      if ( cc == (ssize_t)-1 )
+      {
+         if ( errno == EINTR )
+            continue ;
          break ;
+      }
+      pos = ( pos + cc ) % CHARGEN_PATTERN_SIZE ;
    }
    if( SVC_WAITS( svc ) ) /* Service forks, so close it */
       Sclose(descriptor);
 }
 
 
-static void dgram_chargen( const struct server *serp )
+static unsigned chargen_reply( char *buf, unsigned len, unsigned size )
 {
-   char            buf[ BUFFER_SIZE ] ;
    char            *p ;
-   unsigned int    len ;
-   union xsockaddr lsin ;
-   socklen_t       sin_len = 0 ;
-   int             fd      = SERVER_FD( serp ) ;
-   unsigned int    left    = sizeof( buf ) ;
-   ssize_t         val;
-
-   if ( SC_IPV4( SVC_CONF( SERVER_SERVICE( serp ) ) ) ) 
-      sin_len = sizeof( struct sockaddr_in );
-   else if ( SC_IPV6( SVC_CONF( SERVER_SERVICE( serp ) ) ) ) 
-      sin_len = sizeof( struct sockaddr_in6 );
-
-   val = recvfrom( fd, buf, (size_t)sizeof( buf ), 0, (struct sockaddr *)( &lsin ), &sin_len );
-   if ( val == (ssize_t)-1 )
-      return ;
+   unsigned int    left = min( BUFFER_SIZE, size ) ;
 
 #if BUFFER_SIZE < LINE_LENGTH+2
    bad_variable = 1 ;      /* this will cause a compilation error */
@@ -486,126 +594,215 @@ static void dgram_chargen( const struct server *serp )
       if ( generate_line( p, len ) == NULL )
          break ;
    }
-   (void) sendto( fd, buf, (size_t)(p-buf), 0, SA( &lsin ), sin_len ) ;
+   return( p - buf ) ;
+}
+
+
+static void dgram_chargen( const struct server *serp )
+{
+   dgram_serve( serp, chargen_reply ) ;
+}
+
+
+/*
+ * The mux client services are found by name through an open hash
+ * table, which tcpmux_rehash rebuilds whenever the services change.
+ * Names are compared without regard to case.
+ */
+static struct service **mux_table = NULL ;
+static unsigned         mux_size = 0 ;       /* a power of 2 */
+
+
+static unsigned mux_hash( const char *name )
+{
+   unsigned h = 5381 ;
+
+   while ( *name != NUL )
+      h = h * 33 + tolower( (unsigned char) *name++ ) ;
+   return( h ) ;
+}
+
+
+void tcpmux_rehash(void)
+{
+   unsigned count = 0 ;
+   unsigned u, h ;
+   const char *func = "tcpmux_rehash" ;
+
+   if ( mux_table != NULL )
+      free( mux_table ) ;
+   mux_table = NULL ;
+   mux_size = 0 ;
+
+   for ( u = 0 ; u < pset_count( SERVICES( ps ) ) ; u++ )
+   {
+      struct service *sp = SP( pset_pointer( SERVICES( ps ), u ) ) ;
+
+      if ( SVC_IS_MUXCLIENT( sp ) || SVC_IS_MUXPLUSCLIENT( sp ) )
+         count++ ;
+   }
+   if ( count == 0 )
+      return ;
+
+   /* Keep the table at most half full */
+   for ( mux_size = 4 ; mux_size < 2 * count ; mux_size *= 2 )
+      ;
+   mux_table = (struct service **) calloc( mux_size, sizeof( *mux_table ) ) ;
+   if ( mux_table == NULL )
+   {
+      out_of_memory( func ) ;
+      mux_size = 0 ;
+      return ;
+   }
+
+   /* The first of several services with the same name is found */
+   for ( u = 0 ; u < pset_count( SERVICES( ps ) ) ; u++ )
+   {
+      struct service *sp = SP( pset_pointer( SERVICES( ps ), u ) ) ;
+      const char *name = SC_NAME( SVC_CONF( sp ) ) ;
+
+      if ( ! SVC_IS_MUXCLIENT( sp ) && ! SVC_IS_MUXPLUSCLIENT( sp ) )
+         continue ;
+      for ( h = mux_hash( name ) & ( mux_size - 1 ) ; mux_table[ h ] != NULL ;
+                                          h = ( h + 1 ) & ( mux_size - 1 ) )
+         if ( strcasecmp( name, SC_NAME( SVC_CONF( mux_table[ h ] ) ) ) == 0 )
+            break ;
+      if ( mux_table[ h ] == NULL )
+         mux_table[ h ] = sp ;
+   }
+}
+
+
+/*
+ * Find the mux client service called name, or return NULL
+ */
+struct service *tcpmux_lookup( const char *name )
+{
+   unsigned h ;
+
+   if ( mux_table == NULL )
+      return( NULL ) ;
+   for ( h = mux_hash( name ) & ( mux_size - 1 ) ; mux_table[ h ] != NULL ;
+                                       h = ( h + 1 ) & ( mux_size - 1 ) )
+      if ( strcasecmp( name, SC_NAME( SVC_CONF( mux_table[ h ] ) ) ) == 0 )
+         return( mux_table[ h ] ) ;
+   return( NULL ) ;
+}
+
+
+/*
+ * The service that the tcpmux server being forked is for, when xinetd
+ * has read its name already
+ */
+static struct service *mux_target = NULL ;
+
+/*
+ * Fork the tcpmux server serp for service sp, whose name was read by
+ * the builtin engine
+ */
+status_e tcpmux_start( struct server *serp, struct service *sp )
+{
+   status_e ret ;
+
+   mux_target = sp ;
+   ret = server_start( serp ) ;
+   mux_target = NULL ;
+   return( ret ) ;
 }
 
 
 /*  Handle a request for a tcpmux service. 
  *  It's helpful to remember here that we are now a child of the original
  *  xinetd process. We were forked to keep the parent from blocking
- *  when we try to read the service name off'n the socket connection.
+ *  when we try to read the service name off'n the socket connection,
+ *  unless the builtin engine read it for us (then mux_target is set).
  *  Serp still points to an actual tcpmux 'server', or at least the
  *  service pointer of serp is valid.
  */
-
 static void tcpmux_handler( const struct server *serp )
 {
    char      svc_name[ BUFFER_SIZE ] ;
    int       cc ;
    int       descriptor = SERVER_FD( serp ) ;
    const     struct service *svc = SERVER_SERVICE( serp ) ;
-   unsigned  u;
-   struct    service *sp = NULL;
+   struct    service *sp = mux_target ;
    struct    server server, *nserp;
    struct    service_config *scp = NULL;
 
    close_all_svc_descriptors();
 
-   /*  Read in the name of the service in the format "svc_name\r\n".
-    *
-    *  XXX: should loop on partial reads (could probably use Sread() if
-    *  it wasn't thrown out of xinetd source code a few revisions back).
-    */
-   do
-   {
-      cc = read( descriptor, svc_name, sizeof( svc_name ) ) ;
-   } while (cc == -1 && errno == EINTR);
-
-   if ( cc <= 0 )
-   {
-      msg(LOG_ERR, "tcpmux_handler", "read failed");
-      exit(0);
-   }
-
-   if ( ( cc <= 2 ) ||
-        ( ( svc_name[cc - 1] != '\n' ) || ( svc_name[cc - 2] != '\r' ) ) )
+   if ( sp == NULL )
    {
-      if ( debug.on )
-         msg(LOG_DEBUG, "tcpmux_handler", "Invalid service name format.");
-      
-      exit(0);
-   }
-
-   svc_name[cc - 2] = '\0';  /*  Remove \r\n for compare */
+      /*  Read in the name of the service in the format "svc_name\r\n".
+       *
+       *  XXX: should loop on partial reads (could probably use Sread() if
+       *  it wasn't thrown out of xinetd source code a few revisions back).
+       */
+      do
+      {
+         cc = read( descriptor, svc_name, sizeof( svc_name ) ) ;
+      } while (cc == -1 && errno == EINTR);
 
-   if ( debug.on )
-   {
-      msg(LOG_DEBUG, "tcpmux_handler", "Input (%d bytes) %s as service name.",
-          cc, svc_name);
-   }
+      if ( cc <= 0 )
+      {
+         msg(LOG_ERR, "tcpmux_handler", "read failed");
+         exit(0);
+      }
 
-   /*  Search the services for the a match on name.
-    */
+      if ( ( cc <= 2 ) ||
+           ( ( svc_name[cc - 1] != '\n' ) || ( svc_name[cc - 2] != '\r' ) ) )
+      {
+         if ( debug.on )
+            msg(LOG_DEBUG, "tcpmux_handler", "Invalid service name format.");
+         
+         exit(0);
+      }
 
-   for ( u = 0 ; u < pset_count( SERVICES( ps ) ) ; u++ )
-   {
-      sp = SP( pset_pointer( SERVICES( ps ), u ) ) ;
+      svc_name[cc - 2] = '\0';  /*  Remove \r\n for compare */
 
-      if ( strcasecmp( svc_name, SC_NAME( SVC_CONF( sp ) ) ) == 0 )
+      if ( debug.on )
       {
-         /*  Found the pointer. Validate its type.
-          */
-         scp = SVC_CONF( sp );
+         msg(LOG_DEBUG, "tcpmux_handler", "Input (%d bytes) %s as service name.",
+             cc, svc_name);
+      }
 
-         if ( ! SVC_IS_MUXCLIENT( sp ) && ! SVC_IS_MUXPLUSCLIENT( sp ) )
+      if ( ( sp = tcpmux_lookup( svc_name ) ) == NULL )
+      {
+         if ( debug.on )
          {
-            if ( debug.on )
-            {
-               msg(LOG_DEBUG, "tcpmux_handler", "Non-tcpmux service name: %s.",
-                   svc_name);
-            }
-            continue;
+            msg(LOG_DEBUG, "tcpmux_handler", "Service name %s not found.",
+                svc_name);
          }
 
-         /*  Send the accept string if we're a PLUS (+) client.
-          */
-
-         if ( SVC_IS_MUXPLUSCLIENT( sp ) )
+         /*  If a service was not found, we should say so. */
+         if ( Swrite( descriptor, TCPMUX_NOT_FOUND, sizeof( TCPMUX_NOT_FOUND ) ) !=
+              sizeof ( TCPMUX_NOT_FOUND ) )
          {
-            if ( Swrite( descriptor, TCPMUX_ACK, sizeof( TCPMUX_ACK ) ) !=
-                 sizeof( TCPMUX_ACK ) )
-            {
-                msg(LOG_ERR, "tcpmux_handler", "Ack write failed for %s.",
-		    svc_name);
-                exit(0);
-            }
+            msg(LOG_ERR, "tcpmux_handler", "Not found write failed for %s.",
+                svc_name);
+            exit(0);
          }
-         break;  /*  Time to get on with the service */
+          
+         /*  Flush and exit, nothing to do */
+         Sflush( descriptor );
+         Sclose( descriptor );
+         exit(0);
       }
-      continue;  /*  Keep looking */
    }
+   scp = SVC_CONF( sp );
 
-   if ( u >= pset_count( SERVICES( ps ) ) )
-   {
-      if ( debug.on )
-      {
-         msg(LOG_DEBUG, "tcpmux_handler", "Service name %s not found.",
-             svc_name);
-      }
+   /*  Send the accept string if we're a PLUS (+) client.
+    */
 
-      /*  If a service was not found, we should say so. */
-      if ( Swrite( descriptor, TCPMUX_NOT_FOUND, sizeof( TCPMUX_NOT_FOUND ) ) !=
-           sizeof ( TCPMUX_NOT_FOUND ) )
+   if ( SVC_IS_MUXPLUSCLIENT( sp ) )
+   {
+      if ( Swrite( descriptor, TCPMUX_ACK, sizeof( TCPMUX_ACK ) ) !=
+           sizeof( TCPMUX_ACK ) )
       {
-         msg(LOG_ERR, "tcpmux_handler", "Not found write failed for %s.",
-             svc_name);
-         exit(0);
+          msg(LOG_ERR, "tcpmux_handler", "Ack write failed for %s.",
+	      SC_NAME( scp ));
+          exit(0);
       }
-       
-      /*  Flush and exit, nothing to do */
-      Sflush( descriptor );
-      Sclose( descriptor );
-      exit(0);
    }
 
    if( SVC_WAITS( svc ) ) /* Service forks, so close it */
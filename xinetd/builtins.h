@@ -18,10 +18,18 @@
 #define FORK            YES
 #define NO_FORK         NO
 
+/*
+ * The stream builtins that engine.c can serve without a fork
+ */
+typedef enum { NO_ENGINE = 0, 
+               ENGINE_ECHO, ENGINE_DISCARD, ENGINE_CHARGEN,
+               ENGINE_TCPMUX } engine_e ;
+
 struct builtin
 {
    voidfunc    b_handler ;             /* builtin service handler           */
    boolean_e   b_fork_server ;         /* whether a server must be forked   */
+   engine_e    b_engine ;              /* what the engine serves instead    */
 } ;
 
 typedef struct builtin builtin_s ;
@@ -32,6 +40,7 @@ typedef struct builtin builtin_s ;
 #define BUILTIN_HANDLER( bp )          ( (bp)->b_handler ) 
 #define BUILTIN_INVOKE( bp, serp )     (*(bp)->b_handler)( serp )
 #define BUILTIN_FORKS( bp )            ( (bp)->b_fork_server == YES )
+#define BUILTIN_ENGINE( bp )           ( (bp)->b_engine )
 
 
 struct builtin_service
@@ -43,5 +52,24 @@ struct builtin_service
 
 const builtin_s *builtin_find(const char *service_name,int type);
 const builtin_s *builtin_lookup(const struct builtin_service services[],const char *service_name,int type);
+const char *chargen_pattern(void);
+
+struct service ;
+struct server ;
+
+void tcpmux_rehash(void);
+struct service *tcpmux_lookup(const char *name);
+status_e tcpmux_start(struct server *serp, struct service *sp);
+
+/*
+ * Size of a line of chargen output, including the CR LF
+ */
+#define CHARGEN_LINE_SIZE        74
+
+/*
+ * The chargen output repeats after CHARGEN_LINES lines
+ */
+#define CHARGEN_LINES            95
+#define CHARGEN_PATTERN_SIZE     ( CHARGEN_LINES * CHARGEN_LINE_SIZE )
 
 #endif   /* BUILTIN_H */
@@ -43,6 +43,11 @@
 
 #include "str.h"
 #include "child.h"
+#include "proxy.h"
+#include "ident.h"
+#include "logstorm.h"
+#include "logwriter.h"
+#include "intloop.h"
 #include "sconf.h"
 #include "msg.h"
 #include "main.h"
@@ -172,7 +177,8 @@ void exec_server( const struct server *serp )
    }
 #endif
 
-   (void) Sclose( descriptor ) ;
+   if ( descriptor > MAX_PASS_FD )
+      (void) Sclose( descriptor ) ;
 
 #ifndef solaris
 #if !defined(HAVE_SETSID)
@@ -219,7 +225,7 @@ void exec_server( const struct server *serp )
  * of ps.ros.Argv's. 
  * The rest of ps.ros.Argv is cleared to spaces
  */
-static void rename_process( const char *name )
+void rename_process( const char *name )
 {
    const char *from = name ;
    char *to = ps.ros.Argv[ 0 ] ;
@@ -328,8 +334,10 @@ void child_process( struct server *serp )
    struct service          *sp  = SERVER_SERVICE( serp ) ;
    connection_s            *cp  = SERVER_CONNECTION( serp ) ;
    struct service_config   *scp = SVC_CONF( sp ) ;
+   int                      fd ;
    const char              *func = "child_process" ;
 
+   intloop_child( serp ) ;
    signal_default_state();
 
    if ((signals_pending[0] >= 0 && Sclose(signals_pending[0])) ||
@@ -341,9 +349,13 @@ void child_process( struct server *serp )
    signals_pending[0] = -1;
    signals_pending[1] = -1;
 
-   Sclose(0);
-   Sclose(1);
-   Sclose(2);
+   /* 
+    * In an interceptor 0, 1 and 2 are already closed, so the descriptor
+    * of the server it starts may be one of them.
+    */
+   for ( fd = 0 ; fd <= 2 ; fd++ )
+      if ( fd != CONN_DESCRIPTOR( cp ) )
+         Sclose( fd ) ;
 
 
 #ifdef DEBUG_SERVER
@@ -354,15 +366,25 @@ void child_process( struct server *serp )
    }
 #endif
 
-   if ( ! SC_IS_INTERCEPTED( scp ) )
+   /*
+    * Only the interceptor keeps its privileges: the server it starts
+    * is external
+    */
+   if ( ! SC_IS_INTERCEPTED( scp ) || ! SC_IS_INTERNAL( scp ) )
    {
       set_credentials( scp ) ;
       if ( SC_SPECIFIED( scp, A_NICE ) )
          (void) nice( SC_NICE( scp ) ) ;
    }
 
-   if ( svc_child_access_control(sp, cp) != OK )
+   /*
+    * A failure of access control is left for xinetd to log (see logstorm.c)
+    */
+   logstorm_forward() ;
+   if ( ! SERVER_ACCESS_CHECKED( serp ) &&
+         svc_child_access_control(sp, cp) != OK )
       exit(0);
+   logstorm_close() ;
 
    if ( SERVER_LOGUSER( serp ) )
    {
@@ -494,7 +516,19 @@ void child_exit(void)
 
       if ( pid == 0 )
          break ;
+
+      /* the failures it reported, before the server is forgotten */
+      logstorm_collect() ;
       
+      if ( proxy_exit( pid, status ) )
+         continue ;
+
+      if ( ident_exit( pid, status ) )
+         continue ;
+
+      if ( logwriter_exit( pid, status ) )
+         continue ;
+
       if ( ( serp = server_lookup( pid ) ) != NULL )
       {
          SERVER_EXITSTATUS(serp) = status ;
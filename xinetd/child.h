@@ -13,6 +13,7 @@ __attribute__ ((noreturn))
 #endif
 void child_process(struct server *serp);
 void child_exit(void);
+void rename_process(const char *name);
 #ifdef __GNUC__
 __attribute__ ((noreturn))
 #endif
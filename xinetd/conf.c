@@ -20,6 +20,8 @@
 #include "conf.h"
 #include "msg.h"
 #include "main.h"
+#include "builtins.h"
+#include "banner.h"
 
 
 void cnf_free( struct configuration *confp )
@@ -208,6 +210,12 @@ unsigned cnf_start_services( struct configuration *confp )
     */
    pset_clear( sconfs ) ;
 
+   /* The tcpmux clients may have changed */
+   tcpmux_rehash() ;
+
+   /* So may the banners */
+   banner_reload() ;
+
    if ( debug.on )
       msg( LOG_DEBUG, func, "mask_max = %d, services_started = %d",
             ps.rws.mask_max, services_started ) ;
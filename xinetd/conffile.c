@@ -0,0 +1,610 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+
+/*
+ * A note on configuration files:
+ * Every parse of the configuration records the files it read (the main
+ * file, included files and the files of included directories) with
+ * their modification time, size and a hash of their contents, and the
+ * included directories with their modification time. On a hard
+ * reconfiguration, conffile_check compares these with the files on
+ * disk. A file whose time or size changed but whose contents hash the
+ * same is not considered changed. The answer is one of:
+ *
+ *      CFC_NONE    nothing changed
+ *      CFC_FILES   only files that hold nothing but services changed,
+ *                  were added to an included directory, or were removed;
+ *                  those files can be read again on their own
+ *      CFC_ALL     the main file, a file with the defaults entry or with
+ *                  includes, or a file read before the defaults entry
+ *                  changed; everything must be read again
+ *
+ * When only some files are read again (a partial parse), the defaults
+ * entry and includes are not accepted: conffile_mark refuses them, and
+ * conffile_end then fails so that everything is read again.
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pset.h"
+#include "sio.h"
+#include "str.h"
+
+#include "conffile.h"
+#include "includedir.h"
+#include "msg.h"
+#include "util.h"
+
+#define CF_DIR             0x10        /* an included directory */
+#define CF_EARLY           0x20        /* read before the defaults entry */
+#define CF_RACY            0x40        /* modified as it was read */
+
+struct conffile
+{
+   char          *cf_path ;
+   time_t         cf_mtime ;
+   off_t          cf_size ;
+   uint64_t       cf_hash ;
+   int            cf_flags ;
+} ;
+
+#define CFP( p )           ((struct conffile *)(p))
+
+static pset_h conffiles = NULL ;       /* of the configuration in use */
+static pset_h recording = NULL ;       /* of the parse in progress */
+static pset_h changes = NULL ;         /* paths found by conffile_check */
+static bool_int partial_parse = FALSE ;
+static bool_int defaults_seen = FALSE ;
+
+
+/*
+ * 64-bit FNV-1a hash of the contents of fd. pread is used so that
+ * the offset of fd is left alone.
+ */
+static status_e file_hash( int fd, uint64_t *hashp )
+{
+   char        buf[ 8192 ] ;
+   off_t       offset = 0 ;
+   uint64_t    h = 14695981039346656037ULL ;
+   ssize_t     n ;
+
+   while ( ( n = pread( fd, buf, sizeof( buf ), offset ) ) != 0 )
+   {
+      ssize_t i ;
+
+      if ( n == -1 )
+         return( FAILED ) ;
+      for ( i = 0 ; i < n ; i++ )
+         h = ( h ^ (unsigned char) buf[ i ] ) * 1099511628211ULL ;
+      offset += n ;
+   }
+   *hashp = h ;
+   return( OK ) ;
+}
+
+
+static struct conffile *cf_alloc( const char *path, int flags )
+{
+   struct conffile *cfp ;
+   const char *func = "cf_alloc" ;
+
+   if ( ( cfp = NEW( struct conffile ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      return( NULL ) ;
+   }
+   CLEAR( *cfp ) ;
+   if ( ( cfp->cf_path = new_string( path ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      FREE( cfp ) ;
+      return( NULL ) ;
+   }
+   cfp->cf_flags = flags ;
+   return( cfp ) ;
+}
+
+
+static void cf_free( struct conffile *cfp )
+{
+   free( cfp->cf_path ) ;
+   FREE( cfp ) ;
+}
+
+
+static void cf_destroy( pset_h *tablep )
+{
+   unsigned u ;
+
+   if ( *tablep == NULL )
+      return ;
+   for ( u = 0 ; u < pset_count( *tablep ) ; u++ )
+      cf_free( CFP( pset_pointer( *tablep, u ) ) ) ;
+   pset_destroy( *tablep ) ;
+   *tablep = NULL ;
+}
+
+
+/*
+ * Find the last entry of table for path; the file being parsed is
+ * the last one recorded, unless it includes others.
+ */
+static struct conffile *cf_find( pset_h table, const char *path )
+{
+   unsigned u ;
+
+   if ( table == NULL )
+      return( NULL ) ;
+   for ( u = pset_count( table ) ; u > 0 ; u-- )
+   {
+      struct conffile *cfp = CFP( pset_pointer( table, u - 1 ) ) ;
+
+      if ( strcmp( cfp->cf_path, path ) == 0 )
+         return( cfp ) ;
+   }
+   return( NULL ) ;
+}
+
+
+static unsigned cf_count( pset_h table, const char *path )
+{
+   unsigned u ;
+   unsigned count = 0 ;
+
+   for ( u = 0 ; u < pset_count( table ) ; u++ )
+      if ( strcmp( CFP( pset_pointer( table, u ) )->cf_path, path ) == 0 )
+         count++ ;
+   return( count ) ;
+}
+
+
+/*
+ * The included directory path was found in, if it is recorded
+ */
+static struct conffile *cf_dir_of( const char *path )
+{
+   const char *slash = strrchr( path, '/' ) ;
+   unsigned u ;
+
+   if ( slash == NULL || conffiles == NULL )
+      return( NULL ) ;
+   for ( u = 0 ; u < pset_count( conffiles ) ; u++ )
+   {
+      struct conffile *cfp = CFP( pset_pointer( conffiles, u ) ) ;
+
+      if ( ( cfp->cf_flags & CF_DIR ) &&
+           strlen( cfp->cf_path ) == (size_t) ( slash - path ) &&
+           strncmp( cfp->cf_path, path, slash - path ) == 0 )
+         return( cfp ) ;
+   }
+   return( NULL ) ;
+}
+
+
+static void changes_clear( void )
+{
+   unsigned u ;
+
+   if ( changes == NULL )
+      return ;
+   for ( u = 0 ; u < pset_count( changes ) ; u++ )
+      free( (char *) pset_pointer( changes, u ) ) ;
+   pset_clear( changes ) ;
+}
+
+
+static status_e changes_add( const char *path )
+{
+   char *p ;
+
+   if ( changes == NULL && ( changes = pset_create( 0, 0 ) ) == NULL )
+      return( FAILED ) ;
+   if ( ( p = new_string( path ) ) == NULL )
+      return( FAILED ) ;
+   if ( pset_add( changes, p ) == NULL )
+   {
+      free( p ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+
+/*
+ * Start recording the files of a parse. A partial parse reads only the
+ * files found changed by conffile_check.
+ */
+void conffile_start( bool_int partial )
+{
+   cf_destroy( &recording ) ;
+   if ( ( recording = pset_create( 0, 0 ) ) == NULL )
+      out_of_memory( "conffile_start" ) ;
+   partial_parse = partial ;
+   defaults_seen = FALSE ;
+}
+
+
+/*
+ * Record that path, open on fd, is being parsed
+ */
+void conffile_note( int fd, const char *path )
+{
+   struct conffile   *cfp ;
+   struct stat        st ;
+   int                flags = 0 ;
+
+   if ( recording == NULL )
+      return ;
+
+   if ( partial_parse )
+   {
+      struct conffile *old = cf_find( conffiles, path ) ;
+
+      if ( old == NULL )
+         old = cf_dir_of( path ) ;
+      if ( old != NULL )
+         flags = old->cf_flags & CF_EARLY ;
+   }
+   else if ( ! defaults_seen )
+      flags = CF_EARLY ;
+
+   if ( ( cfp = cf_alloc( path, flags ) ) == NULL )
+      return ;
+   if ( fstat( fd, &st ) == -1 || file_hash( fd, &cfp->cf_hash ) == FAILED )
+   {
+      /* Never found unchanged */
+      cfp->cf_flags |= CF_RACY ;
+      cfp->cf_mtime = (time_t) -1 ;
+   }
+   else
+   {
+      cfp->cf_mtime = st.st_mtime ;
+      cfp->cf_size = st.st_size ;
+      if ( st.st_mtime >= time( NULL ) )
+         cfp->cf_flags |= CF_RACY ;
+   }
+   if ( pset_add( recording, cfp ) == NULL )
+      cf_free( cfp ) ;
+}
+
+
+/*
+ * Record that the included directory path is being read
+ */
+void conffile_note_dir( const char *path )
+{
+   struct conffile   *cfp ;
+   struct stat        st ;
+
+   if ( recording == NULL )
+      return ;
+   if ( ( cfp = cf_alloc( path, CF_DIR | ( defaults_seen ? 0 : CF_EARLY ) ) )
+                                                                     == NULL )
+      return ;
+   cfp->cf_mtime = ( stat( path, &st ) == -1 ) ? (time_t) -1 : st.st_mtime ;
+   if ( pset_add( recording, cfp ) == NULL )
+      cf_free( cfp ) ;
+}
+
+
+/*
+ * Record that the file path holds an include (CF_NESTED) or the
+ * defaults entry (CF_DEFAULTS). Returns FAILED if the entry must be
+ * skipped, because this is a partial parse.
+ */
+status_e conffile_mark( const char *path, int what )
+{
+   struct conffile *cfp = cf_find( recording, path ) ;
+
+   if ( cfp != NULL )
+      cfp->cf_flags |= what ;
+   if ( what & CF_DEFAULTS )
+      defaults_seen = TRUE ;
+   return( partial_parse ? FAILED : OK ) ;
+}
+
+
+/*
+ * Invoked when a parse is over. The files of a successful parse replace
+ * those of the configuration in use; a partial parse replaces only the
+ * files it read, and fails if it found includes or the defaults entry.
+ */
+status_e conffile_end( status_e parsed )
+{
+   unsigned u ;
+
+   if ( recording == NULL )
+      return( FAILED ) ;
+
+   if ( parsed == FAILED )
+   {
+      cf_destroy( &recording ) ;
+      return( FAILED ) ;
+   }
+
+   if ( ! partial_parse )
+   {
+      cf_destroy( &conffiles ) ;
+      conffiles = recording ;
+      recording = NULL ;
+      return( OK ) ;
+   }
+
+   for ( u = 0 ; u < pset_count( recording ) ; u++ )
+      if ( CFP( pset_pointer( recording, u ) )->cf_flags &
+                                             ( CF_NESTED | CF_DEFAULTS ) )
+      {
+         cf_destroy( &recording ) ;
+         return( FAILED ) ;
+      }
+
+   for ( u = 0 ; u < pset_count( conffiles ) ; u++ )
+   {
+      struct conffile *cfp = CFP( pset_pointer( conffiles, u ) ) ;
+
+      if ( cfp->cf_flags & CF_DIR )
+      {
+         struct stat st ;
+
+         cfp->cf_mtime = ( stat( cfp->cf_path, &st ) == -1 ) ?
+                                                   (time_t) -1 : st.st_mtime ;
+      }
+      else if ( conffile_changed( cfp->cf_path ) )
+      {
+         pset_remove_index( conffiles, u ) ;
+         cf_free( cfp ) ;
+         u-- ;
+      }
+   }
+   for ( u = 0 ; u < pset_count( recording ) ; u++ )
+      if ( pset_add( conffiles, pset_pointer( recording, u ) ) == NULL )
+         cf_free( CFP( pset_pointer( recording, u ) ) ) ;
+   pset_destroy( recording ) ;
+   recording = NULL ;
+   return( OK ) ;
+}
+
+
+/*
+ * Add the files of the included directory dirp that were not read
+ * before. Returns FAILED if the directory cannot be read.
+ */
+static status_e check_dir( const struct conffile *dirp, unsigned *addedp )
+{
+   DIR              *dirfp ;
+   struct dirent    *direntry ;
+   const char       *func = "check_dir" ;
+
+   if ( ( dirfp = opendir( dirp->cf_path ) ) == NULL )
+      return( FAILED ) ;
+   while ( ( direntry = readdir( dirfp ) ) != NULL )
+   {
+      char          *path ;
+      size_t         len ;
+      struct stat    st ;
+
+      if ( ! includedir_wanted( direntry->d_name ) )
+         continue ;
+      len = strlen( dirp->cf_path ) + strlen( direntry->d_name ) + 2 ;
+      if ( ( path = malloc( len ) ) == NULL )
+      {
+         out_of_memory( func ) ;
+         closedir( dirfp ) ;
+         return( FAILED ) ;
+      }
+      (void) strx_sprint( path, len, "%s/%s", dirp->cf_path, direntry->d_name ) ;
+      if ( stat( path, &st ) == 0 && S_ISREG( st.st_mode ) &&
+           cf_find( conffiles, path ) == NULL )
+      {
+         if ( changes_add( path ) == FAILED )
+         {
+            free( path ) ;
+            closedir( dirfp ) ;
+            return( FAILED ) ;
+         }
+         (*addedp)++ ;
+      }
+      free( path ) ;
+   }
+   closedir( dirfp ) ;
+   return( OK ) ;
+}
+
+
+/*
+ * Check whether the file cfp changed. Returns TRUE if it did.
+ */
+static bool_int check_file( struct conffile *cfp )
+{
+   struct stat    st ;
+   uint64_t       hash ;
+   int            fd ;
+   status_e       hashed ;
+
+   if ( stat( cfp->cf_path, &st ) == -1 )
+      return( TRUE ) ;
+   if ( ! ( cfp->cf_flags & CF_RACY ) && st.st_mtime == cfp->cf_mtime &&
+        st.st_size == cfp->cf_size )
+      return( FALSE ) ;
+
+   if ( ( fd = open( cfp->cf_path, O_RDONLY ) ) == -1 )
+      return( TRUE ) ;
+   hashed = file_hash( fd, &hash ) ;
+   (void) close( fd ) ;
+   if ( hashed == FAILED || hash != cfp->cf_hash || cfp->cf_mtime == -1 )
+      return( TRUE ) ;
+
+   /* Touched, but the same */
+   cfp->cf_mtime = st.st_mtime ;
+   cfp->cf_size = st.st_size ;
+   if ( st.st_mtime < time( NULL ) )
+      cfp->cf_flags &= ~CF_RACY ;
+   return( FALSE ) ;
+}
+
+
+/*
+ * Compare the files of the configuration in use with those on disk,
+ * and remember the files that changed
+ */
+cfcheck_e conffile_check( void )
+{
+   bool_int    has_defaults = FALSE ;
+   unsigned    u ;
+
+   changes_clear() ;
+   if ( conffiles == NULL || pset_count( conffiles ) == 0 )
+      return( CFC_ALL ) ;
+
+   for ( u = 0 ; u < pset_count( conffiles ) ; u++ )
+      if ( CFP( pset_pointer( conffiles, u ) )->cf_flags & CF_DEFAULTS )
+         has_defaults = TRUE ;
+
+   for ( u = 0 ; u < pset_count( conffiles ) ; u++ )
+   {
+      struct conffile *cfp = CFP( pset_pointer( conffiles, u ) ) ;
+      bool_int early = ( cfp->cf_flags & CF_EARLY ) && has_defaults ;
+
+      if ( cfp->cf_flags & CF_DIR )
+      {
+         struct stat st ;
+         unsigned added = 0 ;
+
+         if ( stat( cfp->cf_path, &st ) == -1 || ! S_ISDIR( st.st_mode ) )
+            return( CFC_ALL ) ;
+         if ( st.st_mtime == cfp->cf_mtime )
+            continue ;
+         if ( check_dir( cfp, &added ) == FAILED )
+            return( CFC_ALL ) ;
+         if ( added == 0 )
+            cfp->cf_mtime = st.st_mtime ;
+         else if ( early || cf_count( conffiles, cfp->cf_path ) > 1 )
+            return( CFC_ALL ) ;
+         continue ;
+      }
+
+      if ( ! check_file( cfp ) )
+         continue ;
+
+      /* The main file is always the first one */
+      if ( u == 0 || early ||
+           ( cfp->cf_flags & ( CF_NESTED | CF_DEFAULTS ) ) ||
+           cf_count( conffiles, cfp->cf_path ) > 1 ||
+           changes_add( cfp->cf_path ) == FAILED )
+         return( CFC_ALL ) ;
+   }
+   return( ( changes == NULL || pset_count( changes ) == 0 ) ?
+                                                      CFC_NONE : CFC_FILES ) ;
+}
+
+
+unsigned conffile_changes( void )
+{
+   return( changes == NULL ? 0 : pset_count( changes ) ) ;
+}
+
+
+const char *conffile_change( unsigned u )
+{
+   return( (const char *) pset_pointer( changes, u ) ) ;
+}
+
+
+/*
+ * Returns TRUE if path is one of the files found changed
+ */
+bool_int conffile_changed( const char *path )
+{
+   unsigned u ;
+
+   if ( path == NULL )
+      return( FALSE ) ;
+   for ( u = 0 ; u < conffile_changes() ; u++ )
+      if ( strcmp( conffile_change( u ), path ) == 0 )
+         return( TRUE ) ;
+   return( FALSE ) ;
+}
+
+
+/*
+ * The recorded files and directories, for watching them
+ */
+unsigned conffile_count( void )
+{
+   return( conffiles == NULL ? 0 : pset_count( conffiles ) ) ;
+}
+
+
+const char *conffile_path( unsigned u, bool_int *is_dirp )
+{
+   struct conffile *cfp = CFP( pset_pointer( conffiles, u ) ) ;
+
+   *is_dirp = ( cfp->cf_flags & CF_DIR ) ? TRUE : FALSE ;
+   return( cfp->cf_path ) ;
+}
+
+
+/*
+ * Returns TRUE if the entry name of directory dir is part of the
+ * configuration: a file that was read, or a file an included
+ * directory would read
+ */
+bool_int conffile_relevant( const char *dir, const char *name )
+{
+   unsigned u ;
+   size_t dirlen = strlen( dir ) ;
+
+   for ( u = 0 ; u < conffile_count() ; u++ )
+   {
+      struct conffile *cfp = CFP( pset_pointer( conffiles, u ) ) ;
+
+      if ( cfp->cf_flags & CF_DIR )
+      {
+         if ( strcmp( cfp->cf_path, dir ) == 0 && includedir_wanted( name ) )
+            return( TRUE ) ;
+      }
+      else if ( strncmp( cfp->cf_path, dir, dirlen ) == 0 &&
+                cfp->cf_path[ dirlen ] == '/' &&
+                strcmp( &cfp->cf_path[ dirlen + 1 ], name ) == 0 )
+         return( TRUE ) ;
+   }
+   return( FALSE ) ;
+}
+
+
+void conffile_dump( int fd )
+{
+   unsigned u ;
+
+   if ( conffiles == NULL )
+      return ;
+   Sprint( fd, "Configuration files:\n" ) ;
+   for ( u = 0 ; u < pset_count( conffiles ) ; u++ )
+   {
+      struct conffile *cfp = CFP( pset_pointer( conffiles, u ) ) ;
+
+      if ( cfp->cf_flags & CF_DIR )
+         Sprint( fd, "\t%s/ mtime=%ld\n", cfp->cf_path, (long) cfp->cf_mtime ) ;
+      else
+         Sprint( fd, "\t%s mtime=%ld size=%ld hash=%08lx%08lx%s%s\n",
+            cfp->cf_path, (long) cfp->cf_mtime, (long) cfp->cf_size,
+            (unsigned long) ( cfp->cf_hash >> 32 ),
+            (unsigned long) ( cfp->cf_hash & 0xffffffffUL ),
+            ( cfp->cf_flags & CF_NESTED ) ? " includes" : "",
+            ( cfp->cf_flags & CF_DEFAULTS ) ? " defaults" : "" ) ;
+   }
+   Sputchar( fd, '\n' ) ;
+}
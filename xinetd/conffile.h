@@ -0,0 +1,38 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+#ifndef CONFFILE_H
+#define CONFFILE_H
+
+#include "config.h"
+
+#include "defs.h"
+
+/*
+ * What a reconfiguration has to read again
+ */
+typedef enum { CFC_NONE, CFC_FILES, CFC_ALL } cfcheck_e ;
+
+/*
+ * What parse_conf_file finds in a file besides services
+ */
+#define CF_NESTED          0x1         /* include or includedir */
+#define CF_DEFAULTS        0x2         /* the defaults entry */
+
+void conffile_start(bool_int partial);
+void conffile_note(int fd, const char *path);
+void conffile_note_dir(const char *path);
+status_e conffile_mark(const char *path, int what);
+status_e conffile_end(status_e parsed);
+cfcheck_e conffile_check(void);
+unsigned conffile_changes(void);
+const char *conffile_change(unsigned u);
+bool_int conffile_changed(const char *path);
+unsigned conffile_count(void);
+const char *conffile_path(unsigned u, bool_int *is_dirp);
+bool_int conffile_relevant(const char *dir, const char *name);
+void conffile_dump(int fd);
+
+#endif
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 
 #ifdef HAVE_RPC_RPC_H
 #include <rpc/rpc.h>
@@ -39,6 +40,9 @@
 #include "sensor.h"
 #include "inet.h"
 #include "main.h"
+#include "conffile.h"
+#include "service.h"
+#include "state.h"
 
 extern int inetd_compat;
 
@@ -392,6 +396,38 @@ static status_e service_fill( struct service_config *scp,
       SC_SPECIFY( scp, A_LOG_ON_FAILURE ) ;
    }
 
+   if ( USE_DEFAULT( scp, def, A_LOG_MODE ) )
+   {
+      SC_LOG_ASYNC(scp) = SC_LOG_ASYNC(def) ;
+      SC_SPECIFY( scp, A_LOG_MODE ) ;
+   }
+
+   if ( USE_DEFAULT( scp, def, A_LOG_OVERFLOW ) )
+   {
+      SC_LOG_OVERFLOW(scp) = SC_LOG_OVERFLOW(def) ;
+      SC_SPECIFY( scp, A_LOG_OVERFLOW ) ;
+   }
+
+   if ( USE_DEFAULT( scp, def, A_LOG_ROTATE ) )
+   {
+      SC_LOG_ROTATE(scp) = SC_LOG_ROTATE(def) ;
+      SC_LOG_COMPRESS(scp) = SC_LOG_COMPRESS(def) ;
+      SC_SPECIFY( scp, A_LOG_ROTATE ) ;
+   }
+
+   if ( USE_DEFAULT( scp, def, A_LOG_FORMAT ) )
+   {
+      SC_LOG_JSON(scp) = SC_LOG_JSON(def) ;
+      SC_SPECIFY( scp, A_LOG_FORMAT ) ;
+   }
+
+   if ( USE_DEFAULT( scp, def, A_LOG_FAILURE_LIMIT ) )
+   {
+      SC_LOG_FAILURE_LIMIT(scp) = SC_LOG_FAILURE_LIMIT(def) ;
+      SC_LOG_FAILURE_INTERVAL(scp) = SC_LOG_FAILURE_INTERVAL(def) ;
+      SC_SPECIFY( scp, A_LOG_FAILURE_LIMIT ) ;
+   }
+
    if ( USE_DEFAULT( scp, def, A_LOG_TYPE ) )
    {
       struct log *dlp = SC_LOG( def ) ;
@@ -677,6 +713,13 @@ static status_e check_entry( struct service_config *scp,
          M_CLEAR( SC_XFLAGS(scp), SF_INTERCEPT ) ;
       }
    }
+   if ( SC_INTERCEPT_INLINE( scp ) == YES && ! SC_IS_INTERCEPTED( scp ) )
+   {
+      msg( LOG_WARNING, func,
+         "Service %s is not intercepted; ignoring intercept_mode",
+         SC_ID(scp) ) ;
+      SC_INTERCEPT_INLINE( scp ) = NO ;
+   }
    
    /* Steer the lost sheep home */
    if ( SC_SENSOR( scp ) )
@@ -696,6 +739,9 @@ static status_e check_entry( struct service_config *scp,
       if (SC_BUILTIN(scp) == NULL )
          return( FAILED ) ;
    }
+   else if ( SC_SPECIFIED( scp, A_BUILTIN_MODE ) )
+      msg( LOG_WARNING, func,
+         "Service %s is not internal; ignoring builtin_mode", SC_ID(scp) ) ;
 
 #ifdef LABELED_NET
       if (SC_LABELED_NET(scp)) {
@@ -808,16 +854,54 @@ static status_e check_entry( struct service_config *scp,
           }
       } /* if not unlisted */
     }
+    if ( ( SC_SPECIFIED( scp, A_DEFER_ACCEPT ) || 
+           SC_SPECIFIED( scp, A_TCP_FASTOPEN ) ) &&
+         SC_SOCKET_TYPE( scp ) != SOCK_STREAM )
+    {
+       msg( LOG_WARNING, func, 
+          "Service %s is not a tcp service; ignoring defer_accept and"
+          " tcp_fastopen", SC_NAME(scp));
+       SC_DEFER_ACCEPT( scp ) = 0 ;
+       SC_TCP_FASTOPEN( scp ) = 0 ;
+    }
     if ( SC_SPECIFIED( scp, A_REDIR ))
     {
-       if ( SC_SOCKET_TYPE( scp ) != SOCK_STREAM )
+       if ( SC_SOCKET_TYPE( scp ) != SOCK_STREAM &&
+            SC_SOCKET_TYPE( scp ) != SOCK_DGRAM )
        {
           msg( LOG_ERR, func, 
- 	      "Only tcp sockets are supported for redirected service %s",
+ 	      "Only tcp and udp sockets are supported for redirected service %s",
  	      SC_NAME(scp));
           return FAILED;
        }
-       if ( SC_WAITS( scp ) )
+       if ( SC_SOCKET_TYPE( scp ) == SOCK_DGRAM )
+       {
+#ifndef HAVE_EPOLL_CREATE
+          msg( LOG_ERR, func, 
+             "Redirected service %s: udp redirection needs epoll",
+             SC_NAME(scp));
+          return FAILED;
+#endif
+          /*
+           * A single redirector takes over the socket and serves all
+           * clients until it has been idle for a while
+           */
+          if ( ! SC_WAITS( scp ) )
+          {
+             msg( LOG_ERR, func, 
+                 "Redirected udp service %s must wait", SC_NAME(scp));
+             return FAILED;
+          }
+          if ( SC_REDIR_INLINE( scp ) == YES || SC_REDIR_CHECK( scp ) > 0 )
+          {
+             msg( LOG_WARNING, func, 
+                "Redirected udp service %s can't use redirect_mode = inline"
+                " or redirect_check; ignoring them", SC_NAME(scp));
+             SC_REDIR_INLINE( scp ) = NO ;
+             SC_REDIR_CHECK( scp ) = 0 ;
+          }
+       }
+       else if ( SC_WAITS( scp ) )
        {
           msg( LOG_ERR, func, 
  	      "Redirected service %s must not wait", SC_NAME(scp));
@@ -830,6 +914,15 @@ static status_e check_entry( struct service_config *scp,
 	      SC_NAME(scp));
           return FAILED;
        }
+       if ( SC_REDIR_INLINE( scp ) == YES && 
+            ( SC_IS_INTERCEPTED( scp ) || SC_MUST_IDENTIFY( scp ) ||
+              M_IS_SET( SC_LOG_ON_SUCCESS(scp), LO_USERID ) ) )
+       {
+          msg( LOG_WARNING, func, 
+             "Redirected service %s can't be inline with INTERCEPT, IDONLY"
+             " or USERID logging; using redirect_mode = fork", SC_NAME(scp));
+          SC_REDIR_INLINE( scp ) = NO ;
+       }
     }
     else /* Not a redirected service */
     {
@@ -840,6 +933,17 @@ static status_e check_entry( struct service_config *scp,
              " not redirected", SC_NAME(scp));
           return FAILED;
        }
+       if( SC_SPECIFIED( scp, A_REDIRECT_MODE ) ||
+           SC_SPECIFIED( scp, A_REDIRECT_POLICY ) ||
+           SC_SPECIFIED( scp, A_REDIRECT_CHECK ) ||
+           SC_SPECIFIED( scp, A_REDIRECT_CONNECT_TIMEOUT ) ||
+           SC_SPECIFIED( scp, A_REDIRECT_IDLE_TIMEOUT ) )
+       {
+          msg( LOG_ERR, func,
+             "Service %s should not have redirect_* attributes set"
+             " since its not redirected", SC_NAME(scp));
+          return FAILED;
+       }
     }
     
    if ( SC_NAMEINARGS(scp) )
@@ -871,6 +975,7 @@ static status_e check_entry( struct service_config *scp,
  */
 static status_e get_conf( int fd, struct configuration *confp )
 {
+   conffile_note( fd, ps.ros.config_file ) ;
    parse_conf_file( fd, confp, ps.ros.config_file ) ;
    parse_end() ;
    return( OK ) ;
@@ -886,40 +991,12 @@ static status_e get_conf( int fd, struct configuration *confp )
    }
 
 /*
- * Get a configuration by reading the configuration file.
+ * Fill the services of confp from the defaults and check them
  */
-status_e cnf_get( struct configuration *confp )
+static void finish_conf( struct configuration *confp )
 {
-   int config_fd ;
    struct service_config *scp ;
-   const char *func = "cnf_get" ;
-
-   if ( cnf_init( confp, &config_fd, &iter ) == FAILED )
-      return( FAILED ) ;
-
-   else if ( get_conf( config_fd, confp ) == FAILED )
-   {
-      Sclose( config_fd ) ;
-      cnf_free( confp ) ;
-      psi_destroy( iter ) ;
-      return( FAILED ) ;
-   }
-
-   /* get_conf eventually calls Srdline, try Sclosing to unmmap memory. */
-   Sclose( config_fd );
-   if( inetd_compat ) {
-      current_file = "/etc/inetd.conf";
-      config_fd = open(current_file, O_RDONLY);
-      if( config_fd >= 0 ) {
-         parse_inet_conf_file( config_fd, confp );
-         parse_end() ;
-         /*
-	  * parse_inet_conf eventually calls Srdline, try Sclosing to 
-	  * unmmap memory. 
-	  */
-         Sclose(config_fd);
-      }
-   }
+   const char *func = "finish_conf" ;
 
    remove_disabled_services( confp ) ;
 
@@ -988,6 +1065,152 @@ status_e cnf_get( struct configuration *confp )
 #ifndef NO_RPC
    endrpcent() ;
 #endif
+}
+
+
+/*
+ * Get a configuration by reading the configuration file.
+ */
+status_e cnf_get( struct configuration *confp )
+{
+   int config_fd ;
+
+   if ( cnf_init( confp, &config_fd, &iter ) == FAILED )
+      return( FAILED ) ;
+
+   conffile_start( FALSE ) ;
+   if ( get_conf( config_fd, confp ) == FAILED )
+   {
+      Sclose( config_fd ) ;
+      cnf_free( confp ) ;
+      psi_destroy( iter ) ;
+      (void) conffile_end( FAILED ) ;
+      return( FAILED ) ;
+   }
+
+   /* get_conf eventually calls Srdline, try Sclosing to unmmap memory. */
+   Sclose( config_fd );
+   if( inetd_compat ) {
+      current_file = "/etc/inetd.conf";
+      config_fd = open(current_file, O_RDONLY);
+      if( config_fd >= 0 ) {
+         parse_inet_conf_file( config_fd, confp );
+         parse_end() ;
+         /*
+	  * parse_inet_conf eventually calls Srdline, try Sclosing to 
+	  * unmmap memory. 
+	  */
+         Sclose(config_fd);
+      }
+   }
+
+   finish_conf( confp ) ;
+   (void) conffile_end( OK ) ;
+   return( OK ) ;
+}
+
+
+/*
+ * Check whether the service scp, read again from a changed file, clashes
+ * with a service of a file that did not change
+ */
+static bool_int clashes( const struct service_config *scp )
+{
+   unsigned u ;
+
+   for ( u = 0 ; u < pset_count( SERVICES( ps ) ) ; u++ )
+   {
+      struct service_config *oscp =
+                              SVC_CONF( SP( pset_pointer( SERVICES( ps ), u ) ) ) ;
+
+      if ( conffile_changed( SC_FILE( oscp ) ) )
+         continue ;
+      if ( EQ( SC_ID( oscp ), SC_ID( scp ) ) ||
+           ( SC_PORT( oscp ) == SC_PORT( scp ) &&
+             SC_PROTOVAL( oscp ) == SC_PROTOVAL( scp ) ) )
+         return( TRUE ) ;
+      if ( SC_IS_RPC( oscp ) && SC_IS_RPC( scp ) &&
+           RD_PROGNUM( SC_RPCDATA( oscp ) ) == RD_PROGNUM( SC_RPCDATA( scp ) ) )
+         return( TRUE ) ;
+   }
+   return( FALSE ) ;
+}
+
+
+/*
+ * Get the services of the configuration files that conffile_check found
+ * changed, filled from the defaults in use. Fails if these files cannot
+ * be read on their own, or if one of their services clashes with a
+ * service of another file; then the whole configuration must be read.
+ */
+status_e cnf_reread( struct configuration *confp )
+{
+   status_e    status = OK ;
+   unsigned    u ;
+   const char *func = "cnf_reread" ;
+
+   CLEAR( *confp ) ;
+   if ( ( confp->cnf_service_confs = pset_create( 0, 0 ) ) == NULL )
+   {
+      msg( LOG_CRIT, func, "can't create service table" ) ;
+      return( FAILED ) ;
+   }
+   if ( ( iter = psi_create( confp->cnf_service_confs ) ) == NULL )
+   {
+      msg( LOG_ERR, func, "can't create service table iterator" ) ;
+      pset_destroy( confp->cnf_service_confs ) ;
+      return( FAILED ) ;
+   }
+   confp->cnf_defaults = DEFAULTS( ps ) ;
+
+   conffile_start( TRUE ) ;
+   for ( u = 0 ; u < conffile_changes() ; u++ )
+   {
+      const char *path = conffile_change( u ) ;
+      int fd = open( path, O_RDONLY ) ;
+
+      if ( fd == -1 )
+      {
+         /* The services of a removed file are dropped */
+         if ( errno == ENOENT )
+            continue ;
+         msg( LOG_ERR, func, "open( %s ) failed: %m", path ) ;
+         status = FAILED ;
+         break ;
+      }
+      msg( LOG_DEBUG, func, "Reading configuration file %s", path ) ;
+      conffile_note( fd, path ) ;
+      parse_conf_file( fd, confp, path ) ;
+      Sclose( fd ) ;
+   }
+   parse_end() ;
+
+   if ( status == OK )
+   {
+      struct service_config *scp ;
+
+      finish_conf( confp ) ;
+      for ( u = 0 ; u < pset_count( CNF_SERVICE_CONFS( confp ) ) ; u++ )
+      {
+         scp = SCP( pset_pointer( CNF_SERVICE_CONFS( confp ), u ) ) ;
+         if ( clashes( scp ) )
+         {
+            msg( LOG_NOTICE, func,
+               "service %s clashes with a service of another file", SC_ID( scp ) ) ;
+            status = FAILED ;
+            break ;
+         }
+      }
+   }
+   else
+      psi_destroy( iter ) ;
+
+   confp->cnf_defaults = NULL ;
+   if ( conffile_end( status ) == FAILED )
+   {
+      cnf_free( confp ) ;
+      return( FAILED ) ;
+   }
    return( OK ) ;
 }
 
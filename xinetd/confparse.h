@@ -6,6 +6,7 @@
 #include "xconfig.h"
 
 status_e cnf_get(struct configuration *confp);
+status_e cnf_reread(struct configuration *confp);
 
 #endif
 
@@ -25,6 +25,7 @@
 #include "state.h"
 #include "special.h"
 #include "access.h"
+#include "log.h"
 
 #define NEW_CONN()            NEW( connection_s )
 #define FREE_CONN( cop )      FREE( cop )
@@ -198,20 +199,12 @@ void conn_free( connection_s *cp, int release_mem )
 const char *conn_addrstr( const connection_s *cp )
 {
    static char name[NI_MAXHOST];
-   unsigned int len = 0;
 
    if( !M_IS_SET( (cp)->co_flags, COF_HAVE_ADDRESS ) )
       return "<no address>";
 
-   if( cp->co_remote_address.sa.sa_family == AF_INET ) 
-      len = sizeof(struct sockaddr_in);
-   else if( cp->co_remote_address.sa.sa_family == AF_INET6 )
-      len = sizeof(struct sockaddr_in6);
-
-   if( getnameinfo( &cp->co_remote_address.sa, len,
-         name, NI_MAXHOST, NULL, 0, NI_NUMERICHOST ) ) {
+   if( xaddrtext( &cp->co_remote_address, name, sizeof( name ) ) == NULL )
       return "<no address>";
-   }
    return name;
 }
 
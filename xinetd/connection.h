@@ -42,6 +42,7 @@
 /* Connection flags */
 #define COF_HAVE_ADDRESS            1
 #define COF_NEW_DESCRIPTOR          2
+#define COF_FAIL_SUPPRESSED         3    /* its FAIL entry was not logged */
 
 struct connection
 {
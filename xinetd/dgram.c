@@ -0,0 +1,288 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+
+/*
+ * Batched datagram I/O, for the udp redirector and interceptor and the
+ * datagram builtins.
+ * Datagrams are received and sent without blocking, many per system
+ * call where the system has recvmmsg(2) and sendmmsg(2), and one at a
+ * time otherwise. A batch can also carry the local address of each
+ * datagram (IP_PKTINFO), so that it is answered from that address.
+ */
+
+#include "config.h"
+/* for recvmmsg(2), sendmmsg(2) and struct in_pktinfo */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dgram.h"
+
+
+struct dgram_batch *dgram_create( unsigned size, unsigned bufsize )
+{
+   struct dgram_batch *bp ;
+
+   if ( ( bp = NEW( struct dgram_batch ) ) == NULL )
+      return( NULL ) ;
+   CLEAR( *bp ) ;
+   bp->db_size = size ;
+   bp->db_bufsize = bufsize ;
+   bp->db_msg = (struct dgram_msg *) calloc( size, sizeof( *bp->db_msg ) ) ;
+   bp->db_iov = (struct iovec *) calloc( size, sizeof( *bp->db_iov ) ) ;
+   bp->db_addr = (union xsockaddr *) calloc( size, sizeof( *bp->db_addr ) ) ;
+   bp->db_data = (void **) calloc( size, sizeof( *bp->db_data ) ) ;
+   bp->db_buf = (char *) malloc( (size_t) size * bufsize ) ;
+   if ( bp->db_msg == NULL || bp->db_iov == NULL || bp->db_addr == NULL ||
+        bp->db_data == NULL || bp->db_buf == NULL )
+   {
+      free( bp->db_msg ) ;
+      free( bp->db_iov ) ;
+      free( bp->db_addr ) ;
+      free( bp->db_data ) ;
+      free( bp->db_buf ) ;
+      free( bp ) ;
+      return( NULL ) ;
+   }
+   return( bp ) ;
+}
+
+
+/*
+ * Have the datagrams of batch bp carry control data, for IP_PKTINFO.
+ */
+status_e dgram_pktinfo( struct dgram_batch *bp )
+{
+   if ( bp->db_ctl != NULL )
+      return( OK ) ;
+   bp->db_ctl = (char *) calloc( bp->db_size, DGRAM_CTL_SIZE ) ;
+   bp->db_ctllen = (socklen_t *) calloc( bp->db_size, sizeof( socklen_t ) ) ;
+   if ( bp->db_ctl == NULL || bp->db_ctllen == NULL )
+   {
+      free( bp->db_ctl ) ;
+      free( bp->db_ctllen ) ;
+      bp->db_ctl = NULL ;
+      bp->db_ctllen = NULL ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+
+/*
+ * Set up the messages of a batch for a receive into slots first and
+ * on, or for a send of the data already in them
+ */
+static void dgram_prepare( struct dgram_batch *bp, unsigned first,
+                           unsigned n, bool_int receive, bool_int named )
+{
+   unsigned i ;
+
+   for ( i = first ; i < first + n ; i++ )
+   {
+      struct msghdr *mhp = &bp->db_msg[ i ].dm_hdr ;
+
+      CLEAR( *mhp ) ;
+      bp->db_iov[ i ].iov_base = DGRAM_BUF( bp, i ) ;
+      if ( receive )
+      {
+         bp->db_iov[ i ].iov_len = bp->db_bufsize ;
+         bp->db_msg[ i ].dm_len = 0 ;
+      }
+      else
+         bp->db_iov[ i ].iov_len = bp->db_msg[ i ].dm_len ;
+      mhp->msg_iov = &bp->db_iov[ i ] ;
+      mhp->msg_iovlen = 1 ;
+      if ( named )
+      {
+         mhp->msg_name = &bp->db_addr[ i ] ;
+         mhp->msg_namelen = receive ? sizeof( bp->db_addr[ i ] ) :
+                              ( bp->db_addr[ i ].sa.sa_family == AF_INET6 ?
+                                 sizeof( struct sockaddr_in6 ) :
+                                 sizeof( struct sockaddr_in ) ) ;
+      }
+      if ( bp->db_ctl != NULL )
+      {
+         if ( receive )
+            bp->db_ctllen[ i ] = DGRAM_CTL_SIZE ;
+         if ( bp->db_ctllen[ i ] != 0 )
+         {
+            mhp->msg_control = DGRAM_CTL( bp, i ) ;
+            mhp->msg_controllen = bp->db_ctllen[ i ] ;
+         }
+      }
+   }
+}
+
+
+/*
+ * Receive up to n datagrams from fd into slots first and on, with their
+ * source addresses if named is set.
+ * Returns the number received, or -1 with errno set.
+ */
+int dgram_recv( int fd, struct dgram_batch *bp, unsigned first,
+                unsigned n, bool_int named )
+{
+   int cc ;
+
+   dgram_prepare( bp, first, n, TRUE, named ) ;
+#ifdef HAVE_RECVMMSG
+   do
+      cc = recvmmsg( fd, (struct mmsghdr *) &bp->db_msg[ first ], n,
+                                                      MSG_DONTWAIT, NULL ) ;
+   while ( cc == -1 && errno == EINTR ) ;
+#else
+   for ( cc = 0 ; (unsigned) cc < n ; cc++ )
+   {
+      ssize_t len = recvmsg( fd, &bp->db_msg[ first + cc ].dm_hdr,
+                                                         MSG_DONTWAIT ) ;
+
+      if ( len == -1 && errno == EINTR )
+      {
+         cc-- ;
+         continue ;
+      }
+      if ( len == -1 )
+      {
+         if ( cc == 0 )
+            return( -1 ) ;
+         break ;
+      }
+      bp->db_msg[ first + cc ].dm_len = len ;
+   }
+#endif
+   if ( bp->db_ctl != NULL )
+   {
+      int i ;
+
+      for ( i = 0 ; i < cc ; i++ )
+         bp->db_ctllen[ first + i ] =
+                        bp->db_msg[ first + i ].dm_hdr.msg_controllen ;
+   }
+   return( cc ) ;
+}
+
+
+/*
+ * Send the datagrams in slots first to first+n-1 on fd, to the address
+ * in their slot if named is set. Datagrams that can't be sent right
+ * away are dropped, as the network would.
+ */
+void dgram_send( int fd, struct dgram_batch *bp, unsigned first,
+                 unsigned n, bool_int named )
+{
+   dgram_prepare( bp, first, n, FALSE, named ) ;
+   while ( n > 0 )
+   {
+      int cc ;
+
+#ifdef HAVE_SENDMMSG
+      cc = sendmmsg( fd, (struct mmsghdr *) &bp->db_msg[ first ], n,
+                                                            MSG_DONTWAIT ) ;
+#else
+      cc = ( sendmsg( fd, &bp->db_msg[ first ].dm_hdr,
+                                          MSG_DONTWAIT ) == -1 ) ? -1 : 1 ;
+#endif
+      if ( cc == -1 && errno == EINTR )
+         continue ;
+      if ( cc == -1 )
+      {
+         /* skip the datagram that failed */
+         cc = 1 ;
+      }
+      first += cc ;
+      n -= cc ;
+   }
+}
+
+
+/*
+ * Turn the control data received with the datagram in slot i into the
+ * control data of an answer sent from the address the datagram was
+ * sent to. The address is dropped if there is none, so that the answer
+ * goes out from the address the system picks.
+ */
+void dgram_reply( struct dgram_batch *bp, unsigned i )
+{
+   struct msghdr    mh ;
+   struct cmsghdr  *cmp ;
+   socklen_t        len = 0 ;
+
+   if ( bp->db_ctl == NULL )
+      return ;
+
+   CLEAR( mh ) ;
+   mh.msg_control = DGRAM_CTL( bp, i ) ;
+   mh.msg_controllen = bp->db_ctllen[ i ] ;
+   for ( cmp = CMSG_FIRSTHDR( &mh ) ; cmp != NULL ;
+                                          cmp = CMSG_NXTHDR( &mh, cmp ) )
+   {
+#ifdef IP_PKTINFO
+      if ( cmp->cmsg_level == IPPROTO_IP && cmp->cmsg_type == IP_PKTINFO )
+      {
+         struct in_pktinfo pi ;
+
+         memcpy( &pi, CMSG_DATA( cmp ), sizeof( pi ) ) ;
+         /* let the routing pick the interface */
+         pi.ipi_ifindex = 0 ;
+         pi.ipi_addr.s_addr = INADDR_ANY ;
+         len = CMSG_SPACE( sizeof( pi ) ) ;
+         cmp = (struct cmsghdr *) DGRAM_CTL( bp, i ) ;
+         cmp->cmsg_level = IPPROTO_IP ;
+         cmp->cmsg_type = IP_PKTINFO ;
+         cmp->cmsg_len = CMSG_LEN( sizeof( pi ) ) ;
+         memcpy( CMSG_DATA( cmp ), &pi, sizeof( pi ) ) ;
+         break ;
+      }
+#endif
+#ifdef IPV6_PKTINFO
+      if ( cmp->cmsg_level == IPPROTO_IPV6 && cmp->cmsg_type == IPV6_PKTINFO )
+      {
+         struct in6_pktinfo pi ;
+
+         /* the interface is kept, for link-local addresses */
+         memcpy( &pi, CMSG_DATA( cmp ), sizeof( pi ) ) ;
+         len = CMSG_SPACE( sizeof( pi ) ) ;
+         cmp = (struct cmsghdr *) DGRAM_CTL( bp, i ) ;
+         cmp->cmsg_level = IPPROTO_IPV6 ;
+         cmp->cmsg_type = IPV6_PKTINFO ;
+         cmp->cmsg_len = CMSG_LEN( sizeof( pi ) ) ;
+         memcpy( CMSG_DATA( cmp ), &pi, sizeof( pi ) ) ;
+         break ;
+      }
+#endif
+   }
+   bp->db_ctllen[ i ] = len ;
+}
+
+
+/*
+ * Ask for the local address of the datagrams received on fd, a socket
+ * of address family family. This is not an error where the system
+ * can't tell it.
+ */
+status_e dgram_recv_pktinfo( int fd, int family )
+{
+   int on = 1 ;
+
+#ifdef IP_PKTINFO
+   if ( family == AF_INET &&
+        setsockopt( fd, IPPROTO_IP, IP_PKTINFO,
+                                    (char *) &on, sizeof( on ) ) == -1 )
+      return( FAILED ) ;
+#endif
+#ifdef IPV6_RECVPKTINFO
+   if ( family == AF_INET6 &&
+        setsockopt( fd, IPPROTO_IPV6, IPV6_RECVPKTINFO,
+                                    (char *) &on, sizeof( on ) ) == -1 )
+      return( FAILED ) ;
+#endif
+   return( OK ) ;
+}
@@ -0,0 +1,66 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+#ifndef DGRAM_H
+#define DGRAM_H
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "defs.h"
+
+/*
+ * One datagram of a batch. This has the layout of struct mmsghdr, which
+ * is what dgram.c passes it to recvmmsg(2) and sendmmsg(2) as.
+ */
+struct dgram_msg
+{
+   struct msghdr        dm_hdr ;
+   unsigned int         dm_len ;
+} ;
+
+/*
+ * A batch of datagrams, received or sent with one system call where
+ * the system has recvmmsg(2)/sendmmsg(2).
+ */
+struct dgram_batch
+{
+   unsigned             db_size ;         /* number of slots */
+   unsigned             db_bufsize ;      /* bytes per slot */
+   unsigned             db_count ;        /* slots in use (for the user) */
+   struct dgram_msg    *db_msg ;
+   struct iovec        *db_iov ;
+   union xsockaddr     *db_addr ;
+   void               **db_data ;         /* for the user */
+   char                *db_buf ;
+   char                *db_ctl ;          /* control data, if enabled */
+   socklen_t           *db_ctllen ;       /* control data per slot */
+} ;
+
+#define DGRAM_BUF( bp, i )       ( (bp)->db_buf + (size_t)(i) * (bp)->db_bufsize )
+#define DGRAM_LEN( bp, i )       ( (bp)->db_msg[ i ].dm_len )
+#define DGRAM_NAMELEN( bp, i )   ( (bp)->db_msg[ i ].dm_hdr.msg_namelen )
+#define DGRAM_ADDR( bp, i )      ( &(bp)->db_addr[ i ] )
+#define DGRAM_DATA( bp, i )      ( (bp)->db_data[ i ] )
+#define DGRAM_CTL( bp, i )       ( (bp)->db_ctl + (size_t)(i) * DGRAM_CTL_SIZE )
+
+/*
+ * Room for the control data of a slot: one IP_PKTINFO or IPV6_PKTINFO
+ * message, with some to spare
+ */
+#define DGRAM_CTL_SIZE           128
+
+struct dgram_batch *dgram_create(unsigned size, unsigned bufsize);
+int dgram_recv(int fd, struct dgram_batch *bp, unsigned first, unsigned n,
+               bool_int named);
+void dgram_send(int fd, struct dgram_batch *bp, unsigned first, unsigned n,
+                bool_int named);
+status_e dgram_pktinfo(struct dgram_batch *bp);
+void dgram_reply(struct dgram_batch *bp, unsigned i);
+status_e dgram_recv_pktinfo(int fd, int family);
+
+#endif
@@ -0,0 +1,624 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#ifdef HAVE_EPOLL_CREATE
+#include <sys/epoll.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sio.h"
+#include "engine.h"
+#include "access.h"
+#include "builtins.h"
+#include "connection.h"
+#include "log.h"
+#include "main.h"
+#include "msg.h"
+#include "sconf.h"
+#include "state.h"
+#include "xconfig.h"
+#include "xtimer.h"
+
+/*
+ * A note on the builtin engine:
+ * Connections to the stream echo, discard and chargen services are
+ * served by xinetd itself unless builtin_mode = fork is set, instead
+ * of by a forked process each. Every connection is a small state
+ * machine driven by one epoll(7) descriptor, which is part of the
+ * socket mask of the main loop. Its socket is non-blocking and it has
+ * a buffer of ENGINE_BUFFER bytes:
+ *    echo     reads into the buffer while it is empty, and writes it
+ *             out; while a client does not read, it is not read either
+ *    discard  reads until the client closes the connection
+ *    chargen  sends straight from the precomputed pattern of
+ *             builtins.c, and does not use the buffer
+ *    tcpmux   reads the name of the service the client wants into the
+ *             buffer, within TCPMUX_TIMEOUT seconds. The tcpmux server
+ *             is forked only once that service is known, and it starts
+ *             the service's server right away; an unknown name is
+ *             answered without a fork.
+ *
+ * As with inline redirection, each connection keeps its struct server
+ * (with a pid of 0) in the server table, so that instances are counted
+ * and the exit entry is logged when the connection is over.
+ * Beyond ENGINE_SESSIONS connections, or where there is no epoll, a
+ * server is forked as usual.
+ */
+
+#ifdef HAVE_EPOLL_CREATE
+
+#define ENGINE_EVENTS         64
+
+/*
+ * Times a buffer is read or refilled per event, so that a fast client
+ * does not keep the others waiting
+ */
+#define ENGINE_REFILLS        16
+
+struct bsession
+{
+   struct server    *bs_server ;
+   int               bs_fd ;
+   engine_e          bs_engine ;
+   unsigned          bs_events ;       /* registered with epoll */
+   bool_int          bs_eof ;          /* the client sends no more */
+   size_t            bs_pos ;          /* offset in the chargen pattern */
+   time_t            bs_deadline ;     /* for the tcpmux service name */
+   size_t            bs_len ;          /* data in bs_buf */
+   size_t            bs_off ;          /* how much of it was written */
+   struct bsession  *bs_prev ;
+   struct bsession  *bs_next ;
+   char              bs_buf[ ENGINE_BUFFER ] ;
+} ;
+
+static int               engine_epfd = -1 ;
+static struct bsession  *sessions ;
+static unsigned          session_count ;
+static bool_int          expire_armed ;    /* the tcpmux timer is set */
+
+
+static status_e engine_init(void)
+{
+   const char *func = "engine_init" ;
+
+   if ( ( engine_epfd = epoll_create( ENGINE_EVENTS ) ) == -1 )
+   {
+      msg( LOG_ERR, func, "epoll_create: %m" ) ;
+      return( FAILED ) ;
+   }
+   if ( engine_epfd >= FD_SETSIZE )
+   {
+      msg( LOG_ERR, func, "epoll descriptor %d is too large", engine_epfd ) ;
+      (void) close( engine_epfd ) ;
+      engine_epfd = -1 ;
+      return( FAILED ) ;
+   }
+   (void) fcntl( engine_epfd, F_SETFD, FD_CLOEXEC ) ;
+
+   FD_SET( engine_epfd, &ps.rws.socket_mask ) ;
+   if ( engine_epfd > ps.rws.mask_max )
+      ps.rws.mask_max = engine_epfd ;
+   return( OK ) ;
+}
+
+
+static status_e session_watch( struct bsession *bsp, unsigned events )
+{
+   struct epoll_event ev ;
+
+   if ( events == bsp->bs_events )
+      return( OK ) ;
+   ev.events = events ;
+   ev.data.ptr = bsp ;
+   if ( epoll_ctl( engine_epfd, EPOLL_CTL_MOD, bsp->bs_fd, &ev ) == -1 )
+      return( FAILED ) ;
+   bsp->bs_events = events ;
+   return( OK ) ;
+}
+
+
+/*
+ * Take session bsp out of the engine, before its socket is closed or
+ * handed to a server. The socket may still be open in a child (a
+ * server that has not exec'ed yet, a log writer), and then closing it
+ * would not take it out of the epoll set: bsp would come back with its
+ * next event.
+ */
+static void session_unlink( struct bsession *bsp )
+{
+   struct epoll_event ev ;
+
+   CLEAR( ev ) ;
+   (void) epoll_ctl( engine_epfd, EPOLL_CTL_DEL, bsp->bs_fd, &ev ) ;
+   if ( bsp->bs_prev != NULL )
+      bsp->bs_prev->bs_next = bsp->bs_next ;
+   else
+      sessions = bsp->bs_next ;
+   if ( bsp->bs_next != NULL )
+      bsp->bs_next->bs_prev = bsp->bs_prev ;
+   session_count-- ;
+}
+
+
+/*
+ * The connection is over: end its server
+ */
+static void session_end( struct bsession *bsp )
+{
+   struct server *serp = bsp->bs_server ;
+   connection_s *cp = SERVER_CONNECTION( serp ) ;
+
+   session_unlink( bsp ) ;
+
+   /* A tcpmux session is logged once it is known that it gets no fork */
+   if ( bsp->bs_engine == ENGINE_TCPMUX )
+      svc_log_success( SERVER_SERVICE( serp ), cp, SERVER_PID( serp ) ) ;
+
+   /* The connection itself is freed by server_end */
+   CONN_CLOSE( cp ) ;
+   SERVER_EXITSTATUS( serp ) = 0 ;
+   server_end( serp ) ;
+   FREE( bsp ) ;
+}
+
+
+/*
+ * Write out what is in the buffer.
+ * Returns FAILED if the connection is broken.
+ */
+static status_e session_flush( struct bsession *bsp )
+{
+   while ( bsp->bs_off < bsp->bs_len )
+   {
+      ssize_t cc = send( bsp->bs_fd, &bsp->bs_buf[ bsp->bs_off ],
+                                 bsp->bs_len - bsp->bs_off, 0 ) ;
+
+      if ( cc == (ssize_t)-1 )
+      {
+         if ( errno == EINTR )
+            continue ;
+         return( ( errno == EAGAIN ) ? OK : FAILED ) ;
+      }
+      bsp->bs_off += cc ;
+   }
+   bsp->bs_off = bsp->bs_len = 0 ;
+   return( OK ) ;
+}
+
+
+/*
+ * Read what the client sent into the buffer.
+ * Returns FAILED if the connection is broken.
+ */
+static status_e session_read( struct bsession *bsp )
+{
+   ssize_t cc ;
+
+   do
+      cc = recv( bsp->bs_fd, bsp->bs_buf, sizeof( bsp->bs_buf ), 0 ) ;
+   while ( cc == (ssize_t)-1 && errno == EINTR ) ;
+
+   if ( cc == 0 )
+      bsp->bs_eof = TRUE ;
+   else if ( cc != (ssize_t)-1 )
+   {
+      bsp->bs_off = 0 ;
+      bsp->bs_len = cc ;
+   }
+   else if ( errno != EAGAIN )
+      return( FAILED ) ;
+   return( OK ) ;
+}
+
+
+/*
+ * Send chargen output until the socket is full, or ENGINE_REFILLS
+ * patterns have been sent.
+ * Returns FAILED if the connection is broken.
+ */
+static status_e chargen_send( struct bsession *bsp )
+{
+   const char *pattern = chargen_pattern() ;
+   int         n ;
+
+   for ( n = 0 ; n < ENGINE_REFILLS ; n++ )
+   {
+      ssize_t cc = send( bsp->bs_fd, &pattern[ bsp->bs_pos ],
+                                       CHARGEN_PATTERN_SIZE, 0 ) ;
+
+      if ( cc == (ssize_t)-1 )
+      {
+         if ( errno == EINTR )
+            continue ;
+         return( ( errno == EAGAIN ) ? OK : FAILED ) ;
+      }
+      bsp->bs_pos = ( bsp->bs_pos + cc ) % CHARGEN_PATTERN_SIZE ;
+   }
+   return( OK ) ;
+}
+
+
+/*
+ * Read the service name line of a tcpmux client into the buffer. Only
+ * the bytes of that line are taken off the socket, so that what the
+ * client sends after it is left for the server. bs_eof is set once
+ * the line is complete.
+ * Returns FAILED if the connection is broken or the line is too long.
+ */
+static status_e tcpmux_read( struct bsession *bsp )
+{
+   size_t   room = sizeof( bsp->bs_buf ) - 1 - bsp->bs_len ;
+   char    *p = &bsp->bs_buf[ bsp->bs_len ] ;
+   char    *nl ;
+   ssize_t  cc ;
+
+   do
+      cc = recv( bsp->bs_fd, p, room, MSG_PEEK ) ;
+   while ( cc == (ssize_t)-1 && errno == EINTR ) ;
+   if ( cc == (ssize_t)-1 )
+      return( ( errno == EAGAIN ) ? OK : FAILED ) ;
+   if ( cc == 0 )
+      return( FAILED ) ;
+
+   if ( ( nl = memchr( p, '\n', (size_t) cc ) ) != NULL )
+      cc = nl - p + 1 ;
+   do
+      cc = recv( bsp->bs_fd, p, (size_t) cc, 0 ) ;
+   while ( cc == (ssize_t)-1 && errno == EINTR ) ;
+   if ( cc == (ssize_t)-1 )
+      return( FAILED ) ;
+
+   bsp->bs_len += cc ;
+   if ( nl != NULL )
+      bsp->bs_eof = TRUE ;
+   else if ( bsp->bs_len == sizeof( bsp->bs_buf ) - 1 )
+      return( FAILED ) ;
+   return( OK ) ;
+}
+
+
+/*
+ * The client of tcpmux session bsp has sent the name of the service it
+ * wants. If there is such a service, fork the tcpmux server for it;
+ * otherwise tell the client that there is not.
+ */
+static void tcpmux_resolve( struct bsession *bsp )
+{
+   struct server        *serp = bsp->bs_server ;
+   struct service       *sp = SERVER_SERVICE( serp ) ;
+   connection_s         *cp = SERVER_CONNECTION( serp ) ;
+   struct service       *target = NULL ;
+   int                   flags ;
+   const char           *func = "tcpmux_resolve" ;
+
+   if ( bsp->bs_len > 2 && bsp->bs_buf[ bsp->bs_len - 2 ] == '\r' )
+   {
+      bsp->bs_buf[ bsp->bs_len - 2 ] = NUL ;
+      if ( ( target = tcpmux_lookup( bsp->bs_buf ) ) == NULL )
+      {
+         if ( debug.on )
+            msg( LOG_DEBUG, func, "Service name %s not found.", 
+                                                         bsp->bs_buf ) ;
+         (void) send( bsp->bs_fd, TCPMUX_NOT_FOUND, 
+                                          sizeof( TCPMUX_NOT_FOUND ), 0 ) ;
+      }
+   }
+   else if ( debug.on )
+      msg( LOG_DEBUG, func, "Invalid service name format." ) ;
+
+   if ( target == NULL )
+   {
+      session_end( bsp ) ;
+      return ;
+   }
+
+   /*
+    * The server gets the socket as a server forked right away would:
+    * blocking, and out of the engine, which the child closes
+    */
+   session_unlink( bsp ) ;
+   if ( ( flags = fcntl( bsp->bs_fd, F_GETFL ) ) != -1 )
+      (void) fcntl( bsp->bs_fd, F_SETFL, flags & ~O_NONBLOCK ) ;
+   (void) fcntl( bsp->bs_fd, F_SETFD, 0 ) ;
+   FREE( bsp ) ;
+
+   /* server_start counts the server again */
+   SVC_DEC_RUNNING_SERVERS( sp ) ;
+   if ( tcpmux_start( serp, target ) == OK )
+   {
+      CONN_CLOSE( cp ) ;
+      return ;
+   }
+
+   /* The name has been read, so there is no retry */
+   svc_log_failure( sp, cp, AC_FORK ) ;
+   server_release( serp ) ;
+   conn_free( cp, 1 ) ;
+}
+
+
+/*
+ * End the tcpmux sessions whose client did not send a service name in
+ * time. This runs every second while there are tcpmux sessions.
+ */
+static void engine_expire(void)
+{
+   struct bsession  *bsp, *next ;
+   time_t            now = time( NULL ) ;
+   bool_int          pending = FALSE ;
+   const char       *func = "engine_expire" ;
+
+   expire_armed = FALSE ;
+   for ( bsp = sessions ; bsp != NULL ; bsp = next )
+   {
+      next = bsp->bs_next ;
+      if ( bsp->bs_engine != ENGINE_TCPMUX )
+         continue ;
+      if ( now >= bsp->bs_deadline )
+      {
+         if ( debug.on )
+            msg( LOG_DEBUG, func, "tcpmux client sent no service name" ) ;
+         session_end( bsp ) ;
+      }
+      else
+         pending = TRUE ;
+   }
+   if ( pending && xtimer_add( engine_expire, 1 ) != -1 )
+      expire_armed = TRUE ;
+}
+
+
+static void session_event( struct bsession *bsp, unsigned events )
+{
+   unsigned wanted = 0 ;
+   size_t   len ;
+   int      n ;
+
+   if ( events & EPOLLERR )
+   {
+      session_end( bsp ) ;
+      return ;
+   }
+
+   switch ( bsp->bs_engine )
+   {
+      case ENGINE_ECHO:
+         if ( session_flush( bsp ) == FAILED )
+            break ;
+         if ( bsp->bs_len == 0 && ! bsp->bs_eof )
+         {
+            if ( session_read( bsp ) == FAILED ||
+                                    session_flush( bsp ) == FAILED )
+               break ;
+         }
+         if ( bsp->bs_len != 0 )
+            wanted = EPOLLOUT ;
+         else if ( ! bsp->bs_eof )
+            wanted = EPOLLIN ;
+         break ;
+
+      case ENGINE_DISCARD:
+         for ( n = 0 ; n < ENGINE_REFILLS ; n++ )
+         {
+            if ( session_read( bsp ) == FAILED || bsp->bs_eof )
+               break ;
+            len = bsp->bs_len ;
+            bsp->bs_len = 0 ;
+            if ( len < sizeof( bsp->bs_buf ) || n == ENGINE_REFILLS - 1 )
+            {
+               wanted = EPOLLIN ;
+               break ;
+            }
+         }
+         break ;
+
+      case ENGINE_CHARGEN:
+         if ( chargen_send( bsp ) == OK )
+            wanted = EPOLLOUT ;
+         break ;
+
+      case ENGINE_TCPMUX:
+         if ( tcpmux_read( bsp ) == FAILED )
+            break ;
+         if ( bsp->bs_eof )
+         {
+            tcpmux_resolve( bsp ) ;
+            return ;
+         }
+         wanted = EPOLLIN ;
+         break ;
+
+      default:
+         break ;
+   }
+
+   if ( wanted == 0 || session_watch( bsp, wanted ) == FAILED )
+      session_end( bsp ) ;
+}
+
+#endif   /* HAVE_EPOLL_CREATE */
+
+
+/*
+ * Serve the connection of server serp in xinetd.
+ * Returns FAILED if a server should be forked for it instead.
+ */
+status_e engine_start( struct server *serp )
+{
+#ifdef HAVE_EPOLL_CREATE
+   struct service       *sp = SERVER_SERVICE( serp ) ;
+   struct bsession      *bsp ;
+   struct epoll_event    ev ;
+   int                   fd = SERVER_FD( serp ) ;
+   int                   flags ;
+   const char           *func = "engine_start" ;
+
+   if ( session_count >= ENGINE_SESSIONS )
+      return( FAILED ) ;
+   if ( SVC_ENGINE( sp ) == ENGINE_CHARGEN && chargen_pattern() == NULL )
+      return( FAILED ) ;
+   if ( engine_epfd == -1 && engine_init() == FAILED )
+      return( FAILED ) ;
+
+   if ( ( bsp = NEW( struct bsession ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      return( FAILED ) ;
+   }
+   bsp->bs_server = serp ;
+   bsp->bs_fd = fd ;
+   bsp->bs_engine = SVC_ENGINE( sp ) ;
+   bsp->bs_events = ( bsp->bs_engine == ENGINE_CHARGEN ) ? EPOLLOUT : EPOLLIN ;
+   bsp->bs_eof = FALSE ;
+   bsp->bs_pos = 0 ;
+   bsp->bs_len = bsp->bs_off = 0 ;
+   bsp->bs_deadline = time( NULL ) + TCPMUX_TIMEOUT ;
+
+   /*
+    * Until it is registered, the connection can still go to a forked
+    * server, which expects a blocking socket
+    */
+   ev.events = bsp->bs_events ;
+   ev.data.ptr = bsp ;
+   if ( epoll_ctl( engine_epfd, EPOLL_CTL_ADD, fd, &ev ) == -1 )
+   {
+      msg( LOG_ERR, func, "epoll_ctl: %m" ) ;
+      FREE( bsp ) ;
+      return( FAILED ) ;
+   }
+   if ( ( flags = fcntl( fd, F_GETFL ) ) == -1 ||
+         fcntl( fd, F_SETFL, flags | O_NONBLOCK ) == -1 )
+   {
+      msg( LOG_ERR, func, "%s: fcntl F_SETFL failed: %m", SVC_ID( sp ) ) ;
+      (void) epoll_ctl( engine_epfd, EPOLL_CTL_DEL, fd, &ev ) ;
+      FREE( bsp ) ;
+      return( FAILED ) ;
+   }
+   (void) fcntl( fd, F_SETFD, FD_CLOEXEC ) ;
+   if ( bsp->bs_engine == ENGINE_CHARGEN )
+      (void) shutdown( fd, SHUT_RD ) ;
+
+   bsp->bs_prev = NULL ;
+   bsp->bs_next = sessions ;
+   if ( sessions != NULL )
+      sessions->bs_prev = bsp ;
+   sessions = bsp ;
+   session_count++ ;
+
+   SERVER_PID( serp ) = 0 ;
+   SERVER_LOGUSER( serp ) = FALSE ;
+   SERVER_WRITES_TO_LOG( serp ) = FALSE ;
+   (void) time( &SERVER_STARTTIME( serp ) ) ;
+   SVC_INC_RUNNING_SERVERS( sp ) ;
+   if ( bsp->bs_engine != ENGINE_TCPMUX )
+      svc_log_success( sp, SERVER_CONNECTION( serp ), SERVER_PID( serp ) ) ;
+   else if ( ! expire_armed && xtimer_add( engine_expire, 1 ) != -1 )
+      expire_armed = TRUE ;
+   return( OK ) ;
+#else
+   return( FAILED ) ;
+#endif
+}
+
+
+/*
+ * Serve the connections that are ready, if the engine's descriptor is
+ * set in the mask. Returns the number of descriptors handled.
+ */
+int engine_poll( fd_set *maskp )
+{
+#ifdef HAVE_EPOLL_CREATE
+   struct epoll_event   events[ ENGINE_EVENTS ] ;
+   int                  n_ready, i ;
+
+   if ( engine_epfd == -1 || ! FD_ISSET( engine_epfd, maskp ) )
+      return( 0 ) ;
+
+   do
+      n_ready = epoll_wait( engine_epfd, events, ENGINE_EVENTS, 0 ) ;
+   while ( n_ready == -1 && errno == EINTR ) ;
+
+   /* Each session has one descriptor, so it has at most one event */
+   for ( i = 0 ; i < n_ready ; i++ )
+      session_event( (struct bsession *) events[ i ].data.ptr,
+                                                   events[ i ].events ) ;
+   return( 1 ) ;
+#else
+   return( 0 ) ;
+#endif
+}
+
+
+/*
+ * Close all connections of service sp. As with the forked servers of
+ * a service, they end right away.
+ */
+void engine_terminate( const struct service *sp )
+{
+#ifdef HAVE_EPOLL_CREATE
+   struct bsession *bsp, *next ;
+
+   for ( bsp = sessions ; bsp != NULL ; bsp = next )
+   {
+      next = bsp->bs_next ;
+      if ( SERVER_SERVICE( bsp->bs_server ) == sp )
+         session_end( bsp ) ;
+   }
+#endif
+}
+
+
+/*
+ * Returns TRUE if fd is the epoll descriptor of the engine
+ */
+bool_int engine_fd( int fd )
+{
+#ifdef HAVE_EPOLL_CREATE
+   return( engine_epfd != -1 && fd == engine_epfd ) ;
+#else
+   return( FALSE ) ;
+#endif
+}
+
+
+/*
+ * Close the descriptors of the engine in a child that does not exec,
+ * so that its connections end when xinetd closes them
+ */
+void engine_close(void)
+{
+#ifdef HAVE_EPOLL_CREATE
+   struct bsession *bsp ;
+
+   if ( engine_epfd == -1 )
+      return ;
+   (void) close( engine_epfd ) ;
+   for ( bsp = sessions ; bsp != NULL ; bsp = bsp->bs_next )
+      (void) close( bsp->bs_fd ) ;
+#endif
+}
+
+
+void engine_dump( int fd )
+{
+#ifdef HAVE_EPOLL_CREATE
+   if ( engine_epfd != -1 )
+   {
+      Sprint( fd, "builtin engine: sessions = %u\n", session_count ) ;
+      Sputchar( fd, '\n' ) ;
+   }
+#endif
+}
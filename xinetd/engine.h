@@ -0,0 +1,24 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "defs.h"
+#include "server.h"
+#include "service.h"
+
+status_e engine_start(struct server *serp);
+int engine_poll(fd_set *maskp);
+void engine_terminate(const struct service *sp);
+bool_int engine_fd(int fd);
+void engine_close(void);
+void engine_dump(int fd);
+
+#endif
@@ -1,7 +1,7 @@
 /*
  * (c) Copyright 1992 by Panagiotis Tsirigotis
  * (c) Sections Copyright 1998-2001 by Rob Braun
- * All rights reserved.  The file named COPYRIGHT specifies the terms 
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
  * and conditions for redistribution.
  */
 
@@ -9,198 +9,481 @@
 #include "config.h"
 #include <sys/types.h>
 #include <sys/socket.h>
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <poll.h>
 #include <signal.h>
 #include <syslog.h>
-#include <setjmp.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
 #include <ctype.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <time.h>
 #include <unistd.h>
 
 
+#include "sio.h"
 #include "str.h"
 #include "ident.h"
+#include "child.h"
 #include "msg.h"
 #include "server.h"
 #include "connection.h"
 #include "util.h"
 #include "log.h"
+#include "main.h"
 #include "sconst.h"
+#include "service.h"
+#include "signals.h"
+#include "state.h"
+#include "xconfig.h"
 
-
-static char *get_line( int sd, register char *buf, unsigned bufsize );
-static char *verify_line( char *line, unsigned local_port, unsigned remote_port );
+/*
+ * A note on identification:
+ * The user of a connection is asked for from the identity server of the
+ * remote host (RFC 1413) with a non-blocking socket and poll(2), so
+ * that a lookup times out without the help of a signal.
+ *
+ * The USERID of a successful connection is looked up by the server
+ * process before the server is started. The USERID of a failure is
+ * looked up by an ident worker process, which does up to
+ * IDENT_WORKER_QUERIES lookups at a time: xinetd passes it the refused
+ * connection, which the worker keeps open until the identity server has
+ * answered (that server only knows about open connections), and the
+ * worker reports the answer back to xinetd, which logs it. When the
+ * worker can't take a lookup, it is done by a process of the logging
+ * special service instead.
+ *
+ * The answers are kept for IDENT_CACHE_TTL seconds, keyed by remote
+ * address and port pair. A host with no identity server, or one that
+ * did not answer in time, is not asked again during that time,
+ * whatever the ports, unless identification is required. Server
+ * processes see the cache as it was when they were forked.
+ */
 
 
 #define IBUFSIZE      1024      /* RFC-1413 suggests 1000 */
 
-#define START_TIMER( t )   (void) alarm( t )
-#define STOP_TIMER()      (void) alarm( 0 )
+#define IQ_CONNECTING         1
+#define IQ_READING            2
+#define IQ_DONE               3
+
+struct ident_query
+{
+   int               iq_sd ;
+   int               iq_state ;
+   idresult_e        iq_result ;
+   const char       *iq_error ;         /* why, for IDR_RESPERR */
+   unsigned          iq_local_port ;
+   unsigned          iq_remote_port ;
+   time_t            iq_deadline ;      /* 0: no timeout */
+   unsigned          iq_len ;
+   char             *iq_user ;          /* in iq_buf, for IDR_OK */
+   char              iq_buf[ IBUFSIZE ] ;
+} ;
 
+struct ident_entry
+{
+   union xsockaddr   ie_addr ;
+   unsigned          ie_remote_port ;   /* both 0: any connection */
+   unsigned          ie_local_port ;
+   time_t            ie_expires ;
+   idresult_e        ie_result ;
+   char             *ie_user ;
+} ;
 
+static struct ident_entry ident_cache[ IDENT_CACHE_SIZE ] ;
 
-static sigjmp_buf env ;
+static char *verify_line( char *line, unsigned local_port, unsigned remote_port );
 
-#ifdef __GNUC__
-__attribute__ ((noreturn))
-#endif
-static void sigalrm_handler(int signum)
+
+static unsigned addr_port( const union xsockaddr *addr )
 {
-   siglongjmp( env, 1 ) ;
+   if ( addr->sa.sa_family == AF_INET6 )
+      return( ntohs( addr->sa_in6.sin6_port ) ) ;
+   return( ntohs( addr->sa_in.sin_port ) ) ;
 }
 
 
-/*
- * This function always runs in a forked process.
- */
-idresult_e log_remote_user( const struct server *serp, unsigned timeout )
+static bool_int same_host( const union xsockaddr *a, const union xsockaddr *b )
 {
-   static char         buf[ IBUFSIZE ] ;
-   int                 cc ;
-   union xsockaddr     sin_local, sin_remote, sin_contact, sin_bind;
-   volatile unsigned   local_port;
-   volatile unsigned   remote_port;
-   int                 sd ;
-   socklen_t           sin_len ;
-   char               *p ;
-   const char         *func = "log_remote_user" ;
-
-   if ( timeout && signal( SIGALRM, sigalrm_handler ) == SIG_ERR )
+   if ( a->sa.sa_family != b->sa.sa_family )
+      return( FALSE ) ;
+   if ( a->sa.sa_family == AF_INET6 )
+      return( memcmp( &a->sa_in6.sin6_addr, &b->sa_in6.sin6_addr,
+                           sizeof( a->sa_in6.sin6_addr ) ) == 0 ) ;
+   return( a->sa_in.sin_addr.s_addr == b->sa_in.sin_addr.s_addr ) ;
+}
+
+
+static struct ident_entry *cache_slot( const union xsockaddr *addr,
+                                       unsigned remote_port,
+                                       unsigned local_port )
+{
+   const unsigned char  *p ;
+   unsigned              len ;
+   unsigned              h = 2166136261U ;
+
+   if ( addr->sa.sa_family == AF_INET6 )
    {
-      msg( LOG_ERR, func, "signal: %m" ) ;
-      return( IDR_ERROR ) ;
+      p = addr->sa_in6.sin6_addr.s6_addr ;
+      len = 16 ;
    }
-
-   /*
-    * Determine local and remote addresses
-    */
-   sin_len = sizeof( sin_local ) ;
-   if ( getsockname( SERVER_FD( serp ), &sin_local.sa, &sin_len ) == -1 )
+   else
    {
-      msg( LOG_ERR, func, "(%d) getsockname: %m", getpid() ) ;
-      return( IDR_ERROR ) ;
+      p = (const unsigned char *) &addr->sa_in.sin_addr ;
+      len = 4 ;
    }
+   while ( len-- > 0 )
+      h = ( h ^ *p++ ) * 16777619U ;
+   h = ( h ^ remote_port ) * 16777619U ;
+   h = ( h ^ local_port ) * 16777619U ;
+   return( &ident_cache[ h % IDENT_CACHE_SIZE ] ) ;
+}
 
-   if ( CONN_XADDRESS( SERVER_CONNECTION( serp ) ) == NULL )
+
+/*
+ * Look up the answer for the connection from addr to local_port, or
+ * the failure of the host addr if failures is TRUE
+ */
+static const struct ident_entry *cache_lookup( const union xsockaddr *addr,
+                                               unsigned local_port,
+                                               bool_int failures )
+{
+   const struct ident_entry *iep ;
+   time_t now = time( NULL ) ;
+
+   iep = cache_slot( addr, addr_port( addr ), local_port ) ;
+   if ( iep->ie_expires > now && same_host( &iep->ie_addr, addr ) &&
+        iep->ie_remote_port == addr_port( addr ) &&
+        iep->ie_local_port == local_port )
+      return( iep ) ;
+
+   if ( ! failures )
+      return( NULL ) ;
+   iep = cache_slot( addr, 0, 0 ) ;
+   if ( iep->ie_expires > now && same_host( &iep->ie_addr, addr ) &&
+        iep->ie_remote_port == 0 && iep->ie_local_port == 0 )
+      return( iep ) ;
+   return( NULL ) ;
+}
+
+
+/*
+ * Remember the answer of the identity server of addr. A user id is
+ * kept for the connection, a missing or silent server for the host;
+ * other errors are not kept.
+ */
+static void cache_enter( const union xsockaddr *addr, unsigned local_port,
+                         idresult_e result, const char *user )
+{
+   struct ident_entry   *iep ;
+   unsigned              remote_port = 0 ;
+   char                 *dup = NULL ;
+
+   if ( result == IDR_OK )
    {
-      /*
-       * This shouldn't happen since identification only works for
-       * connection-based services.
-       */
-      msg( LOG_ERR, func, "connection has no address" ) ;
-      return( IDR_ERROR ) ;
+      if ( ( dup = new_string( user ) ) == NULL )
+         return ;
+      remote_port = addr_port( addr ) ;
    }
+   else if ( result == IDR_NOSERVER || result == IDR_TIMEDOUT )
+      local_port = 0 ;
+   else
+      return ;
 
-   CLEAR( sin_contact );
-   sin_remote = *CONN_XADDRESS( SERVER_CONNECTION( serp ) ) ;
-   sin_contact = sin_remote;
-   memcpy( &sin_bind, &sin_local, sizeof(sin_bind) ) ;
-   local_port = 0;
-   remote_port = 0;
-   if( sin_remote.sa.sa_family == AF_INET ) {
-      local_port = ntohs( sin_local.sa_in6.sin6_port ) ;
-      remote_port = ntohs( sin_remote.sa_in6.sin6_port ) ;
+   iep = cache_slot( addr, remote_port, local_port ) ;
+   if ( iep->ie_user != NULL )
+      free( iep->ie_user ) ;
+   iep->ie_addr = *addr ;
+   iep->ie_remote_port = remote_port ;
+   iep->ie_local_port = local_port ;
+   iep->ie_expires = time( NULL ) + IDENT_CACHE_TTL ;
+   iep->ie_result = result ;
+   iep->ie_user = dup ;
+}
+
+
+static void query_done( struct ident_query *iqp, idresult_e result )
+{
+   iqp->iq_state = IQ_DONE ;
+   iqp->iq_result = result ;
+}
+
+
+/*
+ * Send the request of iqp, once connected
+ */
+static void query_send( struct ident_query *iqp )
+{
+   char     buf[ 32 ] ;
+   int      cc ;
+   ssize_t  n ;
+
+   cc = strx_nprint( buf, sizeof( buf ),
+      "%u,%u\r\n", iqp->iq_remote_port, iqp->iq_local_port ) ;
+   do
+      n = write( iqp->iq_sd, buf, cc ) ;
+   while ( n == -1 && errno == EINTR ) ;
+
+   /* a fresh socket has room for a request this short */
+   if ( n != cc )
+      query_done( iqp, IDR_ERROR ) ;
+   else
+      iqp->iq_state = IQ_READING ;
+}
+
+
+/*
+ * Start a query to the identity server of remote about the connection
+ * from remote to local. The socket is bound to the local address or
+ * ident might fail for multi-homed hosts.
+ */
+static void query_start( struct ident_query *iqp,
+                         const union xsockaddr *local,
+                         const union xsockaddr *remote,
+                         unsigned timeout )
+{
+   union xsockaddr   sin_bind, sin_contact ;
+   socklen_t         len ;
+
+   CLEAR( *iqp ) ;
+   iqp->iq_sd = -1 ;
+   iqp->iq_local_port = addr_port( local ) ;
+   iqp->iq_remote_port = addr_port( remote ) ;
+   if ( timeout )
+      iqp->iq_deadline = time( NULL ) + timeout ;
+
+   sin_bind = *local ;
+   sin_contact = *remote ;
+   if ( remote->sa.sa_family == AF_INET6 )
+   {
+      len = sizeof( struct sockaddr_in6 ) ;
+      sin_bind.sa_in6.sin6_port = 0 ;
       sin_contact.sa_in6.sin6_port = htons( IDENTITY_SERVICE_PORT ) ;
+   }
+   else
+   {
+      len = sizeof( struct sockaddr_in ) ;
       sin_bind.sa_in.sin_port = 0 ;
-   } else if( sin_remote.sa.sa_family == AF_INET6 ) {
-      local_port = ntohs( sin_local.sa_in.sin_port ) ;
-      remote_port = ntohs( sin_remote.sa_in.sin_port ) ;
       sin_contact.sa_in.sin_port = htons( IDENTITY_SERVICE_PORT ) ;
-      sin_bind.sa_in6.sin6_port = 0 ;
    }
 
    /*
-    * Create a socket, bind it, and set the close-on-exec flag on the
-    * descriptor. We set the flag in case we are called as part of a 
-    * successful attempt to start a server (i.e. execve will follow). 
-    * The socket must be bound to the receiving address or ident might 
-    * fail for multi-homed hosts.
+    * The close-on-exec flag is set in case we are called as part of a
+    * successful attempt to start a server (i.e. execve will follow).
     */
-   sd = socket( sin_remote.sa.sa_family, SOCK_STREAM, 0 ) ;
-   if ( sd == -1 )
+   if ( ( iqp->iq_sd = socket( remote->sa.sa_family, SOCK_STREAM, 0 ) ) == -1 ||
+        bind( iqp->iq_sd, &sin_bind.sa, len ) == -1 ||
+        fcntl( iqp->iq_sd, F_SETFD, FD_CLOEXEC ) == -1 ||
+        fcntl( iqp->iq_sd, F_SETFL, O_NONBLOCK ) == -1 )
    {
-      msg( LOG_ERR, func, "socket creation: %m" ) ;
-      return( IDR_ERROR ) ;
-   }
-   if ( bind(sd, &sin_bind.sa, sizeof(sin_bind.sa)) == -1 )
-   { 
-      msg( LOG_ERR, func, "socket bind: %m" ) ;
-      (void) Sclose( sd ) ;
-      return( IDR_ERROR ) ;
+      iqp->iq_error = strerror( errno ) ;
+      query_done( iqp, IDR_ERROR ) ;
+      return ;
    }
-   if ( fcntl( sd, F_SETFD, FD_CLOEXEC ) == -1 )
+
+   if ( connect( iqp->iq_sd, &sin_contact.sa, len ) == 0 )
+      query_send( iqp ) ;
+   else if ( errno == EINPROGRESS || errno == EINTR )
+      iqp->iq_state = IQ_CONNECTING ;
+   else
+      query_done( iqp, IDR_NOSERVER ) ;
+}
+
+
+/*
+ * Look for a line terminated by CR-LF in what has been read
+ */
+static void query_line( struct ident_query *iqp )
+{
+   char *s ;
+
+   for ( s = iqp->iq_buf + 1 ; s < iqp->iq_buf + iqp->iq_len ; s++ )
+      if ( *s == '\n' && *(s-1) == '\r' )
+      {
+         *(s-1) = NUL ;
+         iqp->iq_user = verify_line( iqp->iq_buf,
+                              iqp->iq_local_port, iqp->iq_remote_port ) ;
+         query_done( iqp, iqp->iq_user != NULL ? IDR_OK : IDR_BADRESP ) ;
+         return ;
+      }
+   if ( iqp->iq_len == sizeof( iqp->iq_buf ) - 1 )
    {
-      msg( LOG_ERR, func, "fcntl F_SETFD: %m" ) ;
-      (void) Sclose( sd ) ;
-      return( IDR_ERROR ) ;
+      iqp->iq_error = "Too much input from identity server" ;
+      query_done( iqp, IDR_RESPERR ) ;
    }
+}
 
-   if ( timeout ) {
-      if ( sigsetjmp( env, 1 ) == 0 )
-         START_TIMER( timeout ) ;
-      else {
-         Sclose( sd ) ;
-         return( IDR_TIMEDOUT ) ;
-      }
+
+/*
+ * Carry on with the query iqp, given the events of its socket (none if
+ * poll timed out)
+ */
+static void query_step( struct ident_query *iqp, int revents, time_t now )
+{
+   if ( revents == 0 )
+   {
+      if ( iqp->iq_deadline != 0 && now >= iqp->iq_deadline )
+         query_done( iqp, IDR_TIMEDOUT ) ;
+      return ;
    }
 
-   if ( connect( sd, &sin_contact.sa, sizeof( sin_contact ) ) == -1 )
+   if ( iqp->iq_state == IQ_CONNECTING )
    {
-      if ( timeout ) {
-         STOP_TIMER() ;
-         signal ( SIGALRM, SIG_DFL ) ;
-      }
-      Sclose( sd );
-      return( IDR_NOSERVER ) ;
+      int         err = 0 ;
+      socklen_t   len = sizeof( err ) ;
+
+      if ( getsockopt( iqp->iq_sd, SOL_SOCKET, SO_ERROR, &err, &len ) == -1 ||
+           err != 0 )
+         query_done( iqp, IDR_NOSERVER ) ;
+      else
+         query_send( iqp ) ;
+      return ;
    }
 
-   cc = strx_nprint( buf, sizeof( buf ), 
-      "%d,%d\r\n", remote_port, local_port ) ;
-   if ( write_buf( sd, buf, cc ) == FAILED )
+   if ( iqp->iq_state == IQ_READING )
    {
-      if ( timeout ) {
-         STOP_TIMER() ;
-         signal ( SIGALRM, SIG_DFL ) ;
+      ssize_t cc = read( iqp->iq_sd, &iqp->iq_buf[ iqp->iq_len ],
+                           sizeof( iqp->iq_buf ) - 1 - iqp->iq_len ) ;
+
+      if ( cc == -1 )
+      {
+         if ( errno == EINTR || errno == EAGAIN )
+            return ;
+         iqp->iq_error = strerror( errno ) ;
+         query_done( iqp, IDR_RESPERR ) ;
+         return ;
       }
-      Sclose( sd );
-      return( IDR_ERROR ) ;
+      if ( cc == 0 )
+      {
+         iqp->iq_error = "identd server reply missing ending CR-LF" ;
+         query_done( iqp, IDR_RESPERR ) ;
+         return ;
+      }
+      iqp->iq_len += cc ;
+      iqp->iq_buf[ iqp->iq_len ] = NUL ;
+      query_line( iqp ) ;
    }
+}
+
+
+static short query_events( const struct ident_query *iqp )
+{
+   return( iqp->iq_state == IQ_CONNECTING ? POLLOUT : POLLIN ) ;
+}
+
+
+/*
+ * The poll(2) timeout for the query iqp
+ */
+static int query_timeout( const struct ident_query *iqp, time_t now )
+{
+   if ( iqp->iq_deadline == 0 )
+      return( -1 ) ;
+   if ( now >= iqp->iq_deadline )
+      return( 0 ) ;
+   return( (int) ( iqp->iq_deadline - now ) * 1000 ) ;
+}
+
+
+static void query_end( struct ident_query *iqp )
+{
+   if ( iqp->iq_sd != -1 )
+      (void) close( iqp->iq_sd ) ;
+   iqp->iq_sd = -1 ;
+}
 
-   p = get_line( sd, buf, sizeof( buf ) ) ;
 
-   if ( timeout ) {
-      STOP_TIMER() ;
-      signal ( SIGALRM, SIG_DFL ) ;
+/*
+ * This function always runs in a forked process.
+ */
+idresult_e log_remote_user( const struct server *serp, unsigned timeout )
+{
+   static struct ident_query   query ;
+   struct ident_query         *iqp = &query ;
+   const struct ident_entry   *iep ;
+   union xsockaddr             sin_local, sin_remote ;
+   socklen_t                   sin_len ;
+   const char                 *func = "log_remote_user" ;
+
+   /*
+    * Determine local and remote addresses
+    */
+   sin_len = sizeof( sin_local ) ;
+   if ( getsockname( SERVER_FD( serp ), &sin_local.sa, &sin_len ) == -1 )
+   {
+      msg( LOG_ERR, func, "(%d) getsockname: %m", getpid() ) ;
+      return( IDR_ERROR ) ;
    }
 
-   if ( p == NULL ) {
-      Sclose( sd );
-      return( IDR_RESPERR ) ;
+   if ( CONN_XADDRESS( SERVER_CONNECTION( serp ) ) == NULL )
+   {
+      /*
+       * This shouldn't happen since identification only works for
+       * connection-based services.
+       */
+      msg( LOG_ERR, func, "connection has no address" ) ;
+      return( IDR_ERROR ) ;
    }
-   
+   sin_remote = *CONN_XADDRESS( SERVER_CONNECTION( serp ) ) ;
+
    /*
-    * Verify that the received line is OK
+    * A known failure of the host is not waited for again, unless the
+    * service requires identification
     */
-   if ( ( p = verify_line( buf, local_port, remote_port ) ) == NULL )
+   iep = cache_lookup( &sin_remote, addr_port( &sin_local ), timeout != 0 ) ;
+   if ( iep != NULL )
    {
-      msg(LOG_ERR, func, "Bad line received from identity server at %s: %s",
-         xaddrname( &sin_remote ), buf ) ;
-      Sclose( sd );
-      return( IDR_BADRESP ) ;
+      if ( iep->ie_result == IDR_OK )
+         svc_logprint( SERVER_CONNSERVICE( serp ), USERID_ENTRY, "%s",
+                                                         iep->ie_user ) ;
+      return( iep->ie_result ) ;
+   }
+
+   query_start( iqp, &sin_local, &sin_remote, timeout ) ;
+   while ( iqp->iq_state != IQ_DONE )
+   {
+      struct pollfd pfd ;
+      int n ;
+
+      pfd.fd = iqp->iq_sd ;
+      pfd.events = query_events( iqp ) ;
+      pfd.revents = 0 ;
+      n = poll( &pfd, 1, query_timeout( iqp, time( NULL ) ) ) ;
+      if ( n == -1 )
+      {
+         if ( errno == EINTR )
+            continue ;
+         msg( LOG_ERR, func, "poll: %m" ) ;
+         query_done( iqp, IDR_ERROR ) ;
+         break ;
+      }
+      query_step( iqp, n == 0 ? 0 : pfd.revents, time( NULL ) ) ;
    }
+   query_end( iqp ) ;
 
-   svc_logprint( SERVER_CONNSERVICE( serp ), USERID_ENTRY, "%s", p ) ;
-   return( IDR_OK ) ;
+   if ( iqp->iq_result == IDR_OK )
+      svc_logprint( SERVER_CONNSERVICE( serp ), USERID_ENTRY, "%s",
+                                                         iqp->iq_user ) ;
+   else if ( iqp->iq_result == IDR_BADRESP )
+      msg(LOG_ERR, func, "Bad line received from identity server at %s: %s",
+         xaddrname( &sin_remote ), iqp->iq_buf ) ;
+   else if ( iqp->iq_error != NULL )
+      msg( LOG_ERR, func, "identity server at %s: %s",
+         xaddrname( &sin_remote ), iqp->iq_error ) ;
+   return( iqp->iq_result ) ;
 }
 
 
-static char *verify_line( char *line, 
-                           unsigned local_port, 
+static char *verify_line( char *line,
+                           unsigned local_port,
                            unsigned remote_port )
 {
    char   *p ;
@@ -220,7 +503,7 @@ static char *verify_line( char *line,
       return( NULL ) ;
    }
    *p = ',' ;
-   
+
    start = p+1 ;
    p = strchr( start, ':' ) ;
    if ( p == NULL )
@@ -232,7 +515,7 @@ static char *verify_line( char *line,
       return( NULL ) ;
    }
    *p = ':';
-   
+
    /*
     * Look for the 'USERID' string
     */
@@ -258,53 +541,6 @@ static char *verify_line( char *line,
       return( NULL ) ;
    return( p ) ;
 }
-   
-
-/*
- * Get a line terminated by CR-LF.
- * Replace the CR-LF with NUL.
- */
-static char *get_line( int sd, char *buf, unsigned bufsize )
-{
-   int     size ;
-   ssize_t     cc ;
-   char   *p ;
-   char   *s ;
-   const char *func = "get_line" ;
-
-   for ( p = buf, size = bufsize ; size > 0 ; p += cc, size -= cc )
-   {
-      cc = read( sd, p, size ) ;
-      if ( cc == (ssize_t)-1 ) {
-         if ( errno == EINTR )
-         {
-            cc = 0 ;
-            continue ;
-         }
-         else
-         {
-            msg( LOG_ERR, func, "read: %m" ) ;
-            return( CHAR_NULL ) ;
-         }
-      }
-
-      if ( cc == 0 )
-      {
-         msg( LOG_ERR, func, "identd server reply missing ending CR-LF" ) ;
-         return( CHAR_NULL ) ;
-      }
-      for ( s = p ; s < p + cc ; s++ )
-      {
-         if ( (*s == '\n') && (s != buf) && (*(s-1) == '\r') )
-         {
-            *(s-1) = NUL ;
-            return( buf ) ;
-         }
-      }
-   }
-   msg( LOG_ERR, func, "Too much input from identity server" ) ;
-   return( CHAR_NULL ) ;
-}
 
 
 const char *idresult_explain( idresult_e result )
@@ -324,15 +560,15 @@ const char *idresult_explain( idresult_e result )
       case IDR_TIMEDOUT:
          reason = "timeout" ;
          break ;
-      
+
       case IDR_ERROR:
          reason = "system error" ;
          break ;
-      
+
       case IDR_RESPERR:
          reason = "error while receiving response" ;
          break ;
-      
+
       case IDR_BADRESP:
          reason = "bad response" ;
          break ;
@@ -340,3 +576,516 @@ const char *idresult_explain( idresult_e result )
    return( reason ) ;
 }
 
+
+struct ident_request
+{
+   unsigned          ir_id ;
+   unsigned          ir_timeout ;
+   union xsockaddr   ir_local ;
+   union xsockaddr   ir_remote ;
+} ;
+
+struct ident_report
+{
+   unsigned          ir_id ;
+   idresult_e        ir_result ;
+   char              ir_text[ IBUFSIZE ] ;   /* the user id or the bad line */
+} ;
+
+/*
+ * The parent's view of a lookup done by the worker. The lookup id is
+ * the index of the lookup in the table.
+ */
+struct ident_lookup
+{
+   struct service   *il_sp ;            /* NULL: free slot */
+   union xsockaddr   il_remote ;
+   unsigned          il_local_port ;
+} ;
+
+static struct ident_lookup ident_lookups[ IDENT_WORKER_QUERIES ] ;
+static unsigned ident_pending = 0 ;
+static unsigned ident_next = 0 ;
+static pid_t worker_pid = 0 ;
+static int worker_fd = -1 ;
+
+
+/*
+ * The rest of this section up to ident_worker_spawn runs in the worker
+ * process, which does not log
+ */
+
+struct worker_query
+{
+   unsigned             wq_id ;
+   int                  wq_conn ;       /* -1: free slot */
+   struct ident_query   wq_query ;
+} ;
+
+
+static void worker_report( int ctl, struct worker_query *wqp )
+{
+   struct ident_report   rep ;
+   struct ident_query   *iqp = &wqp->wq_query ;
+   const char           *text = "" ;
+   size_t                len ;
+
+   if ( iqp->iq_result == IDR_OK )
+      text = iqp->iq_user ;
+   else if ( iqp->iq_result == IDR_BADRESP )
+      text = iqp->iq_buf ;
+   rep.ir_id = wqp->wq_id ;
+   rep.ir_result = iqp->iq_result ;
+   len = strlen( text ) ;
+   if ( len >= sizeof( rep.ir_text ) )
+      len = sizeof( rep.ir_text ) - 1 ;
+   memcpy( rep.ir_text, text, len ) ;
+   rep.ir_text[ len ] = NUL ;
+   (void) send( ctl, (char *) &rep,
+                  offsetof( struct ident_report, ir_text ) + len + 1, 0 ) ;
+
+   query_end( iqp ) ;
+   (void) close( wqp->wq_conn ) ;
+   wqp->wq_conn = -1 ;
+}
+
+
+/*
+ * Take the requests of the parent. Returns FALSE when the parent is
+ * gone.
+ */
+static bool_int worker_control( int ctl, struct worker_query *queries )
+{
+   for ( ;; )
+   {
+      struct ident_request req ;
+      struct msghdr        mh ;
+      struct iovec         iov ;
+      struct cmsghdr      *cmp ;
+      union {
+         struct cmsghdr    cm ;
+         char              buf[ CMSG_SPACE( sizeof( int ) ) ] ;
+      } control ;
+      ssize_t              cc ;
+      int                  fd = -1 ;
+      struct worker_query *wqp ;
+
+      CLEAR( mh ) ;
+      iov.iov_base = (char *) &req ;
+      iov.iov_len = sizeof( req ) ;
+      mh.msg_iov = &iov ;
+      mh.msg_iovlen = 1 ;
+      mh.msg_control = control.buf ;
+      mh.msg_controllen = sizeof( control.buf ) ;
+
+      cc = recvmsg( ctl, &mh, MSG_DONTWAIT ) ;
+      if ( cc == -1 && errno == EINTR )
+         continue ;
+      if ( cc == -1 && errno == EAGAIN )
+         return( TRUE ) ;
+      if ( cc <= 0 )
+         return( FALSE ) ;
+
+      for ( cmp = CMSG_FIRSTHDR( &mh ) ; cmp ; cmp = CMSG_NXTHDR( &mh, cmp ) )
+         if ( cmp->cmsg_level == SOL_SOCKET && cmp->cmsg_type == SCM_RIGHTS )
+            memcpy( &fd, CMSG_DATA( cmp ), sizeof( int ) ) ;
+      if ( cc != sizeof( req ) || fd < 0 || req.ir_id >= IDENT_WORKER_QUERIES )
+      {
+         if ( fd >= 0 )
+            (void) close( fd ) ;
+         continue ;
+      }
+
+      /* the parent never has more lookups than slots here */
+      wqp = &queries[ req.ir_id ] ;
+      if ( wqp->wq_conn != -1 )
+      {
+         query_end( &wqp->wq_query ) ;
+         (void) close( wqp->wq_conn ) ;
+      }
+      wqp->wq_id = req.ir_id ;
+      wqp->wq_conn = fd ;
+      query_start( &wqp->wq_query, &req.ir_local, &req.ir_remote,
+                                                      req.ir_timeout ) ;
+      if ( wqp->wq_query.iq_state == IQ_DONE )
+         worker_report( ctl, wqp ) ;
+   }
+}
+
+
+#ifdef __GNUC__
+__attribute__ ((noreturn))
+#endif
+static void ident_worker_main( int ctl )
+{
+   static struct worker_query    queries[ IDENT_WORKER_QUERIES ] ;
+   static struct pollfd          pfds[ IDENT_WORKER_QUERIES + 1 ] ;
+   static struct worker_query   *polled[ IDENT_WORKER_QUERIES + 1 ] ;
+   unsigned                      u ;
+   int                           fd ;
+#ifdef RLIMIT_NOFILE
+   struct rlimit                 rl ;
+#endif
+
+   /*
+    * Keep nothing that belongs to the parent, the log included. This is
+    * done first, since a connection of xinetd stays open as long as
+    * the worker has it.
+    */
+   for ( fd = 0 ; (unsigned)fd < ps.ros.max_descriptors ; fd++ )
+      if ( fd != ctl )
+         (void) close( fd ) ;
+
+   signal_default_state() ;
+   (void) signal( SIGPIPE, SIG_IGN ) ;
+
+   /*
+    * The worker does not use select(2), so it is not limited to
+    * FD_SETSIZE descriptors; each lookup takes two.
+    */
+#ifdef RLIMIT_NOFILE
+   rl.rlim_max = ps.ros.orig_max_descriptors ;
+   rl.rlim_cur = ps.ros.orig_max_descriptors ;
+   (void) setrlimit( RLIMIT_NOFILE, &rl ) ;
+#endif
+
+   rename_process( "xinetd ident worker" ) ;
+
+   for ( u = 0 ; u < IDENT_WORKER_QUERIES ; u++ )
+      queries[ u ].wq_conn = -1 ;
+
+   for ( ;; )
+   {
+      time_t   now = time( NULL ) ;
+      int      timeout = -1 ;
+      unsigned n = 0 ;
+      unsigned i ;
+
+      pfds[ n ].fd = ctl ;
+      pfds[ n ].events = POLLIN ;
+      polled[ n++ ] = NULL ;
+      for ( u = 0 ; u < IDENT_WORKER_QUERIES ; u++ )
+      {
+         struct ident_query *iqp = &queries[ u ].wq_query ;
+         int t ;
+
+         if ( queries[ u ].wq_conn == -1 )
+            continue ;
+         pfds[ n ].fd = iqp->iq_sd ;
+         pfds[ n ].events = query_events( iqp ) ;
+         polled[ n++ ] = &queries[ u ] ;
+         t = query_timeout( iqp, now ) ;
+         if ( t != -1 && ( timeout == -1 || t < timeout ) )
+            timeout = t ;
+      }
+
+      for ( i = 0 ; i < n ; i++ )
+         pfds[ i ].revents = 0 ;
+      if ( poll( pfds, n, timeout ) == -1 && errno != EINTR )
+         _exit( 1 ) ;
+
+      now = time( NULL ) ;
+      for ( i = 1 ; i < n ; i++ )
+      {
+         struct worker_query *wqp = polled[ i ] ;
+
+         query_step( &wqp->wq_query, pfds[ i ].revents, now ) ;
+         if ( wqp->wq_query.iq_state == IQ_DONE )
+            worker_report( ctl, wqp ) ;
+      }
+      if ( pfds[ 0 ].revents != 0 && ! worker_control( ctl, queries ) )
+         _exit( 0 ) ;
+   }
+}
+
+
+/*
+ * Fork the ident worker
+ */
+static status_e ident_worker_spawn(void)
+{
+   int sv[ 2 ] ;
+   const char *func = "ident_worker_spawn" ;
+
+   if ( socketpair( AF_UNIX, SOCK_SEQPACKET, 0, sv ) == -1 )
+   {
+      msg( LOG_ERR, func, "socketpair failed: %m" ) ;
+      return( FAILED ) ;
+   }
+
+   switch ( worker_pid = fork() )
+   {
+      case 0:
+         ident_worker_main( sv[ 1 ] ) ;
+         /* NOTREACHED */
+
+      case -1:
+         msg( LOG_ERR, func, "fork failed: %m" ) ;
+         (void) close( sv[ 0 ] ) ;
+         (void) close( sv[ 1 ] ) ;
+         worker_pid = 0 ;
+         return( FAILED ) ;
+   }
+
+   (void) close( sv[ 1 ] ) ;
+   worker_fd = sv[ 0 ] ;
+   if ( fcntl( worker_fd, F_SETFD, FD_CLOEXEC ) == -1 )
+      msg( LOG_ERR, func, "fcntl F_SETFD failed: %m" ) ;
+   FD_SET( worker_fd, &ps.rws.socket_mask ) ;
+   if ( worker_fd > ps.rws.mask_max )
+      ps.rws.mask_max = worker_fd ;
+
+   if ( debug.on )
+      msg( LOG_DEBUG, func, "started ident worker %d", worker_pid ) ;
+   return( OK ) ;
+}
+
+
+/*
+ * Send a request and the connection descriptor to the worker without
+ * blocking
+ */
+static status_e ident_send( const struct ident_request *reqp, int fd )
+{
+   struct msghdr     mh ;
+   struct iovec      iov ;
+   struct cmsghdr   *cmp ;
+   union {
+      struct cmsghdr cm ;
+      char           buf[ CMSG_SPACE( sizeof( int ) ) ] ;
+   } control ;
+   ssize_t           cc ;
+
+   CLEAR( mh ) ;
+   CLEAR( control ) ;
+   iov.iov_base = (char *) reqp ;
+   iov.iov_len = sizeof( *reqp ) ;
+   mh.msg_iov = &iov ;
+   mh.msg_iovlen = 1 ;
+   mh.msg_control = control.buf ;
+   mh.msg_controllen = sizeof( control.buf ) ;
+   cmp = CMSG_FIRSTHDR( &mh ) ;
+   cmp->cmsg_level = SOL_SOCKET ;
+   cmp->cmsg_type = SCM_RIGHTS ;
+   cmp->cmsg_len = CMSG_LEN( sizeof( int ) ) ;
+   memcpy( CMSG_DATA( cmp ), &fd, sizeof( int ) ) ;
+
+   do
+      cc = sendmsg( worker_fd, &mh, MSG_DONTWAIT ) ;
+   while ( cc == -1 && errno == EINTR ) ;
+   return( cc == sizeof( *reqp ) ? OK : FAILED ) ;
+}
+
+
+/*
+ * Look up the USERID of the refused connection cp of service sp.
+ * Returns FAILED if it has to be looked up by the logging service
+ * instead. The caller still frees cp.
+ */
+status_e ident_submit( struct service *sp, connection_s *cp )
+{
+   const union xsockaddr      *remote = CONN_XADDRESS( cp ) ;
+   const struct ident_entry   *iep ;
+   struct ident_request        req ;
+   union xsockaddr             local ;
+   socklen_t                   len = sizeof( local ) ;
+   unsigned                    id ;
+
+   if ( remote == NULL ||
+        getsockname( CONN_DESCRIPTOR( cp ), &local.sa, &len ) == -1 )
+      return( FAILED ) ;
+
+   if ( ( iep = cache_lookup( remote, addr_port( &local ), TRUE ) ) != NULL )
+   {
+      if ( iep->ie_result == IDR_OK )
+         svc_logprint( sp, USERID_ENTRY, "%s", iep->ie_user ) ;
+      return( OK ) ;
+   }
+
+   if ( ident_pending == IDENT_WORKER_QUERIES )
+      return( FAILED ) ;
+   if ( worker_pid == 0 && ident_worker_spawn() == FAILED )
+      return( FAILED ) ;
+   if ( worker_fd < 0 )
+      return( FAILED ) ;      /* lost its socket; waiting for it to exit */
+
+   for ( id = ident_next ; ident_lookups[ id ].il_sp != NULL ; )
+      id = ( id + 1 ) % IDENT_WORKER_QUERIES ;
+
+   CLEAR( req ) ;
+   req.ir_id = id ;
+   req.ir_timeout = LOGUSER_FAILURE_TIMEOUT ;
+   req.ir_local = local ;
+   req.ir_remote = *remote ;
+   if ( ident_send( &req, CONN_DESCRIPTOR( cp ) ) == FAILED )
+      return( FAILED ) ;
+
+   SVC_HOLD( sp ) ;
+   ident_lookups[ id ].il_sp = sp ;
+   ident_lookups[ id ].il_remote = *remote ;
+   ident_lookups[ id ].il_local_port = addr_port( &local ) ;
+   ident_next = ( id + 1 ) % IDENT_WORKER_QUERIES ;
+   ident_pending++ ;
+   return( OK ) ;
+}
+
+
+static void lookup_release( struct ident_lookup *ilp )
+{
+   struct service *sp = ilp->il_sp ;
+
+   ilp->il_sp = NULL ;
+   ident_pending-- ;
+   if ( SVC_RELE( sp ) == 0 )
+   {
+      pset_remove( SERVICES( ps ), sp ) ;
+      svc_release( sp ) ;
+   }
+}
+
+
+/*
+ * A lookup is over: log and keep its answer
+ */
+static void lookup_end( const struct ident_report *repp )
+{
+   struct ident_lookup *ilp ;
+   const char *func = "lookup_end" ;
+
+   if ( repp->ir_id >= IDENT_WORKER_QUERIES ||
+        ( ilp = &ident_lookups[ repp->ir_id ] )->il_sp == NULL )
+   {
+      msg( LOG_ERR, func, "ident worker %d reported unknown lookup %u",
+            worker_pid, repp->ir_id ) ;
+      return ;
+   }
+
+   cache_enter( &ilp->il_remote, ilp->il_local_port,
+                                 repp->ir_result, repp->ir_text ) ;
+   if ( repp->ir_result == IDR_OK )
+      svc_logprint( ilp->il_sp, USERID_ENTRY, "%s", repp->ir_text ) ;
+   else if ( repp->ir_result == IDR_BADRESP )
+      msg( LOG_ERR, func, "Bad line received from identity server at %s: %s",
+            xaddrname( &ilp->il_remote ), repp->ir_text ) ;
+   else if ( repp->ir_result != IDR_NOSERVER )
+      msg( LOG_ERR, func, "Failed to contact identity server at %s: %s",
+            xaddrname( &ilp->il_remote ), idresult_explain( repp->ir_result ) ) ;
+   lookup_release( ilp ) ;
+}
+
+
+/*
+ * Read the reports of the worker
+ */
+static void ident_input(void)
+{
+   for ( ;; )
+   {
+      struct ident_report rep ;
+      ssize_t cc ;
+
+      cc = recv( worker_fd, (char *) &rep, sizeof( rep ), MSG_DONTWAIT ) ;
+      if ( cc > (ssize_t) offsetof( struct ident_report, ir_text ) )
+      {
+         rep.ir_text[ sizeof( rep.ir_text ) - 1 ] = NUL ;
+         lookup_end( &rep ) ;
+         continue ;
+      }
+      if ( cc == -1 && errno == EINTR )
+         continue ;
+      if ( cc == -1 && errno == EAGAIN )
+         return ;
+      if ( cc == -1 || cc == 0 )
+         break ;
+   }
+
+   /*
+    * The worker is gone; the rest is done when it is reaped
+    */
+   FD_CLR( worker_fd, &ps.rws.socket_mask ) ;
+   (void) close( worker_fd ) ;
+   worker_fd = -1 ;
+}
+
+
+/*
+ * Handle the worker if its socket is set in the mask.
+ * Returns the number of descriptors handled.
+ */
+int ident_poll( fd_set *maskp )
+{
+   if ( worker_fd >= 0 && FD_ISSET( worker_fd, maskp ) )
+   {
+      ident_input() ;
+      return( 1 ) ;
+   }
+   return( 0 ) ;
+}
+
+
+/*
+ * Invoked when a child process exits. Returns TRUE if it was the
+ * worker, in which case its lookups are abandoned.
+ */
+bool_int ident_exit( pid_t pid, int status )
+{
+   unsigned u ;
+   const char *func = "ident_exit" ;
+
+   if ( pid <= 0 || pid != worker_pid )
+      return( FALSE ) ;
+
+   if ( worker_fd >= 0 )
+      ident_input() ;
+   if ( worker_fd >= 0 )
+   {
+      FD_CLR( worker_fd, &ps.rws.socket_mask ) ;
+      (void) close( worker_fd ) ;
+      worker_fd = -1 ;
+   }
+
+   if ( ident_pending != 0 )
+      msg( LOG_ERR, func, "ident worker %d exited with %u lookups",
+            pid, ident_pending ) ;
+   for ( u = 0 ; u < IDENT_WORKER_QUERIES ; u++ )
+      if ( ident_lookups[ u ].il_sp != NULL )
+         lookup_release( &ident_lookups[ u ] ) ;
+   worker_pid = 0 ;
+   return( TRUE ) ;
+}
+
+
+/*
+ * Returns TRUE if fd is the socket of the worker
+ */
+bool_int ident_fd( int fd )
+{
+   return( worker_pid != 0 && fd == worker_fd ) ;
+}
+
+
+/*
+ * Close the worker socket in a child that does not exec; the worker
+ * only notices that the parent is gone once all copies are closed.
+ */
+void ident_close(void)
+{
+   if ( worker_fd >= 0 )
+      (void) close( worker_fd ) ;
+}
+
+
+void ident_dump( int fd )
+{
+   unsigned u, entries = 0 ;
+   time_t now = time( NULL ) ;
+
+   if ( worker_pid != 0 )
+      Sprint( fd, "ident worker %d: lookups = %u\n",
+                                             worker_pid, ident_pending ) ;
+   for ( u = 0 ; u < IDENT_CACHE_SIZE ; u++ )
+      if ( ident_cache[ u ].ie_expires > now )
+         entries++ ;
+   Sprint( fd, "ident cache: entries = %u\n", entries ) ;
+   Sputchar( fd, '\n' ) ;
+}
@@ -1,10 +1,20 @@
 #ifndef IDENT_H
 #define IDENT_H
 
+#include <sys/types.h>
+#include <sys/time.h>
+
 #include "defs.h"
+#include "connection.h"
 
 idresult_e log_remote_user(const struct server *serp,unsigned timeout);
 const char *idresult_explain(idresult_e result);
+status_e ident_submit(struct service *sp, connection_s *cp);
+int ident_poll(fd_set *maskp);
+bool_int ident_exit(pid_t pid, int status);
+bool_int ident_fd(int fd);
+void ident_close(void);
+void ident_dump(int fd);
 
 #endif
 
@@ -18,6 +18,7 @@
 #include "pset.h"
 #include "str.h"
 #include "includedir.h"
+#include "conffile.h"
 #include "msg.h"
 #include "parse.h"
 #include "sio.h"
@@ -42,6 +43,19 @@ static int compfunc( const void *_a, const void *_b )
    return strcmp(a[0], b[0]);
 }
 
+/* Don't try to parse any files containing a dot ('.')
+ * or ending with a tilde ('~'). This catches the case of 
+ * '.' and '..', as well as preventing the parsing of 
+ * many editor files, temporary files and those saved by RPM
+ * package upgrades.
+ */
+bool_int includedir_wanted(const char *name)
+{
+   return( name[0] /* Shouldn't happen */ &&
+           strchr(name, '.') == NULL &&
+           name[strlen(name)-1] != '~' );
+}
+
 void handle_includedir(const char *service_name, struct configuration *confp)
 {
    char *filename;
@@ -84,6 +98,7 @@ void handle_includedir(const char *service_name, struct configuration *confp)
       pset_add(dir_list, storename);
    }
    closedir(dirfp);
+   conffile_note_dir(service_name);
 
    /* Sort the list using "compfunc" */
    pset_sort(dir_list, compfunc);
@@ -94,15 +109,7 @@ void handle_includedir(const char *service_name, struct configuration *confp)
    for( u = 0; (unsigned)u < pset_count(dir_list); u++ ) {
       storename = pset_pointer(dir_list, u);
 
-      /* Don't try to parse any files containing a dot ('.')
-      * or ending with a tilde ('~'). This catches the case of 
-      * '.' and '..', as well as preventing the parsing of 
-      * many editor files, temporary files and those saved by RPM
-      * package upgrades.
-      */
-      if ( !storename[0] /* Shouldn't happen */ || 
-                      strchr(storename, '.') ||
-                      storename[strlen(storename)-1] == '~') {
+      if ( !includedir_wanted(storename) ) {
          pset_remove(dir_list, storename);
          free(storename);
          u--;
@@ -139,6 +146,7 @@ void handle_includedir(const char *service_name, struct configuration *confp)
          continue;
       }
       parsemsg( LOG_DEBUG,func,"Reading included configuration file: %s",filename);
+      conffile_note(incfd, filename);
       parse_conf_file(incfd, confp, filename);
 
       /* 
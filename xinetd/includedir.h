@@ -3,6 +3,7 @@
 
 #include "conf.h"
 
+bool_int includedir_wanted(const char *name);
 void handle_includedir(const char *service_name,struct configuration *confp);
 
 #endif
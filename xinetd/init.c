@@ -153,14 +153,17 @@ static void set_fd_limit(void)
 
    maxfd = rl.rlim_max;
    if ( rl.rlim_max == RLIM_INFINITY ) 
-      rl.rlim_max = FD_SETSIZE;
+      rl.rlim_cur = FD_SETSIZE;
+   else
+      rl.rlim_cur = rl.rlim_max ;
 
    /* XXX: a dumb way to prevent fd_set overflow possibilities; the rest
-    * of xinetd should be changed to use an OpenBSD inetd-like fd_grow(). */
-   if ( rl.rlim_max > FD_SETSIZE )
-      rl.rlim_max = FD_SETSIZE;
+    * of xinetd should be changed to use an OpenBSD inetd-like fd_grow(). 
+    * Only the soft limit is lowered, so that interceptors, which use 
+    * epoll, and servers can raise theirs again. */
+   if ( rl.rlim_cur > FD_SETSIZE )
+      rl.rlim_cur = FD_SETSIZE;
      
-   rl.rlim_cur = rl.rlim_max ;
    if ( setrlimit( RLIMIT_NOFILE, &rl ) == -1 )
    {
       syscall_failed("setrlimit(RLIMIT_NOFILE)");
@@ -170,7 +173,7 @@ static void set_fd_limit(void)
    }
 
    ps.ros.orig_max_descriptors = maxfd ;
-   ps.ros.max_descriptors = rl.rlim_max ;
+   ps.ros.max_descriptors = rl.rlim_cur ;
 #else      /* ! RLIMIT_NOFILE */
    ps.ros.max_descriptors = getdtablesize() ;
 #endif   /* RLIMIT_NOFILE */
@@ -101,63 +101,6 @@ void intercept( struct server *serp )
 }
 
 
-/*
- * Create a socket and bind it to (INADDR_LOOPBACK,0)
- */
-static int get_server_socket( struct intercept_s *ip )
-{
-   struct service *sp = SERVER_SERVICE( INT_SERVER( ip ) ) ;
-   union xsockaddr *sinp = INT_LOCALADDR( ip ) ;
-   int sd ;
-   socklen_t size = AF_UNIX ;
-
-   const char *func = "get_server_socket" ;
-
-   if( SC_IPV6(SVC_CONF(sp)) ) {
-      struct addrinfo hint, *res = NULL;
-      memset(&hint, 0, sizeof(struct addrinfo));
-      hint.ai_family = AF_INET6;
-      hint.ai_flags = AI_NUMERICHOST;
-      sinp->sa_in6.sin6_family = AF_INET6;
-      sinp->sa_in6.sin6_port = 0;
-      if( getaddrinfo("::1", NULL, &hint, &res) != 0  )
-         int_fail( ip, "can't find ::1" );
-      if( res == NULL )
-         int_fail( ip, "no results for ::1" );
-      if( res->ai_family != AF_INET6 )
-         int_fail( ip, "non IPv6 result for ::1" );
-      memcpy(sinp, res->ai_addr, sizeof( struct sockaddr_in6 ));
-      freeaddrinfo(res);
-      size = sizeof(struct sockaddr_in6);
-   } else if( SC_IPV4(SVC_CONF(sp)) ) {
-      sinp->sa_in.sin_family = AF_INET;
-      sinp->sa_in.sin_port = 0;
-      sinp->sa_in.sin_addr.s_addr = inet_addr( "127.0.0.1" );
-      size = sizeof(struct sockaddr_in);
-   } else
-      int_fail( ip, "unknown socket family" );
-
-   if ( ( sd = socket( sinp->sa.sa_family, SVC_SOCKET_TYPE( sp ), SC_PROTOVAL(SVC_CONF(sp)) ) ) == -1 )
-      int_fail( ip, "socket creation" ) ;
-
-   if ( bind( sd, SA( sinp ), size ) == -1 )
-      int_fail( ip, "bind" ) ;
-   
-   size = sizeof( *sinp ) ;
-   if ( getsockname( sd, (struct sockaddr *)( sinp ), &size ) == -1 )
-      int_fail( ip, "getsockname" ) ;
-   
-   if ( debug.on )
-      msg( LOG_DEBUG, func, "address = %s, port = %d",
-         xaddrname( sinp ), ntohs( xaddrport( sinp ) ) ) ;
-      
-   if ( ip->int_socket_type == SOCK_STREAM )
-      (void) listen( sd, LISTEN_BACKLOG ) ;
-   
-   return( sd ) ;
-}
-
-
 static void start_server( struct intercept_s *ip )
 {
    struct server      *serp = INT_SERVER( ip ) ;
@@ -165,7 +108,8 @@ static void start_server( struct intercept_s *ip )
    int                server_socket ;
    pid_t              pid ;
 
-   server_socket = get_server_socket( ip ) ;
+   if ( ( server_socket = int_server_socket( ip ) ) == -1 )
+      int_fail( ip, "server socket" ) ;
    
    pid = fork() ;
 
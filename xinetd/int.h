@@ -27,6 +27,8 @@ struct channel
    union xsockaddr      ch_from ;
    int                  ch_local_socket ;
    int                  ch_remote_socket ;
+   struct channel      *ch_next ;           /* in its hash chain */
+   unsigned             ch_flags ;          /* used by intloop.c */
 } ;
 
 typedef struct channel channel_s ;
@@ -45,6 +47,11 @@ struct intercept_common
    int                  ic_remote_socket ;
    union xsockaddr      ic_local_addr ;
    pset_h               ic_connections ;
+   struct channel     **ic_table ;          /* connections by address */
+   int                  ic_epfd ;           /* -1 unless using epoll */
+   struct channel     **ic_fds ;            /* channels by descriptor */
+   int                  ic_fds_size ;
+   bool_int             ic_inline ;         /* in xinetd itself */
    struct server        ic_server ;
 } ;
 
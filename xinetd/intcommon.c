@@ -9,21 +9,40 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
 #include <signal.h>
 #include <syslog.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "intcommon.h"
 #include "msg.h"
 #include "signals.h"
 #include "connection.h"
+#include "access.h"
+#include "log.h"
 #include "sconf.h"
 #include "state.h"
 #include "main.h"
+#include "util.h"
+#include "intloop.h"
 #include "xconfig.h"
 
+/*
+ * Number of hash chains of the connection table
+ */
+#define INT_BUCKETS              4096
+
+#define INT_HASH( addrp )        ( xaddrhash( addrp, TRUE ) % INT_BUCKETS )
+
 
 void int_fail( const struct intercept_s *ip, const char *lsyscall )
 {
@@ -110,6 +129,7 @@ void int_init( struct intercept_s *ip, struct server *serp )
          xlog_destroy( SVC_LOG( sp ) ) ;
       (void) Sclose( SVC_FD( sp ) ) ;
    }
+   intloop_close() ;
 
    /*
     * Setup signal handling
@@ -121,19 +141,155 @@ void int_init( struct intercept_s *ip, struct server *serp )
    if ( signal( SIGTERM, int_sighandler ) == SIG_ERR )
       int_fail( ip, "signal" ) ;
    
-   /*
-    * Initialize state
-    */
+   if ( int_setup( ip, serp ) == FAILED )
+      (*ip->int_ops->exit)() ;
+}
+
+
+/*
+ * Initialize the state of ip for intercepting the connections of serp
+ */
+status_e int_setup( struct intercept_s *ip, struct server *serp )
+{
+   const char *func = "int_setup" ;
+
    INTERCEPT( ip ) = TRUE ;
    *INT_SERVER( ip ) = *serp ;
    INT_REMOTE( ip ) = SERVER_FD( serp ) ;
 
    INT_CONNECTIONS( ip ) = pset_create( 0, 0 ) ;
-   if ( INT_CONNECTIONS( ip ) == NULL )
+   ip->int_common.ic_table = 
+         (channel_s **) calloc( INT_BUCKETS, sizeof( channel_s * ) ) ;
+   if ( INT_CONNECTIONS( ip ) == NULL || ip->int_common.ic_table == NULL )
    {
       msg( LOG_ERR, func, ES_NOMEM ) ;
-      (*ip->int_ops->exit)() ;
+      int_cleanup( ip ) ;
+      return( FAILED ) ;
+   }
+   ip->int_common.ic_epfd = -1 ;
+   return( OK ) ;
+}
+
+
+/*
+ * Free what int_setup allocated, and the descriptor table. The
+ * channels must have been closed already.
+ */
+void int_cleanup( struct intercept_s *ip )
+{
+   if ( INT_CONNECTIONS( ip ) != NULL )
+      pset_destroy( INT_CONNECTIONS( ip ) ) ;
+   if ( ip->int_common.ic_table != NULL )
+      free( ip->int_common.ic_table ) ;
+   if ( ip->int_common.ic_fds != NULL )
+      free( ip->int_common.ic_fds ) ;
+   INT_CONNECTIONS( ip ) = NULL ;
+   ip->int_common.ic_table = NULL ;
+   ip->int_common.ic_fds = NULL ;
+   ip->int_common.ic_fds_size = 0 ;
+}
+
+
+/*
+ * Create the socket the server is given: a socket bound to the
+ * loopback address, at INT_LOCALADDR( ip ).
+ * Returns the socket, or -1.
+ */
+int int_server_socket( struct intercept_s *ip )
+{
+   struct service *sp = SERVER_SERVICE( INT_SERVER( ip ) ) ;
+   union xsockaddr *sinp = INT_LOCALADDR( ip ) ;
+   int sd ;
+   socklen_t size = AF_UNIX ;
+
+   const char *func = "int_server_socket" ;
+
+   if( SC_IPV6(SVC_CONF(sp)) ) {
+      struct addrinfo hint, *res = NULL;
+      memset(&hint, 0, sizeof(struct addrinfo));
+      hint.ai_family = AF_INET6;
+      hint.ai_flags = AI_NUMERICHOST;
+      sinp->sa_in6.sin6_family = AF_INET6;
+      sinp->sa_in6.sin6_port = 0;
+      if( getaddrinfo("::1", NULL, &hint, &res) != 0 || res == NULL ||
+          res->ai_family != AF_INET6 ) {
+         msg( LOG_ERR, func, "can't find ::1" ) ;
+         if ( res != NULL )
+            freeaddrinfo(res);
+         return( -1 ) ;
+      }
+      memcpy(sinp, res->ai_addr, sizeof( struct sockaddr_in6 ));
+      freeaddrinfo(res);
+      size = sizeof(struct sockaddr_in6);
+   } else if( SC_IPV4(SVC_CONF(sp)) ) {
+      sinp->sa_in.sin_family = AF_INET;
+      sinp->sa_in.sin_port = 0;
+      sinp->sa_in.sin_addr.s_addr = inet_addr( "127.0.0.1" );
+      size = sizeof(struct sockaddr_in);
+   } else {
+      msg( LOG_ERR, func, "unknown socket family" ) ;
+      return( -1 ) ;
+   }
+
+   if ( ( sd = socket( sinp->sa.sa_family, SVC_SOCKET_TYPE( sp ), SC_PROTOVAL(SVC_CONF(sp)) ) ) == -1 )
+   {
+      msg( LOG_ERR, func, "socket creation failed: %m" ) ;
+      return( -1 ) ;
    }
+
+   if ( bind( sd, SA( sinp ), size ) == -1 )
+   {
+      msg( LOG_ERR, func, "bind failed: %m" ) ;
+      (void) Sclose( sd ) ;
+      return( -1 ) ;
+   }
+   
+   size = sizeof( *sinp ) ;
+   if ( getsockname( sd, (struct sockaddr *)( sinp ), &size ) == -1 )
+   {
+      msg( LOG_ERR, func, "getsockname failed: %m" ) ;
+      (void) Sclose( sd ) ;
+      return( -1 ) ;
+   }
+   
+   if ( debug.on )
+      msg( LOG_DEBUG, func, "address = %s, port = %d",
+         xaddrname( sinp ), ntohs( xaddrport( sinp ) ) ) ;
+      
+   if ( ip->int_socket_type == SOCK_STREAM )
+      (void) listen( sd, LISTEN_BACKLOG ) ;
+   
+   return( sd ) ;
+}
+
+
+/*
+ * Check the address and the time of access of a new client at sinp.
+ * A refused client is logged.
+ */
+status_e int_access( struct intercept_s *ip, union xsockaddr *sinp )
+{
+   struct server  *serp  = INT_SERVER( ip ) ;
+   struct service *sp    = SERVER_SERVICE( serp ) ;
+   connection_s   *cop   = SERVER_CONNECTION( serp ) ;
+
+   CONN_SETADDR( cop, sinp ) ;      /* for logging */
+
+   if ( INTERCEPT( ip ) )
+   {
+      mask_t check_mask ;
+      access_e result ;
+      
+      M_OR( check_mask, XMASK( CF_ADDRESS ), XMASK( CF_TIME ) ) ;
+      result = access_control( sp, cop, &check_mask ) ;
+
+      if ( result != AC_OK )
+      {
+         svc_log_failure( sp, cop, result ) ;
+         return( FAILED ) ;
+      }
+   }
+   return( OK ) ;
 }
 
 
@@ -162,7 +318,21 @@ channel_s *int_newconn( struct intercept_s *ip,
       return( CHANNEL_NULL ) ;
    }
 
-   if ( connect( sd, SA( local ), sizeof( *local ) ) == -1 )
+   (void) fcntl( sd, F_SETFD, FD_CLOEXEC ) ;
+
+   /*
+    * Inside xinetd, the connect must not block when the server is
+    * slow to accept. Until it completes, sends fail with EAGAIN.
+    */
+   if ( ip->int_common.ic_inline && fcntl( sd, F_SETFL, O_NONBLOCK ) == -1 )
+   {
+      msg( LOG_ERR, func, "(intercepting %s) fcntl failed: %m", sid ) ;
+      (void) Sclose( sd ) ;
+      return( CHANNEL_NULL ) ;
+   }
+
+   if ( connect( sd, SA( local ), sizeof( *local ) ) == -1 &&
+         ! ( ip->int_common.ic_inline && errno == EINPROGRESS ) )
    {
       msg( LOG_ERR, func, "(intercepting %s) connect failed: %m", sid ) ;
       (void) Sclose( sd ) ;
@@ -189,6 +359,9 @@ channel_s *int_newconn( struct intercept_s *ip,
    chp->ch_from = *sinp ;
    chp->ch_local_socket = sd ;
    chp->ch_remote_socket = remote_socket ;
+   chp->ch_flags = 0 ;
+   chp->ch_next = ip->int_common.ic_table[ INT_HASH( sinp ) ] ;
+   ip->int_common.ic_table[ INT_HASH( sinp ) ] = chp ;
    return( chp ) ;
 }
 
@@ -200,28 +373,171 @@ channel_s *int_newconn( struct intercept_s *ip,
  *    a connection pointer if the address is found
  *    NULL if the address if not found
  *
- * *addr_checked is set to TRUE of FALSE depending on whether there
- * is already a connection from the same IP address in the table.
+ * *addr_checked is set to TRUE if the address was found, and so has
+ * already been checked and logged.
  */
 channel_s *int_lookupconn( struct intercept_s *ip, 
                            union xsockaddr *sinp,
                            bool_int *addr_checked )
 {
-   unsigned      u ;
-   pset_h      conntab = INT_CONNECTIONS( ip ) ;
+   channel_s *chp ;
 
-   *addr_checked = FALSE ;
+   for ( chp = ip->int_common.ic_table[ INT_HASH( sinp ) ] ; 
+                                             chp ; chp = chp->ch_next )
+      if ( xaddrequal( &chp->ch_from, sinp ) )
+         break ;
+   *addr_checked = ( chp != CHANNEL_NULL ) ;
+   return( chp ) ;
+}
 
-   for ( u = 0 ; u < pset_count( conntab ) ; u++ )
+
+/*
+ * Remove a connection from the hash table. The caller removes it from
+ * the connection table and frees it.
+ */
+void int_unlinkconn( struct intercept_s *ip, channel_s *chp )
+{
+   channel_s **pp = &ip->int_common.ic_table[ INT_HASH( &chp->ch_from ) ] ;
+
+   while ( *pp != CHANNEL_NULL && *pp != chp )
+      pp = &(*pp)->ch_next ;
+   if ( *pp == chp )
+      *pp = chp->ch_next ;
+}
+
+
+#ifdef HAVE_EPOLL_CREATE
+
+/*
+ * Set up epoll for the interceptor and register the service socket
+ */
+status_e int_epoll_init( struct intercept_s *ip )
+{
+#ifdef RLIMIT_NOFILE
+   struct rlimit rl ;
+#endif
+   const char *func = "int_epoll_init" ;
+
+   if ( ( ip->int_common.ic_epfd = epoll_create( 64 ) ) == -1 )
+   {
+      msg( LOG_ERR, func, "epoll_create: %m" ) ;
+      return( FAILED ) ;
+   }
+   (void) fcntl( ip->int_common.ic_epfd, F_SETFD, FD_CLOEXEC ) ;
+
+   /*
+    * Without select(2), the interceptor is not limited to FD_SETSIZE
+    * descriptors.
+    */
+#ifdef RLIMIT_NOFILE
+   rl.rlim_max = ps.ros.orig_max_descriptors ;
+   rl.rlim_cur = ps.ros.orig_max_descriptors ;
+   (void) setrlimit( RLIMIT_NOFILE, &rl ) ;
+#endif
+   return( int_watch( ip, INT_REMOTE( ip ), CHANNEL_NULL ) ) ;
+}
+
+
+/*
+ * Wait for input on fd, which belongs to channel chp
+ */
+status_e int_watch( struct intercept_s *ip, int fd, channel_s *chp )
+{
+   struct intercept_common *icp = &ip->int_common ;
+   struct epoll_event ev ;
+   const char *func = "int_watch" ;
+
+   if ( fd >= icp->ic_fds_size )
    {
-      register channel_s *chp = CHP( pset_pointer( conntab, u ) ) ;
+      int size = icp->ic_fds_size ? icp->ic_fds_size : 64 ;
+      channel_s **p ;
 
-      if ( memcmp( &chp->ch_from, sinp, sizeof( *sinp ) ) == 0 )
+      while ( size <= fd )
+         size *= 2 ;
+      p = (channel_s **) realloc( icp->ic_fds, size * sizeof( *p ) ) ;
+      if ( p == NULL )
       {
-         *addr_checked = TRUE ;
-         if ( xaddrport(&chp->ch_from) == xaddrport(sinp) )
-            return( chp ) ;
+         msg( LOG_ERR, func, ES_NOMEM ) ;
+         return( FAILED ) ;
       }
+      while ( icp->ic_fds_size < size )
+         p[ icp->ic_fds_size++ ] = CHANNEL_NULL ;
+      icp->ic_fds = p ;
    }
-   return( CHANNEL_NULL ) ;
+
+   ev.events = EPOLLIN ;
+   ev.data.fd = fd ;
+   if ( epoll_ctl( icp->ic_epfd, EPOLL_CTL_ADD, fd, &ev ) == -1 )
+   {
+      msg( LOG_ERR, func, "epoll_ctl: %m" ) ;
+      return( FAILED ) ;
+   }
+   icp->ic_fds[ fd ] = chp ;
+   return( OK ) ;
 }
+
+
+/*
+ * Change the events fd, which is being watched, is waited for
+ */
+status_e int_rewatch( struct intercept_s *ip, int fd, unsigned events )
+{
+   struct epoll_event ev ;
+   const char *func = "int_rewatch" ;
+
+   ev.events = events ;
+   ev.data.fd = fd ;
+   if ( epoll_ctl( ip->int_common.ic_epfd, EPOLL_CTL_MOD, fd, &ev ) == -1 )
+   {
+      msg( LOG_ERR, func, "epoll_ctl: %m" ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+
+void int_unwatch( struct intercept_s *ip, int fd )
+{
+   struct intercept_common *icp = &ip->int_common ;
+
+   if ( fd < icp->ic_fds_size && icp->ic_fds[ fd ] != CHANNEL_NULL )
+   {
+      (void) epoll_ctl( icp->ic_epfd, EPOLL_CTL_DEL, fd, NULL ) ;
+      icp->ic_fds[ fd ] = CHANNEL_NULL ;
+   }
+}
+
+
+/*
+ * The channel fd belongs to, or NULL
+ */
+channel_s *int_channel( const struct intercept_s *ip, int fd )
+{
+   if ( fd < 0 || fd >= ip->int_common.ic_fds_size )
+      return( CHANNEL_NULL ) ;
+   return( ip->int_common.ic_fds[ fd ] ) ;
+}
+
+
+/*
+ * Returns either a positive number of events or -1
+ */
+int int_wait( struct intercept_s *ip, struct epoll_event *events, int max )
+{
+   const char *func = "int_wait" ;
+
+   for ( ;; )
+   {
+      int n_ready = epoll_wait( ip->int_common.ic_epfd, events, max, -1 ) ;
+
+      if ( n_ready > 0 )
+         return( n_ready ) ;
+      if ( n_ready == -1 && errno != EINTR )
+      {
+         msg( LOG_ERR, func, "epoll_wait: %m" ) ;
+         return( -1 ) ;
+      }
+   }
+}
+
+#endif   /* HAVE_EPOLL_CREATE */
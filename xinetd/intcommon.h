@@ -3,6 +3,9 @@
 
 #include "config.h"
 #include <sys/types.h>
+#ifdef HAVE_EPOLL_CREATE
+#include <sys/epoll.h>
+#endif
 #include "int.h"
 
 void int_fail(const struct intercept_s *ip,const char *lsyscall);
@@ -12,10 +15,23 @@ __attribute__ ((noreturn))
 #endif
 void int_exit(struct intercept_s *ip);
 void int_init(struct intercept_s *ip,struct server *serp);
+status_e int_setup(struct intercept_s *ip, struct server *serp);
+void int_cleanup(struct intercept_s *ip);
+int int_server_socket(struct intercept_s *ip);
+status_e int_access(struct intercept_s *ip, union xsockaddr *sinp);
 
 channel_s *int_newconn( struct intercept_s *ip, union xsockaddr *sinp, 
                         int remote_socket );
 channel_s *int_lookupconn( struct intercept_s *ip, union xsockaddr *sinp, 
                            bool_int *addr_checked );
+void int_unlinkconn( struct intercept_s *ip, channel_s *chp );
+#ifdef HAVE_EPOLL_CREATE
+status_e int_epoll_init( struct intercept_s *ip );
+status_e int_watch( struct intercept_s *ip, int fd, channel_s *chp );
+status_e int_rewatch( struct intercept_s *ip, int fd, unsigned events );
+void int_unwatch( struct intercept_s *ip, int fd );
+channel_s *int_channel( const struct intercept_s *ip, int fd );
+int int_wait( struct intercept_s *ip, struct epoll_event *events, int max );
+#endif
 #endif
 
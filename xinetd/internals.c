@@ -19,6 +19,14 @@
 
 #include "sio.h"
 #include "internals.h"
+#include "autoreload.h"
+#include "conffile.h"
+#include "proxy.h"
+#include "ident.h"
+#include "logwriter.h"
+#include "logstorm.h"
+#include "intloop.h"
+#include "engine.h"
 #include "msg.h"
 #include "sconf.h"
 #include "state.h"
@@ -26,6 +34,7 @@
 #include "xconfig.h"
 #include "xtimer.h"
 #include "options.h"
+#include "retry.h"
 
 static unsigned thread_check( register struct service *sp,unsigned running_servers, unsigned retry_servers );
 static unsigned refcount_check( struct service *sp, unsigned *running_servers, unsigned *retry_servers );
@@ -87,6 +96,8 @@ void dump_internal_state(void)
    Sprint( dump_fd, "Current time: %s\n", ctime( &current_time ) ) ;
 
    dump_services( dump_fd ) ;
+   conffile_dump( dump_fd ) ;
+   autoreload_dump( dump_fd ) ;
 
    /*
     * Dump the server table
@@ -103,6 +114,14 @@ void dump_internal_state(void)
    for ( u = 0 ; u < pset_count( RETRIES( ps ) ) ; u++ )
       server_dump( SERP( pset_pointer( RETRIES( ps ), u ) ), dump_fd ) ;
    Sputchar( dump_fd, '\n' ) ;
+   retry_dump( dump_fd ) ;
+   server_spawn_dump( dump_fd ) ;
+   proxy_dump( dump_fd ) ;
+   ident_dump( dump_fd ) ;
+   logwriter_dump( dump_fd ) ;
+   logstorm_dump( dump_fd ) ;
+   intloop_dump( dump_fd ) ;
+   engine_dump( dump_fd ) ;
 
    /*
     * Dump the socket mask
@@ -249,7 +268,7 @@ static void consistency_check( enum check_type type )
     * Check if there are any descriptors set in socket_mask_copy
     */
    for ( fd = 0 ; (unsigned)fd < ps.ros.max_descriptors ; fd++ )
-      if ( FD_ISSET( fd, &socket_mask_copy ) && ((fd != signals_pending[0]) && fd != signals_pending[1]))
+      if ( FD_ISSET( fd, &socket_mask_copy ) && ((fd != signals_pending[0]) && fd != signals_pending[1]) && ! proxy_fd( fd ) && ! ident_fd( fd ) && ! autoreload_fd( fd ) && ! logstorm_fd( fd ) && ! intloop_fd( fd ) && ! engine_fd( fd ))
       {
          msg( LOG_ERR, func,
             "descriptor %d set in socket mask but there is no service for it",
@@ -369,7 +388,7 @@ static int count_refs( struct service *sp, pset_h servers, unsigned *countp )
 
    for ( u = 0 ; u < pset_count( servers ) ; u++ )
    {
-      serp = SERP( pset_pointer( SERVERS( ps ), u ) ) ;
+      serp = SERP( pset_pointer( servers, u ) ) ;
       if ( SERVER_SERVICE( serp ) == sp )
       {
          refs++ ;
@@ -0,0 +1,688 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#ifdef HAVE_EPOLL_CREATE
+#include <sys/epoll.h>
+#endif
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "sio.h"
+#include "intloop.h"
+#include "intcommon.h"
+#include "udpint.h"
+#include "connection.h"
+#include "log.h"
+#include "main.h"
+#include "msg.h"
+#include "sconf.h"
+#include "state.h"
+#include "util.h"
+#include "xconfig.h"
+
+/*
+ * A note on inline interception:
+ * A service with intercept_mode = inline is intercepted by xinetd
+ * itself rather than by a forked interceptor. Its server is forked as
+ * usual, except that it is given a socket bound to the loopback
+ * address instead of the service socket. xinetd keeps the service
+ * socket: it accepts the connections (or receives the datagrams) of
+ * the clients, checks their address and access times, and relays
+ * their data to and from the server. Each intercepted server has an
+ * epoll(7) descriptor for its channels, which is part of the socket
+ * mask of the main loop.
+ *
+ * Stream data is relayed without blocking and without buffering: it
+ * is peeked at, sent as far as the other side takes it, and only that
+ * much is consumed. While one side can't take any more, the other is
+ * not read, so that tcp flow control works from end to end.
+ */
+
+#ifdef HAVE_EPOLL_CREATE
+
+/*
+ * Maximum number of events handled per wakeup
+ */
+#define IL_EVENTS             64
+
+/*
+ * ch_flags of a stream channel
+ */
+#define IL_LOCAL_EOF          0x1      /* the server sends no more */
+#define IL_REMOTE_EOF         0x2      /* the client sends no more */
+#define IL_LOCAL_FULL         0x4      /* the server takes no more for now */
+#define IL_REMOTE_FULL        0x8      /* the client takes no more for now */
+
+struct intloop
+{
+   struct intercept_s      il_int ;
+   struct server          *il_server ;      /* in the server table */
+   connection_s            il_conn ;        /* of the last client */
+   int                     il_socket ;      /* for the server, until forked */
+   bool_int                il_started ;
+   bool_int                il_accepting ;   /* FALSE when out of descriptors */
+   unsigned                il_accepted ;
+   struct idgram_private   il_idgram ;
+   struct intloop         *il_next ;
+} ;
+
+#define IL_EPFD( ilp )        ( (ilp)->il_int.int_common.ic_epfd )
+#define IL_STREAM( ilp )      ( (ilp)->il_int.int_socket_type == SOCK_STREAM )
+
+static struct intloop *intloops ;
+
+static char il_buf[ INT_INLINE_CHUNK ] ;
+
+
+static struct intloop *il_find( const struct server *serp )
+{
+   struct intloop *ilp ;
+
+   for ( ilp = intloops ; ilp != NULL ; ilp = ilp->il_next )
+      if ( ilp->il_server == serp )
+         return( ilp ) ;
+   return( NULL ) ;
+}
+
+
+static void il_close( struct intloop *ilp, channel_s *chp )
+{
+   struct intercept_s *ip = &ilp->il_int ;
+   const char *func = "il_close" ;
+
+   if ( debug.on )
+      msg( LOG_DEBUG, func, "Closing channel to %s,%d",
+            xaddrname( &chp->ch_from ), ntohs( xaddrport( &chp->ch_from ) ) ) ;
+
+   int_unwatch( ip, chp->ch_local_socket ) ;
+   (void) Sclose( chp->ch_local_socket ) ;
+   if ( IL_STREAM( ilp ) )
+   {
+      int_unwatch( ip, chp->ch_remote_socket ) ;
+      (void) Sclose( chp->ch_remote_socket ) ;
+   }
+   int_unlinkconn( ip, chp ) ;
+   pset_remove( INT_CONNECTIONS( ip ), chp ) ;
+   FREE_CHANNEL( chp ) ;
+
+   if ( ! ilp->il_accepting &&
+         int_rewatch( ip, INT_REMOTE( ip ), EPOLLIN ) == OK )
+      ilp->il_accepting = TRUE ;
+}
+
+
+/*
+ * Free ilp and everything it holds, except the service socket
+ */
+static void il_free( struct intloop *ilp )
+{
+   struct intercept_s *ip = &ilp->il_int ;
+   unsigned u ;
+
+   if ( IL_EPFD( ilp ) >= 0 )
+   {
+      FD_CLR( IL_EPFD( ilp ), &ps.rws.socket_mask ) ;
+      (void) close( IL_EPFD( ilp ) ) ;
+   }
+   if ( ilp->il_socket >= 0 )
+      (void) Sclose( ilp->il_socket ) ;
+   for ( u = 0 ; INT_CONNECTIONS( ip ) &&
+                     u < pset_count( INT_CONNECTIONS( ip ) ) ; u++ )
+   {
+      channel_s *chp = CHP( pset_pointer( INT_CONNECTIONS( ip ), u ) ) ;
+
+      (void) Sclose( chp->ch_local_socket ) ;
+      if ( IL_STREAM( ilp ) )
+         (void) Sclose( chp->ch_remote_socket ) ;
+      FREE_CHANNEL( chp ) ;
+   }
+   int_cleanup( ip ) ;
+   FREE( ilp ) ;
+}
+
+
+/*
+ * Set up the inline interception of server serp before it is forked.
+ * Returns FAILED if a forked interceptor should be used instead.
+ */
+status_e intloop_prepare( struct server *serp )
+{
+   struct service       *sp = SERVER_SERVICE( serp ) ;
+   struct intloop       *ilp ;
+   struct intercept_s   *ip ;
+   const char           *func = "intloop_prepare" ;
+
+   if ( ( ilp = NEW( struct intloop ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      return( FAILED ) ;
+   }
+   CLEAR( *ilp ) ;
+   ip = &ilp->il_int ;
+   ilp->il_server = serp ;
+   ilp->il_socket = -1 ;
+   ilp->il_accepting = TRUE ;
+   IL_EPFD( ilp ) = -1 ;
+
+   /*
+    * The clients are logged with a connection of our own, so that the
+    * server keeps the address it was started for
+    */
+   ilp->il_conn = *SERVER_CONNECTION( serp ) ;
+   if ( int_setup( ip, serp ) == FAILED )
+   {
+      il_free( ilp ) ;
+      return( FAILED ) ;
+   }
+   INT_SERVER( ip )->svr_conn = &ilp->il_conn ;
+   ip->int_common.ic_inline = TRUE ;
+
+   if ( SVC_SOCKET_TYPE( sp ) == SOCK_DGRAM )
+   {
+      if ( di_inline( ip, &ilp->il_idgram ) == FAILED )
+      {
+         il_free( ilp ) ;
+         return( FAILED ) ;
+      }
+   }
+   else
+      ip->int_socket_type = SOCK_STREAM ;
+
+   /*
+    * The epoll descriptor goes in the socket mask of the main loop
+    */
+   if ( ( IL_EPFD( ilp ) = epoll_create( IL_EVENTS ) ) == -1 )
+   {
+      msg( LOG_ERR, func, "epoll_create: %m" ) ;
+      il_free( ilp ) ;
+      return( FAILED ) ;
+   }
+   if ( IL_EPFD( ilp ) >= FD_SETSIZE )
+   {
+      msg( LOG_ERR, func, "%s: epoll descriptor %d is too large",
+            SVC_ID( sp ), IL_EPFD( ilp ) ) ;
+      (void) close( IL_EPFD( ilp ) ) ;
+      IL_EPFD( ilp ) = -1 ;
+      il_free( ilp ) ;
+      return( FAILED ) ;
+   }
+   (void) fcntl( IL_EPFD( ilp ), F_SETFD, FD_CLOEXEC ) ;
+
+   if ( ( ilp->il_socket = int_server_socket( ip ) ) == -1 ||
+         int_watch( ip, INT_REMOTE( ip ), CHANNEL_NULL ) == FAILED )
+   {
+      il_free( ilp ) ;
+      return( FAILED ) ;
+   }
+
+   ilp->il_next = intloops ;
+   intloops = ilp ;
+   return( OK ) ;
+}
+
+
+/*
+ * Invoked in the forked process. If serp is intercepted inline, it is
+ * turned into the server, which is given the loopback socket.
+ */
+void intloop_child( struct server *serp )
+{
+   struct intloop *ilp = il_find( serp ) ;
+
+   if ( ilp == NULL )
+      return ;
+   CONN_SET_DESCRIPTOR( SERVER_CONNECTION( serp ), ilp->il_socket ) ;
+   SVC_MAKE_EXTERNAL( SERVER_SERVICE( serp ) ) ;
+   SERVER_LOGUSER( serp ) = FALSE ;
+}
+
+
+/*
+ * The server of serp has been forked: start intercepting
+ */
+void intloop_start( struct server *serp )
+{
+   struct intloop *ilp = il_find( serp ) ;
+   struct intercept_s *ip ;
+   const char *func = "intloop_start" ;
+
+   if ( ilp == NULL )
+      return ;
+   ip = &ilp->il_int ;
+
+   (void) Sclose( ilp->il_socket ) ;
+   ilp->il_socket = -1 ;
+   SERVER_PID( INT_SERVER( ip ) ) = SERVER_PID( serp ) ;
+
+   if ( IL_STREAM( ilp ) &&
+         fcntl( INT_REMOTE( ip ), F_SETFL, O_NONBLOCK ) == -1 )
+      msg( LOG_ERR, func, "%s: fcntl F_SETFL failed: %m",
+            SVC_ID( SERVER_SERVICE( serp ) ) ) ;
+
+   FD_SET( IL_EPFD( ilp ), &ps.rws.socket_mask ) ;
+   if ( IL_EPFD( ilp ) > ps.rws.mask_max )
+      ps.rws.mask_max = IL_EPFD( ilp ) ;
+   ilp->il_started = TRUE ;
+
+   if ( debug.on )
+      msg( LOG_DEBUG, func, "intercepting %s server %d inline",
+            SVC_ID( SERVER_SERVICE( serp ) ), SERVER_PID( serp ) ) ;
+}
+
+
+/*
+ * The server of serp is gone (or could not be forked): close all its
+ * channels
+ */
+void intloop_end( struct server *serp )
+{
+   struct intloop **pp ;
+   struct intloop *ilp ;
+   struct service *sp = SERVER_SERVICE( serp ) ;
+   int fd ;
+
+   for ( pp = &intloops ; *pp != NULL && (*pp)->il_server != serp ; )
+      pp = &(*pp)->il_next ;
+   if ( ( ilp = *pp ) == NULL )
+      return ;
+   *pp = ilp->il_next ;
+
+   /*
+    * As a forked interceptor does, take the request the server was
+    * started for if it never got to it, so that it does not start
+    * another server right away. Unless the service was deactivated,
+    * its socket is still there.
+    */
+   fd = INT_REMOTE( &ilp->il_int ) ;
+   if ( ilp->il_started && SVC_IS_AVAILABLE( sp ) )
+   {
+      if ( IL_STREAM( ilp ) )
+      {
+         if ( ilp->il_accepted == 0 )
+         {
+            int sd = accept( fd, SA( NULL ), NULL ) ;
+
+            if ( sd != -1 )
+               (void) close( sd ) ;
+         }
+         (void) fcntl( fd, F_SETFL, 0 ) ;
+      }
+      else if ( ilp->il_idgram.received_packets == 0 )
+         drain( fd ) ;
+   }
+   il_free( ilp ) ;
+}
+
+
+/*
+ * Accept a new client of a stream service
+ */
+static void il_channel( struct intloop *ilp, int sd, union xsockaddr *sinp )
+{
+   struct intercept_s   *ip = &ilp->il_int ;
+   struct server        *serp = INT_SERVER( ip ) ;
+   channel_s            *chp ;
+   bool_int              addr_checked ;
+   const char           *func = "il_channel" ;
+
+   if ( debug.on )
+      msg( LOG_DEBUG, func, "connection request from %s,%d",
+         xaddrname( sinp ), ntohs( xaddrport( sinp ) ) ) ;
+
+   if ( int_lookupconn( ip, sinp, &addr_checked ) != CHANNEL_NULL )
+   {
+      msg( LOG_ERR, func,
+         "Received another connection request from %s,%d",
+            xaddrname( sinp ), ntohs( xaddrport( sinp ) ) ) ;
+      (void) close( sd ) ;
+      return ;
+   }
+
+   (void) fcntl( sd, F_SETFD, FD_CLOEXEC ) ;
+   if ( fcntl( sd, F_SETFL, O_NONBLOCK ) == -1 ||
+         int_access( ip, sinp ) == FAILED ||
+         ( chp = int_newconn( ip, sinp, sd ) ) == CHANNEL_NULL )
+   {
+      (void) close( sd ) ;
+      return ;
+   }
+
+#if defined( TCP_NODELAY )
+   {
+      int on = 1 ;
+
+      (void) setsockopt( chp->ch_local_socket, IPPROTO_TCP,
+                           TCP_NODELAY, (char *) &on, sizeof( on ) ) ;
+      (void) setsockopt( chp->ch_remote_socket, IPPROTO_TCP,
+                           TCP_NODELAY, (char *) &on, sizeof( on ) ) ;
+   }
+#endif   /* TCP_NODELAY */
+
+   if ( int_watch( ip, chp->ch_local_socket, chp ) == FAILED ||
+         int_watch( ip, chp->ch_remote_socket, chp ) == FAILED )
+   {
+      il_close( ilp, chp ) ;
+      return ;
+   }
+
+   svc_log_success( SERVER_SERVICE( serp ), SERVER_CONNECTION( serp ),
+                                                      SERVER_PID( serp ) ) ;
+}
+
+
+static void il_accept( struct intloop *ilp )
+{
+   struct intercept_s *ip = &ilp->il_int ;
+   int n ;
+   const char *func = "il_accept" ;
+
+   for ( n = 0 ; n < IL_EVENTS ; n++ )
+   {
+      union xsockaddr   csin ;
+      socklen_t         sin_len = sizeof( csin ) ;
+      int               sd ;
+
+      sd = accept( INT_REMOTE( ip ), SA( &csin ), &sin_len ) ;
+      if ( sd == -1 )
+      {
+         if ( errno == EMFILE || errno == ENFILE )
+         {
+            /* wait for a channel to close */
+            msg( LOG_ERR, func, "%s: accept: %m",
+                  SVC_ID( SERVER_SERVICE( INT_SERVER( ip ) ) ) ) ;
+            if ( int_rewatch( ip, INT_REMOTE( ip ), 0 ) == OK )
+               ilp->il_accepting = FALSE ;
+         }
+         else if ( errno != EAGAIN && errno != EINTR &&
+                     errno != ECONNABORTED )
+            msg( LOG_ERR, func, "accept: %m" ) ;
+         return ;
+      }
+      ilp->il_accepted++ ;
+      il_channel( ilp, sd, &csin ) ;
+   }
+}
+
+
+/*
+ * Move what 'from' has, as far as 'to' takes it. When from is at its
+ * end, the eof flag is set and 'to' is shut down for writing; when to
+ * takes less than there is, the full flag is set.
+ */
+static status_e il_relay( channel_s *chp, int from, int to,
+                          unsigned eof, unsigned full )
+{
+   ssize_t rcc, wcc ;
+
+   do
+      rcc = recv( from, il_buf, sizeof( il_buf ), MSG_PEEK ) ;
+   while ( rcc == (ssize_t)-1 && errno == EINTR ) ;
+
+   if ( rcc == 0 )
+   {
+      chp->ch_flags |= eof ;
+      (void) shutdown( to, SHUT_WR ) ;
+      return( OK ) ;
+   }
+   if ( rcc == (ssize_t)-1 )
+      return( ( errno == EAGAIN ) ? OK : FAILED ) ;
+
+   do
+      wcc = send( to, il_buf, rcc, 0 ) ;
+   while ( wcc == (ssize_t)-1 && errno == EINTR ) ;
+
+   if ( wcc == (ssize_t)-1 )
+   {
+      if ( errno != EAGAIN )
+         return( FAILED ) ;
+      wcc = 0 ;
+   }
+   if ( wcc > 0 )
+   {
+      ssize_t cc ;
+
+      do
+         cc = recv( from, il_buf, wcc, 0 ) ;
+      while ( cc == (ssize_t)-1 && errno == EINTR ) ;
+   }
+   if ( wcc < rcc )
+      chp->ch_flags |= full ;
+   return( OK ) ;
+}
+
+
+/*
+ * Wait for what the flags of chp call for on each of its sockets
+ */
+static status_e il_rewatch( struct intercept_s *ip, channel_s *chp )
+{
+   unsigned f = chp->ch_flags ;
+   unsigned local_events, remote_events ;
+
+   local_events = ( ( f & ( IL_LOCAL_EOF | IL_REMOTE_FULL ) ) ? 0 : EPOLLIN ) |
+                  ( ( f & IL_LOCAL_FULL ) ? EPOLLOUT : 0 ) ;
+   remote_events = ( ( f & ( IL_REMOTE_EOF | IL_LOCAL_FULL ) ) ? 0 : EPOLLIN ) |
+                   ( ( f & IL_REMOTE_FULL ) ? EPOLLOUT : 0 ) ;
+   if ( int_rewatch( ip, chp->ch_local_socket, local_events ) == FAILED ||
+        int_rewatch( ip, chp->ch_remote_socket, remote_events ) == FAILED )
+      return( FAILED ) ;
+   return( OK ) ;
+}
+
+
+static void il_stream( struct intloop *ilp, channel_s *chp,
+                       int fd, unsigned events )
+{
+   bool_int local    = ( fd == chp->ch_local_socket ) ;
+   int      other    = local ? chp->ch_remote_socket : chp->ch_local_socket ;
+   unsigned eof      = local ? IL_LOCAL_EOF : IL_REMOTE_EOF ;
+   unsigned full     = local ? IL_LOCAL_FULL : IL_REMOTE_FULL ;
+   unsigned other_eof  = local ? IL_REMOTE_EOF : IL_LOCAL_EOF ;
+   unsigned other_full = local ? IL_REMOTE_FULL : IL_LOCAL_FULL ;
+   unsigned flags    = chp->ch_flags ;
+
+   /* fd takes data again: move what the other side has for it */
+   if ( ( flags & full ) && ( events & ( EPOLLOUT | EPOLLERR | EPOLLHUP ) ) )
+   {
+      chp->ch_flags &= ~full ;
+      if ( il_relay( chp, other, fd, other_eof, full ) == FAILED )
+      {
+         il_close( ilp, chp ) ;
+         return ;
+      }
+   }
+
+   if ( ! ( chp->ch_flags & ( eof | other_full ) ) &&
+         ( events & ( EPOLLIN | EPOLLERR | EPOLLHUP ) ) &&
+         il_relay( chp, fd, other, eof, other_full ) == FAILED )
+   {
+      il_close( ilp, chp ) ;
+      return ;
+   }
+
+   /*
+    * The channel is over when both sides are done sending. A socket
+    * in error, or hung up while it is not read, is not waited for.
+    */
+   if ( ( chp->ch_flags & ( IL_LOCAL_EOF | IL_REMOTE_EOF ) ) ==
+                                    ( IL_LOCAL_EOF | IL_REMOTE_EOF ) ||
+        ( ( events & ( EPOLLERR | EPOLLHUP ) ) &&
+                           ( chp->ch_flags & ( eof | other_full ) ) ) )
+   {
+      il_close( ilp, chp ) ;
+      return ;
+   }
+
+   if ( chp->ch_flags != flags && il_rewatch( &ilp->il_int, chp ) == FAILED )
+      il_close( ilp, chp ) ;
+}
+
+
+static void il_events( struct intloop *ilp )
+{
+   struct intercept_s   *ip = &ilp->il_int ;
+   struct epoll_event    events[ IL_EVENTS ] ;
+   bool_int              accept_pending = FALSE ;
+   int                   n_ready, i ;
+
+   do
+      n_ready = epoll_wait( IL_EPFD( ilp ), events, IL_EVENTS, 0 ) ;
+   while ( n_ready == -1 && errno == EINTR ) ;
+
+   for ( i = 0 ; i < n_ready ; i++ )
+   {
+      int fd = events[ i ].data.fd ;
+      channel_s *chp ;
+
+      if ( fd == INT_REMOTE( ip ) )
+      {
+         if ( IL_STREAM( ilp ) )
+            accept_pending = TRUE ;
+         else
+            udp_remote_to_local( ip ) ;
+         continue ;
+      }
+
+      /* The channel may have been closed earlier in this batch */
+      if ( ( chp = int_channel( ip, fd ) ) == CHANNEL_NULL )
+         continue ;
+
+      if ( IL_STREAM( ilp ) )
+         il_stream( ilp, chp, fd, events[ i ].events ) ;
+      else if ( udp_local_to_remote( ip, chp ) == FAILED )
+         il_close( ilp, chp ) ;
+   }
+
+   /*
+    * As in the tcp interceptor, new connections are accepted after the
+    * batch, so that a reused descriptor can't get a stale event.
+    */
+   if ( IL_STREAM( ilp ) )
+   {
+      if ( accept_pending )
+         il_accept( ilp ) ;
+   }
+   else
+      udp_flush( ip ) ;
+}
+
+
+/*
+ * Handle the intercepted servers whose descriptors are set in the mask.
+ * Returns the number of descriptors handled.
+ */
+int intloop_poll( fd_set *maskp )
+{
+   struct intloop *ilp ;
+   int handled = 0 ;
+
+   for ( ilp = intloops ; ilp != NULL ; ilp = ilp->il_next )
+      if ( ilp->il_started && FD_ISSET( IL_EPFD( ilp ), maskp ) )
+      {
+         il_events( ilp ) ;
+         handled++ ;
+      }
+   return( handled ) ;
+}
+
+
+/*
+ * Stop checking the clients of service sp, whose INTERCEPT flag has
+ * been cleared. Returns TRUE if sp is intercepted inline.
+ */
+bool_int intloop_stop( const struct service *sp )
+{
+   struct intloop *ilp ;
+   bool_int found = FALSE ;
+
+   for ( ilp = intloops ; ilp != NULL ; ilp = ilp->il_next )
+      if ( SERVER_SERVICE( ilp->il_server ) == sp )
+      {
+         INTERCEPT( &ilp->il_int ) = FALSE ;
+         found = TRUE ;
+      }
+   return( found ) ;
+}
+
+
+/*
+ * Returns TRUE if fd is the epoll descriptor of an intercepted server
+ */
+bool_int intloop_fd( int fd )
+{
+   struct intloop *ilp ;
+
+   for ( ilp = intloops ; ilp != NULL ; ilp = ilp->il_next )
+      if ( ilp->il_started && IL_EPFD( ilp ) == fd )
+         return( TRUE ) ;
+   return( FALSE ) ;
+}
+
+
+/*
+ * Close the descriptors of the inline interception in a child that
+ * does not exec, so that the channels end when xinetd closes them
+ */
+void intloop_close(void)
+{
+   struct intloop *ilp ;
+   unsigned u ;
+
+   for ( ilp = intloops ; ilp != NULL ; ilp = ilp->il_next )
+   {
+      struct intercept_s *ip = &ilp->il_int ;
+
+      (void) close( IL_EPFD( ilp ) ) ;
+      for ( u = 0 ; u < pset_count( INT_CONNECTIONS( ip ) ) ; u++ )
+      {
+         channel_s *chp = CHP( pset_pointer( INT_CONNECTIONS( ip ), u ) ) ;
+
+         (void) close( chp->ch_local_socket ) ;
+         if ( IL_STREAM( ilp ) )
+            (void) close( chp->ch_remote_socket ) ;
+      }
+   }
+}
+
+
+void intloop_dump( int fd )
+{
+   struct intloop *ilp ;
+
+   for ( ilp = intloops ; ilp != NULL ; ilp = ilp->il_next )
+      Sprint( fd, "%s intercepted inline: server %d, channels = %u\n",
+            SVC_ID( SERVER_SERVICE( ilp->il_server ) ),
+            SERVER_PID( ilp->il_server ),
+            pset_count( INT_CONNECTIONS( &ilp->il_int ) ) ) ;
+   Sputchar( fd, '\n' ) ;
+}
+
+#else   /* HAVE_EPOLL_CREATE */
+
+status_e intloop_prepare( struct server *serp )
+{
+   return( FAILED ) ;
+}
+
+void intloop_child( struct server *serp ) { }
+void intloop_start( struct server *serp ) { }
+void intloop_end( struct server *serp ) { }
+int intloop_poll( fd_set *maskp ) { return( 0 ) ; }
+bool_int intloop_stop( const struct service *sp ) { return( FALSE ) ; }
+bool_int intloop_fd( int fd ) { return( FALSE ) ; }
+void intloop_close(void) { }
+void intloop_dump( int fd ) { }
+
+#endif   /* HAVE_EPOLL_CREATE */
@@ -0,0 +1,27 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+#ifndef INTLOOP_H
+#define INTLOOP_H
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "defs.h"
+#include "server.h"
+#include "service.h"
+
+status_e intloop_prepare(struct server *serp);
+void intloop_child(struct server *serp);
+void intloop_start(struct server *serp);
+void intloop_end(struct server *serp);
+int intloop_poll(fd_set *maskp);
+bool_int intloop_stop(const struct service *sp);
+bool_int intloop_fd(int fd);
+void intloop_close(void);
+void intloop_dump(int fd);
+
+#endif
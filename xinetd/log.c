@@ -14,6 +14,8 @@
 #include <time.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <arpa/inet.h>
 #ifdef HAVE_NETDB_H
 #include <netdb.h>
 #endif
@@ -23,20 +25,38 @@
 #include "sconf.h"
 #include "sconst.h"
 #include "msg.h"
+#include "logstorm.h"
 
 
 #define LOGBUF_SIZE                  1024
 
 static char ipv6_ret[NI_MAXHOST];
 
-const char *xaddrname(const union xsockaddr *inaddr)
+/*
+ * Numeric text of address inaddr in buf. inet_ntop(3) is much cheaper
+ * than getnameinfo(3), which is only needed for the scope of an IPv6
+ * link-local address. Returns NULL if the address can't be converted.
+ */
+const char *xaddrtext( const union xsockaddr *inaddr, char *buf, size_t size )
 {
    unsigned int len = 0;
-   if( inaddr->sa.sa_family == AF_INET )  len = sizeof(struct sockaddr_in);
-   if( inaddr->sa.sa_family == AF_INET6 ) len = sizeof(struct sockaddr_in6);
-   memset(ipv6_ret, 0, sizeof(ipv6_ret));
-   if( getnameinfo(&inaddr->sa, len, ipv6_ret, sizeof(ipv6_ret), NULL, 
-         0, NI_NUMERICHOST) )
+
+   if ( inaddr->sa.sa_family == AF_INET )
+      return( inet_ntop( AF_INET, &inaddr->sa_in.sin_addr, buf, size ) ) ;
+   if ( inaddr->sa.sa_family == AF_INET6 )
+   {
+      if ( inaddr->sa_in6.sin6_scope_id == 0 )
+         return( inet_ntop( AF_INET6, &inaddr->sa_in6.sin6_addr, buf, size ) ) ;
+      len = sizeof(struct sockaddr_in6);
+   }
+   if( getnameinfo(&inaddr->sa, len, buf, size, NULL, 0, NI_NUMERICHOST) )
+      return( NULL ) ;
+   return( buf ) ;
+}
+
+const char *xaddrname(const union xsockaddr *inaddr)
+{
+   if ( xaddrtext( inaddr, ipv6_ret, sizeof( ipv6_ret ) ) == NULL )
       strncpy(ipv6_ret, "<unknown>", NI_MAXHOST);
    return ipv6_ret;
 }
@@ -48,7 +68,167 @@ uint16_t xaddrport(const union xsockaddr *inaddr)
    return 0;
 }
 
-static int log_common(mask_t *, char *, int, const connection_s *) ;
+static int log_common(const struct service_config *, mask_t *, char *, int, 
+                                                      const connection_s *) ;
+
+/*
+ * A note on the log formats:
+ * With log_format = text, records look like
+ *
+ *      START: service pid=1234 from=10.0.0.1
+ *
+ * With log_format = json, each record is a JSON object on a line of
+ * its own, without the time stamp of the file log in front of it:
+ *
+ *      {"event":"START","service":"service","time":"...","pid":1234,...}
+ *
+ * The beginning of the START, FAIL and EXIT records of a service, up to
+ * and including its id, only depends on its configuration. It is built
+ * when the log of the service is started and copied into each record.
+ */
+
+static const char *entry_names[ LOG_ENTRIES ] =
+   { START_ENTRY, FAIL_ENTRY, EXIT_ENTRY } ;
+
+
+/*
+ * Write s to buf as a JSON string. Returns the number of bytes written.
+ */
+static int json_string( char *buf, int size, const char *s )
+{
+   static const char hex[] = "0123456789abcdef" ;
+   int len = 0 ;
+
+   if ( size < 2 )
+      return( 0 ) ;
+   buf[ len++ ] = '"' ;
+   for ( ; *s != NUL ; s++ )
+   {
+      unsigned char c = (unsigned char) *s ;
+
+      if ( c == '"' || c == '\\' )
+      {
+         if ( len + 3 > size )
+            break ;
+         buf[ len++ ] = '\\' ;
+         buf[ len++ ] = c ;
+      }
+      else if ( c < 0x20 )
+      {
+         if ( len + 7 > size )
+            break ;
+         (void) memcpy( &buf[ len ], "\\u00", 4 ) ;
+         buf[ len + 4 ] = hex[ c >> 4 ] ;
+         buf[ len + 5 ] = hex[ c & 0xf ] ;
+         len += 6 ;
+      }
+      else
+      {
+         if ( len + 2 > size )
+            break ;
+         buf[ len++ ] = c ;
+      }
+   }
+   buf[ len++ ] = '"' ;
+   return( len ) ;
+}
+
+
+/*
+ * The beginning of the records of line_id for service id
+ */
+static int log_begin( const struct service_config *scp, const char *line_id,
+                      const char *id, char *buf, int bufsize )
+{
+   int len ;
+
+   if ( SC_LOG_JSON( scp ) != YES )
+      return( strx_nprint( buf, bufsize, "%s: %s", line_id, id ) ) ;
+
+   len = strx_nprint( buf, bufsize, "{\"event\":\"%s\",\"service\":", line_id ) ;
+   return( len + json_string( &buf[ len ], bufsize - len, id ) ) ;
+}
+
+
+/*
+ * Build the beginning of the START, FAIL and EXIT records of scp
+ */
+void log_prefixes( struct service_config *scp )
+{
+   char  buf[ LOGBUF_SIZE ] ;
+   int   len ;
+   int   e ;
+
+   for ( e = 0 ; e < LOG_ENTRIES ; e++ )
+   {
+      if ( SC_LOG_PREFIX( scp, e ) != NULL )
+         free( SC_LOG_PREFIX( scp, e ) ) ;
+      len = log_begin( scp, entry_names[ e ], SC_ID( scp ),
+                                                buf, sizeof( buf ) - 1 ) ;
+      buf[ len ] = NUL ;
+      SC_LOG_PREFIX( scp, e ) = new_string( buf ) ;
+      SC_LOG_PREFIX_LEN( scp, e ) = len ;
+   }
+}
+
+
+/*
+ * The JSON time stamp of the current second, built once per second
+ */
+static const char *json_time( void )
+{
+   static time_t  last = (time_t) -1 ;
+   static char    stamp[ 40 ] ;
+   time_t         now = time( NULL ) ;
+
+   if ( now != last )
+   {
+      struct tm *tmp = localtime( &now ) ;
+
+      if ( tmp == NULL ||
+           strftime( stamp, sizeof( stamp ), "%Y-%m-%dT%H:%M:%S%z", tmp ) == 0 )
+         stamp[ 0 ] = NUL ;
+      last = now ;
+   }
+   return( stamp ) ;
+}
+
+
+/*
+ * Start record e of scp in buf. Returns the number of bytes written.
+ */
+static int log_start_entry( const struct service_config *scp, int e, 
+                            char *buf, int bufsize )
+{
+   int len = SC_LOG_PREFIX_LEN( scp, e ) ;
+
+   if ( SC_LOG_PREFIX( scp, e ) == NULL || len >= bufsize )
+      len = log_begin( scp, entry_names[ e ], SC_ID( scp ), buf, bufsize ) ;
+   else
+      (void) memcpy( buf, SC_LOG_PREFIX( scp, e ), len ) ;
+
+   if ( SC_LOG_JSON( scp ) == YES )
+      len += strx_nprint( &buf[ len ], bufsize - len,
+                                    ",\"time\":\"%s\"", json_time() ) ;
+   return( len ) ;
+}
+
+
+/*
+ * Write record buf of service sp, ending it first if it is a JSON object.
+ * There is always room for the closing brace, as the records are built
+ * in buffers 1 byte shorter than the one they are in.
+ */
+static void log_entry_write( struct service *sp, char *buf, int len, int flags )
+{
+   if ( SC_LOG_JSON( SVC_CONF( sp ) ) == YES )
+   {
+      buf[ len++ ] = '}' ;
+      flags |= XLOG_NO_HEADER ;
+   }
+   xlog_write( SVC_LOG(sp), buf, len, flags ) ;
+}
+
 
 /*
  * This function writes log records of the form:
@@ -66,25 +246,26 @@ void svc_log_success( struct service *sp, const connection_s *cp, pid_t pid )
    if ( ! SVC_LOGS_ON_SUCCESS( sp ) )
       return ;
    
-   bufsize = sizeof( buf ) ;
+   bufsize = sizeof( buf ) - 1 ;
    len = 0 ;
    
-   cc = strx_nprint( buf, bufsize, "%s: %s", START_ENTRY, SC_ID( scp ) ) ;
+   cc = log_start_entry( scp, LE_START, buf, bufsize ) ;
    len += cc ;
    bufsize -= cc ;
 
    if ( SC_LOGS_PID( scp ) )
    {
-      cc = strx_nprint( &buf[ len ], bufsize, " pid=%d", pid ) ;
+      cc = strx_nprint( &buf[ len ], bufsize,
+               SC_LOG_JSON( scp ) == YES ? ",\"pid\":%d" : " pid=%d", pid ) ;
       len += cc ;
       bufsize -= cc ;
    }
 
-   cc = log_common( &SC_LOG_ON_SUCCESS( scp ), &buf[len], bufsize, cp ) ;
+   cc = log_common( scp, &SC_LOG_ON_SUCCESS( scp ), &buf[len], bufsize, cp ) ;
    len += cc ;
    bufsize -= cc ;
 
-   xlog_write( SVC_LOG(sp), buf, len, XLOG_NO_ERRNO ) ;
+   log_entry_write( sp, buf, len, XLOG_NO_ERRNO ) ;
 }
 
 
@@ -93,10 +274,12 @@ void svc_log_success( struct service *sp, const connection_s *cp, pid_t pid )
  *
  *      FAIL: service failure-type [from_address]
  *
+ * Returns FALSE if the record was not written because too many like it
+ * were written already (see logstorm.c).
  */
-void svc_log_failure( struct service *sp, 
-                      const connection_s *cp, 
-                      access_e access_failure )
+bool_int svc_log_failure( struct service *sp, 
+                          const connection_s *cp, 
+                          access_e access_failure )
 {
    char                    buf[ LOGBUF_SIZE ] ;
    int                     bufsize ;
@@ -105,28 +288,72 @@ void svc_log_failure( struct service *sp,
    int                     cc ;
    
    if ( ! SVC_LOGS_ON_FAILURE( sp ) )
-      return ;
+      return( TRUE ) ;
+   if ( logstorm_pass( sp, access_failure ) )
+      return( TRUE ) ;
+   if ( logstorm_suppress( sp, cp, access_failure ) )
+      return( FALSE ) ;
    
-   bufsize = sizeof( buf ) ;
-   cc = strx_nprint( buf, bufsize, "%s: %s", FAIL_ENTRY, SC_ID( scp ) ) ;
+   bufsize = sizeof( buf ) - 1 ;
+   cc = log_start_entry( scp, LE_FAIL, buf, bufsize ) ;
    len += cc ;
    bufsize -= cc ;
 
    cc = strx_nprint( &buf[ len ], bufsize,
-                        " %s", ACCESS_EXPLAIN( access_failure ) ) ;
+                        SC_LOG_JSON( scp ) == YES ? ",\"reason\":\"%s\"" : " %s",
+                        ACCESS_EXPLAIN( access_failure ) ) ;
+   len += cc ;
+   bufsize -= cc ;
+
+   cc = log_common( scp, &SC_LOG_ON_FAILURE( scp ), &buf[ len ], bufsize, cp ) ;
+   len += cc ;
+   bufsize -= cc ;
+
+   log_entry_write( sp, buf, len, XLOG_NO_ERRNO ) ;
+   return( TRUE ) ;
+}
+
+
+/*
+ * This function writes log records of the form:
+ *
+ *      FAIL: service failure-type from=network suppressed count in interval
+ *
+ * for the failures from network that were not logged (see logstorm.c).
+ */
+void svc_log_suppressed( struct service *sp, access_e access_failure,
+                         const char *network, unsigned count, 
+                         unsigned interval )
+{
+   char                    buf[ LOGBUF_SIZE ] ;
+   int                     bufsize ;
+   struct service_config   *scp = SVC_CONF( sp ) ;
+   int                     len = 0 ;
+   int                     cc ;
+
+   if ( ! SVC_IS_LOGGING( sp ) )
+      return ;
+
+   bufsize = sizeof( buf ) - 1 ;
+   cc = log_start_entry( scp, LE_FAIL, buf, bufsize ) ;
    len += cc ;
    bufsize -= cc ;
 
-   cc = log_common( &SC_LOG_ON_FAILURE( scp ), &buf[ len ], bufsize, cp ) ;
+   cc = strx_nprint( &buf[ len ], bufsize,
+      SC_LOG_JSON( scp ) == YES ? 
+         ",\"reason\":\"%s\",\"from\":\"%s\",\"suppressed\":%u,\"interval\":%u" :
+         " %s from=%s suppressed %u in %us",
+      ACCESS_EXPLAIN( access_failure ), network, count, interval ) ;
    len += cc ;
    bufsize -= cc ;
 
-   xlog_write( SVC_LOG(sp), buf, len, XLOG_NO_ERRNO ) ;
+   log_entry_write( sp, buf, len, XLOG_NO_ERRNO ) ;
 }
 
 
 
-static int log_common( mask_t *logmask, 
+static int log_common( const struct service_config *scp,
+                        mask_t *logmask, 
                         char *buf, 
                         int bufsize, 
                         const connection_s *cp )
@@ -134,7 +361,9 @@ static int log_common( mask_t *logmask,
    int len = 0 ;
 
    if ( M_IS_SET( *logmask, LO_HOST ) )
-      len = strx_nprint( buf, bufsize, " from=%s", conn_addrstr( cp ) ) ;
+      len = strx_nprint( buf, bufsize,
+                  SC_LOG_JSON( scp ) == YES ? ",\"from\":\"%s\"" : " from=%s",
+                  conn_addrstr( cp ) ) ;
    return( len ) ;
 }
 
@@ -152,10 +381,10 @@ void svc_log_exit( struct service *sp, const struct server *serp )
    if ( ! SVC_LOGS_ON_EXIT( sp ) )
       return ;
 
-   bufsize = sizeof( buf ) ;
+   bufsize = sizeof( buf ) - 1 ;
    len = 0 ;
 
-   cc = strx_nprint( buf, bufsize, "%s: %s", EXIT_ENTRY, SC_ID( scp ) ) ;
+   cc = log_start_entry( scp, LE_EXIT, buf, bufsize ) ;
    bufsize -= cc ;
    len += cc ;
 
@@ -187,7 +416,8 @@ void svc_log_exit( struct service *sp, const struct server *serp )
 
       if ( s )
       {
-         cc = strx_nprint( &buf[ len ], bufsize, " %s=%d", s, num ) ;
+         cc = strx_nprint( &buf[ len ], bufsize, 
+               SC_LOG_JSON( scp ) == YES ? ",\"%s\":%d" : " %s=%d", s, num ) ;
          len += cc ;
          bufsize -= cc ;
       }
@@ -195,7 +425,9 @@ void svc_log_exit( struct service *sp, const struct server *serp )
 
    if ( SC_LOGS_PID( scp ) )
    {
-      cc = strx_nprint( &buf[ len ], bufsize, " pid=%d", SERVER_PID( serp ) ) ;
+      cc = strx_nprint( &buf[ len ], bufsize, 
+               SC_LOG_JSON( scp ) == YES ? ",\"pid\":%d" : " pid=%d", 
+               SERVER_PID( serp ) ) ;
       len += cc ;
       bufsize -= cc ;
    }
@@ -205,12 +437,13 @@ void svc_log_exit( struct service *sp, const struct server *serp )
       time_t current_time ;
 
       (void) time( &current_time ) ;
-      cc = strx_nprint( &buf[ len ], bufsize, " duration=%ld(sec)",
+      cc = strx_nprint( &buf[ len ], bufsize, 
+         SC_LOG_JSON( scp ) == YES ? ",\"duration\":%ld" : " duration=%ld(sec)",
          (long)(current_time - SERVER_STARTTIME( serp )) ) ;
       len += cc ;
       bufsize -= cc ;
    }
-   xlog_write( SVC_LOG(sp), buf, len, XLOG_NO_ERRNO ) ;
+   log_entry_write( sp, buf, len, XLOG_NO_ERRNO ) ;
 }
 
 
@@ -224,7 +457,7 @@ void svc_logprint( struct service *sp, const char *line_id,
                    const char *fmt, ...)
 {
    char     buf[ LOGBUF_SIZE ] ;
-   int      bufsize = sizeof( buf ) ;
+   int      bufsize = sizeof( buf ) - 1 ;
    int      len ;
    int      cc ;
    va_list  ap ;
@@ -232,10 +465,25 @@ void svc_logprint( struct service *sp, const char *line_id,
    if ( ! SVC_IS_LOGGING( sp ) )
       return ;
 
-   len = strx_nprint( buf, bufsize, "%s: %s ", line_id, SVC_ID( sp ) ) ;
-   va_start( ap, fmt ) ;
-   cc = strx_nprintv( &buf[ len ], bufsize-len, fmt, ap ) ;
-   va_end( ap ) ;
-   xlog_write( SVC_LOG(sp), buf, len+cc, XLOG_NO_ERRNO | XLOG_NO_SIZECHECK ) ;
+   if ( SC_LOG_JSON( SVC_CONF( sp ) ) == YES )
+   {
+      char text[ LOGBUF_SIZE ] ;
+
+      len = log_begin( SVC_CONF( sp ), line_id, SVC_ID( sp ), buf, bufsize ) ;
+      len += strx_nprint( &buf[ len ], bufsize - len,
+                           ",\"time\":\"%s\",\"message\":", json_time() ) ;
+      va_start( ap, fmt ) ;
+      (void) strx_nprintv( text, sizeof( text ), fmt, ap ) ;
+      va_end( ap ) ;
+      cc = json_string( &buf[ len ], bufsize - len, text ) ;
+   }
+   else
+   {
+      len = strx_nprint( buf, bufsize, "%s: %s ", line_id, SVC_ID( sp ) ) ;
+      va_start( ap, fmt ) ;
+      cc = strx_nprintv( &buf[ len ], bufsize-len, fmt, ap ) ;
+      va_end( ap ) ;
+   }
+   log_entry_write( sp, buf, len+cc, XLOG_NO_ERRNO | XLOG_NO_SIZECHECK ) ;
 }
 
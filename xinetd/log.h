@@ -56,10 +56,14 @@ struct log
 #define LOG_GET_FILELOG( lp )        (&(lp)->l_fl)
 #define LOG_GET_SYSLOG( lp )         (&(lp)->l_sl)
 
+const char *xaddrtext(const union xsockaddr *inaddr, char *buf, size_t size);
 const char *xaddrname(const union xsockaddr *inaddr);
 uint16_t xaddrport(const union xsockaddr *inaddr);
+void log_prefixes(struct service_config *scp);
 void svc_log_success(struct service *sp, const connection_s *cp,pid_t pid);
-void svc_log_failure(struct service *sp, const connection_s *cp,access_e access_failure);
+bool_int svc_log_failure(struct service *sp, const connection_s *cp,access_e access_failure);
+void svc_log_suppressed(struct service *sp, access_e access_failure,
+                        const char *network, unsigned count, unsigned interval);
 void svc_log_exit(struct service *sp,const struct server *serp);
 void svc_logprint(struct service *sp,const char *line_id,const char *fmt,...)
 #ifdef __GNUC__
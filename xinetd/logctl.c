@@ -11,26 +11,149 @@
 #include <sys/stat.h>
 #include <syslog.h>
 #include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include "str.h"
 #include "logctl.h"
+#include "logwriter.h"
 #include "msg.h"
 #include "xconfig.h"
 #include "main.h"
 #include "sconf.h"
+#include "util.h"
 
 
-static xlog_h start_filelog( const char *id, struct filelog *flp )
+/*
+ * The services that log to the same file share one file log, opened
+ * by the first of them with its size limits, log_mode and log_rotate,
+ * and closed when the last of them is done with it. The records of all
+ * of them go through one buffer, and the size of the file is kept in
+ * one place.
+ *
+ * A reconfiguration starts a new generation of file logs (see
+ * log_reopen): the services open their logs again, with the new
+ * settings, and the logs of the previous generation are closed as
+ * the services let go of them.
+ */
+struct log_file
+{
+   char              *lf_path ;
+   xlog_h             lf_xh ;
+   unsigned           lf_refs ;
+   unsigned           lf_generation ;
+   pid_t              lf_pid ;        /* of the process that rotates it */
+   boolean_e          lf_async ;
+   int                lf_overflow ;
+   boolean_e          lf_compress ;
+   struct log_file   *lf_next ;
+} ;
+
+static struct log_file *log_files = NULL ;
+static unsigned log_generation = 0 ;
+
+
+/*
+ * The file log lfp has reached its soft limit: rotate it, unless this is
+ * a server that writes to it before its exec(2), or the last old file
+ * is still to be compressed. The writer of an asynchronous log still
+ * has the old file, so it is replaced by one for the new file.
+ */
+static void rotate_filelog( struct log_file *lfp )
+{
+   char       *old = NULL ;
+   size_t      len ;
+   const char *func = "rotate_filelog" ;
+
+   if ( getpid() != lfp->lf_pid || logwriter_busy( lfp->lf_path ) )
+      return ;
+
+   if ( xlog_control( lfp->lf_xh, XLOG_ROTATE ) != XLOG_ENOERROR )
+   {
+      msg( LOG_ERR, func, "rotation of log %s failed", lfp->lf_path ) ;
+      return ;
+   }
+
+   if ( lfp->lf_compress == YES )
+   {
+      len = strlen( lfp->lf_path ) + 3 ;
+      if ( ( old = malloc( len ) ) == NULL )
+         out_of_memory( func ) ;
+      else
+         (void) strx_nprint( old, (int) len, "%s.1", lfp->lf_path ) ;
+   }
+
+   if ( lfp->lf_async == YES )
+   {
+      logwriter_retire( lfp->lf_xh, old ) ;
+      if ( logwriter_start( lfp->lf_xh, lfp->lf_path,
+                                          lfp->lf_overflow ) == FAILED )
+         (void) xlog_control( lfp->lf_xh, XLOG_ASYNC, -1, lfp->lf_overflow ) ;
+   }
+   else if ( old != NULL )
+      (void) logwriter_compress( lfp->lf_path, old ) ;
+
+   if ( old != NULL )
+      free( old ) ;
+}
+
+
+/*
+ * This function is invoked when a file log detects an error.
+ * Since the log may be shared, it is named by its file.
+ */
+static void filelog_in_error( xlog_h xh, int error_code, void *arg )
+{
+   struct log_file    *lfp      = (struct log_file *) arg ;
+   const char         *func     = "filelog_in_error" ;
+
+#ifdef lint
+   xh = xh ;
+#endif
+   if ( error_code == XLOG_EROTATE )
+      rotate_filelog( lfp ) ;
+   else if ( error_code == XLOG_ESIZE )
+      msg( LOG_ERR, func, "Size of log %s exceeded hard limit",
+                                                         lfp->lf_path ) ;
+   else
+      msg( LOG_ERR, func, "Error in log %s: %d", lfp->lf_path, error_code ) ;
+}
+
+
+static xlog_h start_filelog( const char *id, struct filelog *flp,
+                             const struct service_config *scp )
 {
    xlog_h   xh ;
    int      fd ;
    int      log_file_mode = ( debug.on ) ? 0644 : LOG_FILE_MODE ;
+   struct log_file *lfp ;
    const char *func = "start_filelog" ;
 
+   for ( lfp = log_files ; lfp != NULL ; lfp = lfp->lf_next )
+      if ( lfp->lf_generation == log_generation &&
+                     strcmp( lfp->lf_path, flp->fl_filename ) == 0 )
+      {
+         lfp->lf_refs++ ;
+         return( lfp->lf_xh ) ;
+      }
+
+   if ( ( lfp = NEW( struct log_file ) ) == NULL ||
+        ( lfp->lf_path = new_string( flp->fl_filename ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      if ( lfp != NULL )
+         FREE( lfp ) ;
+      return( NULL ) ;
+   }
+
    xh = xlog_create( XLOG_FILELOG, id, XLOG_NOFLAGS,
                      flp->fl_filename, LOG_OPEN_FLAGS, log_file_mode ) ;
    if ( xh == NULL )
    {
       msg( LOG_ERR, func, "creation of %s log failed", id ) ;
+      free( lfp->lf_path ) ;
+      FREE( lfp ) ;
       return( NULL ) ;
    }
 
@@ -39,19 +162,80 @@ static xlog_h start_filelog( const char *id, struct filelog *flp )
    {
       msg( LOG_ERR, func, "Failed to set close-on-exec flag for log file" ) ;
       xlog_destroy( xh ) ;
+      free( lfp->lf_path ) ;
+      FREE( lfp ) ;
       return( NULL ) ;
    }
 
    ps.rws.descriptors_free-- ;
 
+   lfp->lf_xh = xh ;
+   lfp->lf_refs = 1 ;
+   lfp->lf_generation = log_generation ;
+   lfp->lf_pid = getpid() ;
+   lfp->lf_async = SC_LOG_ASYNC( scp ) ;
+   lfp->lf_overflow = SC_LOG_OVERFLOW( scp ) ;
+   lfp->lf_compress = SC_LOG_COMPRESS( scp ) ;
+   lfp->lf_next = log_files ;
+   log_files = lfp ;
+   (void) xlog_control( xh, XLOG_CALLBACK, filelog_in_error, (void *)lfp ) ;
+
+   /* Before the limits, so that a file already too large is rotated */
+   if ( SC_LOG_ROTATE( scp ) != 0 )
+      (void) xlog_control( xh, XLOG_ROTATION, SC_LOG_ROTATE( scp ),
+         SC_LOG_COMPRESS( scp ) == YES ? LOG_COMPRESS_SUFFIX : NULL ) ;
+
    if ( FILELOG_SIZE_CONTROL( flp ) )
       (void) xlog_control( xh,
                      XLOG_LIMITS, flp->fl_soft_limit, flp->fl_hard_limit ) ;
 
+   /* Without a writer, the log is written directly */
+   if ( SC_LOG_ASYNC( scp ) == YES )
+      (void) logwriter_start( xh, flp->fl_filename, SC_LOG_OVERFLOW( scp ) ) ;
+
    return( xh ) ;
 }
 
 
+/*
+ * Done with file log xh: close it if nobody else uses it
+ */
+static void end_filelog( xlog_h xh )
+{
+   struct log_file **lfpp ;
+
+   for ( lfpp = &log_files ; *lfpp != NULL ; lfpp = &(*lfpp)->lf_next )
+   {
+      struct log_file *lfp = *lfpp ;
+
+      if ( lfp->lf_xh != xh )
+         continue ;
+      if ( --lfp->lf_refs != 0 )
+         return ;
+      if ( lfp->lf_async == YES )
+         logwriter_retire( xh, NULL ) ;
+      *lfpp = lfp->lf_next ;
+      free( lfp->lf_path ) ;
+      FREE( lfp ) ;
+      break ;
+   }
+   ps.rws.descriptors_free++ ;
+   xlog_destroy( xh ) ;
+}
+
+
+/*
+ * Invoked when the configuration is read again: the file logs started
+ * from now on are not shared with those already open, so that their
+ * files are opened again (a file that was renamed by log rotation is
+ * created anew) and they get the settings of the new configuration.
+ */
+void log_reopen( void )
+{
+   log_generation++ ;
+}
+
+
 /*
  * This function is invoked when a xlog detects an error (for example,
  * exceeding the file size limit).
@@ -85,6 +269,8 @@ status_e log_start( struct service *sp, xlog_h *xhp )
    struct log   *lp    = SC_LOG( SVC_CONF( sp ) ) ;
    const char   *func  = "log_start" ;
 
+   log_prefixes( SVC_CONF( sp ) ) ;
+
    switch ( lp->l_type )
    {
       case L_NONE:
@@ -92,7 +278,7 @@ status_e log_start( struct service *sp, xlog_h *xhp )
          break ;
 
       case L_SYSLOG:
-         xh = xlog_create( XLOG_SYSLOG, sid, XLOG_NOFLAGS, 
+         xh = xlog_create( XLOG_SYSLOG, sid, SYSLOG_FLAGS, 
                   LOG_GET_SYSLOG( lp )->sl_facility,
                   LOG_GET_SYSLOG( lp )->sl_level ) ;
          if ( xh == NULL )
@@ -106,13 +292,11 @@ status_e log_start( struct service *sp, xlog_h *xhp )
       case L_FILE:
          /*
           * NOTE: if the same file is specified for more than one service,
-          *         it will be opened as many times.
-          *         Furthermore, size control will not be accurate.
+          *         the services share the log (see start_filelog).
           */
-         xh = start_filelog( sid, LOG_GET_FILELOG( lp ) ) ;
+         xh = start_filelog( sid, LOG_GET_FILELOG( lp ), SVC_CONF( sp ) ) ;
          if ( xh == NULL )
             return( FAILED ) ;
-         (void) xlog_control( xh, XLOG_CALLBACK, log_in_error, (void *)sp ) ;
          break ;
       
       case L_COMMON_FILE:
@@ -122,15 +306,14 @@ status_e log_start( struct service *sp, xlog_h *xhp )
             else
             {
                xh = start_filelog( "default", 
-                              LOG_GET_FILELOG( SC_LOG( DEFAULTS( ps ) ) ) ) ;
+                              LOG_GET_FILELOG( SC_LOG( DEFAULTS( ps ) ) ),
+                              DEFAULTS( ps ) ) ;
                if ( xh == NULL )
                {
                   DEFAULT_LOG_ERROR( ps ) = TRUE ;
                   return( FAILED ) ;
                }
                DEFAULT_LOG( ps ) = xh ;
-               (void) xlog_control( xh,
-                           XLOG_CALLBACK, log_in_error, VOID_NULL ) ;
             }
          else
             xh = DEFAULT_LOG( ps ) ;
@@ -159,8 +342,8 @@ void log_end( struct log *lp, xlog_h xh )
    switch ( LOG_GET_TYPE( lp ) )
    {
       case L_FILE:
-         ps.rws.descriptors_free++ ;
-         /* FALL THROUGH */
+         end_filelog( xh ) ;
+         break ;
       
       case L_SYSLOG:
          xlog_destroy( xh ) ;
@@ -7,6 +7,7 @@
 
 status_e log_start(struct service *sp,xlog_h *xhp);
 void log_end(struct log *lp,xlog_h xh);
+void log_reopen(void);
 
 #endif
 
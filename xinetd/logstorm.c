@@ -0,0 +1,513 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+
+/*
+ * A note on failure storms:
+ * A service under attack can refuse thousands of connections a second,
+ * and log as many FAIL entries. With log_failure_limit = <count>
+ * <interval>, the failures of a service are counted per reason and per
+ * source network (of LOG_FAILURE_PREFIX4 or LOG_FAILURE_PREFIX6 bits),
+ * in windows of <interval> seconds which start with the first failure
+ * of their kind. The first <count> failures of a window are logged as
+ * usual, the others are only counted, and when the window is over, one
+ * entry tells how many were not logged:
+ *
+ *      FAIL: service address from=10.0.0.0/24 suppressed 4812 in 10s
+ *
+ * The USERID of a failure that is not logged is not looked up either.
+ * At most LOG_FAILURE_SOURCES networks are counted at a time; the
+ * failures from other networks are logged.
+ * The access control of a server that xinetd forks (only_from, no_access,
+ * access_times, libwrap...) is done in the server. The server does not
+ * log its failure but reports it to xinetd through the report pipe, and
+ * xinetd logs it (or not) as if it had found it, when it reads the
+ * report or when the server exits. If the report cannot be sent, the
+ * server logs the failure itself, and it is not counted.
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#ifdef HAVE_NETDB_H
+#include <netdb.h>
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <syslog.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sio.h"
+#include "str.h"
+
+#include "logstorm.h"
+#include "log.h"
+#include "main.h"
+#include "msg.h"
+#include "sconf.h"
+#include "server.h"
+#include "service.h"
+#include "state.h"
+#include "util.h"
+#include "xconfig.h"
+#include "xtimer.h"
+
+#define STORM_BUCKETS         1024
+
+struct storm
+{
+   char             *st_id ;          /* of the service */
+   access_e          st_code ;
+   union xsockaddr   st_net ;         /* the source network */
+   int               st_bits ;        /* its prefix length */
+   time_t            st_start ;       /* of the window */
+   unsigned          st_logged ;
+   unsigned          st_suppressed ;
+   struct storm     *st_next ;
+} ;
+
+/*
+ * A failure found by a server
+ */
+struct failure_report
+{
+   pid_t             fr_pid ;
+   access_e          fr_code ;
+} ;
+
+static struct storm *storms[ STORM_BUCKETS ] ;
+static unsigned storm_count = 0 ;
+static int sweep_timer = 0 ;
+static time_t sweep_when ;
+static int report_pipe[ 2 ] = { -1, -1 } ;
+static bool_int forwarding = FALSE ;   /* in a server, its failures */
+
+static void storm_sweep(void) ;
+
+
+/*
+ * Put the network of address addr in *net. Returns the length of its
+ * prefix, or -1 if addr is not an IP address.
+ */
+static int storm_net( const union xsockaddr *addr, union xsockaddr *net )
+{
+   unsigned char  *bytes ;
+   int             size ;
+   int             bits ;
+   int             i ;
+
+   CLEAR( *net ) ;
+   if ( addr->sa.sa_family == AF_INET6 &&
+        IN6_IS_ADDR_V4MAPPED( &addr->sa_in6.sin6_addr ) )
+   {
+      net->sa_in.sin_family = AF_INET ;
+      (void) memcpy( &net->sa_in.sin_addr,
+                     &addr->sa_in6.sin6_addr.s6_addr[ 12 ], 4 ) ;
+   }
+   else if ( addr->sa.sa_family == AF_INET )
+   {
+      net->sa_in.sin_family = AF_INET ;
+      net->sa_in.sin_addr = addr->sa_in.sin_addr ;
+   }
+   else if ( addr->sa.sa_family == AF_INET6 )
+   {
+      net->sa_in6.sin6_family = AF_INET6 ;
+      net->sa_in6.sin6_addr = addr->sa_in6.sin6_addr ;
+   }
+   else
+      return( -1 ) ;
+
+   if ( net->sa.sa_family == AF_INET )
+   {
+      bytes = (unsigned char *) &net->sa_in.sin_addr ;
+      size = 4 ;
+      bits = LOG_FAILURE_PREFIX4 ;
+   }
+   else
+   {
+      bytes = net->sa_in6.sin6_addr.s6_addr ;
+      size = 16 ;
+      bits = LOG_FAILURE_PREFIX6 ;
+   }
+   for ( i = 0 ; i < size ; i++ )
+      if ( i * 8 >= bits )
+         bytes[ i ] = 0 ;
+      else if ( i * 8 + 8 > bits )
+         bytes[ i ] &= (unsigned char) ( 0xff << ( i * 8 + 8 - bits ) ) ;
+   return( bits ) ;
+}
+
+
+static unsigned storm_hash( const char *id, access_e code,
+                            const union xsockaddr *net )
+{
+   const unsigned char  *p ;
+   unsigned              h = 2166136261U ;
+   size_t                len ;
+
+   for ( p = (const unsigned char *) id ; *p != NUL ; p++ )
+      h = ( h ^ *p ) * 16777619U ;
+   h = ( h ^ (unsigned) code ) * 16777619U ;
+   if ( net->sa.sa_family == AF_INET )
+   {
+      p = (const unsigned char *) &net->sa_in.sin_addr ;
+      len = 4 ;
+   }
+   else
+   {
+      p = net->sa_in6.sin6_addr.s6_addr ;
+      len = 16 ;
+   }
+   while ( len-- > 0 )
+      h = ( h ^ *p++ ) * 16777619U ;
+   return( h % STORM_BUCKETS ) ;
+}
+
+
+static bool_int storm_match( const struct storm *stp, const char *id,
+                             access_e code, const union xsockaddr *net )
+{
+   if ( stp->st_code != code || stp->st_net.sa.sa_family != net->sa.sa_family )
+      return( FALSE ) ;
+   if ( net->sa.sa_family == AF_INET )
+   {
+      if ( stp->st_net.sa_in.sin_addr.s_addr != net->sa_in.sin_addr.s_addr )
+         return( FALSE ) ;
+   }
+   else if ( memcmp( &stp->st_net.sa_in6.sin6_addr, &net->sa_in6.sin6_addr,
+                     sizeof( net->sa_in6.sin6_addr ) ) != 0 )
+      return( FALSE ) ;
+   return( strcmp( stp->st_id, id ) == 0 ) ;
+}
+
+
+/*
+ * Arrange for the windows to be looked at when the first of them ends
+ */
+static void storm_schedule( time_t when )
+{
+   time_t      now ;
+   const char *func = "storm_schedule" ;
+
+   if ( sweep_timer != 0 )
+   {
+      if ( sweep_when <= when )
+         return ;
+      xtimer_remove( sweep_timer ) ;
+      sweep_timer = 0 ;
+   }
+
+   now = time( NULL ) ;
+   if ( ( sweep_timer =
+            xtimer_add( storm_sweep, when > now ? when - now : 0 ) ) == -1 )
+   {
+      msg( LOG_ERR, func, "xtimer_add: %m" ) ;
+      sweep_timer = 0 ;
+      return ;
+   }
+   sweep_when = when ;
+}
+
+
+/*
+ * Log how many failures were not logged in the window of stp
+ */
+static void storm_report( struct service *sp, const struct storm *stp )
+{
+   char  net[ NI_MAXHOST + 8 ] ;
+
+   if ( xaddrtext( &stp->st_net, net, sizeof( net ) ) == NULL )
+      (void) strcpy( net, "<unknown>" ) ;
+   (void) strx_nprint( &net[ strlen( net ) ], sizeof( net ) - strlen( net ),
+                                                   "/%d", stp->st_bits ) ;
+   svc_log_suppressed( sp, stp->st_code, net, stp->st_suppressed,
+                       SC_LOG_FAILURE_INTERVAL( SVC_CONF( sp ) ) ) ;
+}
+
+
+static struct service *storm_service( const char *id )
+{
+   unsigned u ;
+
+   for ( u = 0 ; u < pset_count( SERVICES( ps ) ) ; u++ )
+   {
+      struct service *sp = SP( pset_pointer( SERVICES( ps ), u ) ) ;
+
+      if ( strcmp( SVC_ID( sp ), id ) == 0 )
+         return( sp ) ;
+   }
+   return( NULL ) ;
+}
+
+
+/*
+ * Close the windows that are over, reporting what they suppressed, and
+ * forget their networks
+ */
+static void storm_sweep( void )
+{
+   time_t   now = time( NULL ) ;
+   time_t   next = 0 ;
+   unsigned b ;
+
+   sweep_timer = 0 ;
+   for ( b = 0 ; b < STORM_BUCKETS ; b++ )
+   {
+      struct storm **stpp = &storms[ b ] ;
+      struct storm *stp ;
+
+      while ( ( stp = *stpp ) != NULL )
+      {
+         struct service *sp = storm_service( stp->st_id ) ;
+
+         if ( sp != NULL && SC_LOG_FAILURE_LIMIT( SVC_CONF( sp ) ) != 0 )
+         {
+            time_t end = stp->st_start +
+                           SC_LOG_FAILURE_INTERVAL( SVC_CONF( sp ) ) ;
+
+            if ( now < end && now >= stp->st_start )
+            {
+               if ( next == 0 || end < next )
+                  next = end ;
+               stpp = &stp->st_next ;
+               continue ;
+            }
+         }
+         if ( sp != NULL && SVC_IS_LOGGING( sp ) && stp->st_suppressed != 0 )
+            storm_report( sp, stp ) ;
+         *stpp = stp->st_next ;
+         free( stp->st_id ) ;
+         FREE( stp ) ;
+         storm_count-- ;
+      }
+   }
+   if ( next != 0 )
+      storm_schedule( next ) ;
+}
+
+
+/*
+ * Invoked for each failure of service sp to be logged. Returns TRUE if
+ * it is only to be counted, because too many failures like it have
+ * been logged already.
+ */
+bool_int logstorm_suppress( struct service *sp, const connection_s *cp,
+                            access_e code )
+{
+   struct service_config   *scp = SVC_CONF( sp ) ;
+   const union xsockaddr   *addr = CONN_XADDRESS( cp ) ;
+   union xsockaddr          net ;
+   struct storm            *stp ;
+   unsigned                 h ;
+   int                      bits ;
+   time_t                   now ;
+   const char              *func = "logstorm_suppress" ;
+
+   if ( SC_LOG_FAILURE_LIMIT( scp ) == 0 || addr == NULL ||
+        ( bits = storm_net( addr, &net ) ) == -1 )
+      return( FALSE ) ;
+
+   now = time( NULL ) ;
+   h = storm_hash( SVC_ID( sp ), code, &net ) ;
+   for ( stp = storms[ h ] ; stp != NULL ; stp = stp->st_next )
+      if ( storm_match( stp, SVC_ID( sp ), code, &net ) )
+         break ;
+
+   if ( stp == NULL )
+   {
+      if ( storm_count >= LOG_FAILURE_SOURCES )
+         return( FALSE ) ;
+      if ( ( stp = NEW( struct storm ) ) == NULL )
+      {
+         out_of_memory( func ) ;
+         return( FALSE ) ;
+      }
+      CLEAR( *stp ) ;
+      if ( ( stp->st_id = new_string( SVC_ID( sp ) ) ) == NULL )
+      {
+         out_of_memory( func ) ;
+         FREE( stp ) ;
+         return( FALSE ) ;
+      }
+      stp->st_code = code ;
+      stp->st_net = net ;
+      stp->st_bits = bits ;
+      stp->st_next = storms[ h ] ;
+      storms[ h ] = stp ;
+      storm_count++ ;
+   }
+   else if ( now >= stp->st_start &&
+             now - stp->st_start < (time_t) SC_LOG_FAILURE_INTERVAL( scp ) )
+   {
+      if ( stp->st_logged < SC_LOG_FAILURE_LIMIT( scp ) )
+      {
+         stp->st_logged++ ;
+         return( FALSE ) ;
+      }
+      stp->st_suppressed++ ;
+      return( TRUE ) ;
+   }
+   else if ( stp->st_suppressed != 0 )
+      storm_report( sp, stp ) ;
+
+   /* a new window */
+   stp->st_start = now ;
+   stp->st_logged = 1 ;
+   stp->st_suppressed = 0 ;
+   storm_schedule( now + SC_LOG_FAILURE_INTERVAL( scp ) ) ;
+   return( FALSE ) ;
+}
+
+
+void logstorm_dump( int fd )
+{
+   unsigned b ;
+
+   for ( b = 0 ; b < STORM_BUCKETS ; b++ )
+   {
+      struct storm *stp ;
+
+      for ( stp = storms[ b ] ; stp != NULL ; stp = stp->st_next )
+      {
+         char net[ NI_MAXHOST ] ;
+
+         if ( xaddrtext( &stp->st_net, net, sizeof( net ) ) == NULL )
+            (void) strcpy( net, "<unknown>" ) ;
+         Sprint( fd, "failures of %s (%s) from %s/%d: %u logged, %u suppressed\n",
+            stp->st_id, ACCESS_EXPLAIN( stp->st_code ), net, stp->st_bits,
+            stp->st_logged, stp->st_suppressed ) ;
+      }
+   }
+   Sputchar( fd, '\n' ) ;
+}
+
+
+/*
+ * Open the pipe through which the servers report their failures
+ */
+void logstorm_start( void )
+{
+   int         i ;
+   const char *func = "logstorm_start" ;
+
+   if ( pipe( report_pipe ) == -1 )
+   {
+      msg( LOG_ERR, func, "pipe: %m" ) ;
+      report_pipe[ 0 ] = report_pipe[ 1 ] = -1 ;
+      return ;
+   }
+   for ( i = 0 ; i < 2 ; i++ )
+      if ( fcntl( report_pipe[ i ], F_SETFD, FD_CLOEXEC ) == -1 ||
+           fcntl( report_pipe[ i ], F_SETFL, O_NONBLOCK ) == -1 )
+      {
+         msg( LOG_ERR, func, "fcntl: %m" ) ;
+         logstorm_close() ;
+         return ;
+      }
+   FD_SET( report_pipe[ 0 ], &ps.rws.socket_mask ) ;
+   if ( report_pipe[ 0 ] > ps.rws.mask_max )
+      ps.rws.mask_max = report_pipe[ 0 ] ;
+}
+
+
+/*
+ * Invoked in a server before its access control: from now on, its
+ * failures are reported to xinetd
+ */
+void logstorm_forward( void )
+{
+   forwarding = ( report_pipe[ 1 ] >= 0 ) ;
+}
+
+
+/*
+ * Invoked in a server for each failure of service sp. Returns TRUE if
+ * the failure was reported to xinetd, which logs it.
+ */
+bool_int logstorm_pass( struct service *sp, access_e code )
+{
+   struct failure_report fr ;
+   ssize_t               cc ;
+
+   if ( ! forwarding || SC_LOG_FAILURE_LIMIT( SVC_CONF( sp ) ) == 0 )
+      return( FALSE ) ;
+
+   fr.fr_pid = getpid() ;
+   fr.fr_code = code ;
+   do
+      cc = write( report_pipe[ 1 ], &fr, sizeof( fr ) ) ;
+   while ( cc == -1 && errno == EINTR ) ;
+   return( cc == sizeof( fr ) ) ;
+}
+
+
+/*
+ * Log the failures the servers reported. The server of a report is
+ * still known, since the report is read at the latest when the exit of
+ * the server is.
+ */
+void logstorm_collect( void )
+{
+   struct failure_report   fr ;
+   ssize_t                 cc ;
+   const char             *func = "logstorm_collect" ;
+
+   if ( report_pipe[ 0 ] < 0 )
+      return ;
+
+   for ( ;; )
+   {
+      struct server *serp ;
+
+      cc = read( report_pipe[ 0 ], &fr, sizeof( fr ) ) ;
+      if ( cc == -1 && errno == EINTR )
+         continue ;
+      if ( cc != sizeof( fr ) )
+         break ;
+      if ( ( serp = server_lookup( fr.fr_pid ) ) != NULL )
+         (void) svc_log_failure( SERVER_SERVICE( serp ),
+                                 SERVER_CONNECTION( serp ), fr.fr_code ) ;
+      else if ( debug.on )
+         msg( LOG_DEBUG, func, "report of unknown process %d", fr.fr_pid ) ;
+   }
+   if ( cc == -1 && errno != EAGAIN )
+      msg( LOG_ERR, func, "read: %m" ) ;
+}
+
+
+int logstorm_poll( fd_set *maskp )
+{
+   if ( report_pipe[ 0 ] < 0 || ! FD_ISSET( report_pipe[ 0 ], maskp ) )
+      return( 0 ) ;
+   logstorm_collect() ;
+   return( 1 ) ;
+}
+
+
+bool_int logstorm_fd( int fd )
+{
+   return( report_pipe[ 0 ] >= 0 && fd == report_pipe[ 0 ] ) ;
+}
+
+
+/*
+ * Close the report pipe in a process that does not report through it
+ */
+void logstorm_close( void )
+{
+   int i ;
+
+   for ( i = 0 ; i < 2 ; i++ )
+      if ( report_pipe[ i ] >= 0 )
+      {
+         (void) close( report_pipe[ i ] ) ;
+         report_pipe[ i ] = -1 ;
+      }
+   forwarding = FALSE ;
+}
@@ -0,0 +1,28 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+#ifndef LOGSTORM_H
+#define LOGSTORM_H
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/select.h>
+
+#include "defs.h"
+#include "access.h"
+#include "connection.h"
+
+bool_int logstorm_suppress(struct service *sp, const connection_s *cp,
+                                                         access_e code);
+void logstorm_dump(int fd);
+void logstorm_start(void);
+void logstorm_forward(void);
+bool_int logstorm_pass(struct service *sp, access_e code);
+void logstorm_collect(void);
+int logstorm_poll(fd_set *maskp);
+bool_int logstorm_fd(int fd);
+void logstorm_close(void);
+
+#endif
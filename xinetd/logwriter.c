@@ -0,0 +1,396 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+
+#include "config.h"
+/* for F_SETPIPE_SZ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sio.h"
+#include "str.h"
+#include "logwriter.h"
+#include "child.h"
+#include "main.h"
+#include "msg.h"
+#include "server.h"
+#include "signals.h"
+#include "state.h"
+#include "util.h"
+#include "xconfig.h"
+
+/*
+ * A note on asynchronous logs:
+ * A file log with log_mode = async is not written by xinetd and its
+ * servers but by a log writer process. They write each record to the
+ * writer through a non-blocking pipe, and the writer copies what it
+ * reads to the file, as many records per write(2) as have piled up.
+ * A slow disk then holds up the writer only. When the pipe is full,
+ * the log_overflow policy of the log decides whether a record is
+ * dropped, dropped and counted, or waited for (see XLOG_ASYNC).
+ *
+ * The writer ends when every write end of its pipe is closed, once it
+ * has written all it was sent, so that nothing is lost when a log is
+ * closed on a reconfiguration. When xinetd exits, it closes the pipes
+ * and waits a little for the writers to finish.
+ *
+ * The old files of a rotated log are compressed by a child running
+ * LOG_COMPRESS_PROGRAM. For an asynchronous log, the compressor starts
+ * only when the writer of the old file has finished writing it.
+ */
+
+struct logwriter
+{
+   pid_t                lw_pid ;
+   int                  lw_fd ;        /* write end of the pipe, or -1 */
+   xlog_h               lw_xh ;        /* the log that writes to it */
+   char                *lw_path ;      /* of the log */
+   char                *lw_compress ;  /* file to compress, or NULL */
+   bool_int             lw_compressor ;
+   struct logwriter    *lw_next ;
+} ;
+
+static struct logwriter *writers = NULL ;
+
+
+static void logwriter_free( struct logwriter *lwp )
+{
+   free( lwp->lw_path ) ;
+   if ( lwp->lw_compress != NULL )
+      free( lwp->lw_compress ) ;
+   FREE( lwp ) ;
+}
+
+
+#ifdef __GNUC__
+__attribute__ ((noreturn))
+#endif
+static void logwriter_main( int in, int out )
+{
+   char  *buf ;
+   int    fd ;
+
+   /*
+    * Keep nothing that belongs to the parent, not even the pipes of the
+    * other writers, or they would never see the end of them. This is
+    * done first: as long as the writer has the connections of xinetd,
+    * they stay open when xinetd closes them.
+    */
+   for ( fd = 0 ; (unsigned)fd < ps.ros.max_descriptors ; fd++ )
+      if ( fd != in && fd != out )
+         (void) close( fd ) ;
+
+   signal_default_state() ;
+   (void) signal( SIGPIPE, SIG_IGN ) ;
+
+   rename_process( "xinetd log writer" ) ;
+
+   if ( ( buf = malloc( LOG_WRITER_BUFFER ) ) == NULL )
+      _exit( 1 ) ;
+
+   for ( ;; )
+   {
+      ssize_t cc = read( in, buf, LOG_WRITER_BUFFER ) ;
+      ssize_t done = 0 ;
+
+      if ( cc == -1 && errno == EINTR )
+         continue ;
+      if ( cc <= 0 )
+         break ;
+      while ( done < cc )
+      {
+         ssize_t n = write( out, buf + done, cc - done ) ;
+
+         if ( n == -1 && errno == EINTR )
+            continue ;
+         /* records that can't be written are lost, as they would be */
+         if ( n <= 0 )
+            break ;
+         done += n ;
+      }
+   }
+   _exit( 0 ) ;
+}
+
+
+/*
+ * Start a writer for the file log xh, and have xh write to it
+ */
+status_e logwriter_start( xlog_h xh, const char *path, int overflow )
+{
+   struct logwriter  *lwp ;
+   int                pv[ 2 ] ;
+   int                fd ;
+   const char        *func = "logwriter_start" ;
+
+   if ( xlog_control( xh, XLOG_GETFD, &fd ) != XLOG_ENOERROR )
+      return( FAILED ) ;
+
+   if ( ( lwp = NEW( struct logwriter ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      return( FAILED ) ;
+   }
+   CLEAR( *lwp ) ;
+   if ( ( lwp->lw_path = new_string( path ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      FREE( lwp ) ;
+      return( FAILED ) ;
+   }
+
+   if ( pipe( pv ) == -1 )
+   {
+      msg( LOG_ERR, func, "pipe failed: %m" ) ;
+      free( lwp->lw_path ) ;
+      FREE( lwp ) ;
+      return( FAILED ) ;
+   }
+
+   switch ( lwp->lw_pid = fork() )
+   {
+      case 0:
+         logwriter_main( pv[ 0 ], fd ) ;
+         /* NOTREACHED */
+
+      case -1:
+         msg( LOG_ERR, func, "fork failed: %m" ) ;
+         (void) close( pv[ 0 ] ) ;
+         (void) close( pv[ 1 ] ) ;
+         free( lwp->lw_path ) ;
+         FREE( lwp ) ;
+         return( FAILED ) ;
+   }
+
+   (void) close( pv[ 0 ] ) ;
+   lwp->lw_fd = pv[ 1 ] ;
+   lwp->lw_xh = xh ;
+   if ( fcntl( lwp->lw_fd, F_SETFD, FD_CLOEXEC ) == -1 ||
+        fcntl( lwp->lw_fd, F_SETFL, O_NONBLOCK ) == -1 )
+      msg( LOG_ERR, func, "fcntl failed: %m" ) ;
+#ifdef F_SETPIPE_SZ
+   (void) fcntl( lwp->lw_fd, F_SETPIPE_SZ, LOG_WRITER_PIPE ) ;
+#endif
+
+   /* The log owns the pipe from now on */
+   (void) xlog_control( xh, XLOG_ASYNC, lwp->lw_fd, overflow ) ;
+   lwp->lw_next = writers ;
+   writers = lwp ;
+
+   if ( debug.on )
+      msg( LOG_DEBUG, func, "started log writer %d for %s",
+                                                   lwp->lw_pid, path ) ;
+   return( OK ) ;
+}
+
+
+/*
+ * Start the compressor of the file of lwp
+ */
+static status_e compressor_start( struct logwriter *lwp )
+{
+   int         fd ;
+   const char *func = "compressor_start" ;
+
+   switch ( lwp->lw_pid = fork() )
+   {
+      case 0:
+         /* nothing of xinetd is kept, its connections first of all */
+         for ( fd = 0 ; (unsigned)fd < ps.ros.max_descriptors ; fd++ )
+            (void) close( fd ) ;
+         /* stdin, stdout and stderr */
+         for ( fd = 0 ; fd < 3 ; fd++ )
+            (void) open( "/dev/null", O_RDWR ) ;
+         signal_default_state() ;
+         (void) execlp( LOG_COMPRESS_PROGRAM, LOG_COMPRESS_PROGRAM, "-f",
+                        lwp->lw_compress, (char *) NULL ) ;
+         _exit( 1 ) ;
+         /* NOTREACHED */
+
+      case -1:
+         msg( LOG_ERR, func, "fork failed: %m" ) ;
+         return( FAILED ) ;
+   }
+   lwp->lw_compressor = TRUE ;
+   lwp->lw_fd = -1 ;
+   if ( debug.on )
+      msg( LOG_DEBUG, func, "started log compressor %d for %s",
+                                             lwp->lw_pid, lwp->lw_compress ) ;
+   return( OK ) ;
+}
+
+
+/*
+ * Compress file, an old file of the log path
+ */
+status_e logwriter_compress( const char *path, const char *file )
+{
+   struct logwriter  *lwp ;
+   const char        *func = "logwriter_compress" ;
+
+   if ( ( lwp = NEW( struct logwriter ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      return( FAILED ) ;
+   }
+   CLEAR( *lwp ) ;
+   if ( ( lwp->lw_path = new_string( path ) ) == NULL ||
+        ( lwp->lw_compress = new_string( file ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      logwriter_free( lwp ) ;
+      return( FAILED ) ;
+   }
+   if ( compressor_start( lwp ) == FAILED )
+   {
+      logwriter_free( lwp ) ;
+      return( FAILED ) ;
+   }
+   lwp->lw_next = writers ;
+   writers = lwp ;
+   return( OK ) ;
+}
+
+
+/*
+ * The pipe from the file log xh to its writer is about to be closed. If
+ * file is not NULL, it is compressed once the writer has finished
+ * writing it. The writer is found by its log rather than by its path,
+ * since a log of the previous configuration may still be open on the
+ * same file (see log_reopen).
+ */
+void logwriter_retire( xlog_h xh, const char *file )
+{
+   struct logwriter *lwp ;
+   const char *func = "logwriter_retire" ;
+
+   for ( lwp = writers ; lwp != NULL ; lwp = lwp->lw_next )
+   {
+      if ( lwp->lw_fd == -1 || lwp->lw_xh != xh )
+         continue ;
+      lwp->lw_fd = -1 ;
+      if ( file != NULL && ( lwp->lw_compress = new_string( file ) ) == NULL )
+         out_of_memory( func ) ;
+      return ;
+   }
+}
+
+
+/*
+ * Returns TRUE if an old file of the log path is being compressed, or
+ * is waiting for its writer to be compressed.
+ */
+bool_int logwriter_busy( const char *path )
+{
+   struct logwriter *lwp ;
+
+   for ( lwp = writers ; lwp != NULL ; lwp = lwp->lw_next )
+      if ( lwp->lw_compress != NULL &&
+                                    strcmp( lwp->lw_path, path ) == 0 )
+         return( TRUE ) ;
+   return( FALSE ) ;
+}
+
+
+/*
+ * Invoked when a child process exits. Returns TRUE if it was a writer
+ * or a compressor.
+ */
+bool_int logwriter_exit( pid_t pid, int status )
+{
+   struct logwriter **lwpp ;
+   const char *func = "logwriter_exit" ;
+
+   for ( lwpp = &writers ; *lwpp != NULL ; lwpp = &(*lwpp)->lw_next )
+   {
+      struct logwriter *lwp = *lwpp ;
+
+      if ( lwp->lw_pid != pid )
+         continue ;
+      if ( ! PROC_EXITED( status ) || PROC_EXITSTATUS( status ) != 0 )
+      {
+         if ( lwp->lw_compressor )
+            msg( LOG_ERR, func, "compression of %s failed",
+                                                      lwp->lw_compress ) ;
+         else
+            msg( LOG_ERR, func, "log writer %d for %s failed", pid,
+                                                         lwp->lw_path ) ;
+      }
+      /* The writer is done with its file, which can be compressed now */
+      if ( ! lwp->lw_compressor && lwp->lw_compress != NULL &&
+                                    compressor_start( lwp ) == OK )
+         return( TRUE ) ;
+      *lwpp = lwp->lw_next ;
+      logwriter_free( lwp ) ;
+      return( TRUE ) ;
+   }
+   return( FALSE ) ;
+}
+
+
+/*
+ * Let the writers finish when xinetd exits: close the pipes, which are
+ * not written to anymore, and wait up to LOG_WRITER_WAIT seconds for
+ * the writers to write what is left. The compressors are not waited
+ * for, and the files still being written are left uncompressed.
+ */
+void logwriter_flush(void)
+{
+   struct logwriter *lwp ;
+   time_t deadline = time( NULL ) + LOG_WRITER_WAIT ;
+
+   for ( lwp = writers ; lwp != NULL ; lwp = lwp->lw_next )
+      if ( lwp->lw_fd != -1 )
+         (void) close( lwp->lw_fd ) ;
+
+   for ( ;; )
+   {
+      struct logwriter **lwpp = &writers ;
+      bool_int waiting = FALSE ;
+      struct timespec ts ;
+
+      while ( ( lwp = *lwpp ) != NULL )
+      {
+         if ( ! lwp->lw_compressor &&
+                        waitpid( lwp->lw_pid, NULL, WNOHANG ) == 0 )
+         {
+            waiting = TRUE ;
+            lwpp = &lwp->lw_next ;
+            continue ;
+         }
+         *lwpp = lwp->lw_next ;
+         logwriter_free( lwp ) ;
+      }
+      if ( ! waiting || time( NULL ) > deadline )
+         break ;
+      ts.tv_sec = 0 ;
+      ts.tv_nsec = 10 * 1000 * 1000 ;
+      (void) nanosleep( &ts, NULL ) ;
+   }
+}
+
+
+void logwriter_dump( int fd )
+{
+   struct logwriter *lwp ;
+
+   for ( lwp = writers ; lwp != NULL ; lwp = lwp->lw_next )
+      if ( lwp->lw_compressor )
+         Sprint( fd, "log compressor %d: %s\n",
+                                       lwp->lw_pid, lwp->lw_compress ) ;
+      else
+         Sprint( fd, "log writer %d: %s%s\n", lwp->lw_pid, lwp->lw_path,
+                                 lwp->lw_fd == -1 ? " (finishing)" : "" ) ;
+   Sputchar( fd, '\n' ) ;
+}
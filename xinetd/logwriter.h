@@ -0,0 +1,23 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+#ifndef LOGWRITER_H
+#define LOGWRITER_H
+
+#include "config.h"
+#include <sys/types.h>
+
+#include "defs.h"
+#include "xlog.h"
+
+status_e logwriter_start(xlog_h xh, const char *path, int overflow);
+status_e logwriter_compress(const char *path, const char *file);
+void logwriter_retire(xlog_h xh, const char *file);
+bool_int logwriter_busy(const char *path);
+bool_int logwriter_exit(pid_t pid, int status);
+void logwriter_flush(void);
+void logwriter_dump(int fd);
+
+#endif
@@ -15,7 +15,16 @@
 #include <syslog.h>
 #include <unistd.h>
 
+#include "xlog.h"
+
 #include "main.h"
+#include "proxy.h"
+#include "ident.h"
+#include "autoreload.h"
+#include "logstorm.h"
+#include "logwriter.h"
+#include "intloop.h"
+#include "engine.h"
 #include "init.h"
 #include "msg.h"
 #include "internals.h"
@@ -52,6 +61,8 @@ int main( int argc, char *argv[] )
    xinetd_mdns_init();
 #endif
    init_services() ;
+   autoreload_start() ;
+   logstorm_start() ;
 
    /* Do the chdir after reading the config file.  Relative path names
     * will work better.  
@@ -147,6 +158,9 @@ static void main_loop(void)
          tvptr = NULL;
       }
 
+      /* send the syslog records of the last pass before waiting */
+      xlog_flush() ;
+
       read_mask = ps.rws.socket_mask ;
       n_active = select( ps.rws.mask_max+1, &read_mask,
                         FD_SET_NULL, FD_SET_NULL, tvptr ) ;
@@ -174,6 +188,24 @@ static void main_loop(void)
                continue ;
       }
 
+      if ( ( n_active -= proxy_poll( &read_mask ) ) == 0 )
+         continue ;
+
+      if ( ( n_active -= ident_poll( &read_mask ) ) == 0 )
+         continue ;
+
+      if ( ( n_active -= autoreload_poll( &read_mask ) ) == 0 )
+         continue ;
+
+      if ( ( n_active -= logstorm_poll( &read_mask ) ) == 0 )
+         continue ;
+
+      if ( ( n_active -= intloop_poll( &read_mask ) ) == 0 )
+         continue ;
+
+      if ( ( n_active -= engine_poll( &read_mask ) ) == 0 )
+         continue ;
+
 #ifdef HAVE_MDNS
       if( xinetd_mdns_poll() == 0 )
          if ( --n_active == 0 )
@@ -287,6 +319,7 @@ void quit_program(void)
    }
 
    msg( LOG_WARNING, func, "Exiting..." ) ;
+   logwriter_flush() ;
    exit( 0 ) ;
 }
 
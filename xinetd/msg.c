@@ -79,7 +79,7 @@ const char *msg_init(void)
          }
 
          type_of_xlog = XLOG_SYSLOG ;
-         xh = xlog_create( type_of_xlog, program_name, XLOG_NOFLAGS,
+         xh = xlog_create( type_of_xlog, program_name, SYSLOG_FLAGS,
                                        facility, DEFAULT_SYSLOG_LEVEL ) ;
       }
    }
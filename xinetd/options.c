@@ -28,6 +28,8 @@ int syslog_option ;
 char * syslog_option_arg ;
 int logprocs_option ;
 unsigned logprocs_option_arg ;
+int auto_reload_option ;
+unsigned auto_reload_option_arg ;
 int stayalive_option=0;
 char *program_name ;
 int inetd_compat = 0 ;
@@ -103,6 +105,15 @@ int opt_recognize( int argc, char *argv[] )
             logprocs_option_arg = uarg_1 ;
             logprocs_option = 1 ;
          }
+         else if ( strcmp( &argv[ arg ][ 1 ], "auto_reload" ) == 0 ) 
+         {
+            if ( ++arg == argc )
+               usage() ;
+            if ( parse_uint( argv[ arg ], 10, NUL, &uarg_1 ) < 0 )
+               usage() ;
+            auto_reload_option_arg = uarg_1 ;
+            auto_reload_option = 1 ;
+         }
          else if ( strcmp( &argv[ arg ][ 1 ], "shutdownprocs" ) == 0 ) 
          {
             if ( ++arg == argc )
@@ -144,7 +155,7 @@ int opt_recognize( int argc, char *argv[] )
 
 static void usage(void)
 {
-   Sprint( 2, "Usage: %s [-d] [-f config_file] [-filelog filename] [-syslog facility] [-reuse] [-limit proc_limit] [-pidfile filename] [-logprocs limit] [-shutdownprocs limit] [-cc interval]\n", program_name ) ;
+   Sprint( 2, "Usage: %s [-d] [-f config_file] [-filelog filename] [-syslog facility] [-reuse] [-limit proc_limit] [-pidfile filename] [-logprocs limit] [-shutdownprocs limit] [-cc interval] [-auto_reload delay]\n", program_name ) ;
    exit( 1 ) ;
 }
 
@@ -16,6 +16,8 @@ extern int syslog_option;
 extern char *syslog_option_arg;
 extern int logprocs_option;
 extern unsigned logprocs_option_arg;
+extern int auto_reload_option;
+extern unsigned auto_reload_option_arg;
 extern int stayalive_option;
 extern char *program_name;
 extern int dont_fork;
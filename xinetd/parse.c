@@ -26,6 +26,7 @@
 #include "parsesup.h"
 #include "addr.h"
 #include "includedir.h"
+#include "conffile.h"
 #include "main.h"
 #include "sio.h"
 
@@ -70,7 +71,7 @@ static const struct attribute service_attributes[] =
    { "passenv",        A_PASSENV,       -2,  passenv_parser         },
    { "flags",          A_FLAGS,         -1,  flags_parser           },
    { "nice",           A_NICE,           1,  nice_parser            },
-   { "redirect",       A_REDIR,          2,  redir_parser           },
+   { "redirect",       A_REDIR,         -1,  redir_parser           },
    { "banner",         A_BANNER,         1,  banner_parser          },
    { "bind",           A_BIND,           1,  bind_parser            },
    { "interface",      A_BIND,           1,  bind_parser            },
@@ -110,6 +111,22 @@ static const struct attribute service_attributes[] =
 #ifdef HAVE_KAFEL
    { "kafel_rule",   A_KAFEL_RULE,       1, kafel_parser            },
 #endif
+   { "redirect_mode",  A_REDIRECT_MODE,  1,  redir_mode_parser      },
+   { "redirect_policy", A_REDIRECT_POLICY, 1, redir_policy_parser   },
+   { "redirect_check", A_REDIRECT_CHECK, 1,  redir_check_parser     },
+   { "redirect_connect_timeout", A_REDIRECT_CONNECT_TIMEOUT, 1,
+                                             redir_connect_timeout_parser },
+   { "redirect_idle_timeout", A_REDIRECT_IDLE_TIMEOUT, 1,
+                                             redir_idle_timeout_parser },
+   { "defer_accept",   A_DEFER_ACCEPT,   1,  defer_accept_parser    },
+   { "tcp_fastopen",   A_TCP_FASTOPEN,   1,  tcp_fastopen_parser    },
+   { "intercept_mode", A_INTERCEPT_MODE, 1,  intercept_mode_parser  },
+   { "builtin_mode",   A_BUILTIN_MODE,   1,  builtin_mode_parser    },
+   { "log_mode",       A_LOG_MODE,       1,  log_mode_parser        },
+   { "log_overflow",   A_LOG_OVERFLOW,   1,  log_overflow_parser    },
+   { "log_rotate",     A_LOG_ROTATE,    -1,  log_rotate_parser      },
+   { "log_format",     A_LOG_FORMAT,     1,  log_format_parser      },
+   { "log_failure_limit", A_LOG_FAILURE_LIMIT, 2, log_failure_limit_parser },
    { NULL,             A_NONE,          -1,  NULL                   }
 } ;
 
@@ -118,6 +135,11 @@ static const struct attribute default_attributes[] =
    { "log_type",        A_LOG_TYPE,       -2,   log_type_parser       },
    { "log_on_success",  A_LOG_ON_SUCCESS, -2,   log_on_success_parser },
    { "log_on_failure",  A_LOG_ON_FAILURE, -2,   log_on_failure_parser },
+   { "log_mode",        A_LOG_MODE,        1,   log_mode_parser       },
+   { "log_overflow",    A_LOG_OVERFLOW,    1,   log_overflow_parser   },
+   { "log_rotate",      A_LOG_ROTATE,     -1,   log_rotate_parser     },
+   { "log_format",      A_LOG_FORMAT,      1,   log_format_parser     },
+   { "log_failure_limit", A_LOG_FAILURE_LIMIT, 2, log_failure_limit_parser },
    { "disabled",        A_DISABLED,       -2,   disabled_parser       },
    { "no_access",       A_NO_ACCESS,      -2,   no_access_parser      },
    { "only_from",       A_ONLY_FROM,      -2,   only_from_parser      },
@@ -137,6 +159,8 @@ static const struct attribute default_attributes[] =
 #endif
    { "v6only",          A_V6ONLY,         1,    v6only_parser         },
    { "umask",           A_UMASK,          1,    umask_parser          },
+   { "spawn_rate",      A_SPAWN_RATE,     1,    spawn_rate_parser     },
+   { "spawn_burst",     A_SPAWN_BURST,    1,    spawn_burst_parser    },
 #ifdef HAVE_MDNS
    { "mdns",            A_MDNS,           1,    mdns_parser           },
 #endif
@@ -233,6 +257,8 @@ void parse_conf_file( int fd, struct configuration *confp, const char *filename)
       case INCLUDE_ENTRY:
          {
             int saved_line_count = line_count;
+            if ( conffile_mark( filename, CF_NESTED ) == FAILED )
+               break;
             incfd = open(service_name, O_RDONLY);
             if( incfd < 0 ) {
                parsemsg( LOG_ERR, func, 
@@ -242,6 +268,7 @@ void parse_conf_file( int fd, struct configuration *confp, const char *filename)
             }
             parsemsg( LOG_DEBUG,func,
                "Reading included configuration file: %s",service_name);
+            conffile_note(incfd, service_name);
             parse_conf_file(incfd, confp, service_name);
 	    /*
 	     * parse_conf_file eventually calls Srdline, try Sclosing it
@@ -256,6 +283,8 @@ void parse_conf_file( int fd, struct configuration *confp, const char *filename)
       case INCLUDEDIR_ENTRY:
          {
             int saved_line_count = line_count;
+            if ( conffile_mark( filename, CF_NESTED ) == FAILED )
+               break;
             handle_includedir(service_name, confp);
             current_file = filename;
             line_count = saved_line_count;
@@ -271,6 +300,8 @@ void parse_conf_file( int fd, struct configuration *confp, const char *filename)
             "only 1 defaults entry is allowed. This entry will be ignored" ) ;
             skip_entry( fd ) ;
          }
+         else if ( conffile_mark( filename, CF_DEFAULTS ) == FAILED )
+            skip_entry( fd ) ;
          else if ( parse_entry( DEFAULTS_ENTRY, fd,
                            default_config ) == OK ) {
             found_defaults = YES ;
@@ -423,6 +454,15 @@ static void get_service_entry( int fd,
       return ;
    }
 
+   if ( current_file != NULL &&
+        ( SC_FILE(scp) = new_string( current_file ) ) == NULL )
+   {
+      out_of_memory( func ) ;
+      sc_free( scp ) ;
+      skip_entry( fd ) ;
+      return ;
+   }
+
    /* Now fill in default attributes if given. */
    if ( SC_SPECIFIED( defaults, A_LOG_ON_SUCCESS ) &&
       ! SC_IS_PRESENT( scp, A_LOG_ON_SUCCESS) )
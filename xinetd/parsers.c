@@ -30,6 +30,7 @@
 #endif
 
 #include "str.h"
+#include "xlog.h"
 #include "parsers.h"
 #include "msg.h"
 #include "nvlists.h"
@@ -1213,17 +1214,16 @@ status_e max_load_parser(pset_h values,
 }
 #endif
 
-status_e redir_parser(pset_h values, 
-                      struct service_config *scp, 
-                      enum assign_op op)
+/*
+ * Resolve one "host port" pair of the redirect attribute
+ */
+static status_e redir_addr(const char *adr, const char *port_char,
+                           union xsockaddr *addrp)
 {
-   char *adr = (char *)pset_pointer(values, 0);
    const char *func = "redir_parser";
-   char *port_char;
    int port_int;
    struct addrinfo hints, *res;
 
-   port_char = pset_pointer(values, 1);
    if (parse_base10(port_char, &port_int) || port_int <= 0)
    {  /* OK, maybe its a service name... */
       struct servent *entry;
@@ -1240,13 +1240,6 @@ status_e redir_parser(pset_h values,
       parsemsg(LOG_ERR, func, "port number too large");
       return FAILED;
    }
-   
-   SC_REDIR_ADDR(scp) = (union xsockaddr *)malloc(sizeof(union xsockaddr));
-   if( SC_REDIR_ADDR(scp) == NULL )
-   {
-      parsemsg(LOG_ERR, func, "can't allocate space for redir addr");
-      return FAILED;
-   }
 
    memset(&hints, 0, sizeof(hints));
    hints.ai_flags = AI_CANONNAME;
@@ -1258,29 +1251,66 @@ status_e redir_parser(pset_h values,
 
    if( getaddrinfo(adr, NULL, &hints, &res) < 0 ) {
       parsemsg(LOG_ERR, func, "bad address");
-      free( SC_REDIR_ADDR(scp) );
-      SC_REDIR_ADDR(scp) = NULL;
       return FAILED;
    }
 
    if( (res == NULL) || (res->ai_addr == NULL) ) {
       parsemsg(LOG_ERR, func, "no addresses returned");
-      free( SC_REDIR_ADDR(scp) );
-      SC_REDIR_ADDR(scp) = NULL;
       return FAILED;
    }
       
    if( (res->ai_family == AF_INET) || (res->ai_family == AF_INET6) )
-      memcpy(SC_REDIR_ADDR(scp), res->ai_addr, res->ai_addrlen);
-   if( SC_REDIR_ADDR(scp)->sa.sa_family == AF_INET ) 
-      SC_REDIR_ADDR(scp)->sa_in.sin_port = port_int;
-   if( SC_REDIR_ADDR(scp)->sa.sa_family == AF_INET6 ) 
-      SC_REDIR_ADDR(scp)->sa_in6.sin6_port = port_int;
+      memcpy(addrp, res->ai_addr, res->ai_addrlen);
+   if( addrp->sa.sa_family == AF_INET ) 
+      addrp->sa_in.sin_port = port_int;
+   if( addrp->sa.sa_family == AF_INET6 ) 
+      addrp->sa_in6.sin6_port = port_int;
 
    freeaddrinfo(res);
    return OK;
 }
 
+/*
+ * redirect = host port [host port ...]
+ * Each pair is a backend; connections are spread over them according
+ * to redirect_policy.
+ */
+status_e redir_parser(pset_h values, 
+                      struct service_config *scp, 
+                      enum assign_op op)
+{
+   unsigned count = pset_count(values) / 2;
+   unsigned u;
+   const char *func = "redir_parser";
+
+   if (count == 0 || pset_count(values) % 2 != 0)
+   {
+      parsemsg(LOG_ERR, func, "redirect needs host and port pairs");
+      return FAILED;
+   }
+
+   SC_REDIR_ADDR(scp) = (union xsockaddr *)calloc(count, sizeof(union xsockaddr));
+   if( SC_REDIR_ADDR(scp) == NULL )
+   {
+      parsemsg(LOG_ERR, func, "can't allocate space for redir addr");
+      return FAILED;
+   }
+
+   for (u = 0; u < count; u++)
+   {
+      if (redir_addr((char *)pset_pointer(values, 2*u),
+                     (char *)pset_pointer(values, 2*u+1),
+                     SC_REDIR_BACKEND(scp, u)) == FAILED)
+      {
+         free( SC_REDIR_ADDR(scp) );
+         SC_REDIR_ADDR(scp) = NULL;
+         return FAILED;
+      }
+   }
+   SC_REDIR_COUNT(scp) = count;
+   return OK;
+}
+
 status_e bind_parser( pset_h values, 
                       struct service_config *scp, 
                       enum assign_op op)
@@ -1548,6 +1578,338 @@ status_e umask_parser( pset_h values,
    return( OK );
 }
 
+status_e redir_mode_parser( pset_h values, 
+                            struct service_config *scp, 
+                            enum assign_op op )
+{
+   char *val = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "redir_mode_parser" ;
+
+   if ( EQ( val, "inline" ) )
+   {
+#ifdef HAVE_EPOLL_CREATE
+      SC_REDIR_INLINE(scp) = YES ;
+#else
+      parsemsg( LOG_WARNING, func,
+         "inline redirection is not supported on this system" ) ;
+      SC_REDIR_INLINE(scp) = NO ;
+#endif
+   }
+   else if ( EQ( val, "fork" ) )
+      SC_REDIR_INLINE(scp) = NO ;
+   else
+   {
+      parsemsg( LOG_ERR, func, "Bad value for redirect_mode: %s", val ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+status_e redir_policy_parser( pset_h values, 
+                              struct service_config *scp, 
+                              enum assign_op op )
+{
+   char *val = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "redir_policy_parser" ;
+
+   if ( EQ( val, "roundrobin" ) )
+      SC_REDIR_POLICY(scp) = REDIR_ROUNDROBIN ;
+   else if ( EQ( val, "leastconn" ) )
+      SC_REDIR_POLICY(scp) = REDIR_LEASTCONN ;
+   else if ( EQ( val, "source" ) )
+      SC_REDIR_POLICY(scp) = REDIR_SOURCE ;
+   else
+   {
+      parsemsg( LOG_ERR, func, "Bad value for redirect_policy: %s", val ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+status_e redir_check_parser( pset_h values, 
+                             struct service_config *scp, 
+                             enum assign_op op )
+{
+   char *val = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "redir_check_parser" ;
+
+   if ( parse_base10( val, &SC_REDIR_CHECK(scp) ) || SC_REDIR_CHECK(scp) < 0 )
+   {
+      parsemsg( LOG_ERR, func, "Bad value for redirect_check: %s", val ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+status_e redir_connect_timeout_parser( pset_h values, 
+                                       struct service_config *scp, 
+                                       enum assign_op op )
+{
+   char *val = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "redir_connect_timeout_parser" ;
+
+   if ( parse_base10( val, &SC_REDIR_CONNECT_TIMEOUT(scp) ) ||
+                                       SC_REDIR_CONNECT_TIMEOUT(scp) < 0 )
+   {
+      parsemsg( LOG_ERR, func,
+                  "Bad value for redirect_connect_timeout: %s", val ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+status_e redir_idle_timeout_parser( pset_h values, 
+                                    struct service_config *scp, 
+                                    enum assign_op op )
+{
+   char *val = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "redir_idle_timeout_parser" ;
+
+   if ( parse_base10( val, &SC_REDIR_IDLE_TIMEOUT(scp) ) ||
+                                       SC_REDIR_IDLE_TIMEOUT(scp) < 0 )
+   {
+      parsemsg( LOG_ERR, func,
+                  "Bad value for redirect_idle_timeout: %s", val ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+status_e defer_accept_parser( pset_h values, 
+                              struct service_config *scp, 
+                              enum assign_op op )
+{
+   char *val = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "defer_accept_parser" ;
+
+   if ( parse_base10( val, &SC_DEFER_ACCEPT(scp) ) || SC_DEFER_ACCEPT(scp) < 0 )
+   {
+      parsemsg( LOG_ERR, func, "Bad value for defer_accept: %s", val ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+status_e tcp_fastopen_parser( pset_h values, 
+                              struct service_config *scp, 
+                              enum assign_op op )
+{
+   char *val = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "tcp_fastopen_parser" ;
+
+   if ( parse_base10( val, &SC_TCP_FASTOPEN(scp) ) || SC_TCP_FASTOPEN(scp) < 0 )
+   {
+      parsemsg( LOG_ERR, func, "Bad value for tcp_fastopen: %s", val ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+status_e intercept_mode_parser( pset_h values, 
+                                struct service_config *scp, 
+                                enum assign_op op )
+{
+   char *val = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "intercept_mode_parser" ;
+
+   if ( EQ( val, "inline" ) )
+   {
+#ifdef HAVE_EPOLL_CREATE
+      SC_INTERCEPT_INLINE(scp) = YES ;
+#else
+      parsemsg( LOG_WARNING, func,
+         "inline interception is not supported on this system" ) ;
+      SC_INTERCEPT_INLINE(scp) = NO ;
+#endif
+   }
+   else if ( EQ( val, "fork" ) )
+      SC_INTERCEPT_INLINE(scp) = NO ;
+   else
+   {
+      parsemsg( LOG_ERR, func, "Bad value for intercept_mode: %s", val ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+status_e builtin_mode_parser( pset_h values, 
+                              struct service_config *scp, 
+                              enum assign_op op )
+{
+   char *val = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "builtin_mode_parser" ;
+
+   if ( EQ( val, "inline" ) )
+      SC_BUILTIN_FORK(scp) = NO ;
+   else if ( EQ( val, "fork" ) )
+      SC_BUILTIN_FORK(scp) = YES ;
+   else
+   {
+      parsemsg( LOG_ERR, func, "Bad value for builtin_mode: %s", val ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+status_e log_mode_parser( pset_h values, 
+                          struct service_config *scp, 
+                          enum assign_op op )
+{
+   char *val = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "log_mode_parser" ;
+
+   if ( EQ( val, "sync" ) )
+      SC_LOG_ASYNC(scp) = NO ;
+   else if ( EQ( val, "async" ) )
+      SC_LOG_ASYNC(scp) = YES ;
+   else
+   {
+      parsemsg( LOG_ERR, func, "Bad value for log_mode: %s", val ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+status_e log_overflow_parser( pset_h values, 
+                              struct service_config *scp, 
+                              enum assign_op op )
+{
+   char *val = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "log_overflow_parser" ;
+
+   if ( EQ( val, "count" ) )
+      SC_LOG_OVERFLOW(scp) = XLOG_OVERFLOW_COUNT ;
+   else if ( EQ( val, "drop" ) )
+      SC_LOG_OVERFLOW(scp) = XLOG_OVERFLOW_DROP ;
+   else if ( EQ( val, "block" ) )
+      SC_LOG_OVERFLOW(scp) = XLOG_OVERFLOW_BLOCK ;
+   else
+   {
+      parsemsg( LOG_ERR, func, "Bad value for log_overflow: %s", val ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+/*
+ * Syntax:  log_rotate = <count> [compress]
+ */
+status_e log_rotate_parser( pset_h values, 
+                            struct service_config *scp, 
+                            enum assign_op op )
+{
+   unsigned    count = pset_count( values ) ;
+   char       *keep ;
+   const char *func = "log_rotate_parser" ;
+
+   if ( count == 0 || count > 2 )
+   {
+      parsemsg( LOG_ERR, func, "log_rotate takes a count and compress" ) ;
+      return( FAILED ) ;
+   }
+   keep = (char *) pset_pointer( values, 0 ) ;
+   if ( parse_ubase10( keep, &SC_LOG_ROTATE(scp) ) )
+   {
+      parsemsg( LOG_ERR, func, "log_rotate count is invalid: %s", keep ) ;
+      return( FAILED ) ;
+   }
+   SC_LOG_COMPRESS(scp) = NO ;
+   if ( count == 2 )
+   {
+      char *val = (char *) pset_pointer( values, 1 ) ;
+
+      if ( ! EQ( val, "compress" ) )
+      {
+         parsemsg( LOG_ERR, func, "Bad value for log_rotate: %s", val ) ;
+         return( FAILED ) ;
+      }
+      SC_LOG_COMPRESS(scp) = YES ;
+   }
+   return( OK ) ;
+}
+
+status_e log_format_parser( pset_h values, 
+                            struct service_config *scp, 
+                            enum assign_op op )
+{
+   char *val = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "log_format_parser" ;
+
+   if ( EQ( val, "text" ) )
+      SC_LOG_JSON(scp) = NO ;
+   else if ( EQ( val, "json" ) )
+      SC_LOG_JSON(scp) = YES ;
+   else
+   {
+      parsemsg( LOG_ERR, func, "Bad value for log_format: %s", val ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+/*
+ * Syntax:  log_failure_limit = <count> <interval>
+ * A count of 0 logs every failure.
+ */
+status_e log_failure_limit_parser( pset_h values, 
+                                   struct service_config *scp, 
+                                   enum assign_op op )
+{
+   char *limit = (char *) pset_pointer( values, 0 ) ;
+   char *interval = (char *) pset_pointer( values, 1 ) ;
+   const char *func = "log_failure_limit_parser" ;
+
+   if ( parse_ubase10( limit, &SC_LOG_FAILURE_LIMIT(scp) ) )
+   {
+      parsemsg( LOG_ERR, func, "log_failure_limit count is invalid: %s",
+                                                                  limit ) ;
+      return( FAILED ) ;
+   }
+   if ( parse_ubase10( interval, &SC_LOG_FAILURE_INTERVAL(scp) ) ||
+        SC_LOG_FAILURE_INTERVAL(scp) == 0 )
+   {
+      parsemsg( LOG_ERR, func, "log_failure_limit interval is invalid: %s",
+                                                               interval ) ;
+      SC_LOG_FAILURE_LIMIT(scp) = 0 ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+status_e spawn_rate_parser( pset_h values, 
+                            struct service_config *scp, 
+                            enum assign_op op )
+{
+   char *rate = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "spawn_rate_parser" ;
+
+   if ( EQ( rate, "UNLIMITED" ) )
+      SC_SPAWN_RATE(scp) = 0 ;
+   else if ( parse_ubase10( rate, &SC_SPAWN_RATE(scp) ) ||
+             SC_SPAWN_RATE(scp) == 0 )
+   {
+      parsemsg( LOG_ERR, func, "spawn_rate is invalid: %s", rate ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+status_e spawn_burst_parser( pset_h values, 
+                             struct service_config *scp, 
+                             enum assign_op op )
+{
+   char *burst = (char *) pset_pointer( values, 0 ) ;
+   const char *func = "spawn_burst_parser" ;
+
+   if ( parse_ubase10( burst, &SC_SPAWN_BURST(scp) ) ||
+        SC_SPAWN_BURST(scp) == 0 )
+   {
+      parsemsg( LOG_ERR, func, "spawn_burst is invalid: %s", burst ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
 #ifdef LIBWRAP
 status_e libwrap_parser( pset_h values,
                          struct service_config *scp,
@@ -66,6 +66,22 @@ status_e rlim_stack_parser(pset_h, struct service_config *, enum assign_op) ;
 status_e v6only_parser(pset_h, struct service_config *, enum assign_op);
 status_e deny_time_parser(pset_h, struct service_config *, enum assign_op) ;
 status_e umask_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e redir_mode_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e redir_policy_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e redir_check_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e redir_connect_timeout_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e redir_idle_timeout_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e defer_accept_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e tcp_fastopen_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e intercept_mode_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e builtin_mode_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e log_mode_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e log_overflow_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e log_rotate_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e log_format_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e log_failure_limit_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e spawn_rate_parser(pset_h, struct service_config *, enum assign_op) ;
+status_e spawn_burst_parser(pset_h, struct service_config *, enum assign_op) ;
 status_e mdns_parser(pset_h, struct service_config *, enum assign_op) ;
 #ifdef LIBWRAP
 status_e libwrap_parser(pset_h, struct service_config *, enum assign_op) ;
@@ -0,0 +1,1313 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+#ifdef HAVE_EPOLL_CREATE
+#include <sys/epoll.h>
+#endif
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sio.h"
+#include "proxy.h"
+#include "backend.h"
+#include "child.h"
+#include "connection.h"
+#include "log.h"
+#include "main.h"
+#include "msg.h"
+#include "sconf.h"
+#include "server.h"
+#include "service.h"
+#include "signals.h"
+#include "state.h"
+#include "xconfig.h"
+
+/*
+ * A note on inline redirection:
+ * Connections to services with redirect_mode = inline are not given a
+ * forked process each. Instead, the accepted descriptor is passed over
+ * a SOCK_SEQPACKET socket pair to one of a small pool of proxy
+ * processes, each of which relays the data of many connections with
+ * epoll(7) and non-blocking sockets.
+ *
+ * In the parent, each connection still has its struct server (with a
+ * pid of 0) in the server table, so that instances are counted and the
+ * success and exit entries are logged as usual. When the proxy is done
+ * with a connection, it reports the byte counts back to the parent,
+ * which logs the TRAFFIC entry and ends the server. The proxy itself
+ * never logs; it closes every descriptor except its control socket.
+ *
+ * When the connect to the backend fails or times out, the proxy keeps
+ * the client side and reports PROXY_FAILED. The parent either gives it
+ * another backend with PROXY_CONNECT or stops the session. Sessions
+ * idle for longer than redirect_idle_timeout are ended by the proxy.
+ */
+
+#define PROXY_START           1
+#define PROXY_STOP            2
+#define PROXY_DONE            3        /* a session is over */
+#define PROXY_STOPPED         4        /* a PROXY_STOP was handled */
+#define PROXY_CONNECT         5        /* try another backend */
+#define PROXY_FAILED          6        /* the backend could not be reached */
+
+/*
+ * Errors a proxy reports for a session it could not take on, as opposed
+ * to the connect errors of the backend
+ */
+#define LOCAL_ERROR( e )      ( (e) == EMFILE || (e) == ENFILE || \
+                                (e) == ENOMEM )
+
+struct proxy_request
+{
+   unsigned          pr_id ;
+   int               pr_type ;
+   int               pr_keepalive ;
+   int               pr_connect_timeout ;
+   int               pr_idle_timeout ;
+   union xsockaddr   pr_addr ;         /* port in network byte order */
+} ;
+
+struct proxy_report
+{
+   unsigned          pr_id ;
+   int               pr_type ;
+   int               pr_error ;        /* errno of a failed connect */
+   unsigned long     pr_bytes_in ;
+   unsigned long     pr_bytes_out ;
+} ;
+
+/*
+ * The parent's view of a proxy process. The session id is the index
+ * of the server in the session table.
+ */
+struct proxy
+{
+   pid_t             px_pid ;
+   int               px_fd ;           /* parent end of the socket pair */
+   unsigned          px_sessions ;
+   unsigned          px_used ;         /* slots in use, stopping included */
+   unsigned          px_slots ;
+   unsigned          px_next ;         /* where to look for a free slot */
+   struct server   **px_table ;
+} ;
+
+static struct proxy proxy_pool[ REDIR_PROXIES ] ;
+
+/*
+ * Marks a slot whose session was ended by the parent; the slot is
+ * reused only after the proxy has acknowledged the PROXY_STOP.
+ */
+#define PROXY_STOPPING        ( (struct server *) &proxy_pool[ 0 ] )
+
+
+/*
+ * Send a request (and optionally a descriptor) to a proxy without
+ * blocking
+ */
+static status_e proxy_send( struct proxy *pxp,
+                            const struct proxy_request *reqp, int fd )
+{
+   struct msghdr     mh ;
+   struct iovec      iov ;
+   union {
+      struct cmsghdr cm ;
+      char           buf[ CMSG_SPACE( sizeof( int ) ) ] ;
+   } control ;
+   ssize_t           cc ;
+
+   CLEAR( mh ) ;
+   iov.iov_base = (char *) reqp ;
+   iov.iov_len = sizeof( *reqp ) ;
+   mh.msg_iov = &iov ;
+   mh.msg_iovlen = 1 ;
+   if ( fd >= 0 )
+   {
+      struct cmsghdr *cmp ;
+
+      CLEAR( control ) ;
+      mh.msg_control = control.buf ;
+      mh.msg_controllen = sizeof( control.buf ) ;
+      cmp = CMSG_FIRSTHDR( &mh ) ;
+      cmp->cmsg_level = SOL_SOCKET ;
+      cmp->cmsg_type = SCM_RIGHTS ;
+      cmp->cmsg_len = CMSG_LEN( sizeof( int ) ) ;
+      memcpy( CMSG_DATA( cmp ), &fd, sizeof( int ) ) ;
+   }
+
+   do
+      cc = sendmsg( pxp->px_fd, &mh, MSG_DONTWAIT ) ;
+   while ( cc == -1 && errno == EINTR ) ;
+   return( cc == sizeof( *reqp ) ? OK : FAILED ) ;
+}
+
+
+#ifdef HAVE_EPOLL_CREATE
+
+/*
+ * The rest of this section runs in the proxy process
+ */
+
+#define PROXY_BUFFER          16384
+#define PROXY_EVENTS          64
+
+#define CLIENT                0
+#define SERVER                1
+
+struct session ;
+
+struct endpoint
+{
+   struct session   *ep_session ;
+   int               ep_side ;
+} ;
+
+struct session
+{
+   unsigned          s_id ;
+   int               s_fd[ 2 ] ;
+   unsigned          s_events[ 2 ] ;   /* registered with epoll */
+   struct endpoint   s_ep[ 2 ] ;
+   char             *s_pending[ 2 ] ;  /* data not yet written to s_fd */
+   size_t            s_len[ 2 ] ;
+   size_t            s_off[ 2 ] ;
+   unsigned long     s_bytes[ 2 ] ;    /* bytes read from s_fd */
+   bool_int          s_eof[ 2 ] ;      /* nothing more to read from s_fd */
+   bool_int          s_connecting ;
+   int               s_connect_timeout ;
+   int               s_idle_timeout ;
+   time_t            s_deadline ;      /* of the connect or idle timeout */
+   bool_int          s_dead ;
+   struct session   *s_next_dead ;
+} ;
+
+static int              proxy_epfd ;
+static int              proxy_ctl ;
+static struct session **proxy_sessions ;
+static unsigned         proxy_slots ;
+static struct session  *proxy_dead ;
+static unsigned         proxy_timed ;     /* sessions with a timeout */
+static time_t           proxy_now ;
+
+
+static void session_report( unsigned id, int type, int error,
+                            unsigned long in, unsigned long out )
+{
+   struct proxy_report rep ;
+   ssize_t cc ;
+
+   CLEAR( rep ) ;
+   rep.pr_id = id ;
+   rep.pr_type = type ;
+   rep.pr_error = error ;
+   rep.pr_bytes_in = in ;
+   rep.pr_bytes_out = out ;
+
+   do
+      cc = send( proxy_ctl, (char *) &rep, sizeof( rep ), 0 ) ;
+   while ( cc == -1 && errno == EINTR ) ;
+}
+
+
+/*
+ * Close a session and report it to the parent, unless the parent asked
+ * for it. The memory is released after all the events of the current
+ * epoll_wait have been handled.
+ */
+static void session_close( struct session *sesp, bool_int report, int error )
+{
+   int i ;
+
+   for ( i = CLIENT ; i <= SERVER ; i++ )
+   {
+      if ( sesp->s_fd[ i ] >= 0 )
+         (void) close( sesp->s_fd[ i ] ) ;
+      if ( sesp->s_pending[ i ] != NULL )
+         free( sesp->s_pending[ i ] ) ;
+      sesp->s_pending[ i ] = NULL ;
+   }
+   if ( report )
+      session_report( sesp->s_id, PROXY_DONE, error,
+                        sesp->s_bytes[ CLIENT ], sesp->s_bytes[ SERVER ] ) ;
+   if ( sesp->s_connect_timeout > 0 || sesp->s_idle_timeout > 0 )
+      proxy_timed-- ;
+   if ( sesp->s_id < proxy_slots )
+      proxy_sessions[ sesp->s_id ] = NULL ;
+   sesp->s_dead = TRUE ;
+   sesp->s_next_dead = proxy_dead ;
+   proxy_dead = sesp ;
+}
+
+#define session_end( sesp, error )     session_close( sesp, TRUE, error )
+
+
+/*
+ * The backend could not be reached. The client side is kept until the
+ * parent tells us what to do with it.
+ */
+static void session_failed( struct session *sesp, int error )
+{
+   if ( sesp->s_fd[ SERVER ] >= 0 )
+      (void) close( sesp->s_fd[ SERVER ] ) ;
+   sesp->s_fd[ SERVER ] = -1 ;
+   sesp->s_events[ SERVER ] = 0 ;
+   sesp->s_connecting = FALSE ;
+   sesp->s_deadline = 0 ;
+   session_report( sesp->s_id, PROXY_FAILED, error, 0, 0 ) ;
+}
+
+
+static void session_touch( struct session *sesp )
+{
+   if ( sesp->s_idle_timeout > 0 )
+      sesp->s_deadline = proxy_now + sesp->s_idle_timeout ;
+}
+
+
+/*
+ * Register with epoll the events each side of the session is waiting for
+ */
+static status_e session_update( struct session *sesp )
+{
+   int i ;
+
+   for ( i = CLIENT ; i <= SERVER ; i++ )
+   {
+      unsigned want = 0 ;
+      struct epoll_event ev ;
+
+      if ( sesp->s_eof[ i ] )
+         continue ;        /* no longer registered */
+      if ( sesp->s_connecting )
+         want = ( i == SERVER ) ? EPOLLOUT : 0 ;
+      else if ( sesp->s_eof[ 1 - i ] )
+         want = EPOLLOUT ;
+      else
+      {
+         if ( sesp->s_pending[ 1 - i ] == NULL )
+            want |= EPOLLIN ;
+         if ( sesp->s_pending[ i ] != NULL )
+            want |= EPOLLOUT ;
+      }
+      if ( want == sesp->s_events[ i ] )
+         continue ;
+
+      ev.events = want ;
+      ev.data.ptr = &sesp->s_ep[ i ] ;
+      if ( epoll_ctl( proxy_epfd, EPOLL_CTL_MOD, sesp->s_fd[ i ], &ev ) == -1 )
+         return( FAILED ) ;
+      sesp->s_events[ i ] = want ;
+   }
+   return( OK ) ;
+}
+
+
+/*
+ * Write the pending data of one side of the session.
+ * Returns -1 if the session is finished.
+ */
+static int session_flush( struct session *sesp, int to )
+{
+   ssize_t cc ;
+
+   do
+      cc = write( sesp->s_fd[ to ], sesp->s_pending[ to ] + sesp->s_off[ to ],
+                  sesp->s_len[ to ] - sesp->s_off[ to ] ) ;
+   while ( cc == -1 && errno == EINTR ) ;
+   if ( cc == -1 )
+      return( errno == EAGAIN ? 0 : -1 ) ;
+
+   sesp->s_off[ to ] += cc ;
+   if ( sesp->s_off[ to ] == sesp->s_len[ to ] )
+   {
+      free( sesp->s_pending[ to ] ) ;
+      sesp->s_pending[ to ] = NULL ;
+   }
+   return( 0 ) ;
+}
+
+
+/*
+ * Keep the len bytes at data for the side to, after the data already
+ * pending for it
+ */
+static status_e session_keep( struct session *sesp, int to,
+                              const char *data, size_t len )
+{
+   size_t left = 0 ;
+   char  *p ;
+
+   if ( sesp->s_pending[ to ] != NULL )
+   {
+      left = sesp->s_len[ to ] - sesp->s_off[ to ] ;
+      memmove( sesp->s_pending[ to ],
+               sesp->s_pending[ to ] + sesp->s_off[ to ], left ) ;
+   }
+   if ( ( p = realloc( sesp->s_pending[ to ], left + len ) ) == NULL )
+      return( FAILED ) ;
+   memcpy( p + left, data, len ) ;
+   sesp->s_pending[ to ] = p ;
+   sesp->s_len[ to ] = left + len ;
+   sesp->s_off[ to ] = 0 ;
+   return( OK ) ;
+}
+
+
+/*
+ * Move the data available on one side of the session to the other.
+ * Whatever can't be written right away is kept, and no more is read
+ * from this side until it has been written. Data read while some is
+ * still pending (after a hangup) is kept behind it.
+ * Returns -1 if the session is finished, 1 if there is nothing more
+ * to read from this side.
+ */
+static int session_relay( struct session *sesp, int from )
+{
+   static char buf[ PROXY_BUFFER ] ;
+   int         to = 1 - from ;
+   ssize_t     num_read, num_wrote ;
+
+   do
+      num_read = read( sesp->s_fd[ from ], buf, sizeof( buf ) ) ;
+   while ( num_read == -1 && errno == EINTR ) ;
+   if ( num_read == -1 )
+      return( errno == EAGAIN ? 0 : 1 ) ;
+   if ( num_read == 0 )
+      return( 1 ) ;
+   sesp->s_bytes[ from ] += num_read ;
+
+   if ( sesp->s_pending[ to ] != NULL )
+      num_wrote = 0 ;
+   else
+   {
+      do
+         num_wrote = write( sesp->s_fd[ to ], buf, num_read ) ;
+      while ( num_wrote == -1 && errno == EINTR ) ;
+      if ( num_wrote == -1 )
+      {
+         if ( errno != EAGAIN )
+            return( -1 ) ;
+         num_wrote = 0 ;
+      }
+   }
+
+   if ( num_wrote < num_read &&
+        session_keep( sesp, to, buf + num_wrote, num_read - num_wrote )
+                                                               == FAILED )
+      return( -1 ) ;
+   return( 0 ) ;
+}
+
+
+/*
+ * Nothing more can be read from side: the session ends once the data
+ * pending for the other side has been written. Until then, side is no
+ * longer watched, since its hangup would be reported again and again.
+ */
+static int session_eof( struct session *sesp, int side )
+{
+   if ( sesp->s_pending[ 1 - side ] == NULL )
+      return( -1 ) ;
+   if ( epoll_ctl( proxy_epfd, EPOLL_CTL_DEL, sesp->s_fd[ side ], NULL ) == -1 )
+      return( -1 ) ;
+   sesp->s_eof[ side ] = TRUE ;
+   sesp->s_events[ side ] = 0 ;
+   return( 0 ) ;
+}
+
+
+static void session_event( struct session *sesp, int side, unsigned events )
+{
+   int on = 1 ;
+
+   if ( sesp->s_fd[ SERVER ] < 0 )
+   {
+      /* waiting for another backend; only a hangup matters */
+      if ( side == CLIENT && ( events & ( EPOLLERR | EPOLLHUP ) ) )
+         session_end( sesp, 0 ) ;
+      return ;
+   }
+
+   if ( sesp->s_connecting )
+   {
+      if ( side == SERVER && ( events & ( EPOLLOUT | EPOLLERR | EPOLLHUP ) ) )
+      {
+         int error = 0 ;
+         socklen_t len = sizeof( error ) ;
+
+         if ( getsockopt( sesp->s_fd[ SERVER ], SOL_SOCKET, SO_ERROR,
+                          (char *) &error, &len ) == -1 )
+            error = errno ;
+         if ( error != 0 )
+         {
+            session_failed( sesp, error ) ;
+            return ;
+         }
+         sesp->s_connecting = FALSE ;
+         session_touch( sesp ) ;
+         (void) setsockopt( sesp->s_fd[ SERVER ], IPPROTO_TCP, TCP_NODELAY,
+                            (char *) &on, sizeof( on ) ) ;
+         (void) setsockopt( sesp->s_fd[ CLIENT ], IPPROTO_TCP, TCP_NODELAY,
+                            (char *) &on, sizeof( on ) ) ;
+      }
+      else if ( events & ( EPOLLERR | EPOLLHUP ) )
+      {
+         session_end( sesp, 0 ) ;
+         return ;
+      }
+   }
+   else if ( sesp->s_eof[ 1 - side ] )
+   {
+      /* only the data pending for this side is left */
+      session_touch( sesp ) ;
+      if ( ( events & ( EPOLLERR | EPOLLHUP ) ) ||
+           ( ( events & EPOLLOUT ) && session_flush( sesp, side ) == -1 ) ||
+           sesp->s_pending[ side ] == NULL )
+      {
+         session_end( sesp, 0 ) ;
+         return ;
+      }
+   }
+   else
+   {
+      session_touch( sesp ) ;
+      if ( ( events & EPOLLOUT ) && sesp->s_pending[ side ] != NULL &&
+                                    session_flush( sesp, side ) == -1 )
+      {
+         session_end( sesp, 0 ) ;
+         return ;
+      }
+      if ( events & ( EPOLLIN | EPOLLERR | EPOLLHUP ) )
+      {
+         int rc ;
+
+         /*
+          * On a hangup, what is left to read is taken right away, so
+          * the data pending for the other side is written first.
+          */
+         if ( sesp->s_pending[ 1 - side ] != NULL &&
+                              ! ( events & ( EPOLLERR | EPOLLHUP ) ) )
+            rc = 0 ;  /* wait until the other side has taken the data */
+         else if ( sesp->s_pending[ 1 - side ] != NULL &&
+                   session_flush( sesp, 1 - side ) == -1 )
+            rc = -1 ;
+         else
+            rc = session_relay( sesp, side ) ;
+         if ( rc == 1 )
+            rc = session_eof( sesp, side ) ;
+         if ( rc == -1 )
+         {
+            session_end( sesp, 0 ) ;
+            return ;
+         }
+      }
+   }
+
+   if ( session_update( sesp ) == FAILED )
+      session_end( sesp, 0 ) ;
+}
+
+
+static status_e session_register( struct session *sesp, int side )
+{
+   struct epoll_event ev ;
+
+   ev.events = sesp->s_events[ side ] ;
+   ev.data.ptr = &sesp->s_ep[ side ] ;
+   return( epoll_ctl( proxy_epfd, EPOLL_CTL_ADD, sesp->s_fd[ side ], &ev ) == 0
+                                                            ? OK : FAILED ) ;
+}
+
+
+/*
+ * Start connecting the session to the backend of the request
+ */
+static void session_connect( struct session *sesp,
+                             const struct proxy_request *reqp )
+{
+   struct epoll_event   ev ;
+   socklen_t            len ;
+   int                  on = 1 ;
+   int                  fd ;
+
+   len = ( reqp->pr_addr.sa.sa_family == AF_INET6 ) ?
+            sizeof( struct sockaddr_in6 ) : sizeof( struct sockaddr_in ) ;
+   fd = socket( reqp->pr_addr.sa.sa_family, SOCK_STREAM, 0 ) ;
+   if ( fd == -1 )
+   {
+      session_end( sesp, errno ) ;
+      return ;
+   }
+   sesp->s_fd[ SERVER ] = fd ;
+   if ( fcntl( fd, F_SETFL, O_NONBLOCK ) == -1 )
+   {
+      session_end( sesp, errno ) ;
+      return ;
+   }
+   if ( reqp->pr_keepalive )
+      (void) setsockopt( fd, SOL_SOCKET, SO_KEEPALIVE,
+                         (char *) &on, sizeof( on ) ) ;
+
+   if ( connect( fd, &reqp->pr_addr.sa, len ) == -1 )
+   {
+      if ( errno != EINPROGRESS )
+      {
+         session_failed( sesp, errno ) ;
+         return ;
+      }
+      sesp->s_connecting = TRUE ;
+      sesp->s_events[ SERVER ] = EPOLLOUT ;
+      sesp->s_deadline = ( sesp->s_connect_timeout > 0 ) ?
+                           proxy_now + sesp->s_connect_timeout : 0 ;
+   }
+   else
+   {
+      (void) setsockopt( fd, IPPROTO_TCP, TCP_NODELAY,
+                         (char *) &on, sizeof( on ) ) ;
+      (void) setsockopt( sesp->s_fd[ CLIENT ], IPPROTO_TCP, TCP_NODELAY,
+                         (char *) &on, sizeof( on ) ) ;
+      sesp->s_events[ SERVER ] = EPOLLIN ;
+      session_touch( sesp ) ;
+   }
+
+   if ( session_register( sesp, SERVER ) == FAILED )
+   {
+      session_end( sesp, errno ) ;
+      return ;
+   }
+
+   if ( ! sesp->s_connecting )
+   {
+      ev.events = sesp->s_events[ CLIENT ] = EPOLLIN ;
+      ev.data.ptr = &sesp->s_ep[ CLIENT ] ;
+      if ( epoll_ctl( proxy_epfd, EPOLL_CTL_MOD,
+                                 sesp->s_fd[ CLIENT ], &ev ) == -1 )
+         session_end( sesp, errno ) ;
+   }
+}
+
+
+static void session_start( const struct proxy_request *reqp, int fd )
+{
+   struct session   *sesp ;
+   int               i ;
+
+   if ( fd < 0 )
+   {
+      session_report( reqp->pr_id, PROXY_DONE, EMFILE, 0, 0 ) ;
+      return ;
+   }
+
+   if ( reqp->pr_id >= proxy_slots )
+   {
+      unsigned slots = proxy_slots ? proxy_slots : 64 ;
+      struct session **table ;
+
+      while ( slots <= reqp->pr_id )
+         slots *= 2 ;
+      table = (struct session **)
+                     realloc( proxy_sessions, slots * sizeof( *table ) ) ;
+      if ( table == NULL )
+      {
+         (void) close( fd ) ;
+         session_report( reqp->pr_id, PROXY_DONE, ENOMEM, 0, 0 ) ;
+         return ;
+      }
+      memset( &table[ proxy_slots ], 0,
+                           ( slots - proxy_slots ) * sizeof( *table ) ) ;
+      proxy_sessions = table ;
+      proxy_slots = slots ;
+   }
+
+   if ( ( sesp = NEW( struct session ) ) == NULL )
+   {
+      (void) close( fd ) ;
+      session_report( reqp->pr_id, PROXY_DONE, ENOMEM, 0, 0 ) ;
+      return ;
+   }
+   CLEAR( *sesp ) ;
+   sesp->s_id = reqp->pr_id ;
+   sesp->s_fd[ CLIENT ] = fd ;
+   sesp->s_fd[ SERVER ] = -1 ;
+   sesp->s_connect_timeout = reqp->pr_connect_timeout ;
+   sesp->s_idle_timeout = reqp->pr_idle_timeout ;
+   if ( sesp->s_connect_timeout > 0 || sesp->s_idle_timeout > 0 )
+      proxy_timed++ ;
+   for ( i = CLIENT ; i <= SERVER ; i++ )
+   {
+      sesp->s_ep[ i ].ep_session = sesp ;
+      sesp->s_ep[ i ].ep_side = i ;
+   }
+   proxy_sessions[ sesp->s_id ] = sesp ;
+
+   /*
+    * The client side is registered without events while the backend
+    * is being connected, so that a hangup is still noticed
+    */
+   if ( fcntl( fd, F_SETFL, O_NONBLOCK ) == -1 ||
+        session_register( sesp, CLIENT ) == FAILED )
+   {
+      session_end( sesp, errno ) ;
+      return ;
+   }
+   session_connect( sesp, reqp ) ;
+}
+
+
+/*
+ * Apply the connect and idle timeouts of the sessions
+ */
+static void proxy_sweep(void)
+{
+   unsigned u ;
+
+   for ( u = 0 ; u < proxy_slots ; u++ )
+   {
+      struct session *sesp = proxy_sessions[ u ] ;
+
+      if ( sesp == NULL || sesp->s_deadline == 0 ||
+                                    proxy_now < sesp->s_deadline )
+         continue ;
+      if ( sesp->s_connecting )
+         session_failed( sesp, ETIMEDOUT ) ;
+      else
+         session_end( sesp, 0 ) ;
+   }
+}
+
+
+/*
+ * Handle the requests from the parent. The proxy exits when the
+ * parent goes away.
+ */
+static void proxy_control(void)
+{
+   for ( ;; )
+   {
+      struct proxy_request req ;
+      struct msghdr        mh ;
+      struct iovec         iov ;
+      struct cmsghdr      *cmp ;
+      union {
+         struct cmsghdr    cm ;
+         char              buf[ CMSG_SPACE( sizeof( int ) ) ] ;
+      } control ;
+      ssize_t              cc ;
+      int                  fd = -1 ;
+
+      CLEAR( mh ) ;
+      iov.iov_base = (char *) &req ;
+      iov.iov_len = sizeof( req ) ;
+      mh.msg_iov = &iov ;
+      mh.msg_iovlen = 1 ;
+      mh.msg_control = control.buf ;
+      mh.msg_controllen = sizeof( control.buf ) ;
+
+      cc = recvmsg( proxy_ctl, &mh, MSG_DONTWAIT ) ;
+      if ( cc == -1 && errno == EINTR )
+         continue ;
+      if ( cc == -1 && errno == EAGAIN )
+         return ;
+      if ( cc <= 0 )
+         _exit( 0 ) ;
+      if ( cc != sizeof( req ) )
+         continue ;
+
+      for ( cmp = CMSG_FIRSTHDR( &mh ) ; cmp ; cmp = CMSG_NXTHDR( &mh, cmp ) )
+         if ( cmp->cmsg_level == SOL_SOCKET && cmp->cmsg_type == SCM_RIGHTS )
+            memcpy( &fd, CMSG_DATA( cmp ), sizeof( int ) ) ;
+
+      if ( req.pr_type == PROXY_START )
+         session_start( &req, fd ) ;
+      else if ( req.pr_type == PROXY_CONNECT )
+      {
+         struct session *sesp = ( req.pr_id < proxy_slots ) ?
+                                    proxy_sessions[ req.pr_id ] : NULL ;
+
+         if ( fd >= 0 )
+            (void) close( fd ) ;
+         /* the client may have gone in the meantime */
+         if ( sesp != NULL && sesp->s_fd[ SERVER ] < 0 )
+            session_connect( sesp, &req ) ;
+      }
+      else if ( req.pr_type == PROXY_STOP )
+      {
+         if ( fd >= 0 )
+            (void) close( fd ) ;
+         if ( req.pr_id < proxy_slots && proxy_sessions[ req.pr_id ] != NULL )
+            session_close( proxy_sessions[ req.pr_id ], FALSE, 0 ) ;
+         session_report( req.pr_id, PROXY_STOPPED, 0, 0, 0 ) ;
+      }
+   }
+}
+
+
+#ifdef __GNUC__
+__attribute__ ((noreturn))
+#endif
+static void proxy_main( int ctl )
+{
+   struct epoll_event   events[ PROXY_EVENTS ] ;
+   struct epoll_event   ev ;
+   int                  fd ;
+#ifdef RLIMIT_NOFILE
+   struct rlimit        rl ;
+#endif
+
+   /*
+    * Keep nothing that belongs to the parent: listening sockets,
+    * connections waiting to be retried, the log. This is done first,
+    * since a connection of xinetd stays open as long as the proxy has
+    * it.
+    */
+   for ( fd = 0 ; (unsigned)fd < ps.ros.max_descriptors ; fd++ )
+      if ( fd != ctl )
+         (void) close( fd ) ;
+
+   signal_default_state() ;
+   (void) signal( SIGPIPE, SIG_IGN ) ;
+
+   /*
+    * The proxy does not use select(2), so it is not limited to
+    * FD_SETSIZE descriptors.
+    */
+#ifdef RLIMIT_NOFILE
+   rl.rlim_max = ps.ros.orig_max_descriptors ;
+   rl.rlim_cur = ps.ros.orig_max_descriptors ;
+   (void) setrlimit( RLIMIT_NOFILE, &rl ) ;
+#endif
+
+   rename_process( "xinetd redirect proxy" ) ;
+
+   proxy_ctl = ctl ;
+   if ( ( proxy_epfd = epoll_create( REDIR_PROXY_SESSIONS ) ) == -1 )
+      _exit( 1 ) ;
+   ev.events = EPOLLIN ;
+   ev.data.ptr = NULL ;
+   if ( epoll_ctl( proxy_epfd, EPOLL_CTL_ADD, proxy_ctl, &ev ) == -1 )
+      _exit( 1 ) ;
+
+   proxy_now = time( NULL ) ;
+   for ( ;; )
+   {
+      time_t last = proxy_now ;
+      int n, i ;
+
+      n = epoll_wait( proxy_epfd, events, PROXY_EVENTS,
+                                    proxy_timed ? 1000 : -1 ) ;
+      if ( n == -1 )
+      {
+         if ( errno != EINTR )
+            _exit( 1 ) ;
+         n = 0 ;
+      }
+      proxy_now = time( NULL ) ;
+
+      for ( i = 0 ; i < n ; i++ )
+      {
+         struct endpoint *ep = (struct endpoint *) events[ i ].data.ptr ;
+
+         if ( ep == NULL )
+            proxy_control() ;
+         else if ( ! ep->ep_session->s_dead )
+            session_event( ep->ep_session, ep->ep_side, events[ i ].events ) ;
+      }
+
+      if ( proxy_timed && proxy_now != last )
+         proxy_sweep() ;
+
+      while ( proxy_dead != NULL )
+      {
+         struct session *sesp = proxy_dead ;
+
+         proxy_dead = sesp->s_next_dead ;
+         FREE( sesp ) ;
+      }
+   }
+}
+
+
+/*
+ * Fork a proxy process
+ */
+static status_e proxy_spawn( struct proxy *pxp )
+{
+   int sv[ 2 ] ;
+   const char *func = "proxy_spawn" ;
+
+   if ( socketpair( AF_UNIX, SOCK_SEQPACKET, 0, sv ) == -1 )
+   {
+      msg( LOG_ERR, func, "socketpair failed: %m" ) ;
+      return( FAILED ) ;
+   }
+
+   switch ( pxp->px_pid = fork() )
+   {
+      case 0:
+         proxy_main( sv[ 1 ] ) ;
+         /* NOTREACHED */
+
+      case -1:
+         msg( LOG_ERR, func, "fork failed: %m" ) ;
+         (void) close( sv[ 0 ] ) ;
+         (void) close( sv[ 1 ] ) ;
+         pxp->px_pid = 0 ;
+         return( FAILED ) ;
+   }
+
+   (void) close( sv[ 1 ] ) ;
+   pxp->px_fd = sv[ 0 ] ;
+   if ( fcntl( pxp->px_fd, F_SETFD, FD_CLOEXEC ) == -1 )
+      msg( LOG_ERR, func, "fcntl F_SETFD failed: %m" ) ;
+   FD_SET( pxp->px_fd, &ps.rws.socket_mask ) ;
+   if ( pxp->px_fd > ps.rws.mask_max )
+      ps.rws.mask_max = pxp->px_fd ;
+
+   if ( debug.on )
+      msg( LOG_DEBUG, func, "started redirect proxy %d", pxp->px_pid ) ;
+   return( OK ) ;
+}
+
+#endif   /* HAVE_EPOLL_CREATE */
+
+
+/*
+ * Stop talking to a proxy. A proxy exits when its socket is closed,
+ * ending all its sessions; the rest is done when it is reaped.
+ */
+static void proxy_disconnect( struct proxy *pxp )
+{
+   FD_CLR( pxp->px_fd, &ps.rws.socket_mask ) ;
+   (void) close( pxp->px_fd ) ;
+   pxp->px_fd = -1 ;
+}
+
+
+/*
+ * Fill in a request to connect the session id of serp to its backend
+ */
+static void proxy_request_init( struct proxy_request *reqp,
+                                struct server *serp, unsigned id, int type )
+{
+   struct service_config *scp = SVC_CONF( SERVER_SERVICE( serp ) ) ;
+
+   CLEAR( *reqp ) ;
+   reqp->pr_id = id ;
+   reqp->pr_type = type ;
+   reqp->pr_keepalive = SC_KEEPALIVE( scp ) ;
+   reqp->pr_connect_timeout = SC_REDIR_CONNECT_TIMEOUT( scp ) ;
+   reqp->pr_idle_timeout = SC_REDIR_IDLE_TIMEOUT( scp ) ;
+   memcpy( &reqp->pr_addr, backend_addr( serp ), sizeof( reqp->pr_addr ) ) ;
+   if ( reqp->pr_addr.sa.sa_family == AF_INET )
+      reqp->pr_addr.sa_in.sin_port = htons( reqp->pr_addr.sa_in.sin_port ) ;
+   else if ( reqp->pr_addr.sa.sa_family == AF_INET6 )
+      reqp->pr_addr.sa_in6.sin6_port = htons( reqp->pr_addr.sa_in6.sin6_port ) ;
+}
+
+
+/*
+ * End the session id of pxp from the parent's side. The slot can be
+ * reused once the proxy has acknowledged the PROXY_STOP. If the request
+ * cannot be sent, the proxy would go on with a session the parent no
+ * longer knows about, so the proxy is disconnected and the slot freed.
+ */
+static void proxy_stop( struct proxy *pxp, unsigned id )
+{
+   struct server *serp = pxp->px_table[ id ] ;
+   struct proxy_request req ;
+   const char *func = "proxy_stop" ;
+
+   if ( pxp->px_fd >= 0 )
+   {
+      CLEAR( req ) ;
+      req.pr_id = id ;
+      req.pr_type = PROXY_STOP ;
+      if ( proxy_send( pxp, &req, -1 ) == OK )
+         pxp->px_table[ id ] = PROXY_STOPPING ;
+      else
+      {
+         msg( LOG_ERR, func, "can't stop session of redirect proxy %d: %m",
+               pxp->px_pid ) ;
+         proxy_disconnect( pxp ) ;
+      }
+   }
+   if ( pxp->px_table[ id ] != PROXY_STOPPING )
+   {
+      pxp->px_table[ id ] = NULL ;
+      pxp->px_used-- ;
+   }
+   pxp->px_sessions-- ;
+   SERVER_EXITSTATUS( serp ) = 0 ;
+   server_end( serp ) ;
+}
+
+
+/*
+ * Hand the connection of server serp to a proxy process.
+ * Returns FAILED if the connection should be redirected by a forked
+ * process instead.
+ */
+status_e proxy_start( struct server *serp )
+{
+#ifdef HAVE_EPOLL_CREATE
+   struct service          *sp  = SERVER_SERVICE( serp ) ;
+   struct proxy            *pxp = NULL ;
+   struct proxy_request     req ;
+   unsigned                 u ;
+   unsigned                 id ;
+   const char              *func = "proxy_start" ;
+
+   /*
+    * Pick the least loaded proxy; a new proxy is started only when
+    * all running ones are busier than an empty one.
+    */
+   for ( u = 0 ; u < REDIR_PROXIES ; u++ )
+   {
+      struct proxy *p = &proxy_pool[ u ] ;
+
+      if ( p->px_pid != 0 && p->px_fd < 0 )
+         continue ;        /* lost its socket; waiting for it to exit */
+      if ( pxp == NULL || p->px_sessions < pxp->px_sessions ||
+            ( p->px_sessions == pxp->px_sessions &&
+              pxp->px_pid == 0 && p->px_pid != 0 ) )
+         pxp = p ;
+   }
+   if ( pxp == NULL || pxp->px_sessions >= REDIR_PROXY_SESSIONS )
+      return( FAILED ) ;
+   if ( pxp->px_pid == 0 && proxy_spawn( pxp ) == FAILED )
+      return( FAILED ) ;
+
+   /*
+    * Stopping slots are in use until the proxy acknowledges them
+    */
+   if ( pxp->px_used == pxp->px_slots )
+   {
+      unsigned slots = pxp->px_slots ? pxp->px_slots * 2 : 64 ;
+      struct server **table ;
+
+      table = (struct server **)
+                  realloc( pxp->px_table, slots * sizeof( *table ) ) ;
+      if ( table == NULL )
+      {
+         out_of_memory( func ) ;
+         return( FAILED ) ;
+      }
+      memset( &table[ pxp->px_slots ], 0,
+                           ( slots - pxp->px_slots ) * sizeof( *table ) ) ;
+      pxp->px_next = pxp->px_slots ;
+      pxp->px_table = table ;
+      pxp->px_slots = slots ;
+   }
+   for ( u = 0, id = pxp->px_next ; u < pxp->px_slots ; u++ )
+   {
+      if ( pxp->px_table[ id ] == NULL )
+         break ;
+      id = ( id + 1 ) % pxp->px_slots ;
+   }
+   if ( u == pxp->px_slots )
+   {
+      msg( LOG_ERR, func, "no free slot for redirect proxy %d", pxp->px_pid ) ;
+      return( FAILED ) ;
+   }
+
+   backend_select( serp ) ;
+
+   proxy_request_init( &req, serp, id, PROXY_START ) ;
+   if ( proxy_send( pxp, &req, SERVER_FD( serp ) ) == FAILED )
+   {
+      if ( debug.on )
+         msg( LOG_DEBUG, func, "proxy %d did not take the connection: %m",
+               pxp->px_pid ) ;
+      return( FAILED ) ;
+   }
+
+   pxp->px_table[ id ] = serp ;
+   pxp->px_next = ( id + 1 ) % pxp->px_slots ;
+   pxp->px_sessions++ ;
+   pxp->px_used++ ;
+   backend_use( serp ) ;
+
+   SERVER_PID( serp ) = 0 ;
+   SERVER_LOGUSER( serp ) = FALSE ;
+   SERVER_WRITES_TO_LOG( serp ) = FALSE ;
+   (void) time( &SERVER_STARTTIME( serp ) ) ;
+   SVC_INC_RUNNING_SERVERS( sp ) ;
+   svc_log_success( sp, SERVER_CONNECTION( serp ), SERVER_PID( serp ) ) ;
+   return( OK ) ;
+#else
+   return( FAILED ) ;
+#endif
+}
+
+
+/*
+ * The backend of a session could not be reached: fail over to the next
+ * one, if there is one, or give up on the session
+ */
+static void proxy_session_failed( struct proxy *pxp, struct server *serp,
+                                  const struct proxy_report *repp )
+{
+   struct proxy_request req ;
+   int next = backend_next( serp ) ;
+   const char *func = "proxy_session_failed" ;
+
+   errno = repp->pr_error ;
+   msg( LOG_ERR, func, "%s: can't connect to remote host %s: %m",
+         SVC_ID( SERVER_SERVICE( serp ) ), xaddrname( backend_addr( serp ) ) ) ;
+   backend_release( serp, TRUE, 0, 0 ) ;
+
+   if ( next >= 0 )
+   {
+      SERVER_BACKEND( serp ) = next ;
+      proxy_request_init( &req, serp, repp->pr_id, PROXY_CONNECT ) ;
+      if ( proxy_send( pxp, &req, -1 ) == OK )
+      {
+         backend_use( serp ) ;
+         return ;
+      }
+      SERVER_BACKEND( serp ) = -1 ;
+   }
+   proxy_stop( pxp, repp->pr_id ) ;
+}
+
+
+/*
+ * A session is over: log its traffic and end its server
+ */
+static void proxy_session_end( struct proxy *pxp,
+                               const struct proxy_report *repp )
+{
+   struct server            *serp ;
+   struct service           *sp ;
+   struct service_config    *scp ;
+   const char               *func = "proxy_session_end" ;
+
+   if ( repp->pr_id >= pxp->px_slots ||
+        ( serp = pxp->px_table[ repp->pr_id ] ) == NULL )
+   {
+      msg( LOG_ERR, func, "proxy %d reported unknown session %u",
+            pxp->px_pid, repp->pr_id ) ;
+      return ;
+   }
+   if ( serp == PROXY_STOPPING )
+   {
+      if ( repp->pr_type == PROXY_STOPPED )
+      {
+         pxp->px_table[ repp->pr_id ] = NULL ;
+         pxp->px_used-- ;
+      }
+      return ;
+   }
+   if ( repp->pr_type == PROXY_FAILED )
+   {
+      proxy_session_failed( pxp, serp, repp ) ;
+      return ;
+   }
+   pxp->px_table[ repp->pr_id ] = NULL ;
+   pxp->px_sessions-- ;
+   pxp->px_used-- ;
+
+   sp = SERVER_SERVICE( serp ) ;
+   scp = SVC_CONF( sp ) ;
+   if ( LOCAL_ERROR( repp->pr_error ) )
+   {
+      errno = repp->pr_error ;
+      msg( LOG_ERR, func, "%s: redirect proxy %d failed: %m",
+            SVC_ID( sp ), pxp->px_pid ) ;
+   }
+   else if ( repp->pr_error != 0 )
+   {
+      errno = repp->pr_error ;
+      msg( LOG_ERR, func, "%s: can't connect to remote host %s: %m",
+            SVC_ID( sp ), xaddrname( backend_addr( serp ) ) ) ;
+   }
+   else if ( M_IS_SET( SC_LOG_ON_SUCCESS( scp ), LO_TRAFFIC ) )
+      svc_logprint( SERVER_CONNSERVICE( serp ), "TRAFFIC",
+                    "in=%lu(bytes) out=%lu(bytes)",
+                    repp->pr_bytes_in, repp->pr_bytes_out ) ;
+
+   backend_release( serp,
+         repp->pr_error != 0 && ! LOCAL_ERROR( repp->pr_error ),
+         repp->pr_bytes_in, repp->pr_bytes_out ) ;
+   SERVER_EXITSTATUS( serp ) = 0 ;
+   server_end( serp ) ;
+}
+
+
+/*
+ * Read the reports of a proxy
+ */
+static void proxy_input( struct proxy *pxp )
+{
+   for ( ;; )
+   {
+      struct proxy_report rep ;
+      ssize_t cc ;
+
+      cc = recv( pxp->px_fd, (char *) &rep, sizeof( rep ), MSG_DONTWAIT ) ;
+      if ( cc == sizeof( rep ) )
+      {
+         proxy_session_end( pxp, &rep ) ;
+         continue ;
+      }
+      if ( cc == -1 && errno == EINTR )
+         continue ;
+      if ( cc == -1 && errno == EAGAIN )
+         return ;
+      if ( cc == -1 || cc == 0 )
+         break ;
+   }
+
+   proxy_disconnect( pxp ) ;
+}
+
+
+/*
+ * Handle the proxies whose sockets are set in the mask.
+ * Returns the number of descriptors handled.
+ */
+int proxy_poll( fd_set *maskp )
+{
+   unsigned u ;
+   int      handled = 0 ;
+
+   for ( u = 0 ; u < REDIR_PROXIES ; u++ )
+   {
+      struct proxy *pxp = &proxy_pool[ u ] ;
+
+      if ( pxp->px_pid != 0 && pxp->px_fd >= 0 &&
+                                 FD_ISSET( pxp->px_fd, maskp ) )
+      {
+         proxy_input( pxp ) ;
+         handled++ ;
+      }
+   }
+   return( handled ) ;
+}
+
+
+/*
+ * Invoked when a child process exits. Returns TRUE if it was a proxy,
+ * in which case all its sessions are ended.
+ */
+bool_int proxy_exit( pid_t pid, int status )
+{
+   struct proxy *pxp = NULL ;
+   unsigned u ;
+   const char *func = "proxy_exit" ;
+
+   if ( pid <= 0 )
+      return( FALSE ) ;
+   for ( u = 0 ; u < REDIR_PROXIES ; u++ )
+      if ( proxy_pool[ u ].px_pid == pid )
+         pxp = &proxy_pool[ u ] ;
+   if ( pxp == NULL )
+      return( FALSE ) ;
+
+   if ( pxp->px_fd >= 0 )
+      proxy_input( pxp ) ;
+
+   if ( pxp->px_sessions != 0 )
+      msg( LOG_ERR, func, "redirect proxy %d exited with %u sessions",
+            pid, pxp->px_sessions ) ;
+   for ( u = 0 ; u < pxp->px_slots ; u++ )
+   {
+      struct server *serp = pxp->px_table[ u ] ;
+
+      if ( serp != NULL && serp != PROXY_STOPPING )
+      {
+         pxp->px_table[ u ] = NULL ;
+         SERVER_EXITSTATUS( serp ) = status ;
+         server_end( serp ) ;
+      }
+   }
+   if ( pxp->px_table != NULL )
+      free( pxp->px_table ) ;
+   CLEAR( *pxp ) ;
+   pxp->px_fd = -1 ;
+   return( TRUE ) ;
+}
+
+
+/*
+ * Close all inline sessions of service sp. Like the forked servers of
+ * a service, the sessions are ended right away, since the service log
+ * may be closed before the proxy gets to report them.
+ */
+void proxy_terminate( const struct service *sp )
+{
+   unsigned u, id ;
+
+   for ( u = 0 ; u < REDIR_PROXIES ; u++ )
+   {
+      struct proxy *pxp = &proxy_pool[ u ] ;
+
+      if ( pxp->px_pid == 0 )
+         continue ;
+      for ( id = 0 ; id < pxp->px_slots ; id++ )
+      {
+         struct server *serp = pxp->px_table[ id ] ;
+
+         if ( serp != NULL && serp != PROXY_STOPPING &&
+                                    SERVER_SERVICE( serp ) == sp )
+            proxy_stop( pxp, id ) ;
+      }
+   }
+}
+
+
+/*
+ * Returns TRUE if fd is the socket of a proxy
+ */
+bool_int proxy_fd( int fd )
+{
+   unsigned u ;
+
+   for ( u = 0 ; u < REDIR_PROXIES ; u++ )
+      if ( proxy_pool[ u ].px_pid != 0 && proxy_pool[ u ].px_fd == fd )
+         return( TRUE ) ;
+   return( FALSE ) ;
+}
+
+
+/*
+ * Close the proxy sockets in a child that does not exec; a proxy
+ * only notices that the parent is gone once all of them are closed.
+ */
+void proxy_close(void)
+{
+   unsigned u ;
+
+   for ( u = 0 ; u < REDIR_PROXIES ; u++ )
+      if ( proxy_pool[ u ].px_pid != 0 && proxy_pool[ u ].px_fd >= 0 )
+         (void) close( proxy_pool[ u ].px_fd ) ;
+}
+
+
+void proxy_dump( int fd )
+{
+   unsigned u ;
+
+   for ( u = 0 ; u < REDIR_PROXIES ; u++ )
+      if ( proxy_pool[ u ].px_pid != 0 )
+         Sprint( fd, "redirect proxy %d: sessions = %u\n",
+               proxy_pool[ u ].px_pid, proxy_pool[ u ].px_sessions ) ;
+   Sputchar( fd, '\n' ) ;
+}
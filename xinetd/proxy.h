@@ -0,0 +1,24 @@
+/*
+ * (c) Copyright 1998-2001 by Rob Braun
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
+ * and conditions for redistribution.
+ */
+#ifndef PROXY_H
+#define PROXY_H
+
+#include "config.h"
+#include <sys/types.h>
+#include <sys/time.h>
+
+#include "defs.h"
+#include "server.h"
+
+status_e proxy_start(struct server *serp);
+int proxy_poll(fd_set *maskp);
+bool_int proxy_exit(pid_t pid, int status);
+void proxy_terminate(const struct service *sp);
+bool_int proxy_fd(int fd);
+void proxy_close(void);
+void proxy_dump(int fd);
+
+#endif
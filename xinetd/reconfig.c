@@ -31,6 +31,10 @@
 #endif
 
 #include "reconfig.h"
+#include "proxy.h"
+#include "intloop.h"
+#include "engine.h"
+#include "backend.h"
 #include "msg.h"
 #include "sconf.h"
 #include "conf.h"
@@ -40,12 +44,18 @@
 #include "retry.h"
 #include "logctl.h"
 #include "options.h"
+#include "autoreload.h"
+#include "conffile.h"
+
+extern int inetd_compat;
 
 
 static status_e readjust(struct service *sp, 
 		struct service_config **new_conf_ptr) ;
+static status_e restart_log(struct service *sp,
+		struct service_config *old_conf) ;
 static void swap_defaults(struct configuration *new_conf) ;
-static void close_default_log(struct configuration *confp, xlog_h def_log);
+static void close_default_log(struct service_config *defaults, xlog_h def_log);
 
 #define SWAP( x, y, temp )         (temp) = (x), (x) = (y), (y) = (temp)
 
@@ -53,6 +63,11 @@ static void close_default_log(struct configuration *confp, xlog_h def_log);
 /*
  * Reconfigure the server by rereading the configuration file.
  * Services may be added, deleted or have their attributes changed.
+ * When only files holding nothing but services changed, only those
+ * files are read again (see conffile.c): the services of the other
+ * files keep their configuration, listeners and servers, and only
+ * have their log reopened. When no file changed, everything is read
+ * again.
  * All syslog output uses the LOG_NOTICE priority level (except for
  * errors).
  */
@@ -65,13 +80,40 @@ void hard_reconfig( void )
    unsigned                  new_services ;
    unsigned                  old_services      = 0 ;
    unsigned                  dropped_services   = 0 ;
+   unsigned                  kept_services      = 0 ;
+   bool_int                  partial            = FALSE ;
    xlog_h		     def_log = DEFAULT_LOG( ps );
    const char               *func               = "hard_reconfig" ;
 
 
    msg( LOG_NOTICE, func, "Starting reconfiguration" ) ;
 
-   if ( cnf_get( &new_conf ) == FAILED )
+   if ( ! inetd_compat )
+   {
+      switch ( conffile_check() )
+      {
+         /*
+          * Nothing changed: everything is read again all the same, so
+          * that host names and /etc/services are looked up again
+          */
+         case CFC_NONE:
+            msg( LOG_NOTICE, func, "Configuration files unchanged" ) ;
+            break ;
+
+         case CFC_FILES:
+            msg( LOG_NOTICE, func, "Rereading %u changed configuration files",
+                                                         conffile_changes() ) ;
+            partial = ( cnf_reread( &new_conf ) == OK ) ;
+            if ( ! partial )
+               msg( LOG_NOTICE, func, "Rereading the whole configuration" ) ;
+            break ;
+
+         case CFC_ALL:
+            break ;
+      }
+   }
+
+   if ( ! partial && cnf_get( &new_conf ) == FAILED )
    {
       msg( LOG_WARNING, func, "reconfiguration failed" ) ;
       return ;
@@ -85,9 +127,24 @@ void hard_reconfig( void )
       return ;
    }
 
-   /* After this call, new_conf's defaults point to the old one's defaults */
-   msg( LOG_NOTICE, func, "Swapping defaults" ) ;
-   swap_defaults( &new_conf ) ;
+   /*
+    * The logs started from here on are opened again rather than
+    * shared with the logs in use, which are closed below
+    */
+   log_reopen() ;
+
+   if ( partial )
+   {
+      /* The defaults stay; the common log is reopened all the same */
+      DEFAULT_LOG_ERROR( ps ) = FALSE ;
+      DEFAULT_LOG( ps ) = NULL ;
+   }
+   else
+   {
+      /* After this call, new_conf's defaults point to the old one's defaults */
+      msg( LOG_NOTICE, func, "Swapping defaults" ) ;
+      swap_defaults( &new_conf ) ;
+   }
 
    /*
     * Glossary:
@@ -105,11 +162,21 @@ void hard_reconfig( void )
       boolean_e drop_service ;
 
       /*
-       * Check if this service is in the new Lconf
+       * A service read from a file that did not change is left alone.
+       * Otherwise, check if this service is in the new Lconf
        * Notice that the service Sconf is removed from the new Lconf
        * if it is found there.
        */
-      if (  (nscp = cnf_extract( &new_conf, SVC_CONF( osp ) )) )
+      if ( partial && ! conffile_changed( SC_FILE( SVC_CONF( osp ) ) ) )
+      {
+         if ( restart_log( osp, SVC_CONF( osp ) ) == OK )
+         {
+            kept_services++ ;
+            continue ;
+         }
+         drop_service = YES ;
+      }
+      else if (  (nscp = cnf_extract( &new_conf, SVC_CONF( osp ) )) )
       {
          /*
           * The first action of readjust is to swap the service configuration
@@ -165,7 +232,8 @@ void hard_reconfig( void )
     * All services have terminated by now, so close the old common logfile.
     * remember that swap_defaults put the old defaults section in new_conf.
     */
-   close_default_log( &new_conf, def_log ) ;
+   close_default_log( partial ? DEFAULTS( ps ) : CNF_DEFAULTS( &new_conf ),
+                                                                  def_log ) ;
 
    /*
     * At this point the new Lconf only contains services that were not
@@ -175,6 +243,8 @@ void hard_reconfig( void )
    msg( LOG_NOTICE, func,
       "Reconfigured: new=%d old=%d dropped=%d (services)",
          new_services, old_services, dropped_services ) ;
+   if ( partial )
+      msg( LOG_NOTICE, func, "Left %u services as they were", kept_services ) ;
 
    if ( stayalive_option == 0 ) {
       if ( ps.rws.available_services == 0 )
@@ -187,6 +257,7 @@ void hard_reconfig( void )
       }
    }
 
+   autoreload_update() ;
    cnf_free( &new_conf ) ; 
 }
 
@@ -201,11 +272,11 @@ static void swap_defaults( struct configuration *new_conf )
 }
 
 
-static void close_default_log(struct configuration *confp, xlog_h def_log)
+static void close_default_log(struct service_config *defaults, xlog_h def_log)
 {
    /* Close the common log file, if one was specified */
    if ( def_log != NULL )
-      log_end( SC_LOG( CNF_DEFAULTS( confp ) ), def_log) ;
+      log_end( SC_LOG( defaults ), def_log) ;
 }
 
 
@@ -289,7 +360,12 @@ static void deliver_signal( struct service *sp, int sig )
       struct server *serp ;
 
       serp = SERP( pset_pointer( SERVERS( ps ), u ) ) ;
-      if ( SERVER_SERVICE( serp ) == sp ) {
+
+      /*
+       * Inline redirection sessions have no process of their own;
+       * they are closed by proxy_terminate.
+       */
+      if ( SERVER_SERVICE( serp ) == sp && SERVER_PID( serp ) != 0 ) {
          sendsig( serp, sig ) ;
          if ( (sig == SIGTERM) || (sig == SIGKILL) )
             u--;
@@ -306,12 +382,15 @@ void terminate_servers( struct service *sp )
    int sig = SC_IS_INTERNAL( SVC_CONF( sp ) ) ? SIGTERM : SIGKILL ;
 
    deliver_signal( sp, sig ) ;
+   proxy_terminate( sp ) ;
+   engine_terminate( sp ) ;
 }
 
 
 static void stop_interception( struct service *sp )
 {
-   deliver_signal( sp, INTERCEPT_SIG ) ;
+   if ( ! intloop_stop( sp ) )
+      deliver_signal( sp, INTERCEPT_SIG ) ;
 }
 
 /*
@@ -503,6 +582,7 @@ static status_e readjust( struct service *sp,
       return OK;
    }
 
+   (void) backend_activate( sp ) ;
    return( restart_log( sp, old_conf ) ) ;
 }
 
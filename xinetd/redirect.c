@@ -4,6 +4,9 @@
  * and conditions for redistribution.
  */
 #include "config.h"
+#ifdef HAVE_SPLICE
+#define _GNU_SOURCE
+#endif
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
@@ -11,6 +14,9 @@
 #include <sys/resource.h>
 #endif
 #include <sys/wait.h>
+#ifdef HAVE_EPOLL_CREATE
+#include <sys/epoll.h>
+#endif
 #include <netinet/in.h>
 #include <errno.h>
 #include <pwd.h>
@@ -19,6 +25,8 @@
 #include <sys/wait.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <netinet/tcp.h>
 #ifdef HAVE_ARPA_INET_H
@@ -33,6 +41,12 @@
 #include "log.h"
 #include "sconf.h"
 #include "msg.h"
+#include "access.h"
+#include "backend.h"
+#include "connection.h"
+#include "dgram.h"
+#include "util.h"
+#include "xconfig.h"
 
 #define NET_BUFFER 1500
 
@@ -51,6 +65,537 @@ static void redir_sigpipe( int signum )
    _exit(0);
 }
 
+/*
+ * Copy the data available on 'from' to 'to' through a user space buffer.
+ * Returns -1 when the connection is finished, 0 otherwise.
+ */
+static int copy_data( int from, int to, unsigned long *count )
+{
+   char buff[NET_BUFFER];
+   ssize_t num_read, num_wrote, ret;
+
+   do {
+      num_read = read(from, buff, sizeof(buff));
+   } while (num_read == (ssize_t)-1 && errno == EINTR);
+   if (num_read <= 0)
+      return( -1 );
+   *count += num_read;
+
+   /* Loop until we have written everything that was read */
+   num_wrote = 0;
+   while( num_wrote < num_read ) {
+      ret = write(to, buff + num_wrote, num_read - num_wrote);
+      if (ret == -1 && errno == EINTR)
+         continue;
+      if (ret <= 0)
+         return( -1 );
+      num_wrote += ret;
+   }
+   return( 0 );
+}
+
+#ifdef HAVE_SPLICE
+/*
+ * Move the data available on 'from' to 'to' with splice(2) through
+ * the pipe 'pfd', so that it never gets copied to user space.
+ * The pipe is always drained before returning.
+ * Returns -1 when the connection is finished, 0 otherwise and 1 if
+ * splice is not supported for these descriptors (nothing has been
+ * read in that case).
+ */
+static int splice_data( int from, int to, int pfd[2], unsigned long *count )
+{
+   ssize_t num_read, ret;
+
+   do {
+      num_read = splice(from, NULL, pfd[1], NULL, SPLICE_SIZE,
+                        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+   } while (num_read == (ssize_t)-1 && errno == EINTR);
+   if (num_read == (ssize_t)-1 && ( errno == EINVAL || errno == ENOSYS ))
+      return( 1 );
+   if (num_read <= 0)
+      return( -1 );
+   *count += num_read;
+
+   while( num_read > 0 ) {
+      ret = splice(pfd[0], NULL, to, NULL, num_read, SPLICE_F_MOVE);
+      if (ret == -1 && errno == EINTR)
+         continue;
+      if (ret <= 0)
+         return( -1 );
+      num_read -= ret;
+   }
+   return( 0 );
+}
+#endif
+
+/*
+ * Start the connect of fd. If there is data, TCP fast open is tried
+ * first, so that the data goes out with the SYN; *sentp is set to the
+ * number of bytes sent that way.
+ */
+static int redir_start( int fd, const union xsockaddr *addrp, 
+                        unsigned int len, const char *data, size_t dlen,
+                        size_t *sentp )
+{
+#ifdef MSG_FASTOPEN
+   if( dlen > 0 ) {
+      ssize_t cc = sendto(fd, data, dlen, MSG_FASTOPEN, &addrp->sa, len);
+
+      if( cc >= 0 ) {
+         *sentp = cc;
+         return( 0 );
+      }
+      /* not enabled in the kernel */
+      if( errno != EOPNOTSUPP )
+         return( -1 );
+   }
+#endif
+   return( connect(fd, &addrp->sa, len) );
+}
+
+/*
+ * Connect to the backend at addrp, waiting at most
+ * redirect_connect_timeout seconds. The first dlen bytes the client
+ * sent are in data; *sentp is set to how many of them went out with
+ * the connect. Returns the descriptor, or -1 with errno set.
+ */
+static int redir_connect( const struct service_config *scp,
+                          const union xsockaddr *addrp,
+                          const char *data, size_t dlen, size_t *sentp )
+{
+   union xsockaddr serveraddr ;
+   unsigned int sin_len = 0;
+   int fd, flags = 0, on = 1, v6on, ret;
+   int timeout = SC_REDIR_CONNECT_TIMEOUT( scp );
+   const char *func = "redir_connect";
+
+   *sentp = 0;
+
+   memcpy(&serveraddr, addrp, sizeof(serveraddr));
+   if( serveraddr.sa_in.sin_family == AF_INET ) {
+      sin_len = sizeof( struct sockaddr_in );
+      fd = socket(AF_INET, SOCK_STREAM, 0);
+    } else if( serveraddr.sa_in.sin_family == AF_INET6 ) {
+      sin_len = sizeof( struct sockaddr_in6 );
+      fd = socket(AF_INET6, SOCK_STREAM, 0);
+   } else {
+      msg(LOG_ERR, func, "not a valid protocol. Use IPv4 or IPv6.");
+      exit(0);
+   }
+
+   if( fd < 0 )
+   {
+      msg(LOG_ERR, func, "cannot create socket: %m");
+      exit(0);
+   }
+
+   if( SC_IPV6( scp ) ) {
+      if( SC_V6ONLY( scp ) ) {
+         v6on = 1;
+      } else {
+         v6on = 0;
+      }
+#ifdef IPV6_V6ONLY
+      if( setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&v6on, sizeof(v6on)) < 0 ) { 
+         msg( LOG_ERR, func, "Setting IPV6_V6ONLY option failed (%m)" );
+      }
+#endif
+
+   }
+   if( SC_KEEPALIVE( scp ) )
+      if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, 
+                     (char *)&on, sizeof( on ) ) < 0 )
+         msg(LOG_ERR, func, 
+             "setsockopt SO_KEEPALIVE RedirServerFd failed: %m");
+   
+   if( serveraddr.sa_in.sin_family == AF_INET )
+      serveraddr.sa_in.sin_port = htons(serveraddr.sa_in.sin_port);
+   if( serveraddr.sa_in.sin_family == AF_INET6 )
+      serveraddr.sa_in6.sin6_port = htons(serveraddr.sa_in6.sin6_port);
+
+   /* 
+    * Connect without blocking and wait for the outcome, so that a
+    * backend that drops the SYN does not hold the connection for the
+    * whole of the kernel's connect timeout.
+    */
+   if( timeout > 0 &&
+       ( (flags = fcntl(fd, F_GETFL, 0)) < 0 ||
+         fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0 ) ) {
+      close(fd);
+      return( -1 );
+   }
+   ret = redir_start(fd, &serveraddr, sin_len, data, dlen, sentp);
+   if( ret < 0 && errno != EINPROGRESS ) {
+      close(fd);
+      return( -1 );
+   }
+
+   /* A fast open connect is still in progress when data was sent */
+   if( ret < 0 || *sentp > 0 ) {
+      struct timeval tv;
+      fd_set wrfd;
+      int error = 0;
+      socklen_t len = sizeof(error);
+
+      tv.tv_sec = timeout;
+      tv.tv_usec = 0;
+      FD_ZERO(&wrfd);
+      FD_SET(fd, &wrfd);
+      do {
+         ret = select(fd + 1, (fd_set *)0, &wrfd, (fd_set *)0, 
+                      timeout > 0 ? &tv : NULL);
+      } while (ret == -1 && errno == EINTR);
+      if( ret == 0 )
+         error = ETIMEDOUT;
+      else if( ret < 0 ||
+               getsockopt(fd, SOL_SOCKET, SO_ERROR, (char *)&error, &len) < 0 )
+         error = errno;
+      if( error != 0 ) {
+         close(fd);
+         errno = error;
+         return( -1 );
+      }
+   }
+   if( timeout > 0 && fcntl(fd, F_SETFL, flags) < 0 ) {
+      close(fd);
+      return( -1 );
+   }
+   return( fd );
+}
+
+#ifdef HAVE_EPOLL_CREATE
+
+/*
+ * Redirection of udp services.
+ *
+ * The redirector takes over the socket of the service (which must
+ * wait) and keeps a session for each client: a udp socket connected
+ * to the backend picked for that client, which carries its datagrams
+ * both ways. Sessions expire after a period without datagrams, and
+ * the redirector exits once it has no sessions left, handing the
+ * socket back to xinetd.
+ *
+ * Clients are checked against the address and time access controls
+ * of the service when their session is created. A refused client gets
+ * a session without a socket, so that its datagrams are dropped
+ * without being logged each time.
+ */
+
+#define UDP_BUFFER            65536
+#define UDP_BUCKETS           1024
+
+struct udp_session
+{
+   union xsockaddr      us_client ;
+   socklen_t            us_len ;          /* of us_client */
+   int                  us_fd ;           /* -1 if refused */
+   int                  us_backend ;
+   time_t               us_last ;         /* time of the last datagram */
+   struct udp_session  *us_next ;         /* in its hash chain */
+} ;
+
+static struct udp_session *udp_table[ UDP_BUCKETS ] ;
+static unsigned            udp_sessions ;
+static struct dgram_batch *udp_in ;      /* from the clients */
+static struct dgram_batch *udp_out ;     /* to the clients */
+static int                 udp_epfd ;
+static time_t              udp_now ;
+
+
+static struct udp_session *udp_lookup( const union xsockaddr *addrp )
+{
+   struct udp_session *sesp ;
+
+   for ( sesp = udp_table[ xaddrhash( addrp, TRUE ) % UDP_BUCKETS ] ; sesp ; sesp = sesp->us_next )
+      if ( xaddrequal( &sesp->us_client, addrp ) )
+         return( sesp ) ;
+   return( NULL ) ;
+}
+
+
+static void udp_close( struct service *sp, struct udp_session *sesp )
+{
+   struct udp_session **pp = &udp_table[ xaddrhash( &sesp->us_client, TRUE ) % UDP_BUCKETS ] ;
+
+   while ( *pp != sesp )
+      pp = &(*pp)->us_next ;
+   *pp = sesp->us_next ;
+
+   if ( sesp->us_fd >= 0 )
+   {
+      (void) close( sesp->us_fd ) ;
+      if ( SVC_BACKENDS( sp )[ sesp->us_backend ].be_active > 0 )
+         SVC_BACKENDS( sp )[ sesp->us_backend ].be_active-- ;
+   }
+   udp_sessions-- ;
+   free( sesp ) ;
+}
+
+
+/*
+ * Open a session for a new client. Returns NULL if it can't be had
+ * right now, in which case the datagram is dropped.
+ */
+static struct udp_session *udp_open( struct service *sp,
+                                     const union xsockaddr *addrp,
+                                     socklen_t len )
+{
+   struct udp_session  *sesp ;
+   connection_s         conn ;
+   mask_t               checks ;
+   access_e             result ;
+   union xsockaddr      backend ;
+   struct epoll_event   ev ;
+   const char          *func = "udp_open" ;
+
+   if ( udp_sessions >= REDIR_UDP_SESSIONS )
+      return( NULL ) ;
+   if ( ( sesp = NEW( struct udp_session ) ) == NULL )
+      return( NULL ) ;
+   CLEAR( *sesp ) ;
+   sesp->us_client = *addrp ;
+   sesp->us_len = len ;
+   sesp->us_fd = -1 ;
+   sesp->us_last = udp_now ;
+
+   CLEAR( conn ) ;
+   conn.co_sp = sp ;
+   conn.co_descriptor = -1 ;
+   CONN_SETADDR( &conn, &addrp->sa_in6 ) ;
+   M_CLEAR_ALL( checks ) ;
+   M_SET( checks, CF_ADDRESS ) ;
+   M_SET( checks, CF_TIME ) ;
+   if ( ( result = access_control( sp, &conn, &checks ) ) != AC_OK )
+      svc_log_failure( sp, &conn, result ) ;
+   else
+   {
+      sesp->us_backend = backend_choose( sp, addrp ) ;
+      memcpy( &backend, SC_REDIR_BACKEND( SVC_CONF( sp ), sesp->us_backend ),
+                                                      sizeof( backend ) ) ;
+      if ( backend.sa.sa_family == AF_INET6 )
+      {
+         backend.sa_in6.sin6_port = htons( backend.sa_in6.sin6_port ) ;
+         len = sizeof( struct sockaddr_in6 ) ;
+      }
+      else
+      {
+         backend.sa_in.sin_port = htons( backend.sa_in.sin_port ) ;
+         len = sizeof( struct sockaddr_in ) ;
+      }
+
+      sesp->us_fd = socket( backend.sa.sa_family, SOCK_DGRAM, 0 ) ;
+      ev.events = EPOLLIN ;
+      ev.data.ptr = sesp ;
+      if ( sesp->us_fd < 0 ||
+           fcntl( sesp->us_fd, F_SETFL, O_NONBLOCK ) == -1 ||
+           connect( sesp->us_fd, &backend.sa, len ) == -1 ||
+           epoll_ctl( udp_epfd, EPOLL_CTL_ADD, sesp->us_fd, &ev ) == -1 )
+      {
+         msg( LOG_ERR, func, "can't connect to remote host %s: %m",
+               xaddrname( SC_REDIR_BACKEND( SVC_CONF( sp ),
+                                             sesp->us_backend ) ) ) ;
+         if ( sesp->us_fd >= 0 )
+            (void) close( sesp->us_fd ) ;
+         free( sesp ) ;
+         return( NULL ) ;
+      }
+      SVC_BACKENDS( sp )[ sesp->us_backend ].be_active++ ;
+   }
+
+   {
+      unsigned h = xaddrhash( addrp, TRUE ) % UDP_BUCKETS ;
+
+      sesp->us_next = udp_table[ h ] ;
+      udp_table[ h ] = sesp ;
+   }
+   udp_sessions++ ;
+   return( sesp ) ;
+}
+
+
+/*
+ * Forward a batch of datagrams from the clients. Consecutive datagrams
+ * of the same client go out in one call.
+ */
+static void udp_from_clients( struct service *sp, int fd,
+                              unsigned long *bytes_in )
+{
+   struct dgram_batch *bp = udp_in ;
+   struct udp_session *sesp, *prev = NULL ;
+   int n, i, first ;
+
+   if ( ( n = dgram_recv( fd, bp, 0, REDIR_UDP_BATCH, TRUE ) ) <= 0 )
+      return ;
+
+   for ( i = 0 ; i < n ; i++ )
+   {
+      const union xsockaddr *addrp = DGRAM_ADDR( bp, i ) ;
+
+      if ( prev != NULL && xaddrequal( &prev->us_client, addrp ) )
+         sesp = prev ;
+      else if ( ( sesp = udp_lookup( addrp ) ) == NULL )
+         sesp = udp_open( sp, addrp, DGRAM_NAMELEN( bp, i ) ) ;
+      if ( sesp != NULL )
+      {
+         sesp->us_last = udp_now ;
+         if ( sesp->us_fd < 0 )
+            sesp = NULL ;
+         else
+            *bytes_in += DGRAM_LEN( bp, i ) ;
+      }
+      DGRAM_DATA( bp, i ) = prev = sesp ;
+   }
+
+   for ( first = 0 ; first < n ; first = i )
+   {
+      for ( i = first + 1 ; i < n &&
+               DGRAM_DATA( bp, i ) == DGRAM_DATA( bp, first ) ; i++ )
+         ;
+      if ( ( sesp = DGRAM_DATA( bp, first ) ) != NULL )
+         dgram_send( sesp->us_fd, bp, first, i - first, FALSE ) ;
+   }
+}
+
+
+static void udp_flush( int fd )
+{
+   if ( udp_out->db_count > 0 )
+   {
+      dgram_send( fd, udp_out, 0, udp_out->db_count, TRUE ) ;
+      udp_out->db_count = 0 ;
+   }
+}
+
+
+/*
+ * Queue the replies of a backend for their client. Returns FAILED if
+ * the session should be closed, e.g. because the backend refused it.
+ */
+static status_e udp_from_backend( int fd, struct udp_session *sesp,
+                                  unsigned long *bytes_out )
+{
+   struct dgram_batch *bp = udp_out ;
+   int n, i ;
+
+   if ( bp->db_count == REDIR_UDP_BATCH )
+      udp_flush( fd ) ;
+   n = dgram_recv( sesp->us_fd, bp, bp->db_count,
+                     REDIR_UDP_BATCH - bp->db_count, FALSE ) ;
+   if ( n == -1 )
+      return( errno == EAGAIN ? OK : FAILED ) ;
+
+   for ( i = bp->db_count ; i < (int) bp->db_count + n ; i++ )
+   {
+      *DGRAM_ADDR( bp, i ) = sesp->us_client ;
+      *bytes_out += DGRAM_LEN( bp, i ) ;
+   }
+   bp->db_count += n ;
+   sesp->us_last = udp_now ;
+   if ( bp->db_count == REDIR_UDP_BATCH )
+      udp_flush( fd ) ;
+   return( OK ) ;
+}
+
+
+/*
+ * Close the sessions that have been idle for timeout seconds
+ */
+static void udp_expire( struct service *sp, int timeout )
+{
+   unsigned u ;
+
+   for ( u = 0 ; u < UDP_BUCKETS ; u++ )
+   {
+      struct udp_session *sesp = udp_table[ u ] ;
+
+      while ( sesp != NULL )
+      {
+         struct udp_session *next = sesp->us_next ;
+
+         if ( udp_now - sesp->us_last >= timeout )
+            udp_close( sp, sesp ) ;
+         sesp = next ;
+      }
+   }
+}
+
+
+#ifdef __GNUC__
+__attribute__ ((noreturn))
+#endif
+static void redir_udp( struct server *serp, int fd )
+{
+   struct service *sp = SERVER_SERVICE( serp );
+   struct service_config *scp = SVC_CONF( sp );
+   struct epoll_event events[ REDIR_UDP_BATCH ];
+   struct epoll_event ev;
+   unsigned long bytes_in = 0, bytes_out = 0;
+   int timeout = SC_REDIR_IDLE_TIMEOUT( scp ) > 0 ?
+                     SC_REDIR_IDLE_TIMEOUT( scp ) : REDIR_UDP_TIMEOUT;
+   time_t idle_since, swept;
+   const char *func = "redir_udp";
+
+   udp_in = dgram_create( REDIR_UDP_BATCH, UDP_BUFFER );
+   udp_out = dgram_create( REDIR_UDP_BATCH, UDP_BUFFER );
+   if( udp_in == NULL || udp_out == NULL ||
+       (udp_epfd = epoll_create( REDIR_UDP_BATCH )) == -1 ||
+       fcntl(fd, F_SETFL, O_NONBLOCK) == -1 )
+   {
+      msg(LOG_ERR, func, "cannot set up the redirector: %m");
+      exit(0);
+   }
+   ev.events = EPOLLIN;
+   ev.data.ptr = NULL;
+   if( epoll_ctl(udp_epfd, EPOLL_CTL_ADD, fd, &ev) == -1 )
+   {
+      msg(LOG_ERR, func, "epoll_ctl failed: %m");
+      exit(0);
+   }
+
+   udp_now = idle_since = swept = time(NULL);
+   while( udp_sessions > 0 || udp_now - idle_since < timeout ) {
+      int n, i;
+
+      n = epoll_wait(udp_epfd, events, REDIR_UDP_BATCH, 1000);
+      if( n == -1 && errno != EINTR ) {
+         msg(LOG_ERR, func, "epoll_wait failed: %m");
+         break;
+      }
+      udp_now = time(NULL);
+
+      for( i = 0 ; i < n ; i++ ) {
+         struct udp_session *sesp = events[ i ].data.ptr;
+
+         if( sesp == NULL )
+            udp_from_clients(sp, fd, &bytes_in);
+      }
+      for( i = 0 ; i < n ; i++ ) {
+         struct udp_session *sesp = events[ i ].data.ptr;
+
+         /* the next datagram of the client will open a new session */
+         if( sesp != NULL && udp_from_backend(fd, sesp, &bytes_out) == FAILED )
+            udp_close(sp, sesp);
+      }
+      udp_flush(fd);
+
+      if( udp_now != swept ) {
+         udp_expire(sp, timeout);
+         swept = udp_now;
+      }
+      if( udp_sessions > 0 )
+         idle_since = udp_now;
+   }
+
+   if( M_IS_SET( SC_LOG_ON_SUCCESS(scp), LO_TRAFFIC ) ) {
+      svc_logprint( SERVER_CONNSERVICE( serp ), "TRAFFIC",
+                    "in=%lu(bytes) out=%lu(bytes)", bytes_in, bytes_out );
+   }
+   exit(0);
+}
+
+#endif   /* HAVE_EPOLL_CREATE */
+
 /* Do the redirection of a service */
 /* This function gets called from child.c after we have been forked */
 void redir_handler( struct server *serp )
@@ -58,73 +603,72 @@ void redir_handler( struct server *serp )
    struct service *sp = SERVER_SERVICE( serp );
    struct service_config *scp = SVC_CONF( sp );
    int RedirDescrip = SERVER_FD( serp );
-   int maxfd;
-   ssize_t num_read, num_wrote=0, ret=0;
-   unsigned int sin_len = 0;
+   int maxfd, ret, next, status = 0;
+   char first[NET_BUFFER];
+   ssize_t first_len = 0;
+   size_t sent = 0;
    unsigned long bytes_in = 0, bytes_out = 0;
    int no_to_nagle = 1;
-   int on = 1, v6on;
-   char buff[NET_BUFFER];
+   int on = 1;
+#ifdef HAVE_SPLICE
+   int use_splice = 0;
+   int pipe_in[2], pipe_out[2];
+#endif
    fd_set rdfd, msfd;
-   struct timeval *timep = NULL;
+   struct timeval tv, *timep = NULL;
    const char *func = "redir_handler";
-   union xsockaddr serveraddr ;
 
    if( signal(SIGPIPE, redir_sigpipe) == SIG_ERR ) 
       msg(LOG_ERR, func, "unable to setup signal handler");
 
+   /* The socket of a udp service would be closed with the others */
+   if( SC_PROTOVAL(scp) == IPPROTO_UDP )
+      RedirDescrip = dup(RedirDescrip);
+
    close_all_svc_descriptors();
 
    /* If it's a tcp service we are redirecting */
    if( SC_PROTOVAL(scp) == IPPROTO_TCP )
    {
-      memcpy(&serveraddr, SC_REDIR_ADDR(scp), sizeof(serveraddr));
-      if( serveraddr.sa_in.sin_family == AF_INET ) {
-         sin_len = sizeof( struct sockaddr_in );
-         RedirServerFd = socket(AF_INET, SOCK_STREAM, 0);
-       } else if( serveraddr.sa_in.sin_family == AF_INET6 ) {
-         sin_len = sizeof( struct sockaddr_in6 );
-         RedirServerFd = socket(AF_INET6, SOCK_STREAM, 0);
-      } else {
-         msg(LOG_ERR, func, "not a valid protocol. Use IPv4 or IPv6.");
-         exit(0);
+#ifdef MSG_FASTOPEN
+      /*
+       * With tcp_fastopen, whatever the client has already sent goes
+       * to the backend with the SYN. We don't wait for it, since the
+       * server may be the one to speak first.
+       */
+      if( SC_TCP_FASTOPEN(scp) > 0 ) {
+         do {
+            first_len = recv(RedirDescrip, first, sizeof(first), MSG_DONTWAIT);
+         } while (first_len == (ssize_t)-1 && errno == EINTR);
+         if( first_len < 0 )
+            first_len = 0;
       }
-
-      if( RedirServerFd < 0 )
-      {
-         msg(LOG_ERR, func, "cannot create socket: %m");
-         exit(0);
-      }
-
-      if( SC_IPV6( scp ) ) {
-         if( SC_V6ONLY( scp ) ) {
-            v6on = 1;
-         } else {
-            v6on = 0;
-         }
-#ifdef IPV6_V6ONLY
-         if( setsockopt(RedirServerFd, IPPROTO_IPV6, IPV6_V6ONLY, (char *)&v6on, sizeof(v6on)) < 0 ) { 
-            msg( LOG_ERR, func, "Setting IPV6_V6ONLY option failed (%m)" );
-         }
 #endif
 
-      }
-      if( SC_KEEPALIVE( scp ) )
-         if (setsockopt(RedirServerFd, SOL_SOCKET, SO_KEEPALIVE, 
-                        (char *)&on, sizeof( on ) ) < 0 )
-            msg(LOG_ERR, func, 
-                "setsockopt SO_KEEPALIVE RedirServerFd failed: %m");
-      
-      if( serveraddr.sa_in.sin_family == AF_INET )
-         serveraddr.sa_in.sin_port = htons(serveraddr.sa_in.sin_port);
-      if( serveraddr.sa_in.sin_family == AF_INET6 )
-         serveraddr.sa_in6.sin6_port = htons(serveraddr.sa_in6.sin6_port);
-
-      if( connect(RedirServerFd, &serveraddr.sa, sin_len) < 0 )
+      /*
+       * Try the backend we were given, then fail over to the others.
+       * The parent charges the failure to the first one when we exit.
+       */
+      while( (RedirServerFd = redir_connect(scp, backend_addr(serp),
+                                    first, first_len, &sent)) < 0 )
       {
          msg(LOG_ERR, func, "can't connect to remote host %s: %m",
-            xaddrname( &serveraddr ) );
-         exit(0);
+            xaddrname( backend_addr(serp) ) );
+         if( (next = backend_next(serp)) < 0 )
+            exit(REDIR_EXIT_NOCONNECT);
+         SERVER_BACKEND( serp ) = next;
+         status = REDIR_EXIT_FAILOVER;
+      }
+
+      /* what did not fit in the SYN */
+      bytes_in += first_len;
+      while( sent < (size_t)first_len ) {
+         ret = write(RedirServerFd, first + sent, first_len - sent);
+         if (ret == -1 && errno == EINTR)
+            continue;
+         if (ret <= 0)
+            goto REDIROUT;
+         sent += ret;
       }
 
       /* connection now established */
@@ -141,6 +685,21 @@ void redir_handler( struct server *serp )
          msg(LOG_ERR, func, "setsockopt RedirDescrip failed: %m");
       }
 
+#ifdef HAVE_SPLICE
+      /*
+       * One pipe per direction. If they can't be had, or the kernel
+       * turns splice down for these sockets, we copy the data ourselves.
+       */
+      if( pipe(pipe_in) == 0 ) {
+         if( pipe(pipe_out) == 0 )
+            use_splice = 1;
+         else {
+            close(pipe_in[0]);
+            close(pipe_in[1]);
+         }
+      }
+#endif
+
       maxfd = (RedirServerFd > RedirDescrip)?RedirServerFd:RedirDescrip;
       FD_ZERO(&msfd);
       FD_SET(RedirDescrip, &msfd);
@@ -148,61 +707,41 @@ void redir_handler( struct server *serp )
 
       while(1) {
          memcpy(&rdfd, &msfd, sizeof(rdfd));
-         if (select(maxfd + 1, &rdfd, (fd_set *)0, (fd_set *)0, timep) <= 0) {
-            /* place for timeout code, currently does not time out */
-            break;
+         if( SC_REDIR_IDLE_TIMEOUT(scp) > 0 ) {
+            tv.tv_sec = SC_REDIR_IDLE_TIMEOUT(scp);
+            tv.tv_usec = 0;
+            timep = &tv;
          }
+         /* on an idle timeout, we just close both sides */
+         if (select(maxfd + 1, &rdfd, (fd_set *)0, (fd_set *)0, timep) <= 0)
+            break;
 
          if (FD_ISSET(RedirDescrip, &rdfd)) {
-            do {
-               num_read = read(RedirDescrip,
-                  buff, sizeof(buff));
-               if (num_read == (ssize_t)-1 && errno == EINTR)
-                  continue;
-               if (num_read <= 0)
-                  goto REDIROUT;
-               bytes_in += num_read;
-            } while (num_read < 0);
-
-            /* Loop until we have written everything
-             * that was read */
-            num_wrote = 0;
-            while( num_wrote < num_read ) {
-               ret = write(RedirServerFd,
-                  buff + num_wrote,
-                  num_read - num_wrote);
-               if (ret == -1 && errno == EINTR)
-                  continue;
-               if (ret <= 0)
-                  goto REDIROUT;
-               num_wrote += ret;
-            }
+            ret = 1;
+#ifdef HAVE_SPLICE
+            if (use_splice && 
+               (ret = splice_data(RedirDescrip, RedirServerFd, 
+                                  pipe_in, &bytes_in)) == 1)
+               use_splice = 0;
+#endif
+            if (ret == 1)
+               ret = copy_data(RedirDescrip, RedirServerFd, &bytes_in);
+            if (ret < 0)
+               goto REDIROUT;
          }
 
          if (FD_ISSET(RedirServerFd, &rdfd)) {
-            do {
-               num_read = read(RedirServerFd,
-                  buff, sizeof(buff));
-               if (num_read == -1 && errno == EINTR)
-                  continue;
-               if (num_read <= 0)
-                  goto REDIROUT;
-               bytes_out += num_read;
-            } while (num_read < 0);
-
-            /* Loop until we have written everything
-             * that was read */
-            num_wrote = 0;
-            while( num_wrote < num_read ) {
-               ret = write(RedirDescrip,
-                  buff + num_wrote,
-                  num_read - num_wrote);
-               if (ret == -1 && errno == EINTR)
-                  continue;
-               if (ret <= 0)
-                  goto REDIROUT;
-               num_wrote += ret;
-            }
+            ret = 1;
+#ifdef HAVE_SPLICE
+            if (use_splice && 
+               (ret = splice_data(RedirServerFd, RedirDescrip, 
+                                  pipe_out, &bytes_out)) == 1)
+               use_splice = 0;
+#endif
+            if (ret == 1)
+               ret = copy_data(RedirServerFd, RedirDescrip, &bytes_out);
+            if (ret < 0)
+               goto REDIROUT;
          }
       }
 REDIROUT:
@@ -211,10 +750,15 @@ REDIROUT:
                        "in=%lu(bytes) out=%lu(bytes)", bytes_in, bytes_out );
       }
 
-      exit(0);
+      exit(status);
    }
 
+#ifdef HAVE_EPOLL_CREATE
+   if( SC_PROTOVAL(scp) == IPPROTO_UDP && RedirDescrip >= 0 )
+      redir_udp( serp, RedirDescrip );
+#endif
+
    msg(LOG_ERR, func, 
-   "redirect with any protocol other than tcp is not supported at this time.");
+   "redirect with any protocol other than tcp or udp is not supported at this time.");
    exit(0);
 }
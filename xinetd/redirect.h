@@ -3,6 +3,18 @@
 
 #include "server.h"
 
+/*
+ * Exit status of a redirector that could not connect to its backend
+ * (EX_TEMPFAIL)
+ */
+#define REDIR_EXIT_NOCONNECT     75
+
+/*
+ * Exit status of a redirector that had to fail over to another backend
+ * than the one it was given (EX_PROTOCOL)
+ */
+#define REDIR_EXIT_FAILOVER      76
+
 #ifdef __GNUC__
 __attribute__ ((noreturn))
 #endif
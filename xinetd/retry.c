@@ -1,7 +1,7 @@
 /*
  * (c) Copyright 1992 by Panagiotis Tsirigotis
  * (c) Sections Copyright 1998-2001 by Rob Braun
- * All rights reserved.  The file named COPYRIGHT specifies the terms 
+ * All rights reserved.  The file named COPYRIGHT specifies the terms
  * and conditions for redistribution.
  */
 
@@ -9,8 +9,12 @@
 #include "config.h"
 #include <sys/time.h>
 #include <syslog.h>
+#include <time.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 #include "pset.h"
+#include "sio.h"
 #include "retry.h"
 #include "state.h"
 #include "main.h"
@@ -22,108 +26,275 @@
 #include "sconf.h"
 #include "xtimer.h"
 
-static int retry_timer_running ;
+/*
+ * A note on how retries are scheduled:
+ * Every service with servers waiting to be retried has its own FIFO
+ * queue (svc_retry_queue) and its own backoff state. The services with
+ * a non-empty queue are kept in retry_services. A single timer is armed
+ * for the earliest time any of those services is due. When a service is
+ * due, the servers at the head of its queue are started until one fork
+ * fails; at that point the service backs off exponentially (with jitter
+ * so that services do not retry in lockstep) and the rest of its queue
+ * waits. RETRIES( ps ) still contains all servers waiting to be retried.
+ *
+ * Independently, a global circuit breaker counts consecutive fork
+ * failures. Once it trips, no forks are attempted (new requests are
+ * queued instead) until RETRY_BREAKER_TIME has passed. The first fork
+ * after that decides whether the breaker closes or trips again.
+ */
+
+struct retry_stats
+{
+   unsigned long   scheduled ;
+   unsigned long   succeeded ;
+   unsigned long   dropped ;
+   unsigned long   breaker_trips ;
+} ;
+
+static pset_h              retry_services ;
+static struct retry_stats  stats ;
+static int                 retry_timer_running ;
+static time_t              retry_timer_when ;
+static unsigned            fork_failures ;   /* consecutive, all services  */
+static time_t              breaker_until ;   /* 0 if breaker is closed     */
+
 static void cancel_retry(struct server * serp );
 static void stop_retry_timer(void) ;
 static void start_retry_timer(void) ;
 
 
 /*
- * Attempt to start all servers in the retry table
+ * Return the delay randomized by +/- 25%
  */
-static void server_retry(void)
+static time_t jitter( time_t delay )
 {
-   unsigned          servers_started = 0 ;
-   unsigned          u ;
-   const char       *func = "server_retry" ;
+   static bool_int   seeded = FALSE ;
+   time_t            spread = delay / 4 ;
 
-   for ( u = 0 ; u < pset_count( RETRIES( ps ) ) ; u++ )
+   if ( ! seeded )
    {
-      struct server *retry = SERP( pset_pointer( RETRIES( ps ), u ) ) ;
-      struct service *sp = SERVER_SERVICE( retry ) ;
+      srandom( (unsigned) time( NULL ) ^ (unsigned) getpid() ) ;
+      seeded = TRUE ;
+   }
+   if ( spread == 0 )
+      return( delay ) ;
+   return( delay - spread + random() % ( 2 * spread + 1 ) ) ;
+}
+
+
+/*
+ * Remove the server at the head of the queue of service sp.
+ * The queue is destroyed when it becomes empty.
+ */
+static void dequeue_retry( struct service *sp, struct server *serp )
+{
+   pset_remove( SVC_RETRY_QUEUE( sp ), serp ) ;
+   pset_remove( RETRIES( ps ), serp ) ;
+   if ( pset_count( SVC_RETRY_QUEUE( sp ) ) == 0 )
+   {
+      pset_destroy( SVC_RETRY_QUEUE( sp ) ) ;
+      SVC_RETRY_QUEUE( sp ) = NULL ;
+      pset_remove( retry_services, sp ) ;
+   }
+}
+
+
+/*
+ * Start as many servers as possible from the queue of service sp.
+ * Returns TRUE if the queue is not empty afterwards.
+ */
+static bool_int service_retry( struct service *sp, time_t now )
+{
+   const char *func = "service_retry" ;
+   int         failures ;
+
+   while ( SVC_RETRY_QUEUE( sp ) != NULL )
+   {
+      struct server *retry = SERP( pset_pointer( SVC_RETRY_QUEUE( sp ), 0 ) ) ;
       connection_s *cp = SERVER_CONNECTION( retry ) ;
 
       /*
-       * Drop the retry if access control fails or we have
-       * a memory allocation problem
+       * Access control was done when the request arrived, so it is
+       * not repeated here. Requests that waited too long are dropped.
        */
-      if ( svc_parent_access_control( sp, cp ) == FAILED ||
-         svc_child_access_control (sp, cp) == FAILED ||
-         pset_add( SERVERS( ps ), retry ) == NULL )
+      if ( now - SERVER_STARTTIME( retry ) > RETRY_MAX_AGE ||
+                           pset_add( SERVERS( ps ), retry ) == NULL )
       {
+         msg( LOG_NOTICE, func,
+            "service %s: dropping retry attempt", SVC_ID( sp ) ) ;
+         svc_log_failure( sp, cp, AC_FORK ) ;
+         dequeue_retry( sp, retry ) ;
          cancel_retry( retry ) ;
-         pset_pointer( RETRIES( ps ), u ) = NULL ;
+         stats.dropped++ ;
          continue ;
       }
 
+      failures = SERVER_FORK_FAILURES( retry ) ;
       if ( server_start( retry ) == OK )
       {
-         servers_started++ ;
+         dequeue_retry( sp, retry ) ;
          SVC_DEC_RETRIES( sp ) ;
+         SVC_RETRY_DELAY( sp ) = RETRY_INTERVAL ;
          if ( !SVC_WAITS( sp ) )
             CONN_CLOSE( cp ) ;
-         pset_pointer( RETRIES( ps ), u ) = NULL ;
+         stats.succeeded++ ;
          continue ;
       }
-      else
+
+      pset_remove( SERVERS( ps ), retry ) ;
+
+      /*
+       * Deferred by the spawn governor: try again in a second,
+       * without backing off
+       */
+      if ( SERVER_FORK_FAILURES( retry ) == failures )
       {
-         pset_remove( SERVERS( ps ), retry ) ;
-         if ( SERVER_FORKLIMIT( retry ) )
-         {
-            /*
-             * give up retrying
-             */
-            msg( LOG_ERR, func,
-               "service %s: too many consecutive fork failures", SVC_ID(sp) ) ;
-            svc_log_failure( sp, cp, AC_FORK ) ;
-            cancel_retry( retry ) ;
-            pset_pointer( RETRIES( ps ), u ) = NULL ;
-            continue ;
-         }
-         else
-         {
-            if ( debug.on )
-               msg( LOG_DEBUG, func,
-                  "fork failed for service %s. Retrying...", SVC_ID( sp ) ) ;
-         }
+         SVC_RETRY_TIME( sp ) = now + 1 ;
+         break ;
       }
+
+      if ( SERVER_FORKLIMIT( retry ) )
+      {
+         /*
+          * give up retrying
+          */
+         msg( LOG_ERR, func,
+            "service %s: too many consecutive fork failures", SVC_ID(sp) ) ;
+         svc_log_failure( sp, cp, AC_FORK ) ;
+         dequeue_retry( sp, retry ) ;
+         cancel_retry( retry ) ;
+         stats.dropped++ ;
+      }
+
+      /*
+       * The rest of the queue would fail the same way, so back off
+       */
+      if ( SVC_RETRY_DELAY( sp ) < RETRY_MAX_INTERVAL )
+         SVC_RETRY_DELAY( sp ) *= 2 ;
+      if ( SVC_RETRY_DELAY( sp ) > RETRY_MAX_INTERVAL )
+         SVC_RETRY_DELAY( sp ) = RETRY_MAX_INTERVAL ;
+      SVC_RETRY_TIME( sp ) = now + jitter( SVC_RETRY_DELAY( sp ) ) ;
+
+      if ( debug.on )
+         msg( LOG_DEBUG, func,
+            "fork failed for service %s. Retrying in %ld seconds",
+               SVC_ID( sp ), (long)( SVC_RETRY_TIME( sp ) - now ) ) ;
+      break ;
    }
+   return( SVC_RETRY_QUEUE( sp ) != NULL ) ;
+}
 
-   pset_compact( RETRIES( ps ) ) ;
 
-   if ( debug.on )
-      msg( LOG_DEBUG, func,
-         "%d servers started, %d left to retry",
-            servers_started, pset_count( RETRIES( ps ) ) ) ;
+/*
+ * Attempt to start the servers of all services that are due
+ */
+static void server_retry(void)
+{
+   unsigned          u ;
+   time_t            now = time( NULL ) ;
+   const char       *func = "server_retry" ;
 
-   /* If there's more, start another callback */
-   if ( pset_count( RETRIES( ps ) ) > 0 ) {
-      if ((retry_timer_running=xtimer_add(server_retry, RETRY_INTERVAL)) == -1)
+   retry_timer_running = 0 ;
+
+   if ( ! retry_breaker_open() )
+   {
+      u = 0 ;
+      while ( u < pset_count( retry_services ) )
       {
-         msg( LOG_ERR, func, "xtimer_add: %m" ) ;
-         retry_timer_running = 0;
+         struct service *sp = SP( pset_pointer( retry_services, u ) ) ;
+
+         if ( SVC_RETRY_TIME( sp ) > now || service_retry( sp, now ) )
+            u++ ;
+         if ( retry_breaker_open() )
+            break ;
       }
    }
-   else
-      retry_timer_running = 0;
+
+   if ( debug.on )
+      msg( LOG_DEBUG, func, "%d servers left to retry",
+            pset_count( RETRIES( ps ) ) ) ;
+
+   /* If there's more, start another callback */
+   start_retry_timer() ;
 }
 
 
 /*
- * Schedule a retry by inserting the struct server in the retry table
- * and starting the timer if necessary
+ * Schedule a retry by inserting the struct server in the retry queue
+ * of its service and starting the timer if necessary
  */
 status_e schedule_retry( struct server *serp )
 {
    struct service *sp = SERVER_SERVICE( serp ) ;
    const char *func = "schedule_retry" ;
 
+   if ( SVC_RETRY_QUEUE( sp ) == NULL )
+   {
+      if ( retry_services == NULL &&
+               ( retry_services = pset_create( 0, 0 ) ) == NULL )
+      {
+         out_of_memory( func ) ;
+         return( FAILED ) ;
+      }
+      if ( ( SVC_RETRY_QUEUE( sp ) = pset_create( 0, 0 ) ) == NULL )
+      {
+         out_of_memory( func ) ;
+         return( FAILED ) ;
+      }
+      if ( pset_add( retry_services, sp ) == NULL )
+      {
+         out_of_memory( func ) ;
+         pset_destroy( SVC_RETRY_QUEUE( sp ) ) ;
+         SVC_RETRY_QUEUE( sp ) = NULL ;
+         return( FAILED ) ;
+      }
+      if ( SVC_RETRY_DELAY( sp ) == 0 )
+         SVC_RETRY_DELAY( sp ) = RETRY_INTERVAL ;
+
+      /*
+       * A server that has not failed to fork was deferred by the
+       * spawn governor (or the breaker); it can go in the next second.
+       */
+      if ( SERVER_FORK_FAILURES( serp ) == 0 )
+         SVC_RETRY_TIME( sp ) = time( NULL ) + 1 ;
+      else
+         SVC_RETRY_TIME( sp ) = time( NULL ) + 
+                                    jitter( SVC_RETRY_DELAY( sp ) ) ;
+   }
+   else if ( pset_count( SVC_RETRY_QUEUE( sp ) ) >= RETRY_QUEUE_MAX )
+   {
+      msg( LOG_ERR, func, "service %s: retry queue is full", SVC_ID( sp ) ) ;
+      stats.dropped++ ;
+      return( FAILED ) ;
+   }
+
    if ( pset_add( RETRIES( ps ), serp ) == NULL )
    {
       out_of_memory( func ) ;
       return( FAILED ) ;
    }
+   if ( pset_add( SVC_RETRY_QUEUE( sp ), serp ) == NULL )
+   {
+      out_of_memory( func ) ;
+      pset_remove( RETRIES( ps ), serp ) ;
+      if ( pset_count( SVC_RETRY_QUEUE( sp ) ) == 0 )
+      {
+         pset_destroy( SVC_RETRY_QUEUE( sp ) ) ;
+         SVC_RETRY_QUEUE( sp ) = NULL ;
+         pset_remove( retry_services, sp ) ;
+      }
+      return( FAILED ) ;
+   }
+
+   /*
+    * The server is not running; it goes back in the server table
+    * when it is retried. Until then, the start time is the time
+    * it was queued.
+    */
+   pset_remove( SERVERS( ps ), serp ) ;
+   (void) time( &SERVER_STARTTIME( serp ) ) ;
    SVC_INC_RETRIES( sp ) ;
+   stats.scheduled++ ;
    start_retry_timer() ;
    if ( debug.on )
       msg( LOG_DEBUG, func, "Scheduled retry attempt for %s", SVC_ID( sp ) ) ;
@@ -153,47 +324,117 @@ static void cancel_retry( struct server *serp )
  */
 void cancel_service_retries( struct service *sp )
 {
-   unsigned u ;
    const char *func = "cancel_service_retries" ;
 
    if ( SVC_RETRIES( sp ) == 0 )
       return ;
 
-   u = 0 ;
-   while ( u < pset_count( RETRIES( ps ) ) )
+   while ( SVC_RETRY_QUEUE( sp ) != NULL )
    {
       struct server *serp ;
 
-      serp = SERP( pset_pointer( RETRIES( ps ), u ) ) ;
-      if ( SERVER_SERVICE( serp ) == sp )
-      {
-         msg( LOG_NOTICE, func,
-            "dropping retry attempt for service %s", SVC_ID( sp ) ) ;
-         cancel_retry( serp ) ;
-         pset_remove_index( RETRIES( ps ), u ) ;
-         continue ;
-      }
-      u++ ;
+      serp = SERP( pset_pointer( SVC_RETRY_QUEUE( sp ), 0 ) ) ;
+      msg( LOG_NOTICE, func,
+         "dropping retry attempt for service %s", SVC_ID( sp ) ) ;
+      dequeue_retry( sp, serp ) ;
+      cancel_retry( serp ) ;
+      stats.dropped++ ;
    }
 
-   if ( pset_count( RETRIES( ps ) ) == 0 )
-      stop_retry_timer() ;
+   start_retry_timer() ;
+}
+
+
+/*
+ * Record the outcome of a fork(2) of a server. Enough consecutive
+ * failures trip the circuit breaker.
+ */
+void retry_fork_result( status_e result )
+{
+   const char *func = "retry_fork_result" ;
+
+   if ( result == OK )
+   {
+      if ( breaker_until != 0 )
+         msg( LOG_NOTICE, func, "fork succeeded; resuming server retries" ) ;
+      fork_failures = 0 ;
+      breaker_until = 0 ;
+      return ;
+   }
+
+   if ( ++fork_failures < RETRY_BREAKER_FAILURES || retry_breaker_open() )
+      return ;
+
+   breaker_until = time( NULL ) + RETRY_BREAKER_TIME ;
+   stats.breaker_trips++ ;
+   msg( LOG_ERR, func,
+      "%u consecutive fork failures; suspending forks for %d seconds",
+         fork_failures, RETRY_BREAKER_TIME ) ;
+   start_retry_timer() ;
+}
+
+
+/*
+ * Returns TRUE if forks should not be attempted
+ */
+bool_int retry_breaker_open(void)
+{
+   return( breaker_until != 0 && time( NULL ) < breaker_until ) ;
+}
+
+
+void retry_dump( int fd )
+{
+   Sprint( fd, "retries scheduled = %lu\n", stats.scheduled ) ;
+   Sprint( fd, "retries succeeded = %lu\n", stats.succeeded ) ;
+   Sprint( fd, "retries dropped = %lu\n", stats.dropped ) ;
+   Sprint( fd, "fork breaker trips = %lu\n", stats.breaker_trips ) ;
+   if ( retry_breaker_open() )
+      Sprint( fd, "fork breaker open until %s", ctime( &breaker_until ) ) ;
+   Sputchar( fd, '\n' ) ;
 }
 
 
+/*
+ * Arm the timer for the earliest time any service is due (or the breaker
+ * closes). A timer that is already armed for that time is kept.
+ */
 static void start_retry_timer(void)
 {
+   unsigned    u ;
+   time_t      when = 0 ;
+   time_t      now ;
    const char *func = "start_retry_timer" ;
 
-   /*
-    * Enable timer if necessary.
-    */
+   if ( retry_services == NULL || pset_count( retry_services ) == 0 )
+   {
+      stop_retry_timer() ;
+      return ;
+   }
 
-   if ( retry_timer_running == 0 )
-      if((retry_timer_running=xtimer_add(server_retry, RETRY_INTERVAL)) == -1 ){
-         msg( LOG_ERR, func, "xtimer_add: %m" ) ;
-         retry_timer_running = 0;
-      }
+   for ( u = 0 ; u < pset_count( retry_services ) ; u++ )
+   {
+      struct service *sp = SP( pset_pointer( retry_services, u ) ) ;
+
+      if ( when == 0 || SVC_RETRY_TIME( sp ) < when )
+         when = SVC_RETRY_TIME( sp ) ;
+   }
+   if ( retry_breaker_open() && breaker_until > when )
+      when = breaker_until ;
+
+   if ( retry_timer_running != 0 && retry_timer_when == when )
+      return ;
+   stop_retry_timer() ;
+
+   now = time( NULL ) ;
+   if ( ( retry_timer_running =
+            xtimer_add( server_retry, when > now ? when - now : 0 ) ) == -1 )
+   {
+      msg( LOG_ERR, func, "xtimer_add: %m" ) ;
+      retry_timer_running = 0 ;
+      return ;
+   }
+   retry_timer_when = when ;
 }
 
 
@@ -6,5 +6,8 @@
 
 status_e schedule_retry(struct server *serp);
 void cancel_service_retries(struct service *sp);
+void retry_fork_result(status_e result);
+bool_int retry_breaker_open(void);
+void retry_dump(int fd);
 
 #endif
@@ -13,6 +13,7 @@
 #include "str.h"
 #include "sio.h"
 #include "sconf.h"
+#include "xlog.h"
 #include "timex.h"
 #include "addr.h"
 #include "nvlists.h"
@@ -69,6 +70,8 @@ static void release_string_pset( pset_h pset )
  */
 void sc_free( struct service_config *scp )
 {
+   unsigned u ;
+
 #ifdef HAVE_MDNS
    COND_FREE( SC_MDNS_NAME(scp) );
    xinetd_mdns_svc_free(scp);
@@ -78,6 +81,7 @@ void sc_free( struct service_config *scp )
 #endif
    COND_FREE( SC_NAME(scp) ) ;
    COND_FREE( SC_ID(scp) ) ;
+   COND_FREE( SC_FILE(scp) ) ;
    COND_FREE( SC_PROTONAME(scp) ) ;
    COND_FREE( SC_SERVER(scp) ) ;
    COND_FREE( (char *)SC_REDIR_ADDR(scp) ) ;
@@ -100,6 +104,8 @@ void sc_free( struct service_config *scp )
       free( (char *) SC_SERVER_ARGV(scp) ) ;
    }
    COND_FREE( LOG_GET_FILELOG( SC_LOG( scp ) )->fl_filename ) ;
+   for ( u = 0 ; u < LOG_ENTRIES ; u++ )
+      COND_FREE( SC_LOG_PREFIX( scp, u ) ) ;
 
    if ( SC_ACCESS_TIMES(scp) != NULL )
    {
@@ -218,6 +224,23 @@ static void dump_log_data( int fd, struct service_config *scp, int tab_level )
          break ;
    }
 
+   if ( SC_LOG_ASYNC(scp) == YES )
+      tabprint( fd, tab_level, "Log mode = async (overflow = %s)\n",
+         SC_LOG_OVERFLOW(scp) == XLOG_OVERFLOW_BLOCK ? "block" :
+         SC_LOG_OVERFLOW(scp) == XLOG_OVERFLOW_DROP ? "drop" : "count" ) ;
+
+   if ( SC_LOG_ROTATE(scp) != 0 )
+      tabprint( fd, tab_level, "Log rotation = %u files%s\n",
+         SC_LOG_ROTATE(scp),
+         SC_LOG_COMPRESS(scp) == YES ? ", compressed" : "" ) ;
+
+   if ( SC_LOG_JSON(scp) == YES )
+      tabprint( fd, tab_level, "Log format = json\n" ) ;
+
+   if ( SC_LOG_FAILURE_LIMIT(scp) != 0 )
+      tabprint( fd, tab_level, "Log failure limit = %u per %u seconds\n",
+         SC_LOG_FAILURE_LIMIT(scp), SC_LOG_FAILURE_INTERVAL(scp) ) ;
+
    tabprint( fd, tab_level, "Log_on_success flags =" ) ;
    for ( i = 0 ; success_log_options[ i ].name != NULL ; i++ )
       if ( M_IS_SET( SC_LOG_ON_SUCCESS(scp), success_log_options[ i ].value ) )
@@ -252,6 +275,8 @@ void sc_dump( struct service_config *scp,
    if ( ! is_defaults )
    {
       tabprint( fd, tab_level+1, "id = %s\n", SC_ID(scp) ) ;
+      if ( SC_FILE(scp) != NULL )
+         tabprint( fd, tab_level+1, "file = %s\n", SC_FILE(scp) ) ;
 
       if ( ! M_ARE_ALL_CLEAR( SC_XFLAGS(scp) ) )
       {
@@ -260,6 +285,8 @@ void sc_dump( struct service_config *scp,
             if ( M_IS_SET( SC_XFLAGS(scp), nvp->value ) )
                Sprint( fd, " %s", nvp->name ) ;
          Sputchar( fd, '\n' ) ;
+         if ( SC_IS_INTERCEPTED(scp) && SC_INTERCEPT_INLINE(scp) == YES )
+            tabprint( fd, tab_level+1, "Intercept mode = inline\n" ) ;
       }
 
       if ( ! M_ARE_ALL_CLEAR( SC_TYPE(scp) ) )
@@ -269,6 +296,8 @@ void sc_dump( struct service_config *scp,
             if ( M_IS_SET( SC_TYPE(scp), nvp->value ) )
                Sprint( fd, " %s", nvp->name ) ;
          Sputchar( fd, '\n' ) ;
+         if ( SC_ENGINE(scp) != NO_ENGINE )
+            tabprint( fd, tab_level+1, "Builtin mode = inline\n" ) ;
       }
 
       tabprint( fd, tab_level+1, "socket_type = %s\n",
@@ -279,6 +308,13 @@ void sc_dump( struct service_config *scp,
       
       if ( SC_SPECIFIED( scp, A_PORT ) )
          tabprint( fd, tab_level+1, "port = %d\n", SC_PORT(scp) ) ;
+
+      if ( SC_DEFER_ACCEPT(scp) > 0 )
+         tabprint( fd, tab_level+1, "Defer accept = %d sec\n",
+                     SC_DEFER_ACCEPT(scp) ) ;
+      if ( SC_TCP_FASTOPEN(scp) > 0 )
+         tabprint( fd, tab_level+1, "TCP fast open queue = %d\n",
+                     SC_TCP_FASTOPEN(scp) ) ;
    }
 
    if ( SC_SPECIFIED( scp, A_INSTANCES ) ) {
@@ -323,6 +359,14 @@ void sc_dump( struct service_config *scp,
       tabprint( fd, tab_level+1, "PER_SOURCE = %d\n", 
          SC_PER_SOURCE(scp) );
 
+   if ( is_defaults && SC_SPECIFIED( scp, A_SPAWN_RATE ) )
+      tabprint( fd, tab_level+1, "Spawn rate = %u/sec\n",
+         SC_SPAWN_RATE(scp) );
+
+   if ( is_defaults && SC_SPECIFIED( scp, A_SPAWN_BURST ) )
+      tabprint( fd, tab_level+1, "Spawn burst = %u\n",
+         SC_SPAWN_BURST(scp) );
+
    if ( SC_SPECIFIED( scp, A_BIND ) ) {
 	   if (  SC_BIND_ADDR(scp) ) {
 		  char bindname[NI_MAXHOST];
@@ -374,18 +418,41 @@ void sc_dump( struct service_config *scp,
 
       if ( SC_REDIR_ADDR(scp) != NULL ) 
       {
+         static const char *policies[] = { "roundrobin", "leastconn", "source" } ;
          char redirname[NI_MAXHOST];
-         unsigned int len = 0;
-         if( SC_REDIR_ADDR(scp)->sa.sa_family == AF_INET ) 
-            len = sizeof(struct sockaddr_in);
-         if( SC_REDIR_ADDR(scp)->sa.sa_family == AF_INET6 ) 
-            len = sizeof(struct sockaddr_in6);
-         memset(redirname, 0, sizeof(redirname));
-         if( getnameinfo(&SC_REDIR_ADDR(scp)->sa, len,  redirname, NI_MAXHOST, 
-               NULL, 0, 0) != 0 ) 
-            strcpy(redirname, "unknown");
-         tabprint( fd, tab_level+1, "Redirect = %s:%d\n", redirname, 
-	    SC_REDIR_ADDR(scp)->sa_in.sin_port );
+         unsigned int len, u;
+
+         tabprint( fd, tab_level+1, "Redirect =" ) ;
+         for ( u = 0 ; u < SC_REDIR_COUNT(scp) ; u++ )
+         {
+            const union xsockaddr *addrp = SC_REDIR_BACKEND(scp, u) ;
+
+            len = 0 ;
+            if( addrp->sa.sa_family == AF_INET ) 
+               len = sizeof(struct sockaddr_in);
+            if( addrp->sa.sa_family == AF_INET6 ) 
+               len = sizeof(struct sockaddr_in6);
+            memset(redirname, 0, sizeof(redirname));
+            if( getnameinfo(&addrp->sa, len,  redirname, NI_MAXHOST, 
+                  NULL, 0, 0) != 0 ) 
+               strcpy(redirname, "unknown");
+            Sprint( fd, " %s:%d", redirname, addrp->sa_in.sin_port ) ;
+         }
+         Sputchar( fd, '\n' ) ;
+         if ( SC_REDIR_COUNT(scp) > 1 )
+            tabprint( fd, tab_level+1, "Redirect policy = %s\n",
+                        policies[ SC_REDIR_POLICY(scp) ] ) ;
+         if ( SC_REDIR_CHECK(scp) > 0 )
+            tabprint( fd, tab_level+1, "Redirect check = %d sec\n",
+                        SC_REDIR_CHECK(scp) ) ;
+         if ( SC_REDIR_CONNECT_TIMEOUT(scp) > 0 )
+            tabprint( fd, tab_level+1, "Redirect connect timeout = %d sec\n",
+                        SC_REDIR_CONNECT_TIMEOUT(scp) ) ;
+         if ( SC_REDIR_IDLE_TIMEOUT(scp) > 0 )
+            tabprint( fd, tab_level+1, "Redirect idle timeout = %d sec\n",
+                        SC_REDIR_IDLE_TIMEOUT(scp) ) ;
+         if ( SC_REDIR_INLINE(scp) == YES )
+            tabprint( fd, tab_level+1, "Redirect mode = inline\n" ) ;
       }
 
       if ( SC_IS_RPC( scp ) )
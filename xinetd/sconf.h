@@ -71,6 +71,14 @@
 #define LO_USERID    7
 #define LO_TRAFFIC   8
 
+/*
+ * Log records whose beginning is computed once per configuration
+ */
+#define LE_START     0
+#define LE_FAIL      1
+#define LE_EXIT      2
+#define LOG_ENTRIES  3
+
 struct rpc_data
 {
    unsigned long rd_min_version ;
@@ -84,6 +92,11 @@ struct rpc_data
 
 typedef enum { NO_ENV = 0, STD_ENV, DEF_ENV, CUSTOM_ENV } environ_e ;
 
+/*
+ * How a redirected service picks one of its backends
+ */
+typedef enum { REDIR_ROUNDROBIN = 0, REDIR_LEASTCONN, REDIR_SOURCE } redir_policy_e ;
+
 struct environment
 {
    environ_e  env_type ;
@@ -101,6 +114,7 @@ struct service_config
    mask_t               sc_xflags ;            /* INTERCEPT etc               */
    char                *sc_name;               /* e g  "echo"                 */
    char                *sc_id ;                /* e.g. "echo-stream"          */
+   char                *sc_file ;              /* the file it was read from   */
    uint16_t             sc_port ;              /* in host byte order          */
    int                  sc_socket_type ;       /* e.g. SOCK_DGRAM             */
    struct protocol_name_value sc_protocol ;    /* e.g. "TCP", IPPROTO_TCP     */
@@ -125,7 +139,26 @@ struct service_config
    pset_h               sc_enabled ;      /* used only by the default entry */
    struct environment   sc_environment ;
    const builtin_s     *sc_builtin ;
-   union xsockaddr     *sc_redir_addr ;
+   union xsockaddr     *sc_redir_addr ;     /* sc_redir_count backends  */
+   unsigned             sc_redir_count ;
+   boolean_e            sc_redir_inline ;
+   redir_policy_e       sc_redir_policy ;
+   int                  sc_redir_check ;     /* probe interval, 0 = none */
+   int                  sc_redir_connect_timeout ; /* secs, 0 = none */
+   int                  sc_redir_idle_timeout ;    /* secs, 0 = none */
+   int                  sc_defer_accept ;    /* TCP_DEFER_ACCEPT secs */
+   int                  sc_tcp_fastopen ;    /* TCP_FASTOPEN queue length */
+   boolean_e            sc_intercept_inline ;
+   boolean_e            sc_builtin_fork ;    /* no builtin engine */
+   boolean_e            sc_log_async ;       /* file log written by a writer */
+   int                  sc_log_overflow ;    /* XLOG_OVERFLOW_* */
+   unsigned             sc_log_rotate ;      /* rotated files kept, 0: none */
+   boolean_e            sc_log_compress ;    /* rotated files compressed */
+   boolean_e            sc_log_json ;        /* log_format = json */
+   unsigned             sc_log_failure_limit ;    /* 0: no limit */
+   unsigned             sc_log_failure_interval ; /* secs */
+   char                *sc_log_prefix[ LOG_ENTRIES ] ;
+   int                  sc_log_prefix_len[ LOG_ENTRIES ] ;
    char                *sc_orig_bind_addr ; /* used only when dual stack */
    union xsockaddr     *sc_bind_addr ;
    boolean_e            sc_v6only;
@@ -146,6 +179,8 @@ struct service_config
    rlim_t               sc_rlim_rss;
    rlim_t               sc_rlim_stack;
    mode_t               sc_umask;
+   unsigned             sc_spawn_rate ;   /* used only by the default entry */
+   unsigned             sc_spawn_burst ;  /* used only by the default entry */
    int                  sc_deny_time;         /* Sensor deny access time:
                                                  -1: forever
                                                   0: never
@@ -178,6 +213,7 @@ struct service_config
 #define SC_SOCKET_TYPE( scp )    (scp)->sc_socket_type
 #define SC_ID( scp )             (scp)->sc_id
 #define SC_NAME( scp )           (scp)->sc_name
+#define SC_FILE( scp )           (scp)->sc_file
 #define SC_PROTOVAL( scp )       (scp)->sc_protocol.value
 #define SC_PROTONAME( scp )      (scp)->sc_protocol.name
 #define SC_INSTANCES( scp )      (scp)->sc_instances
@@ -205,6 +241,26 @@ struct service_config
 #define SC_DISABLED( scp )       (scp)->sc_disabled
 #define SC_BUILTIN( scp )        (scp)->sc_builtin
 #define SC_REDIR_ADDR( scp )     (scp)->sc_redir_addr
+#define SC_REDIR_COUNT( scp )    (scp)->sc_redir_count
+#define SC_REDIR_BACKEND( scp, i ) ( &(scp)->sc_redir_addr[ i ] )
+#define SC_REDIR_INLINE( scp )   (scp)->sc_redir_inline
+#define SC_REDIR_POLICY( scp )   (scp)->sc_redir_policy
+#define SC_REDIR_CHECK( scp )    (scp)->sc_redir_check
+#define SC_REDIR_CONNECT_TIMEOUT( scp ) (scp)->sc_redir_connect_timeout
+#define SC_REDIR_IDLE_TIMEOUT( scp )    (scp)->sc_redir_idle_timeout
+#define SC_DEFER_ACCEPT( scp )   (scp)->sc_defer_accept
+#define SC_TCP_FASTOPEN( scp )   (scp)->sc_tcp_fastopen
+#define SC_INTERCEPT_INLINE( scp ) (scp)->sc_intercept_inline
+#define SC_BUILTIN_FORK( scp )   (scp)->sc_builtin_fork
+#define SC_LOG_ASYNC( scp )      (scp)->sc_log_async
+#define SC_LOG_OVERFLOW( scp )   (scp)->sc_log_overflow
+#define SC_LOG_ROTATE( scp )     (scp)->sc_log_rotate
+#define SC_LOG_COMPRESS( scp )   (scp)->sc_log_compress
+#define SC_LOG_JSON( scp )       (scp)->sc_log_json
+#define SC_LOG_FAILURE_LIMIT( scp ) (scp)->sc_log_failure_limit
+#define SC_LOG_FAILURE_INTERVAL( scp ) (scp)->sc_log_failure_interval
+#define SC_LOG_PREFIX( scp, e )  (scp)->sc_log_prefix[ e ]
+#define SC_LOG_PREFIX_LEN( scp, e ) (scp)->sc_log_prefix_len[ e ]
 #define SC_ORIG_BIND_ADDR( scp ) (scp)->sc_orig_bind_addr
 #define SC_BIND_ADDR( scp )      (scp)->sc_bind_addr
 #define SC_BANNER( scp )         (scp)->sc_banner
@@ -218,6 +274,8 @@ struct service_config
 #define SC_TIME_WAIT( scp )      (scp)->sc_time_wait
 #define SC_TIME_REENABLE( scp )  (scp)->sc_time_reenable
 #define SC_UMASK( scp )          (scp)->sc_umask
+#define SC_SPAWN_RATE( scp )     (scp)->sc_spawn_rate
+#define SC_SPAWN_BURST( scp )    (scp)->sc_spawn_burst
 #define SC_DENY_TIME( scp )      (scp)->sc_deny_time
 #define SC_MDNS_NAME( scp )      (scp)->sc_mdns_name
 #define SC_MDNS( scp )           (scp)->sc_mdns
@@ -235,6 +293,11 @@ struct service_config
 #define SC_FORKS( scp )           ( ! SC_IS_INTERNAL( scp ) ||   \
     BUILTIN_FORKS( (scp)->sc_builtin ) )
 #define SC_WAITS( scp )           ( (scp)->sc_wait == YES )
+#define SC_ENGINE( scp )          ( ( SC_IS_INTERNAL( scp ) &&             \
+                                      ! SC_WAITS( scp ) &&                 \
+                                      (scp)->sc_builtin_fork == NO ) ?     \
+                                    BUILTIN_ENGINE( (scp)->sc_builtin ) :  \
+                                    NO_ENGINE )
 #define SC_RETRY( scp )           ( M_IS_CLEAR( (scp)->sc_xflags, SF_NORETRY ) )
 #define SC_MUST_IDENTIFY( scp )   M_IS_SET( (scp)->sc_xflags, SF_IDONLY )
 #define SC_NAMEINARGS( scp )      M_IS_SET( (scp)->sc_xflags, SF_NAMEINARGS )
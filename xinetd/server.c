@@ -13,6 +13,7 @@
 #include <syslog.h>
 #include <fcntl.h>
 #include <time.h>
+#include <sys/time.h>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -31,6 +32,11 @@
 #include "main.h"
 #include "xconfig.h"
 #include "retry.h"
+#include "proxy.h"
+#include "backend.h"
+#include "redirect.h"
+#include "intloop.h"
+#include "engine.h"
 #include "child.h"
 #include "signals.h"
 
@@ -39,6 +45,24 @@
 #define FREE_SERVER( serp )         FREE( serp )
 
 
+/*
+ * The spawn governor is a token bucket that limits the rate at which
+ * servers are forked, across all services. It is configured with the
+ * spawn_rate and spawn_burst attributes of the defaults entry.
+ */
+struct spawn_governor
+{
+   double            tokens ;
+   struct timeval    last_fill ;
+   time_t            cur_second ;
+   unsigned          cur_forks ;     /* forks during cur_second           */
+   unsigned          last_rate ;     /* forks during the previous second  */
+   unsigned long     deferred ;      /* requests deferred by the governor */
+} ;
+
+static struct spawn_governor governor ;
+
+
 #ifndef DEBUG_RETRY
 #define do_fork()         fork()
 #else
@@ -142,6 +166,8 @@ status_e server_run( struct service *sp, connection_s *cp )
    CLEAR( server ) ;
    server.svr_sp = sp ;
    server.svr_conn = cp ;
+   server.svr_backend = -1 ;
+   server.svr_backend_first = -1 ;
 
    if ( ! SVC_FORKS( sp ) )
    {  /*
@@ -162,6 +188,19 @@ status_e server_run( struct service *sp, connection_s *cp )
       return( OK ) ;
    }
 
+   /*
+    * Inline redirection and the builtin engine need no fork, so access
+    * control is done here as for internal services. If no proxy (or
+    * the engine) takes the connection, a process is forked after all.
+    */
+   if ( SC_REDIR_INLINE( SVC_CONF( sp ) ) == YES ||
+                                    SVC_ENGINE( sp ) != NO_ENGINE )
+   {
+      if ( svc_child_access_control( sp, cp ) != OK )
+         return( FAILED ) ;
+      SERVER_ACCESS_CHECKED( &server ) = TRUE ;
+   }
+
    /*
     * Insert new struct server in server table first, to avoid the
     * possibility of running out of memory *after* the fork.
@@ -170,7 +209,26 @@ status_e server_run( struct service *sp, connection_s *cp )
    if ( serp == NULL )
       return( FAILED ) ;
 
-   if ( server_start( serp ) == OK )
+   if ( SERVER_ACCESS_CHECKED( serp ) )
+   {
+      /* The engine keeps the connection until it is done with it */
+      if ( SVC_ENGINE( sp ) != NO_ENGINE )
+      {
+         if ( engine_start( serp ) == OK )
+            return( OK ) ;
+      }
+      else if ( proxy_start( serp ) == OK )
+      {
+         CONN_CLOSE( cp ) ;
+         return( OK ) ;
+      }
+   }
+
+   /*
+    * While the fork circuit breaker is open, the request goes straight
+    * to the retry queue.
+    */
+   if ( ! retry_breaker_open() && server_start( serp ) == OK )
    {
       if( !SVC_WAITS(sp) )
          CONN_CLOSE( cp ) ;
@@ -180,24 +238,82 @@ status_e server_run( struct service *sp, connection_s *cp )
    /* server will be removed in server_release() */
 
    /*
-    * Currently, fork failures are the only reason for retrying.
-    * There is no retry if we exceed the max allowed number of fork failures
+    * Fork failures and the spawn governor are the only reasons for
+    * retrying. There is no retry if we exceed the max allowed number
+    * of fork failures.
     */
    if ( ! SERVER_FORKLIMIT( serp ) && SVC_RETRY( sp ) )
    {
       if ( schedule_retry( serp ) == OK )
          return( OK ) ;
-      else
-         msg( LOG_ERR, func, "Retry failure for %s service", SVC_ID( sp ) ) ;
+      msg( LOG_ERR, func, "Retry failure for %s service", SVC_ID( sp ) ) ;
    }
-   else
-      svc_log_failure( sp, cp, AC_FORK ) ;
+
+   /*
+    * The request is refused, whether it could not be queued (the
+    * retry queue is full) or it was not to be retried
+    */
+   svc_log_failure( sp, cp, AC_FORK ) ;
 
    server_release( serp ) ;
    return( FAILED ) ;
 }
 
 
+/*
+ * Returns TRUE if the spawn governor allows another fork now
+ */
+static bool_int spawn_permitted(void)
+{
+   unsigned          rate = SC_SPAWN_RATE( DEFAULTS( ps ) ) ;
+   unsigned          burst = SC_SPAWN_BURST( DEFAULTS( ps ) ) ;
+   struct timeval    now ;
+   double            elapsed ;
+
+   if ( rate == 0 )
+      return( TRUE ) ;
+   if ( burst == 0 )
+      burst = rate ;
+
+   (void) gettimeofday( &now, NULL ) ;
+   if ( governor.last_fill.tv_sec == 0 )
+      governor.tokens = burst ;
+   else
+   {
+      elapsed = ( now.tv_sec - governor.last_fill.tv_sec ) +
+                  ( now.tv_usec - governor.last_fill.tv_usec ) / 1e6 ;
+      if ( elapsed > 0 )
+         governor.tokens += elapsed * rate ;
+   }
+   if ( governor.tokens > burst )
+      governor.tokens = burst ;
+   governor.last_fill = now ;
+
+   if ( governor.tokens < 1 )
+      return( FALSE ) ;
+   governor.tokens -= 1 ;
+   return( TRUE ) ;
+}
+
+
+/*
+ * Count a fork for the spawn rate statistics
+ */
+static void spawn_count(void)
+{
+   time_t now = time( NULL ) ;
+
+   if ( now != governor.cur_second )
+   {
+      governor.last_rate = ( now == governor.cur_second + 1 ) ?
+                                             governor.cur_forks : 0 ;
+      governor.cur_second = now ;
+      governor.cur_forks = 0 ;
+   }
+   governor.cur_forks++ ;
+}
+
+
 /*
  *  Try to fork a server process.
  *  Actually, we won't fork if tcpmux_child is set, becuase we have
@@ -212,7 +328,29 @@ status_e server_start( struct server *serp )
    if( debug.on )
       msg( LOG_DEBUG, func, "Starting service %s", SC_NAME( SVC_CONF( sp ) ) );
    SERVER_LOGUSER(serp) = SVC_LOGS_USERID_ON_SUCCESS( sp ) ;
-   
+
+   /*
+    * A request over the spawn rate is not a fork failure: the caller
+    * queues it for retry without counting it against the server.
+    */
+   if ( ! spawn_permitted() )
+   {
+      if ( debug.on )
+         msg( LOG_DEBUG, func, "%s: spawn rate exceeded, deferring",
+               SVC_ID( sp ) ) ;
+      governor.deferred++ ;
+      return( FAILED ) ;
+   }
+
+   backend_select( serp ) ;
+
+   /*
+    * A service intercepted inline runs only its server; if that can't
+    * be set up, a forked interceptor is used as usual
+    */
+   if ( SC_INTERCEPT_INLINE( SVC_CONF( sp ) ) == YES )
+      (void) intloop_prepare( serp ) ;
+
    SERVER_PID(serp) = do_fork() ;
 
    switch ( SERVER_PID(serp) )
@@ -228,22 +366,30 @@ status_e server_start( struct server *serp )
       case -1:
          msg( LOG_ERR, func, "%s: fork failed: %m", SVC_ID( sp ) ) ;
          SERVER_FORK_FAILURES(serp)++ ;
+         intloop_end( serp ) ;
+         retry_fork_result( FAILED ) ;
          return( FAILED ) ;
 
       default:
+         retry_fork_result( OK ) ;
+         intloop_start( serp ) ;
+         spawn_count() ;
+         backend_use( serp ) ;
          (void) time( &SERVER_STARTTIME(serp) ) ;
          SVC_INC_RUNNING_SERVERS( sp ) ;
 
          /*
           * Log the start of another server (if it is not an interceptor).
-          * Determine if the server writes to the log (because in that case
-          * we will have to check the log size).
+          * Determine if the server writes to the log.
           */
          if ( ! SVC_IS_INTERCEPTED( sp ) )
             svc_log_success( sp, SERVER_CONNECTION(serp), SERVER_PID(serp) ) ;
          else
             SERVER_WRITES_TO_LOG(serp) = SVC_IS_LOGGING( sp ) ;
          SERVER_WRITES_TO_LOG(serp) |= SERVER_LOGUSER(serp) ;
+         /* a server that does its own access control logs its failure */
+         if ( ! SERVER_ACCESS_CHECKED( serp ) && SVC_LOGS_ON_FAILURE( sp ) )
+            SERVER_WRITES_TO_LOG(serp) = TRUE ;
          return( OK ) ;
    }
 }
@@ -269,6 +415,27 @@ void server_dump( const struct server *serp, int fd )
 }
 
 
+/*
+ * Dump the state of the spawn governor
+ */
+void server_spawn_dump( int fd )
+{
+   time_t now = time( NULL ) ;
+   unsigned rate ;
+
+   if ( now == governor.cur_second )
+      rate = governor.last_rate ;
+   else if ( now == governor.cur_second + 1 )
+      rate = governor.cur_forks ;
+   else
+      rate = 0 ;
+
+   Sprint( fd, "spawn rate = %u/sec\n", rate ) ;
+   Sprint( fd, "spawns deferred = %lu\n", governor.deferred ) ;
+   Sputchar( fd, '\n' ) ;
+}
+
+
 /*
  * Invoked when a server dies, either because of a signal or in case of
  * a normal exit.
@@ -296,10 +463,24 @@ void server_end( struct server *serp )
                   SVC_ID( sp ), SERVER_PID(serp), SVC_ID( conn_sp ), death_type ) ;
       }
       
+      intloop_end( serp ) ;
+
       /* Added this for when accepting wait=yes services */
       if( SVC_WAITS( sp ) )
          FD_SET( SVC_FD( sp ), &ps.rws.socket_mask ) ;
 
+      /*
+       * A redirector that could not reach its backend exits with
+       * REDIR_EXIT_NOCONNECT, or with REDIR_EXIT_FAILOVER if another
+       * backend took the connection
+       */
+      if ( SERVER_BACKEND( serp ) >= 0 )
+         backend_release( serp,
+               PROC_EXITED( SERVER_EXITSTATUS(serp) ) &&
+               ( PROC_EXITSTATUS( SERVER_EXITSTATUS(serp) ) == REDIR_EXIT_NOCONNECT ||
+                 PROC_EXITSTATUS( SERVER_EXITSTATUS(serp) ) == REDIR_EXIT_FAILOVER ),
+               0, 0 ) ;
+
       svc_postmortem( sp, serp ) ;
       server_release( serp ) ;
    }
@@ -40,6 +40,10 @@ struct server
    bool_int        svr_writes_to_log ;   /* needed because a service may be   */
                                          /* reconfigured between server       */
                                          /*   forking and exit                */
+   bool_int        svr_access_checked ;  /* access control done by parent    */
+   int             svr_backend ;         /* redirect backend in use          */
+   int             svr_backend_first ;   /* the one the policy picked        */
+   unsigned        svr_backend_gen ;     /* be_gen of the backend charged    */
 } ;
 
 #define SERP( p )                       ((struct server *)(p))
@@ -54,6 +58,10 @@ struct server
 #define SERVER_LOGUSER( serp )         (serp)->svr_log_remote_user
 #define SERVER_FORK_FAILURES( serp )   (serp)->svr_fork_failures
 #define SERVER_WRITES_TO_LOG( serp )   (serp)->svr_writes_to_log
+#define SERVER_ACCESS_CHECKED( serp )  (serp)->svr_access_checked
+#define SERVER_BACKEND( serp )         (serp)->svr_backend
+#define SERVER_BACKEND_FIRST( serp )   (serp)->svr_backend_first
+#define SERVER_BACKEND_GEN( serp )     (serp)->svr_backend_gen
 
 #define SERVER_FORKLIMIT( serp )         \
                   ( (serp)->svr_fork_failures >= MAX_FORK_FAILURES )
@@ -84,6 +92,7 @@ void server_release(struct server *serp);
 status_e server_run(struct service *sp,connection_s *cp);
 status_e server_start(struct server *serp);
 void server_dump(const struct server *serp,int fd);
+void server_spawn_dump(int fd);
 void server_end(struct server *serp);
 struct server *server_lookup(pid_t pid);
 struct server *server_alloc( const struct server *init_serp );
@@ -53,8 +53,17 @@
 #include "sconf.h"
 #include "msg.h"
 #include "logctl.h"
+#include "logstorm.h"
 #include "xconfig.h"
 #include "special.h"
+#include "backend.h"
+#include "proxy.h"
+#include "ident.h"
+#include "autoreload.h"
+#include "intloop.h"
+#include "engine.h"
+#include "dgram.h"
+#include "banner.h"
 
 
 #define NEW_SVC()              NEW( struct service )
@@ -119,6 +128,7 @@ struct service *svc_make_special( struct service_config *scp )
 
 void svc_free( struct service *sp )
 {
+   backend_free( sp ) ;
    sc_free( SVC_CONF(sp) ) ;
    CLEAR( *sp ) ;
    FREE_SVC( sp ) ;
@@ -302,6 +312,53 @@ static status_e activate_normal( struct service *sp )
               "setsockopt SO_KEEPALIVE failed (%m). service = %s", sid ) ;
    }
 
+   /*
+    * With TCP_DEFER_ACCEPT, a connection is only reported once the
+    * client has sent something, so no server is started for clients
+    * that connect and send nothing
+    */
+   if( SC_DEFER_ACCEPT( scp ) > 0 && (SC_PROTOVAL(scp) == IPPROTO_TCP) )
+   {
+#ifdef TCP_DEFER_ACCEPT
+      int secs = SC_DEFER_ACCEPT( scp ) ;
+
+      if( setsockopt(sd, IPPROTO_TCP, TCP_DEFER_ACCEPT, 
+                     (char *)&secs, sizeof( secs ) ) < 0 )
+         msg( LOG_WARNING, func, 
+              "setsockopt TCP_DEFER_ACCEPT failed (%m). service = %s", sid ) ;
+#else
+      msg( LOG_WARNING, func, 
+           "defer_accept is not supported on this system. service = %s", sid ) ;
+#endif
+   }
+
+   if( SC_TCP_FASTOPEN( scp ) > 0 && (SC_PROTOVAL(scp) == IPPROTO_TCP) )
+   {
+#ifdef TCP_FASTOPEN
+      int qlen = SC_TCP_FASTOPEN( scp ) ;
+
+      if( setsockopt(sd, IPPROTO_TCP, TCP_FASTOPEN, 
+                     (char *)&qlen, sizeof( qlen ) ) < 0 )
+         msg( LOG_WARNING, func, 
+              "setsockopt TCP_FASTOPEN failed (%m). service = %s", sid ) ;
+#else
+      msg( LOG_WARNING, func, 
+           "tcp_fastopen is not supported on this system. service = %s", sid ) ;
+#endif
+   }
+
+   /*
+    * The datagram builtins answer from the address they were asked at,
+    * which they can only tell on a socket bound to any address
+    */
+   if( SC_IS_INTERNAL( scp ) && SC_SOCKET_TYPE( scp ) == SOCK_DGRAM &&
+       SC_BIND_ADDR( scp ) == NULL )
+   {
+      if ( dgram_recv_pktinfo( sd, tsin.sa.sa_family ) == FAILED )
+         msg( LOG_WARNING, func, 
+              "setsockopt PKTINFO failed (%m). service = %s", sid ) ;
+   }
+
    if ( bind( sd, &tsin.sa, sin_len ) == -1 )
    {
       msg( LOG_ERR, func, "bind failed (%m). service = %s", sid ) ;
@@ -403,6 +460,7 @@ status_e svc_activate( struct service *sp )
    ps.rws.active_services++ ;
    ps.rws.available_services++ ;
 
+   (void) backend_activate( sp ) ;
    return( OK ) ;
 }
 
@@ -410,6 +468,7 @@ status_e svc_activate( struct service *sp )
 static void deactivate( const struct service *sp )
 {
    (void) Sclose( SVC_FD( sp ) ) ;
+   backend_deactivate( sp ) ;
 
 #ifdef HAVE_MDNS
    xinetd_mdns_deregister(SVC_CONF(sp));
@@ -561,8 +620,12 @@ void svc_dump( const struct service *sp, int fd )
    {
       tabprint( fd, 1, "running servers = %d\n", SVC_RUNNING_SERVERS(sp) ) ;
       tabprint( fd, 1, "retry servers = %d\n", SVC_RETRIES(sp) ) ;
+      if ( SVC_RETRY_QUEUE(sp) != NULL )
+         tabprint( fd, 1, "retry backoff = %d seconds\n",
+                                          (int)SVC_RETRY_DELAY(sp) ) ;
       tabprint( fd, 1, "attempts = %d\n", SVC_ATTEMPTS(sp) ) ;
       tabprint( fd, 1, "service fd = %d\n", SVC_FD(sp) ) ;
+      backend_dump( sp, fd ) ;
    }
    Sputchar( fd, '\n' ) ;
 }
@@ -588,12 +651,19 @@ void svc_request( struct service *sp )
    else 
       ret_code = svc_generic_handler(sp, cp);
 
-   if( (SVC_SOCKET_TYPE( sp ) == SOCK_DGRAM) && (SVC_IS_ACTIVE( sp )) ) 
+   /*
+    * The datagram builtins read the datagrams they answer themselves,
+    * and leave the others for next time
+    */
+   if( (SVC_SOCKET_TYPE( sp ) == SOCK_DGRAM) && (SVC_IS_ACTIVE( sp )) &&
+       ( ret_code != OK || SVC_FORKS( sp ) || SVC_NOT_GENERIC( sp ) ) ) 
       drain( cp->co_descriptor ) ; /* Prevents looping next time */
    
    if ( ret_code != OK ) 
    {
-      if ( SVC_LOGS_USERID_ON_FAILURE( sp ) ) {
+      if ( SVC_LOGS_USERID_ON_FAILURE( sp ) &&
+           ! M_IS_SET( cp->co_flags, COF_FAIL_SUPPRESSED ) &&
+           ident_submit( sp, cp ) == FAILED ) {
          if( spec_service_handler( LOG_SERVICE( ps ), cp ) == FAILED ) 
 	    conn_free( cp, 1 ) ;
          else if (!SC_WAITS( SVC_CONF( sp ) ) ) {
@@ -624,123 +694,35 @@ status_e svc_generic_handler( struct service *sp, connection_s *cp )
    return( FAILED ) ;
 }
 
-#define TMPSIZE 1024
 /* Print the banner that is supposed to always be printed */
 static int banner_always( const struct service *sp, const connection_s *cp )
 {
-   const char *func = "banner_always";
    const struct service_config *scp = SVC_CONF( sp ) ;
 
    /* print the banner regardless of access control */
-   if ( SC_BANNER(scp) != NULL ) {
-      char tmpbuf[TMPSIZE];
-      ssize_t retval;
-      int bannerfd = open(SC_BANNER(scp), O_RDONLY);
-
-      if( bannerfd < 0 ) {
-         msg( LOG_ERR, func, "service = %s, open of banner %s failed", 
-			 SVC_ID( sp ), SC_BANNER(scp));
-         return(-1);
-      }
-
-      while( (retval = read(bannerfd, tmpbuf, sizeof(tmpbuf))) ) {
-         if (retval == (ssize_t)-1)
-         {
-            if (errno == EINTR)
-               continue;
-            else
-            {
-               msg(LOG_ERR, func, "service %s, Error %m reading banner %s", 
-			       SVC_ID( sp ), SC_BANNER(scp));
-               break;
-            }
-         }
-         Swrite(cp->co_descriptor, tmpbuf, retval);
-      }
-
-      Sclose(bannerfd);
-      Sflush ( cp->co_descriptor );
-   }
-
+   if ( SC_BANNER(scp) != NULL )
+      return( banner_send( SC_BANNER(scp), cp->co_descriptor, SVC_ID( sp ) ) ) ;
    return(0);
 }
 
 static int banner_fail( const struct service *sp, const connection_s *cp )
 {
-   const char *func = "banner_fail";
    const struct service_config *scp = SVC_CONF( sp ) ;
 
-
    if ( SC_BANNER_FAIL(scp) != NULL )
-   {
-      char tmpbuf[TMPSIZE];
-      int retval;
-      int bannerfd = open(SC_BANNER_FAIL(scp), O_RDONLY);
-
-      if( bannerfd < 0 )
-      {
-         msg( LOG_ERR, func, "service = %s, open of banner %s failed", 
-            SVC_ID( sp ), SC_BANNER_FAIL(scp));
-         return(-1);
-      }
-
-      while( (retval = read(bannerfd, tmpbuf, sizeof(tmpbuf))) ) {
-         if (retval == -1)
-         {
-            if (errno == EINTR)
-               continue;
-            else
-            {
-               msg(LOG_ERR, func, "service %s, Error %m reading banner %s", 
-			       SVC_ID( sp ), SC_BANNER(scp));
-               break;
-            }
-         }
-         Swrite(cp->co_descriptor, tmpbuf, retval);
-      }
-
-      Sclose(bannerfd);
-      Sflush ( cp->co_descriptor );
-   }
-
+      return( banner_send( SC_BANNER_FAIL(scp), cp->co_descriptor,
+                                                            SVC_ID( sp ) ) ) ;
    return(0);
 }
 
 static int banner_success( const struct service *sp, const connection_s *cp )
 {
-   const char *func = "banner_success";
    const struct service_config *scp = SVC_CONF( sp ) ;
 
    /* print the access granted banner */
-   if ( SC_BANNER_SUCCESS(scp) != NULL ) {
-      char tmpbuf[TMPSIZE];
-      int retval;
-      int bannerfd = open(SC_BANNER_SUCCESS(scp), O_RDONLY);
-
-      if( bannerfd < 0 ) {
-         msg( LOG_ERR, func, "service = %s, open of banner %s failed", 
-			 SVC_ID( sp ), SC_BANNER_SUCCESS(scp));
-         return(-1);
-      }
-
-      while( (retval = read(bannerfd, tmpbuf, sizeof(tmpbuf))) ) {
-         if (retval == -1)
-         {
-            if (errno == EINTR)
-               continue;
-            else
-            {
-               msg(LOG_ERR, func, "service %s, Error %m reading banner %s", 
-			       SVC_ID( sp ), SC_BANNER(scp));
-               break;
-            }
-         }
-         Swrite(cp->co_descriptor, tmpbuf, retval);
-      }
-
-      Sclose(bannerfd);
-      Sflush ( cp->co_descriptor );
-   }
+   if ( SC_BANNER_SUCCESS(scp) != NULL )
+      return( banner_send( SC_BANNER_SUCCESS(scp), cp->co_descriptor,
+                                                            SVC_ID( sp ) ) ) ;
    return(0);
 }
 
@@ -820,8 +802,8 @@ static status_e failed_service(struct service *sp,
          }
       }
 
-      if ( report_failure )
-         svc_log_failure( sp, cp, result ) ;
+      if ( report_failure && ! svc_log_failure( sp, cp, result ) )
+         CONN_SET_FLAG( cp, COF_FAIL_SUPPRESSED ) ;
 
       banner_fail(sp, cp);
 
@@ -868,7 +850,10 @@ void svc_postmortem( struct service *sp, struct server *serp )
    SVC_DEC_RUNNING_SERVERS( sp ) ;
 
    /*
-    * Log information about the server that died
+    * Log information about the server that died.
+    * xinetd counts the size of the log as it writes to it, but a
+    * server may have written to it too, so the count is brought up
+    * to date from the file.
     */
    if ( SVC_IS_LOGGING( sp ) )
    {
@@ -911,7 +896,9 @@ void svc_postmortem( struct service *sp, struct server *serp )
  * for all child processes that fork, but do not exec. This includes
  * redirect, builtins, and tcpmux. The close on exec flag takes care of
  * child processes that call exec. Without calling this, the listening 
- * fd's are not closed and reconfig will fail.
+ * fd's are not closed and reconfig will fail. The sockets of the
+ * redirect probes and proxies are closed too, so that the child does
+ * not keep them open.
  */
 void close_all_svc_descriptors(void)
 {
@@ -927,8 +914,17 @@ void close_all_svc_descriptors(void)
    }
 
    for ( osp = SP( psi_start( iter ) ) ; osp ; osp = SP( psi_next( iter ) ) )
+   {
         (void) Sclose( SVC_FD( osp ) ) ;
+        backend_deactivate( osp ) ;      /* probe connections */
+   }
   
    psi_destroy( iter ) ;
+   proxy_close() ;
+   ident_close() ;
+   autoreload_close() ;
+   logstorm_close() ;
+   intloop_close() ;
+   engine_close() ;
 }
 
@@ -58,6 +58,22 @@ struct service
    union xsockaddr                        *svc_last_dgram_addr ;
    time_t                                  svc_last_dgram_time ;
    xlog_h                                  svc_log ;
+
+   /*
+    * Servers waiting to be retried, in arrival order, and the
+    * backoff state of the service (see retry.c)
+    */
+   pset_h                 svc_retry_queue ;
+   time_t                 svc_retry_time ;  /* when the queue is due     */
+   time_t                 svc_retry_delay ; /* current backoff (secs)    */
+
+   /*
+    * Health and counters of the backends of a redirected service
+    * (see backend.c)
+    */
+   struct backend        *svc_backends ;
+   unsigned               svc_backend_count ;
+   unsigned               svc_backend_next ; /* round robin position */
 } ;
 
 
@@ -82,6 +98,12 @@ struct service
 #define SVC_LAST_DGRAM_ADDR( sp )  (sp)->svc_last_dgram_addr
 #define SVC_LAST_DGRAM_TIME( sp )  (sp)->svc_last_dgram_time
 #define SVC_NOT_GENERIC( sp )      (sp)->svc_not_generic
+#define SVC_RETRY_QUEUE( sp )      (sp)->svc_retry_queue
+#define SVC_RETRY_TIME( sp )       (sp)->svc_retry_time
+#define SVC_RETRY_DELAY( sp )      (sp)->svc_retry_delay
+#define SVC_BACKENDS( sp )         (sp)->svc_backends
+#define SVC_BACKEND_COUNT( sp )    (sp)->svc_backend_count
+#define SVC_BACKEND_NEXT( sp )     (sp)->svc_backend_next
 
 #define SVC_IS_ACTIVE( sp )      ( (sp)->svc_state == SVC_ACTIVE )
 #define SVC_IS_SUSPENDED( sp )   ( (sp)->svc_state == SVC_SUSPENDED )
@@ -99,6 +121,7 @@ struct service
 #define SVC_FORKS( sp )            SC_FORKS( SVC_CONF( sp ) )
 #define SVC_RETRY( sp )            SC_RETRY( SVC_CONF( sp ) )
 #define SVC_WAITS( sp )            SC_WAITS( SVC_CONF( sp ) )
+#define SVC_ENGINE( sp )           SC_ENGINE( SVC_CONF( sp ) )
 #define SVC_IS_INTERCEPTED( sp )   SC_IS_INTERCEPTED( SVC_CONF( sp ) )
 #define SVC_ACCEPTS_CONNECTIONS( sp )   \
                                    SC_ACCEPTS_CONNECTIONS( SVC_CONF( sp ) )
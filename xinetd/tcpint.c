@@ -7,12 +7,19 @@
 
 
 #include "config.h"
+#ifdef HAVE_SPLICE
+#define _GNU_SOURCE
+#endif
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#ifdef HAVE_EPOLL_CREATE
+#include <sys/epoll.h>
+#endif
 #include <syslog.h>
 #include <signal.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -28,7 +35,7 @@
 #include "xconfig.h"
 #include "sconf.h"
 
-typedef enum { S_OK, S_SERVER_ERR, S_CLIENT_ERR } stream_status_e ;
+typedef enum { S_OK, S_SERVER_ERR, S_CLIENT_ERR, S_NO_SPLICE } stream_status_e ;
 
 struct istream_private
 {
@@ -63,11 +70,40 @@ struct intercept_s *si_init( struct server *serp )
    return( ip ) ;
 }
 
+#ifndef HAVE_EPOLL_CREATE
 static status_e handle_io( psi_h iter, channel_s *chp, fd_set *maskp, stream_status_e (*iofunc)() );
+#endif
 static stream_status_e tcp_local_to_remote( channel_s *chp );
 static stream_status_e tcp_remote_to_local( channel_s *chp );
 static void connection_request( struct intercept_s *ip, channel_s **chpp );
 
+#ifdef HAVE_SPLICE
+/*
+ * The pipe data is spliced through. It is always drained before
+ * tcp_splice returns, so one pipe serves all the channels.
+ */
+static int si_pipe[ 2 ] = { -1, -1 } ;
+
+static void si_pipe_close(void)
+{
+   if ( si_pipe[ 0 ] != -1 )
+   {
+      (void) close( si_pipe[ 0 ] ) ;
+      (void) close( si_pipe[ 1 ] ) ;
+      si_pipe[ 0 ] = si_pipe[ 1 ] = -1 ;
+   }
+}
+
+static void si_pipe_open(void)
+{
+   if ( pipe( si_pipe ) == -1 )
+   {
+      msg( LOG_WARNING, "si_pipe_open", "pipe: %m; not using splice" ) ;
+      si_pipe[ 0 ] = si_pipe[ 1 ] = -1 ;
+   }
+}
+#endif   /* HAVE_SPLICE */
+
 /* Unfortunatly, this can't be private... */
 void si_exit(void)
 {
@@ -79,6 +115,112 @@ void si_exit(void)
 }
 
 
+#ifdef HAVE_EPOLL_CREATE
+
+/*
+ * Maximum number of events handled per epoll_wait(2) call
+ */
+#define SI_EVENTS                 64
+
+
+static void si_close( struct intercept_s *ip, channel_s *chp )
+{
+   const char *func = "si_close" ;
+
+   if ( debug.on )
+      msg( LOG_DEBUG, func,
+         "Closing channel to %s,%d using sockets %d(l),%d(r)",
+            xaddrname( &chp->ch_from ), ntohs(xaddrport( &chp->ch_from )),
+                  chp->ch_local_socket, chp->ch_remote_socket ) ;
+
+   int_unwatch( ip, chp->ch_local_socket ) ;
+   int_unwatch( ip, chp->ch_remote_socket ) ;
+   (void) Sclose( chp->ch_remote_socket ) ;
+   (void) Sclose( chp->ch_local_socket ) ;
+   int_unlinkconn( ip, chp ) ;
+   pset_remove( INT_CONNECTIONS( ip ), chp ) ;
+   FREE_CHANNEL( chp ) ;
+}
+
+
+/*
+ * Each socket of each channel is registered with epoll, so a wakeup
+ * costs in proportion to the sockets that are ready rather than to
+ * the number of channels.
+ */
+static void si_mux(void)
+{
+   struct intercept_s   *ip = &stream_intercept_state ;
+   struct epoll_event   events[ SI_EVENTS ] ;
+#ifdef DEBUG_TCPINT
+   const char           *func = "si_mux" ;
+#endif
+
+   if ( int_epoll_init( ip ) == FAILED )
+      return ;
+#ifdef HAVE_SPLICE
+   si_pipe_open() ;
+#endif
+
+   for ( ;; )
+   {
+      channel_s *chp ;
+      bool_int accept_pending = FALSE ;
+      int n_ready, i ;
+
+      n_ready = int_wait( ip, events, SI_EVENTS ) ;
+      if ( n_ready == -1 )
+         return ;
+
+      for ( i = 0 ; i < n_ready ; i++ )
+      {
+         int fd = events[ i ].data.fd ;
+         stream_status_e status ;
+
+         if ( fd == INT_REMOTE( ip ) )
+         {
+            accept_pending = TRUE ;
+            continue ;
+         }
+
+         /* The channel may have been closed earlier in this batch */
+         if ( ( chp = int_channel( ip, fd ) ) == CHANNEL_NULL )
+            continue ;
+
+#ifdef DEBUG_TCPINT
+         if ( debug.on )
+            msg( LOG_DEBUG, func, "Input available on %s socket %d",
+               ( fd == chp->ch_local_socket ) ? "local" : "remote", fd ) ;
+#endif
+         if ( fd == chp->ch_local_socket )
+            status = tcp_local_to_remote( chp ) ;
+         else
+            status = tcp_remote_to_local( chp ) ;
+
+         if ( status == S_SERVER_ERR )
+            return ;
+         if ( status == S_CLIENT_ERR )
+            si_close( ip, chp ) ;
+      }
+
+      /*
+       * New connections are accepted after the batch has been handled, so
+       * that a descriptor closed above and reused by accept can't receive
+       * an event meant for its previous channel.
+       */
+      if ( accept_pending )
+      {
+         connection_request( ip, &chp ) ;
+         if ( chp != NULL &&
+               ( int_watch( ip, chp->ch_local_socket, chp ) == FAILED ||
+                 int_watch( ip, chp->ch_remote_socket, chp ) == FAILED ) )
+            si_close( ip, chp ) ;
+      }
+   }
+}
+
+#else   /* HAVE_EPOLL_CREATE */
+
 static void si_mux(void)
 {
    struct intercept_s   *ip = &stream_intercept_state ;
@@ -97,6 +239,9 @@ static void si_mux(void)
       msg( LOG_ERR, func, ES_NOMEM ) ;
       return ;
    }
+#ifdef HAVE_SPLICE
+   si_pipe_open() ;
+#endif
 
    for ( ;; )
    {
@@ -185,6 +330,7 @@ static status_e handle_io( psi_h iter,
          FD_CLR( chp->ch_remote_socket, maskp ) ;
          (void) Sclose( chp->ch_remote_socket ) ;
          (void) Sclose( chp->ch_local_socket ) ;
+         int_unlinkconn( &stream_intercept_state, chp ) ;
          psi_remove( iter ) ;
          FREE_CHANNEL( chp ) ;
          break ;
@@ -194,6 +340,8 @@ static status_e handle_io( psi_h iter,
    return( OK ) ;
 }
 
+#endif   /* HAVE_EPOLL_CREATE */
+
 
 static void connection_request( struct intercept_s *ip, channel_s **chpp )
 {
@@ -223,25 +371,11 @@ static void connection_request( struct intercept_s *ip, channel_s **chpp )
    if ( chp == NULL )
    {
       struct server  *serp  = INT_SERVER( ip ) ;
-      struct service *sp    = SERVER_SERVICE( serp ) ;
-      connection_s   *cop   = SERVER_CONNECTION( serp ) ;
 
-      CONN_SETADDR( cop, &csin ) ;
-
-      if ( INTERCEPT( ip ) )
+      if ( int_access( ip, &csin ) == FAILED )
       {
-         mask_t check_mask ;
-         access_e result ;
-         
-         M_OR( check_mask, XMASK( CF_ADDRESS ), XMASK( CF_TIME ) ) ;
-         result = access_control( sp, cop, &check_mask ) ;
-
-         if ( result != AC_OK )
-         {
-            svc_log_failure( sp, cop, result ) ;
-            (void) Sclose( sd ) ;
-            return ;
-         }
+         (void) Sclose( sd ) ;
+         return ;
       }
 
       if ( ( chp = int_newconn( ip, &csin, sd ) ) == NULL )
@@ -251,7 +385,8 @@ static void connection_request( struct intercept_s *ip, channel_s **chpp )
       }
       
       if ( ! addr_checked )
-         svc_log_success( sp, cop, SERVER_PID( serp ) ) ;
+         svc_log_success( SERVER_SERVICE( serp ), SERVER_CONNECTION( serp ),
+                                                      SERVER_PID( serp ) ) ;
 
 #if defined( TCP_NODELAY )
       {
@@ -273,6 +408,58 @@ static void connection_request( struct intercept_s *ip, channel_s **chpp )
 }
 
 
+#ifdef HAVE_SPLICE
+/*
+ * Move the data available on 'from' to 'to' through si_pipe, so that
+ * it is never copied to user space. from_err and to_err are returned
+ * when the respective side fails. S_NO_SPLICE is returned, with
+ * nothing read, if splice(2) does not work on these sockets.
+ */
+static stream_status_e tcp_splice( int from, int to, 
+                                   stream_status_e from_err, 
+                                   stream_status_e to_err )
+{
+   ssize_t   rcc, wcc ;
+   const char *func = "tcp_splice" ;
+
+   do
+   {
+      rcc = splice( from, NULL, si_pipe[ 1 ], NULL, SPLICE_SIZE,
+                                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK ) ;
+   } while ( rcc == (ssize_t)-1 && errno == EINTR ) ;
+
+   if ( rcc == 0 )
+      return( from_err ) ;
+   if ( rcc == (ssize_t)-1 )
+   {
+      if ( errno == EINVAL || errno == ENOSYS )
+         return( S_NO_SPLICE ) ;
+      if ( errno == EAGAIN )
+         return( S_OK ) ;
+      msg( LOG_ERR, func, "splice: %m" ) ;
+      return( from_err ) ;
+   }
+
+   while ( rcc > 0 )
+   {
+      wcc = splice( si_pipe[ 0 ], NULL, to, NULL, rcc, SPLICE_F_MOVE ) ;
+      if ( wcc == (ssize_t)-1 && errno == EINTR )
+         continue ;
+      if ( wcc <= 0 )
+      {
+         msg( LOG_ERR, func, "splice: %m" ) ;
+         /* The pipe still holds data: start over with a clean one */
+         si_pipe_close() ;
+         si_pipe_open() ;
+         return( to_err ) ;
+      }
+      rcc -= wcc ;
+   }
+   return( S_OK ) ;
+}
+#endif   /* HAVE_SPLICE */
+
+
 static stream_status_e tcp_local_to_remote( channel_s *chp )
 {
    char  buf[ DATAGRAM_SIZE ] ;
@@ -281,6 +468,18 @@ static stream_status_e tcp_local_to_remote( channel_s *chp )
    int   left ;
    const char *func = "tcp_local_to_remote" ;
 
+#ifdef HAVE_SPLICE
+   if ( si_pipe[ 0 ] != -1 )
+   {
+      stream_status_e status = tcp_splice( chp->ch_local_socket, 
+                              chp->ch_remote_socket, S_SERVER_ERR, S_CLIENT_ERR ) ;
+
+      if ( status != S_NO_SPLICE )
+         return( status ) ;
+      si_pipe_close() ;
+   }
+#endif
+
    for ( ;; )
    {
       rcc = recv( chp->ch_local_socket, buf, sizeof( buf ), 0 ) ;
@@ -334,6 +533,18 @@ static stream_status_e tcp_remote_to_local( channel_s *chp )
    char *p ;
    const char *func = "tcp_remote_to_local" ;
 
+#ifdef HAVE_SPLICE
+   if ( si_pipe[ 0 ] != -1 )
+   {
+      stream_status_e status = tcp_splice( chp->ch_remote_socket, 
+                              chp->ch_local_socket, S_CLIENT_ERR, S_SERVER_ERR ) ;
+
+      if ( status != S_NO_SPLICE )
+         return( status ) ;
+      si_pipe_close() ;
+   }
+#endif
+
    for ( ;; )
    {
       rcc = recv( chp->ch_remote_socket, buf, sizeof( buf ), 0 ) ;
@@ -23,41 +23,35 @@
 #include "intcommon.h"
 #include "util.h"
 #include "connection.h"
-#include "access.h"
+#include "dgram.h"
 #include "log.h"
 #include "msg.h"
 #include "sconf.h"
+#include "xconfig.h"
 
 /*
  * Datagrams greater than this will be truncated
  */
 #define MAX_DATAGRAM_SIZE         ( 32 * 1024 )
 
-struct packet
-{
-   union xsockaddr from ;
-   char                  *data ;
-   int                  size ;
-} ;
-
-typedef struct packet packet_s ;
-
-
-struct idgram_private
-{
-   unsigned received_packets ;
-} ;
-
 #define IDP( p )               ((struct idgram_private *)(p))
 
 
 static struct idgram_private idgram ;
 
 static void di_mux(void) ;
-static void udp_remote_to_local( struct intercept_s *ip, channel_s **chpp );
-static status_e udp_local_to_remote( channel_s *chp );
-static void send_data( int sd, char *buf, int len, union xsockaddr *addr );
-static status_e get_incoming_packet( struct intercept_s *ip, packet_s *pp );
+
+/*
+ * Datagrams are received and sent in batches: from the clients,
+ * and, gathered from all the channels, to the clients.
+ */
+static struct dgram_batch *di_in ;
+static struct dgram_batch *di_out ;
+
+#ifndef HAVE_EPOLL_CREATE
+static fd_set di_mask ;
+static int di_mask_max ;
+#endif
 
 static const struct intercept_ops idgram_ops =
    {
@@ -69,6 +63,23 @@ static const struct intercept_ops idgram_ops =
 static struct intercept_s dgram_intercept_state ;
 
 
+static status_e di_alloc(void)
+{
+   const char *func = "di_alloc" ;
+
+   if ( di_in == NULL )
+      di_in = dgram_create( INT_UDP_BATCH, MAX_DATAGRAM_SIZE ) ;
+   if ( di_out == NULL )
+      di_out = dgram_create( INT_UDP_BATCH, MAX_DATAGRAM_SIZE ) ;
+   if ( di_in == NULL || di_out == NULL )
+   {
+      out_of_memory( func ) ;
+      return( FAILED ) ;
+   }
+   return( OK ) ;
+}
+
+
 struct intercept_s *di_init( struct server *serp )
 {
    struct intercept_s *ip = &dgram_intercept_state ;
@@ -81,6 +92,19 @@ struct intercept_s *di_init( struct server *serp )
 }
 
 
+/*
+ * Set up ip to intercept datagrams in xinetd itself (see intloop.c),
+ * with the udp_* functions. The ops vector is not used there.
+ */
+status_e di_inline( struct intercept_s *ip, struct idgram_private *idp )
+{
+   ip->int_socket_type = SOCK_DGRAM ;
+   ip->int_priv = (void *) idp ;
+   ip->int_ops = NULL ;
+   return( di_alloc() ) ;
+}
+
+
 void di_exit(void)
 {
    struct intercept_s *ip = &dgram_intercept_state ;
@@ -91,18 +115,76 @@ void di_exit(void)
 }
 
 
+/*
+ * Wait for the replies of the server on a new channel
+ */
+static void di_watch( struct intercept_s *ip, channel_s *chp )
+{
+#ifdef HAVE_EPOLL_CREATE
+   if ( int_watch( ip, chp->ch_local_socket, chp ) == FAILED )
+      chp->ch_state = BAD_CHANNEL ;
+#else
+   FD_SET( chp->ch_local_socket, &di_mask ) ;
+   if ( chp->ch_local_socket > di_mask_max )
+      di_mask_max = chp->ch_local_socket ;
+#endif
+}
+
+
+#ifdef HAVE_EPOLL_CREATE
+
+/*
+ * Returns only if there is an I/O error while communicating with the server
+ */
+static void di_mux(void)
+{
+   struct intercept_s   *ip = &dgram_intercept_state ;
+   struct epoll_event         events[ INT_UDP_BATCH ] ;
+
+   if ( di_alloc() == FAILED || int_epoll_init( ip ) == FAILED )
+      return ;
+
+   for ( ;; )
+   {
+      int n_ready, i ;
+
+      n_ready = int_wait( ip, events, INT_UDP_BATCH ) ;
+      if ( n_ready == -1 )
+         return ;
+
+      for ( i = 0 ; i < n_ready ; i++ )
+      {
+         int fd = events[ i ].data.fd ;
+         channel_s *chp ;
+
+         if ( fd == INT_REMOTE( ip ) )
+            udp_remote_to_local( ip ) ;
+         else if ( ( chp = int_channel( ip, fd ) ) != CHANNEL_NULL &&
+                        udp_local_to_remote( ip, chp ) == FAILED )
+         {
+            udp_flush( ip ) ;
+            return ;
+         }
+      }
+      udp_flush( ip ) ;
+   }
+}
+
+#else   /* HAVE_EPOLL_CREATE */
+
 /*
  * Returns only if there is an I/O error while communicating with the server
  */
 static void di_mux(void)
 {
    struct intercept_s   *ip = &dgram_intercept_state ;
-   fd_set                     socket_mask ;
-   int                        mask_max ;
 
-   FD_ZERO( &socket_mask ) ;
-   FD_SET( INT_REMOTE( ip ), &socket_mask ) ;
-   mask_max = INT_REMOTE( ip ) ;
+   if ( di_alloc() == FAILED )
+      return ;
+
+   FD_ZERO( &di_mask ) ;
+   FD_SET( INT_REMOTE( ip ), &di_mask ) ;
+   di_mask_max = INT_REMOTE( ip ) ;
 
    for ( ;; )
    {
@@ -111,21 +193,15 @@ static void di_mux(void)
       fd_set read_mask ;
       int n_ready ;
 
-      read_mask = socket_mask ;
-      n_ready = int_select( mask_max+1, &read_mask ) ;
+      read_mask = di_mask ;
+      n_ready = int_select( di_mask_max+1, &read_mask ) ;
 
       if ( n_ready == -1 )
          return ;
       
       if ( FD_ISSET( INT_REMOTE( ip ), &read_mask ) )
       {
-         udp_remote_to_local( ip, &chp ) ;
-         if ( chp != NULL )
-         {
-            FD_SET( chp->ch_local_socket, &socket_mask ) ;
-            if ( chp->ch_local_socket > mask_max )
-               mask_max = chp->ch_local_socket ;
-         }
+         udp_remote_to_local( ip ) ;
          if ( --n_ready == 0 )
             continue ;
       }
@@ -136,62 +212,43 @@ static void di_mux(void)
 
          if ( FD_ISSET( chp->ch_local_socket, &read_mask ) )
          {
-            if ( udp_local_to_remote( chp ) == FAILED )
+            if ( udp_local_to_remote( ip, chp ) == FAILED )
+            {
+               udp_flush( ip ) ;
                return ;
+            }
             if ( --n_ready == 0 )
                break ;
          }
       }
+      udp_flush( ip ) ;
    }
 }
 
+#endif   /* HAVE_EPOLL_CREATE */
+
 
 /*
- * Read data from the remote socket and send it to the appropriate local 
- * socket.
- * If this is a new connection, insert it in the connection table and
- * place its handle in *chpp.
+ * Find the channel of the client at addrp, or make one.
  */
-static void udp_remote_to_local( struct intercept_s *ip, channel_s **chpp )
+static channel_s *udp_channel( struct intercept_s *ip, 
+                               union xsockaddr *addrp )
 {
-   char               buf[ MAX_DATAGRAM_SIZE ] ;
-   packet_s           packet ;
    channel_s          *chp ;
    bool_int           addr_checked ;
 
-   *chpp = CHANNEL_NULL ;
-
-   packet.data = buf ;
-   packet.size = sizeof( buf ) ;
-   if ( get_incoming_packet( ip, &packet ) == FAILED )
-      return ;
-
-   chp = int_lookupconn( ip, &packet.from, &addr_checked ) ;
+   chp = int_lookupconn( ip, addrp, &addr_checked ) ;
    if ( chp == CHANNEL_NULL )
    {
       struct server      *serp = INT_SERVER( ip ) ;
-      struct service    *sp = SERVER_SERVICE( serp ) ;
-      connection_s      *cop = SERVER_CONNECTION( serp ) ;
 
-      if ( ( chp = int_newconn( ip, &packet.from, INT_REMOTE( ip ) ) ) == NULL )
-         return ;
-
-      CONN_SETADDR( cop, &packet.from ) ;      /* for logging */
+      if ( ( chp = int_newconn( ip, addrp, INT_REMOTE( ip ) ) ) == NULL )
+         return( CHANNEL_NULL ) ;
 
-      if ( INTERCEPT( ip ) )
+      if ( int_access( ip, addrp ) == FAILED )
       {
-         mask_t check_mask ;
-         access_e result ;
-
-         M_OR( check_mask, XMASK( CF_ADDRESS ), XMASK( CF_TIME ) ) ;
-         result = access_control( sp, cop, &check_mask ) ;
-
-         if ( result != AC_OK )
-         {
-            svc_log_failure( sp, cop, result ) ;
-            chp->ch_state = BAD_CHANNEL ;
-            return ;
-         }
+         chp->ch_state = BAD_CHANNEL ;
+         return( chp ) ;
       }
       
       /*
@@ -199,141 +256,114 @@ static void udp_remote_to_local( struct intercept_s *ip, channel_s **chpp )
        * another successful attempt from the same address
        */
       if ( ! addr_checked )
-         svc_log_success( sp, cop, SERVER_PID( serp ) ) ;
-         
-      *chpp = chp ;
-   }
-   else if ( chp->ch_state == BAD_CHANNEL )
-      return ;
-   
-#ifdef DEBUG_UDPINT
-   if ( debug.on )
-      msg( LOG_DEBUG, "udp_remote_to_local",
-               "sending %d bytes to server on port %d",
-                     packet.size, ntohs( INT_LOCALADDR( ip )->sa_in.sin_port ) ) ;
-#endif
+         svc_log_success( SERVER_SERVICE( serp ), SERVER_CONNECTION( serp ),
+                                                      SERVER_PID( serp ) ) ;
 
-   send_data( chp->ch_local_socket,
-         packet.data, packet.size, NULL ) ;
+      di_watch( ip, chp ) ;
+   }
+   return( chp ) ;
 }
 
 
 /*
- * Send the data in buf to destination addr using the socket sd.
- * If addr is NULL, use the default socket destination
+ * Read a batch of datagrams from the remote socket and send each to
+ * the local socket of its channel. New clients get a channel.
  */
-static void send_data( int sd, char *buf, int len, union xsockaddr *addr )
+void udp_remote_to_local( struct intercept_s *ip )
 {
-   char   *p ;
-   int   left ;
-   ssize_t   cc ;
-   const char   *func = "send_data" ;
+   struct dgram_batch *bp = di_in ;
+   channel_s          *chp, *prev = CHANNEL_NULL ;
+   int                 n, i, first ;
+   const char         *func = "udp_remote_to_local" ;
 
-   for ( p = buf, left = len ; left > 0 ; left -= cc, p+= cc )
+   n = dgram_recv( INT_REMOTE( ip ), bp, 0, bp->db_size, TRUE ) ;
+   if ( n == -1 )
    {
-      if ( addr == NULL )
-         cc = send( sd, p, left, 0 ) ;
-      else
-         cc = sendto( sd, p, left, 0, SA( addr ), sizeof( *addr ) ) ;
-
-      if ( cc == (ssize_t)-1 ) {
-         if ( errno == EINTR )
-         {
-            cc = 0 ;
-            continue ;
-         }
-         else
-         {
-            msg( LOG_ERR, func, "%s: %m", addr ? "sendto" : "send" ) ;
-            return ;
-         }
-      }
+      if ( errno != EAGAIN )
+         msg( LOG_ERR, func, "recvfrom error: %m" ) ;
+      return ;
    }
-}
-
-
-static status_e get_incoming_packet( struct intercept_s *ip, packet_s *pp )
-{
-   socklen_t from_len = 0;
-   const char *func = "get_incoming_packet" ;
+   IDP( ip->int_priv )->received_packets += n ;
 
-   if( SC_IPV4( SVC_CONF( SERVER_SERVICE( INT_SERVER( ip ) ) ) ) )
-      from_len = sizeof( struct sockaddr_in );
-   if( SC_IPV6( SVC_CONF( SERVER_SERVICE( INT_SERVER( ip ) ) ) ) )
-      from_len = sizeof( struct sockaddr_in6 );
-
-   for ( ;; )
+   for ( i = 0 ; i < n ; i++ )
    {
-      ssize_t cc ;
+      union xsockaddr *addrp = DGRAM_ADDR( bp, i ) ;
 
-      from_len = sizeof( pp->from ) ;
-      cc = recvfrom( INT_REMOTE( ip ), pp->data, pp->size,
-                                    0, SA( &pp->from ), &from_len ) ;
-      if ( cc == (ssize_t)-1 )
+      if ( DGRAM_NAMELEN( bp, i ) == 0 )
       {
-         if ( errno != EINTR )
-         {
-            msg( LOG_ERR, func, "recvfrom error: %m" ) ;
-            return( FAILED ) ;
-         }
+         msg( LOG_ERR, func, "incoming packet had 0 length address" ) ;
+         chp = CHANNEL_NULL ;
       }
-      else if ( cc == 0 )
-         return( FAILED ) ;
+      else if ( prev == CHANNEL_NULL || 
+                  ! xaddrequal( &prev->ch_from, addrp ) )
+         chp = udp_channel( ip, addrp ) ;
       else
-      {
-         pp->size = cc ;
-         IDP( ip->int_priv )->received_packets++ ;
-         break ;
-      }
-   }
+         chp = prev ;
 
-   if ( from_len == 0 )
-   {
-      msg( LOG_ERR, func, "incoming packet had 0 length address" ) ;
-      return( FAILED ) ;
-   }
-   
 #ifdef DEBUG_UDPINT
-   if ( debug.on )
-      msg( LOG_DEBUG, func, "Received %d bytes from address: %s,%d",
-         pp->size, xaddrname( &pp->from ), ntohs( xaddrport(&pp->from) ) );
+      if ( debug.on )
+         msg( LOG_DEBUG, func, "Received %d bytes from address: %s,%d",
+            DGRAM_LEN( bp, i ), xaddrname( addrp ), 
+               ntohs( xaddrport( addrp ) ) );
 #endif
+      prev = chp ;
+      if ( chp != CHANNEL_NULL && chp->ch_state == BAD_CHANNEL )
+         chp = CHANNEL_NULL ;
+      DGRAM_DATA( bp, i ) = chp ;
+   }
 
-   return( OK ) ;
+   /* Consecutive datagrams of the same client go out in one call */
+   for ( first = 0 ; first < n ; first = i )
+   {
+      for ( i = first + 1 ; i < n &&
+               DGRAM_DATA( bp, i ) == DGRAM_DATA( bp, first ) ; i++ )
+         ;
+      if ( ( chp = CHP( DGRAM_DATA( bp, first ) ) ) != CHANNEL_NULL )
+         dgram_send( chp->ch_local_socket, bp, first, i - first, FALSE ) ;
+   }
 }
 
 
-static status_e udp_local_to_remote( channel_s *chp )
+void udp_flush( struct intercept_s *ip )
 {
-   char   buf[ MAX_DATAGRAM_SIZE ] ;
-   ssize_t    cc ;
-   const char   *func = "udp_local_to_remote" ;
+   if ( di_out->db_count > 0 )
+   {
+      dgram_send( INT_REMOTE( ip ), di_out, 0, di_out->db_count, TRUE ) ;
+      di_out->db_count = 0 ;
+   }
+}
 
-   for ( ;; )
+
+/*
+ * Queue the replies of the server on channel chp for its client; they
+ * are sent from the remote socket by udp_flush.
+ */
+status_e udp_local_to_remote( struct intercept_s *ip, channel_s *chp )
+{
+   struct dgram_batch *bp = di_out ;
+   int                 n, i ;
+   const char         *func = "udp_local_to_remote" ;
+
+   if ( bp->db_count == bp->db_size )
+      udp_flush( ip ) ;
+   n = dgram_recv( chp->ch_local_socket, bp, bp->db_count,
+                                    bp->db_size - bp->db_count, FALSE ) ;
+   if ( n == -1 )
    {
-      cc = recv( chp->ch_local_socket, buf, sizeof( buf ), 0 ) ;
-   
-      if ( cc == (ssize_t)-1 )
-      {
-         if ( errno != EINTR ) 
-         {
-            msg( LOG_ERR, func, "recv from daemon: %m" ) ;
-            return( FAILED ) ;
-         }
-      }
-      else if ( cc == 0 )
-         return( FAILED ) ;
-      else
-         break ;
+      if ( errno == EAGAIN )
+         return( OK ) ;
+      msg( LOG_ERR, func, "recv from daemon: %m" ) ;
+      return( FAILED ) ;
    }
    
 #ifdef DEBUG_UDPINT
    if ( debug.on )
-      msg( LOG_DEBUG, func, "sending %d bytes to address %s,%d",
-         cc, xaddrname( &chp->ch_from ), ntohs( xaddrport(&chp->ch_from) ) ) ;
+      msg( LOG_DEBUG, func, "sending %d datagrams to address %s,%d",
+         n, xaddrname( &chp->ch_from ), ntohs( xaddrport(&chp->ch_from) ) ) ;
 #endif
 
-   send_data( chp->ch_remote_socket, buf, cc, &chp->ch_from ) ;
+   for ( i = bp->db_count ; i < (int) bp->db_count + n ; i++ )
+      *DGRAM_ADDR( bp, i ) = chp->ch_from ;
+   bp->db_count += n ;
    return( OK ) ;
 }
-
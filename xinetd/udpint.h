@@ -4,10 +4,19 @@
 #include "defs.h"
 #include "int.h"
 
+struct idgram_private
+{
+   unsigned received_packets ;
+} ;
+
 #ifdef __GNUC__
 __attribute__ ((noreturn))
 #endif
 void di_exit(void);
 struct intercept_s *di_init(struct server *serp);
+status_e di_inline(struct intercept_s *ip, struct idgram_private *idp);
+void udp_remote_to_local(struct intercept_s *ip);
+status_e udp_local_to_remote(struct intercept_s *ip, channel_s *chp);
+void udp_flush(struct intercept_s *ip);
 
 #endif
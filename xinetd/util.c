@@ -14,6 +14,7 @@
 #if defined (HAVE_SYS_SOCKET_H)
 #include <sys/socket.h>
 #endif
+#include <netinet/in.h>
 /*
  * The following ifdef is for TIOCNOTTY
  */
@@ -260,6 +261,52 @@ void drain( int sd )
       msg( LOG_DEBUG, "drain", "UDP socket should be empty" ) ;
 }
 
+
+/*
+ * Hash of the address in addrp (FNV-1a), and of its port if with_port
+ * is set.
+ */
+unsigned xaddrhash( const union xsockaddr *addrp, bool_int with_port )
+{
+   const unsigned char *p ;
+   size_t len ;
+   unsigned h = 2166136261U ;
+
+   if ( addrp->sa.sa_family == AF_INET6 )
+   {
+      p = (const unsigned char *) &addrp->sa_in6.sin6_addr ;
+      len = sizeof( addrp->sa_in6.sin6_addr ) ;
+      if ( with_port )
+         h = ( h ^ addrp->sa_in6.sin6_port ) * 16777619U ;
+   }
+   else
+   {
+      p = (const unsigned char *) &addrp->sa_in.sin_addr ;
+      len = sizeof( addrp->sa_in.sin_addr ) ;
+      if ( with_port )
+         h = ( h ^ addrp->sa_in.sin_port ) * 16777619U ;
+   }
+   while ( len-- > 0 )
+      h = ( h ^ *p++ ) * 16777619U ;
+   return( h ) ;
+}
+
+
+/*
+ * Compare the family, address and port of two socket addresses, and
+ * nothing else (unlike memcmp, which also sees the unused bytes).
+ */
+bool_int xaddrequal( const union xsockaddr *a, const union xsockaddr *b )
+{
+   if ( a->sa.sa_family != b->sa.sa_family )
+      return( FALSE ) ;
+   if ( a->sa.sa_family == AF_INET6 )
+      return( a->sa_in6.sin6_port == b->sa_in6.sin6_port &&
+              IN6_ARE_ADDR_EQUAL( &a->sa_in6.sin6_addr, &b->sa_in6.sin6_addr ) ) ;
+   return( a->sa_in.sin_port == b->sa_in.sin_port &&
+           a->sa_in.sin_addr.s_addr == b->sa_in.sin_addr.s_addr ) ;
+}
+
 /*
  * Convert string to an int detecting errors.
  */
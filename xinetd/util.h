@@ -19,6 +19,8 @@ void tabprint(int fd, int tab_level, const char *fmt, ...)
  ;
 #endif
 void drain(int sd);
+unsigned xaddrhash(const union xsockaddr *addrp, bool_int with_port);
+bool_int xaddrequal(const union xsockaddr *a, const union xsockaddr *b);
 int parse_int(const char *, int , int , int *);
 int parse_uint(const char *, int , int , unsigned int *);
 int parse_ull(const char *, int , int , unsigned long long *);
@@ -110,6 +110,21 @@
 #define LOGUSER_FAILURE_TIMEOUT		30
 #endif
 
+/*
+ * The user ids of refused connections are looked up by an ident worker
+ * process, up to IDENT_WORKER_QUERIES at a time. The answers are kept
+ * for IDENT_CACHE_TTL seconds in a cache of IDENT_CACHE_SIZE entries.
+ */
+#ifndef IDENT_WORKER_QUERIES
+#define IDENT_WORKER_QUERIES		256
+#endif
+#ifndef IDENT_CACHE_SIZE
+#define IDENT_CACHE_SIZE		1024
+#endif
+#ifndef IDENT_CACHE_TTL
+#define IDENT_CACHE_TTL			30		/* seconds */
+#endif
+
 /*
  * This is used when an instance limit is not specified for a service
  * and the defaults entry does not specify an instance limit either.
@@ -173,11 +188,140 @@
 #endif
 
 /*
- * Time interval between retry attempts
+ * Initial time interval between retry attempts. Each failed attempt
+ * doubles the interval for that service, up to RETRY_MAX_INTERVAL.
  */
 #ifndef RETRY_INTERVAL
 #define RETRY_INTERVAL			5		/* seconds */
 #endif
+#ifndef RETRY_MAX_INTERVAL
+#define RETRY_MAX_INTERVAL		60		/* seconds */
+#endif
+
+/*
+ * Max number of servers of one service waiting to be retried, and
+ * the max time a request may wait for a retry before it is dropped.
+ */
+#ifndef RETRY_QUEUE_MAX
+#define RETRY_QUEUE_MAX			64
+#endif
+#ifndef RETRY_MAX_AGE
+#define RETRY_MAX_AGE			120		/* seconds */
+#endif
+
+/*
+ * After RETRY_BREAKER_FAILURES consecutive fork failures (over all
+ * services), no forks are attempted for RETRY_BREAKER_TIME seconds.
+ */
+#ifndef RETRY_BREAKER_FAILURES
+#define RETRY_BREAKER_FAILURES		20
+#endif
+#ifndef RETRY_BREAKER_TIME
+#define RETRY_BREAKER_TIME		30		/* seconds */
+#endif
+
+/*
+ * Maximum number of bytes moved by one splice(2) call when redirecting
+ * or intercepting tcp connections. This is also the default capacity
+ * of a pipe on Linux.
+ */
+#ifndef SPLICE_SIZE
+#define SPLICE_SIZE			65536
+#endif
+
+/*
+ * Redirected services with redirect_mode = inline are handled by a pool
+ * of at most REDIR_PROXIES proxy processes, each of which handles up to
+ * REDIR_PROXY_SESSIONS connections. Connections beyond that are
+ * redirected by a forked process as usual.
+ */
+#ifndef REDIR_PROXIES
+#define REDIR_PROXIES			2
+#endif
+#ifndef REDIR_PROXY_SESSIONS
+#define REDIR_PROXY_SESSIONS		8192
+#endif
+
+/*
+ * A redirect backend is ejected after REDIR_EJECT_FAILURES consecutive
+ * failed connects. Without redirect_check, an ejected backend is given
+ * one connection again every REDIR_EJECT_TIME seconds.
+ */
+#ifndef REDIR_EJECT_FAILURES
+#define REDIR_EJECT_FAILURES		3
+#endif
+#ifndef REDIR_EJECT_TIME
+#define REDIR_EJECT_TIME		30		/* seconds */
+#endif
+
+/*
+ * A redirected udp service keeps one upstream socket for each client
+ * it has seen in the last REDIR_UDP_TIMEOUT seconds (unless the service
+ * sets redirect_idle_timeout), for at most REDIR_UDP_SESSIONS clients.
+ * Datagrams are moved in batches of up to REDIR_UDP_BATCH.
+ */
+#ifndef REDIR_UDP_TIMEOUT
+#define REDIR_UDP_TIMEOUT		60		/* seconds */
+#endif
+#ifndef REDIR_UDP_SESSIONS
+#define REDIR_UDP_SESSIONS		4096
+#endif
+#ifndef REDIR_UDP_BATCH
+#define REDIR_UDP_BATCH			32
+#endif
+
+/*
+ * The udp interceptor moves datagrams in batches of up to INT_UDP_BATCH
+ */
+#ifndef INT_UDP_BATCH
+#define INT_UDP_BATCH			16
+#endif
+
+/*
+ * The datagram builtins answer up to BUILTIN_UDP_BATCH datagrams each
+ * time their socket is readable
+ */
+#ifndef BUILTIN_UDP_BATCH
+#define BUILTIN_UDP_BATCH		32
+#endif
+
+/*
+ * Services with intercept_mode = inline are intercepted by xinetd
+ * itself, which moves at most INT_INLINE_CHUNK bytes of a stream at
+ * a time
+ */
+#ifndef INT_INLINE_CHUNK
+#define INT_INLINE_CHUNK		65536
+#endif
+
+/*
+ * The stream echo, discard and chargen services are served by xinetd
+ * itself, for up to ENGINE_SESSIONS connections at a time; more
+ * connections get a forked server as usual. Each connection has a
+ * buffer of ENGINE_BUFFER bytes.
+ */
+#ifndef ENGINE_SESSIONS
+#define ENGINE_SESSIONS			256
+#endif
+#ifndef ENGINE_BUFFER
+#define ENGINE_BUFFER			4096
+#endif
+
+/*
+ * A tcpmux client served by the builtin engine has TCPMUX_TIMEOUT
+ * seconds to send the name of the service it wants
+ */
+#ifndef TCPMUX_TIMEOUT
+#define TCPMUX_TIMEOUT			30		/* seconds */
+#endif
+
+/*
+ * A banner file is looked at again at most every BANNER_CHECK_INTERVAL
+ * seconds, and read again if it has changed
+ */
+#ifndef BANNER_CHECK_INTERVAL
+#define BANNER_CHECK_INTERVAL		1		/* seconds */
+#endif
 
 /*
  * LOG_EXTRA_MIN, LOG_EXTRA_MAX define the limits by which the hard limit
@@ -190,6 +334,69 @@
 #define LOG_EXTRA_MAX			( 20 * 1024 )
 #endif
 
+/*
+ * The records of an asynchronous log wait for its writer in a pipe of
+ * LOG_WRITER_PIPE bytes (where the size of a pipe can be set), and the
+ * writer copies up to LOG_WRITER_BUFFER bytes of them per write(2).
+ * When xinetd exits, it waits up to LOG_WRITER_WAIT seconds for the
+ * writers to finish.
+ */
+#ifndef LOG_WRITER_PIPE
+#define LOG_WRITER_PIPE			( 256 * 1024 )
+#endif
+#ifndef LOG_WRITER_BUFFER
+#define LOG_WRITER_BUFFER		( 64 * 1024 )
+#endif
+#ifndef LOG_WRITER_WAIT
+#define LOG_WRITER_WAIT			5		/* seconds */
+#endif
+
+/*
+ * The old files of a rotated log are compressed with LOG_COMPRESS_PROGRAM,
+ * run as "LOG_COMPRESS_PROGRAM -f file", which makes file<LOG_COMPRESS_SUFFIX>
+ * out of file.
+ */
+#ifndef LOG_COMPRESS_PROGRAM
+#define LOG_COMPRESS_PROGRAM		"gzip"
+#endif
+#ifndef LOG_COMPRESS_SUFFIX
+#define LOG_COMPRESS_SUFFIX		".gz"
+#endif
+
+/*
+ * The flags of the syslog logs. With XLOG_BATCH, the records written
+ * during a pass of the main loop are sent together at its end. Add
+ * XLOG_RFC5424 for RFC 5424 headers, if the syslog daemon takes them
+ * on its local socket.
+ */
+#ifndef SYSLOG_FLAGS
+#define SYSLOG_FLAGS			XLOG_BATCH
+#endif
+
+/*
+ * With log_failure_limit, failures are counted per source network, of
+ * LOG_FAILURE_PREFIX4 bits for IPv4 and LOG_FAILURE_PREFIX6 bits for
+ * IPv6, for up to LOG_FAILURE_SOURCES networks at a time.
+ */
+#ifndef LOG_FAILURE_PREFIX4
+#define LOG_FAILURE_PREFIX4		24
+#endif
+#ifndef LOG_FAILURE_PREFIX6
+#define LOG_FAILURE_PREFIX6		64
+#endif
+#ifndef LOG_FAILURE_SOURCES
+#define LOG_FAILURE_SOURCES		4096
+#endif
+
+/*
+ * With -auto_reload, a burst of changes to the configuration files
+ * causes a reconfiguration no later than AUTO_RELOAD_MAX_DELAY seconds
+ * after its first change, even if the changes go on.
+ */
+#ifndef AUTO_RELOAD_MAX_DELAY
+#define AUTO_RELOAD_MAX_DELAY		10
+#endif
+
 /*
  * If SENSORS are used and someone trips it, they are added to the
  * global_no_access table for whatever the configured time is. This
@@ -25,6 +25,7 @@
  */
 
 static pset_h xtimer_list = NULL;
+static int xtimer_last_id = 0;
 
 static int xtimer_init( void )
 {
@@ -56,7 +57,6 @@ int xtimer_add( void (*func)(void), time_t secs )
 {
 	xtime_h *new_xtimer = NULL;
 	time_t tmptime;
-	unsigned count;
 
 	if( xtimer_list == NULL ) {
 		if( xtimer_init() < 0 )
@@ -77,11 +77,12 @@ int xtimer_add( void (*func)(void), time_t secs )
 	new_xtimer->timerfunc = func;
 	new_xtimer->when =  tmptime + secs;
 
-	if( (count = pset_count( xtimer_list )) == 0 ) {
-	   new_xtimer->xtid = 1;
-	} else {
-	   new_xtimer->xtid = ((xtime_h *)(pset_pointer(xtimer_list, count-1)))->xtid + 1;
-	}
+	/* The last timer of the list is the latest one, not the newest
+	 * one, so the identifiers come from a counter of their own.
+	 */
+	if( ++xtimer_last_id <= 0 )
+	   xtimer_last_id = 1;
+	new_xtimer->xtid = xtimer_last_id;
 
 	if( pset_add( xtimer_list, new_xtimer ) == NULL ) {
 		free( new_xtimer );